@@ -0,0 +1,134 @@
+/**
+ * @file
+ *
+ * Micro-benchmark comparing @ref KeyMap to the @c unordered_map it replaced
+ * in @ref OOCMesher, using a synthetic stream of external vertex keys.
+ *
+ * Only insertion is measured, since that is all the mesher does. The memory
+ * figure is the peak of the container's @c mem.bench.* statistic divided by
+ * the number of keys, so it excludes the allocator's per-node overhead.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <boost/tr1/random.hpp>
+#include "src/tr1_cstdint.h"
+#include "src/tr1_unordered_map.h"
+#include "src/key_map.h"
+#include "src/allocator.h"
+#include "src/statistics.h"
+#include "src/timer.h"
+
+typedef std::tr1::uint64_t key_type;
+
+/**
+ * Generate keys in the order they would be seen by the mesher. The domain
+ * is split into cubic blocks, which are visited in a random order. Each
+ * block emits the keys of the vertices on its faces in sorted order, so
+ * that each key is seen once for each block that shares it.
+ *
+ * @param blocks   Number of blocks along each axis.
+ * @param size     Number of cells along each edge of a block.
+ */
+static std::vector<key_type> makeKeys(unsigned int blocks, unsigned int size)
+{
+    std::tr1::mt19937 engine;
+    std::vector<unsigned int> order(blocks * blocks * blocks);
+    for (std::size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    for (std::size_t i = 0; i + 1 < order.size(); i++)
+        std::swap(order[i], order[i + engine() % (order.size() - i)]);
+
+    std::vector<key_type> keys;
+    std::vector<key_type> blockKeys;
+    for (std::size_t i = 0; i < order.size(); i++)
+    {
+        const key_type base[3] =
+        {
+            (order[i] % blocks) * size,
+            (order[i] / blocks % blocks) * size,
+            (order[i] / (blocks * blocks)) * size
+        };
+        blockKeys.clear();
+        for (key_type z = 0; z <= size; z++)
+            for (key_type y = 0; y <= size; y++)
+                for (key_type x = 0; x <= size; x++)
+                    if (x == 0 || x == size || y == 0 || y == size || z == 0 || z == size)
+                    {
+                        // Vertices lie on edges, so use twice the cell coordinates
+                        const key_type kx = 2 * (base[0] + x);
+                        const key_type ky = 2 * (base[1] + y) + 1;
+                        const key_type kz = 2 * (base[2] + z);
+                        blockKeys.push_back((kz << 42) | (ky << 21) | kx);
+                    }
+        std::sort(blockKeys.begin(), blockKeys.end());
+        keys.insert(keys.end(), blockKeys.begin(), blockKeys.end());
+    }
+    return keys;
+}
+
+template<typename Map>
+static std::tr1::uint64_t insertAll(Map &m, const std::vector<key_type> &keys);
+
+template<>
+std::tr1::uint64_t insertAll(
+    Statistics::Container::unordered_map<key_type, std::tr1::int32_t> &m,
+    const std::vector<key_type> &keys)
+{
+    std::tr1::uint64_t hits = 0;
+    for (std::size_t i = 0; i < keys.size(); i++)
+        if (!m.insert(std::make_pair(keys[i], std::tr1::int32_t(i))).second)
+            hits++;
+    return hits;
+}
+
+template<>
+std::tr1::uint64_t insertAll(KeyMap<std::tr1::int32_t> &m, const std::vector<key_type> &keys)
+{
+    std::tr1::uint64_t hits = 0;
+    for (std::size_t i = 0; i < keys.size(); i++)
+        if (!m.insert(keys[i], std::tr1::int32_t(i)).second)
+            hits++;
+    return hits;
+}
+
+template<typename Map>
+static void run(const char *name, const std::string &statName, const std::vector<key_type> &keys)
+{
+    Statistics::Peak &peak = Statistics::getStatistic<Statistics::Peak>(statName);
+    Map m(statName);
+    Timer timer;
+    std::tr1::uint64_t hits = insertAll(m, keys);
+    double elapsed = timer.getElapsed();
+    std::cout << name << ": " << elapsed << "s, "
+        << peak.getMax() / double(m.size()) << " bytes/key, "
+        << m.size() << " keys, " << hits << " duplicates\n";
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int blocks = 16;
+    unsigned int size = 63;
+    if (argc > 3)
+    {
+        std::cerr << "Usage: keymapbench [blocks [block-size]]\n";
+        return 1;
+    }
+    if (argc >= 2)
+        blocks = std::strtoul(argv[1], NULL, 10);
+    if (argc >= 3)
+        size = std::strtoul(argv[2], NULL, 10);
+
+    const std::vector<key_type> keys = makeKeys(blocks, size);
+    run<Statistics::Container::unordered_map<key_type, std::tr1::int32_t> >(
+        "unordered_map", "mem.bench.unordered_map", keys);
+    run<KeyMap<std::tr1::int32_t> >("KeyMap", "mem.bench.KeyMap", keys);
+    return 0;
+}
@@ -291,6 +291,7 @@ __kernel void countUniqueVertices(__global uint * restrict vertexUnique,
  * @param      inKeys          Vertex keys corresponding to @a inVertices (plus a sentinel @c ULONG_MAX).
  * @param      minExternalKey  Vertex keys >= @a minExternalKey are considered to be external vertices.
  * @param      keyOffset       Value added to keys on output (after comparison with @a minExternalKey).
+ * @param      keyShift        Each component of a key is shifted left by this much before @a keyOffset is added.
  */
 __kernel void compactVertices(
     __global float * restrict outVertices,
@@ -301,7 +302,8 @@ __kernel void compactVertices(
     __global const float4 * restrict inVertices,
     __global const ulong * restrict inKeys,
     ulong minExternalKey,
-    ulong keyOffset)
+    ulong keyOffset,
+    uint keyShift)
 {
     const uint gid = get_global_id(0);
     const uint u = vertexUnique[gid];
@@ -314,7 +316,13 @@ __kernel void compactVertices(
         vstore3(v.xyz, u, outVertices);
         if (ext)
         {
-            outKeys[u] = (key & (KEY_EXTERNAL_FLAG - 1)) + keyOffset;
+            const ulong kx = key & KEY_AXIS_MASK;
+            const ulong ky = (key >> KEY_AXIS_BITS) & KEY_AXIS_MASK;
+            const ulong kz = (key >> (2 * KEY_AXIS_BITS)) & KEY_AXIS_MASK;
+            const ulong shifted = ((kz << keyShift) << (2 * KEY_AXIS_BITS))
+                | ((ky << keyShift) << KEY_AXIS_BITS)
+                | (kx << keyShift);
+            outKeys[u] = shifted + keyOffset;
             if (u == 0)
                 *firstExternal = 0;
         }
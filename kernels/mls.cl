@@ -23,6 +23,7 @@
  *
  * Required defines:
  * - WGS_X, WGS_Y, WGS_Z
+ * - MAX_BUCKET (number of workitems that cooperate to load splat IDs)
  * - FIT_SPHERE (0 or 1)
  * - FIT_PLANE (0 or 1)
  */
@@ -49,11 +50,9 @@
 # error "Exactly one of FIT_PLANE and FIT_SPHERE must be defined"
 #endif
 
-/**
- * The number of workitems that cooperate to load splat IDs.
- */
-#define MAX_BUCKET 256
-
+#if !defined(MAX_BUCKET) || MAX_BUCKET < 1
+# error "MAX_BUCKET must be defined as a positive integer"
+#endif
 #if WGS_X * WGS_Y * WGS_Z < MAX_BUCKET
 # error "The workgroup must have at least MAX_BUCKET elements"
 #endif
@@ -286,6 +285,7 @@ inline float3 projectOriginPlane(const Plane * restrict plane)
  * @param[out] corners     The isovalues from a slice.
  * @param      splats      Input splats, in global grid coordinates, and with the inverse squared radius in the w component.
  * @param      commands, start Encoded octree for the local bin
+ * @param      startOffset Position of the octree within @a start.
  * @param      startShift  Subsampling shift for octree, times 3.
  * @param      offset      Difference between global grid coordinates and the local region of interest.
  * @param      zStride, zBias See @ref Marching::ImageParams
@@ -302,6 +302,7 @@ void processCorners(
     __global const Splat * restrict splats,
     __global const command_type * restrict commands,
     __global const command_type * restrict start,
+    uint startOffset,
     uint startShift,
     int3 offset,
     uint zStride,
@@ -316,7 +317,7 @@ void processCorners(
     wid.y = get_group_id(1) * WGS_Y;
     wid.z = get_group_id(2) * WGS_Z + get_global_offset(2);
     uint code = makeCode(wid) >> startShift;
-    command_type pos = start[code];
+    command_type pos = start[startOffset + code];
 
     uint lid = get_local_id(0);
 
@@ -432,6 +433,95 @@ void processCorners(
     write_imagef(corners, outCoord.xy, f);
 }
 
+/**
+ * Compute the surface normal at each of a set of vertices, from the gradient
+ * of the function fitted at the vertex. The splats are taken from the octree
+ * cell holding the nearest grid corner, which is one that was sampled by
+ * @ref processCorners. Vertices with too few nearby splats to make a fit
+ * are given a zero normal.
+ *
+ * There is one work-item per vertex.
+ *
+ * @param[out] normals     Unit normals, as tightly packed xyz triplets.
+ * @param      vertices    Vertices in global grid coordinates, as tightly packed xyz triplets.
+ * @param      splats, commands, start, startOffset, startShift, offset See @ref processCorners.
+ */
+__kernel void computeNormals(
+    __global float * restrict normals,
+    __global const float * restrict vertices,
+    __global const Splat * restrict splats,
+    __global const command_type * restrict commands,
+    __global const command_type * restrict start,
+    uint startOffset,
+    uint startShift,
+    int3 offset)
+{
+    const uint gid = get_global_id(0);
+    const float3 vertex = vload3(gid, vertices);
+    const float3 local = vertex - convert_float3(offset);
+    const int3 corner = max(convert_int3_rtn(local + 0.5f), (int3) (0, 0, 0));
+    const uint code = makeCode(corner) >> startShift;
+    command_type pos = start[startOffset + code];
+
+    float3 n = (float3) (0.0f, 0.0f, 0.0f);
+    if (pos >= 0)
+    {
+#if FIT_SPHERE
+        SphereFit fit;
+        sphereFitInit(&fit);
+#elif FIT_PLANE
+        PlaneFit fit;
+        planeFitInit(&fit);
+#else
+#error "Expected FIT_SPHERE or FIT_PLANE"
+#endif
+
+        command_type end = commands[pos++];
+        while (pos >= 0)
+        {
+            for (; pos < end; pos++)
+            {
+                command_type splatId = commands[pos];
+                float4 positionRadius = splats[splatId].positionRadius;
+                float3 p = positionRadius.xyz - vertex;
+                float pp = dot3(p, p);
+                float d = pp * positionRadius.w;
+                if (d < RADIUS_CUTOFF)
+                {
+                    float4 normalQuality = splats[splatId].normalQuality;
+                    float w = 1.0f - d;
+                    w *= w;
+                    w *= w;
+                    w *= normalQuality.w;
+#if FIT_SPHERE
+                    sphereFitAdd(&fit, w, p, pp, normalQuality.xyz);
+#elif FIT_PLANE
+                    planeFitAdd(&fit, w, p, pp, normalQuality.xyz);
+#endif
+                }
+            }
+            pos = commands[end];
+            end = (pos >= 0) ? commands[pos++] : INT_MIN;
+        }
+
+        if (fit.hits >= HITS_CUTOFF)
+        {
+#if FIT_SPHERE
+            Sphere sphere;
+            fitSphere(&fit, &sphere);
+            // The gradient of the algebraic sphere at the (local) origin
+            float3 g = sphere.b;
+#elif FIT_PLANE
+            float3 g = fit.sumWn;
+#endif
+            float gg = dot3(g, g);
+            if (gg > 0.0f && isfinite(gg))
+                n = g * rsqrt(gg);
+        }
+    }
+    vstore3(n, gid, normals);
+}
+
 /*******************************************************************************
  * Test code only below here.
  *******************************************************************************/
@@ -145,7 +145,9 @@ inline uint makeCode(int3 xyz)
  * writes to slots [j][i] for j in 0..7. The number of splats is given by
  * <code>get_global_size(0)</code>.
  *
- * Each workitem corresponds to a single splat.
+ * Each workitem corresponds to a single splat. The global offset specifies
+ * the position (in splats) at which to write the entries, so that several
+ * octrees can be written into the same arrays.
  *
  * @param[out] keys        The cell codes for the entries.
  * @param[out] values      The splat IDs for the entries.
@@ -155,6 +157,7 @@ inline uint makeCode(int3 xyz)
  * @param minShift         Minimum bit shift (determines subsampling of grid to give finest level).
  * @param maxShift         Maximum bit shift (determines base level).
  * @param firstSplat       Index of first splat to process within @a splats
+ * @param keyBase          Value added to all keys (start of this octree in the start array).
  */
 __kernel void writeEntries(
     __global uint *keys,
@@ -164,12 +167,13 @@ __kernel void writeEntries(
     __local uint *levelOffsets,
     uint minShift,
     uint maxShift,
-    uint firstSplat)
+    uint firstSplat,
+    uint keyBase)
 {
     if (get_local_id(0) == 0)
     {
         // TODO: compute in parallel, as long as splats array is big enough
-        uint pos = 0;
+        uint pos = keyBase;
         uint add = 1U << (3 * (maxShift - minShift));
         for (uint i = minShift; i <= maxShift; i++)
         {
@@ -182,7 +186,7 @@ __kernel void writeEntries(
 
     uint gid = get_global_id(0);
     uint pos = gid * 8;
-    gid += firstSplat;
+    gid += firstSplat - get_global_offset(0);
 
     float4 positionRadius = splats[gid].positionRadius;
     int3 ilo;
@@ -41,6 +41,7 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/bind.hpp>
+#include <boost/ref.hpp>
 #include "src/tr1_unordered_map.h"
 #include <iostream>
 #include <map>
@@ -433,14 +434,14 @@ static std::size_t run(
         const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
         const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
 
-        const Grid grid = splats.getBoundingGrid();
+        Grid grid = splats.getBoundingGrid();
         const unsigned int chunkCells = postprocessGrid(vm, grid);
 
         {
             // Open a scope so that objects will be released before finalization
             boost::scoped_ptr<Timeplot::Action> initTimer(new Timeplot::Action("init", mainWorker, "init.time"));
 
-            MesherGroup mesherGroup(memMesh);
+            MesherGroup mesherGroup(memMesh, vm[Option::mesherThreads].as<int>());
             ReceiverGather<MesherGroup::WorkItem, MesherGroup> receiver("receiver", mesherGroup, gatherComm, numSlaves);
             Scatter scatter(scatterComm, mainWorker);
             BucketCollector collector(maxLoadSplats, scatter);
@@ -458,6 +459,7 @@ static std::size_t run(
                 ProgressMPI progressMPI(&progress, splats.numSplats(), progressComm, 0);
 
                 mesherGroup.setInputFunctor(mesher->functor(pass));
+                collector.reset();
 
                 // Start threads
                 boost::thread receiverThread(boost::ref(receiver));
@@ -466,7 +468,7 @@ static std::size_t run(
 
                 try
                 {
-                    doBucket(mainWorker, vm, splats, grid, chunkCells, collector);
+                    doBucket(mainWorker, vm, splats, grid, chunkCells, boost::ref(collector));
                 }
                 catch (...)
                 {
@@ -37,6 +37,7 @@
 #include <boost/thread/thread.hpp>
 #include <boost/progress.hpp>
 #include <boost/ref.hpp>
+#include <boost/bind.hpp>
 #include "src/tr1_unordered_map.h"
 #include <iostream>
 #include <map>
@@ -48,6 +49,7 @@
 #include "src/logging.h"
 #include "src/timer.h"
 #include "src/fast_ply.h"
+#include "src/compact_writer.h"
 #include "src/splat.h"
 #include "src/grid.h"
 #include "src/splat_tree_cl.h"
@@ -67,11 +69,117 @@
 #include "src/timeplot.h"
 #include "src/bucket_collector.h"
 #include "src/bucket_loader.h"
+#include "src/incremental.h"
 #include "src/mlsgpu_core.h"
 
 namespace po = boost::program_options;
 using namespace std;
 
+/**
+ * Callback for @ref BucketCollector::setPostFlush that periodically writes a
+ * partial checkpoint. To get a consistent snapshot, the workers are stopped,
+ * which waits for all the bins seen so far to be fully processed, and then
+ * restarted afterwards.
+ */
+class PartialCheckpointer
+{
+private:
+    Timeplot::Worker &tworker;
+    MesherBase &mesher;
+    SlaveWorkers &slaveWorkers;
+    MesherGroup &mesherGroup;
+    SplatSet::FileSet &splats;
+    const Grid &grid;
+    ProgressMeter *progress;
+    const boost::filesystem::path path;
+    const double interval;          ///< Seconds between checkpoints
+    Timer::timestamp last;          ///< Time of the previous checkpoint
+
+public:
+    PartialCheckpointer(
+        Timeplot::Worker &tworker, MesherBase &mesher,
+        SlaveWorkers &slaveWorkers, MesherGroup &mesherGroup,
+        SplatSet::FileSet &splats, const Grid &grid,
+        ProgressMeter *progress,
+        const boost::filesystem::path &path, double interval)
+        : tworker(tworker), mesher(mesher), slaveWorkers(slaveWorkers), mesherGroup(mesherGroup),
+        splats(splats), grid(grid), progress(progress), path(path), interval(interval),
+        last(Timer::currentTime())
+    {
+    }
+
+    void operator()(std::tr1::uint64_t bins)
+    {
+        if (Timer::getElapsed(last, Timer::currentTime()) < interval)
+            return;
+
+        slaveWorkers.stop();
+        mesherGroup.stop();
+        mesher.checkpointPartial(tworker, path, bins);
+        slaveWorkers.start(splats, grid, progress);
+        mesherGroup.start();
+        last = Timer::currentTime();
+    }
+};
+
+/**
+ * Output state for one level of detail: the writers and the mesher that
+ * feeds them.
+ */
+struct OutputLevel
+{
+    Grid::size_type factor;                         ///< Ratio of the grid spacing to @c --fit-grid
+    boost::scoped_ptr<FastPly::Writer> writer;
+    boost::scoped_ptr<CompactWriter> compactWriter; ///< Compact writer, or @c NULL if not used
+    boost::scoped_ptr<MesherBase> mesher;
+
+    OutputLevel(const po::variables_map &vm, const std::string &out, Grid::size_type factor);
+};
+
+OutputLevel::OutputLevel(const po::variables_map &vm, const std::string &out, Grid::size_type factor)
+    : factor(factor)
+{
+    const WriterType writerType = vm[Option::writer].as<Choice<WriterTypeWrapper> >();
+    writer.reset(new FastPly::Writer(writerType));
+    setWriterComments(vm, *writer);
+    writer->setNormals(vm.count(Option::normals));
+    if (vm.count(Option::compact))
+        compactWriter.reset(new CompactWriter(writerType));
+
+    mesher.reset(createMesher(getMesherType(vm), *writer, getNamer(vm, out)));
+    setMesherOptions(vm, *mesher, factor);
+    mesher->setCompactWriter(compactWriter.get());
+}
+
+/**
+ * Generate the output name for a level of detail. The finest level uses the
+ * name as given, while coarser levels have <code>_L</code><i>n</i> inserted
+ * before the extension (if any).
+ */
+static std::string levelOutputName(const std::string &out, std::size_t level)
+{
+    if (level == 0)
+        return out;
+    const boost::filesystem::path path(out);
+    std::ostringstream name;
+    name << path.stem().string() << "_L" << level << path.extension().string();
+    return (path.parent_path() / name.str()).string();
+}
+
+/// Records a chunk's region with the mesher of every level of detail
+static void setChunkGrids(boost::ptr_vector<OutputLevel> &levels, const ChunkId &chunkId, const Grid &grid)
+{
+    for (std::size_t level = 0; level < levels.size(); level++)
+        levels[level].mesher->setChunkGrid(chunkId, grid);
+}
+
+/// Passes a mesh to the mesher for its level of detail
+static void dispatchLevel(const std::vector<MesherBase::InputFunctor> &inputs,
+                          MesherWork &work, Timeplot::Worker &tworker)
+{
+    inputs[work.level](work, tworker);
+}
+
 /**
  * Main execution.
  *
@@ -95,14 +203,37 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
     {
         Statistics::Timer grandTotalTimer("run.time");
 
-        const WriterType writerType = vm[Option::writer].as<Choice<WriterTypeWrapper> >();
-        boost::scoped_ptr<FastPly::Writer> writer(new FastPly::Writer(writerType));
-        setWriterComments(vm, *writer);
-
-        boost::scoped_ptr<MesherBase> mesher(new OOCMesher(*writer, getNamer(vm, out)));
-        setMesherOptions(vm, *mesher);
-
+        /* Each level of detail has its own mesher and output files, but
+         * they share the input files, the buckets and the workers.
+         */
+        boost::ptr_vector<OutputLevel> levels;
+        BOOST_FOREACH(Grid::size_type factor, getLevelFactors(vm))
+        {
+            levels.push_back(new OutputLevel(vm, levelOutputName(out, levels.size()), factor));
+        }
+        // Checkpointing is only allowed with a single level
+        MesherBase * const mesher = levels[0].mesher.get();
+        // Decides which chunks to recompute, if --incremental is given
+        boost::scoped_ptr<Incremental::Tracker> tracker;
+
+        /* A checkpoint written part-way through a run is resumed by
+         * processing the rest of the input, skipping the bins that are done.
+         */
+        bool resumeFinal = false;
+        std::tr1::uint64_t skipBins = 0;
         if (vm.count(Option::resume))
+        {
+            boost::filesystem::path path(vm[Option::resume].as<std::string>());
+            if (isPartialCheckpoint(path))
+            {
+                skipBins = mesher->resumePartial(mainWorker, path);
+                Log::log[Log::info] << "Resuming after " << skipBins << " completed bins\n";
+            }
+            else
+                resumeFinal = true;
+        }
+
+        if (resumeFinal)
         {
             boost::filesystem::path path(vm[Option::resume].as<std::string>());
             ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
@@ -115,20 +246,39 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 boost::scoped_ptr<Timeplot::Action> initTimer(new Timeplot::Action("init", mainWorker, "init.time"));
 
                 Log::log[Log::info] << "Initializing...\n";
-                MesherGroup mesherGroup(memMesh);
-                SlaveWorkers slaveWorkers(
-                    mainWorker, vm, devices,
-                    makeOutputGenerator(mesherGroup));
-                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                MesherGroup mesherGroup(memMesh, vm[Option::mesherThreads].as<int>());
 
                 Splats splats;
+                float regionLower[3], regionUpper[3];
+                if (getRegionBox(vm, regionLower, regionUpper))
+                    splats.setRegion(regionLower, regionUpper);
                 doComputeBlobs(mainWorker, vm, splats,
                                boost::bind(&Splats::computeBlobs, &splats, _1, _2, &Log::log[Log::info], true));
                 Grid grid = splats.getBoundingGrid();
                 unsigned int chunkCells = postprocessGrid(vm, grid);
+                if (vm.count(Option::incremental))
+                    tracker.reset(createTracker(vm, grid, chunkCells, getNamer(vm, out)));
+
+                // Tuning must happen before the workers are created, since they use the results
+                if (vm.count(Option::tune))
+                    doTune(mainWorker, vm, devices, splats, grid);
+
+                SlaveWorkers slaveWorkers(
+                    mainWorker, vm, devices,
+                    makeOutputGenerator(mesherGroup));
+                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                boost::scoped_ptr<Incremental::Filter> filter;
+                if (tracker)
+                    filter.reset(new Incremental::Filter(*tracker, collector));
 
                 initTimer.reset();
 
+                /* Every level is computed from the same buckets: the copy
+                 * stage passes each loaded bin to the device once per level,
+                 * and the output is routed to the level's mesher. The meshers
+                 * all have the same type and hence the same number of passes.
+                 */
+                collector.setChunkFunctor(boost::bind(&setChunkGrids, boost::ref(levels), _1, _2));
                 for (unsigned int pass = 0; pass < mesher->numPasses(); pass++)
                 {
                     Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher->numPasses() << endl;
@@ -138,7 +288,31 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
 
                     ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
 
-                    mesherGroup.setInputFunctor(mesher->functor(pass));
+                    if (levels.size() == 1)
+                        mesherGroup.setInputFunctor(mesher->functor(pass));
+                    else
+                    {
+                        std::vector<MesherBase::InputFunctor> inputs;
+                        for (std::size_t level = 0; level < levels.size(); level++)
+                            inputs.push_back(levels[level].mesher->functor(pass));
+                        mesherGroup.setInputFunctor(boost::bind(&dispatchLevel, inputs, _1, _2));
+                    }
+
+                    // Each pass must see the same chunk IDs
+                    collector.reset();
+                    if (pass == 0)
+                        collector.setSkip(skipBins);
+
+                    boost::scoped_ptr<PartialCheckpointer> checkpointer;
+                    if (vm.count(Option::partialCheckpoint) && pass == 0)
+                    {
+                        checkpointer.reset(new PartialCheckpointer(
+                                mainWorker, *mesher, slaveWorkers, mesherGroup,
+                                splats, grid, &progress,
+                                vm[Option::partialCheckpoint].as<std::string>(),
+                                vm[Option::checkpointInterval].as<int>()));
+                        collector.setPostFlush(boost::ref(*checkpointer));
+                    }
 
                     // Start threads
                     slaveWorkers.start(splats, grid, &progress);
@@ -146,12 +320,16 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
 
                     try
                     {
-                        doBucket(mainWorker, vm, splats, grid, chunkCells, collector);
+                        if (filter)
+                            doBucket(mainWorker, vm, splats, grid, chunkCells, boost::ref(*filter));
+                        else
+                            doBucket(mainWorker, vm, splats, grid, chunkCells, boost::ref(collector));
                     }
                     catch (...)
                     {
                         // This can't be handled using unwinding, because that would operate in
                         // the wrong order
+                        collector.setPostFlush(BucketCollector::PostFlushFunctor());
                         collector.flush();
                         slaveWorkers.stop();
                         mesherGroup.stop();
@@ -162,6 +340,9 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                      * satisfy the requirement that stop() is only called after producers
                      * are terminated.
                      */
+                    if (filter)
+                        filter->flush();
+                    collector.setPostFlush(BucketCollector::PostFlushFunctor());
                     collector.flush();
                     slaveWorkers.stop();
                     mesherGroup.stop();
@@ -174,7 +355,23 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 mesher->checkpoint(mainWorker, path);
             }
             else
-                ret = mesher->write(mainWorker, &Log::log[Log::info]);
+            {
+                std::size_t kept = 0;
+                if (tracker)
+                {
+                    Log::log[Log::info] << tracker->numDirty() << " chunk(s) recomputed\n";
+                    kept = tracker->prepareOutputs();
+                }
+                for (std::size_t level = 0; level < levels.size(); level++)
+                    ret += levels[level].mesher->write(mainWorker, &Log::log[Log::info]);
+                if (tracker)
+                {
+                    tracker->recordOutputs();
+                    tracker->getManifest().save(vm[Option::incremental].as<std::string>());
+                    Log::log[Log::info] << kept << " unchanged output file(s) kept\n";
+                    ret += kept;
+                }
+            }
         }
     } // ends scope for grandTotalTimer
 
@@ -33,6 +33,7 @@
 #endif
 #include <cstddef>
 #include <limits>
+#include <algorithm>
 #include <string>
 #include <stdexcept>
 #include <fstream>
@@ -46,6 +47,8 @@
 #include <boost/exception/all.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #include "errors.h"
 #include "binary_io.h"
 
@@ -147,6 +150,18 @@ BinaryIO::offset_type BinaryReader::size() const
     }
 }
 
+void BinaryReader::willNeed(offset_type offset, offset_type count) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    willNeedImpl(offset, count);
+}
+
+void BinaryReader::willNeedImpl(offset_type offset, offset_type count) const
+{
+    (void) offset;
+    (void) count;
+}
+
 std::size_t BinaryWriter::write(const void *buf, std::size_t count, offset_type offset) const
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -175,6 +190,33 @@ void BinaryWriter::resize(offset_type size) const
     }
 }
 
+BinaryWriter::Mapping *BinaryWriter::map(offset_type offset, std::size_t count) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(count > 0, std::invalid_argument);
+    try
+    {
+        return mapImpl(offset, count);
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(filename());
+        throw;
+    }
+    catch (std::ios::failure &e)
+    {
+        // Thrown directly by boost::iostreams
+        throw boost::enable_error_info(e) << boost::errinfo_file_name(filename());
+    }
+}
+
+BinaryWriter::Mapping *BinaryWriter::mapImpl(offset_type offset, std::size_t count) const
+{
+    (void) offset;
+    (void) count;
+    return NULL;
+}
+
 namespace
 {
 
@@ -356,6 +398,9 @@ private:
     virtual void closeImpl();
     virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
     virtual offset_type sizeImpl() const;
+#if SYSCALL_IO_POSIX
+    virtual void willNeedImpl(offset_type offset, offset_type count) const;
+#endif
 
 public:
     virtual ~SyscallReader();
@@ -375,6 +420,7 @@ private:
     HANDLE fd;
 #endif
 
+protected:
     virtual void openImpl(const boost::filesystem::path &path);
     virtual void closeImpl();
     virtual std::size_t writeImpl(const void *buf, std::size_t count, offset_type offset) const;
@@ -441,6 +487,17 @@ BinaryIO::offset_type SyscallReader::sizeImpl() const
     return buf.st_size;
 }
 
+void SyscallReader::willNeedImpl(offset_type offset, offset_type count) const
+{
+#ifdef POSIX_FADV_WILLNEED
+    // Failure is harmless, since this is only advice
+    (void) posix_fadvise(fd, offset, count, POSIX_FADV_WILLNEED);
+#else
+    (void) offset;
+    (void) count;
+#endif
+}
+
 std::size_t SyscallReader::readImpl(void *buf, size_t count, offset_type offset) const
 {
     size_t remain = count;
@@ -650,6 +707,127 @@ void SyscallWriter::resizeImpl(offset_type size) const
 
 #endif // SYSCALL_IO_WIN32
 
+/**
+ * Implementation of @ref BinaryWriter that supports @ref BinaryWriter::map
+ * using memory mapping. Rather than mapping each requested range
+ * separately, it maps a window of up to @ref windowSize bytes and hands out
+ * pointers into it until a request falls outside it, so that the many small
+ * ranges written for consecutive clumps share one mapping. It works for
+ * files that are too large to map in one piece. Ordinary writes are handled
+ * as for @ref SyscallWriter.
+ */
+class MmapWriter : public SyscallWriter
+{
+public:
+    /// Preferred size of a mapped window
+    static const std::size_t windowSize = 64 * 1024 * 1024;
+
+private:
+    /// A mapped range of the file, which is unmapped when no longer referenced
+    class Window : public boost::noncopyable
+    {
+    private:
+        boost::iostreams::mapped_file_sink sink;
+
+    public:
+        const offset_type start;  ///< File offset of the first mapped byte
+        const offset_type end;    ///< File offset after the last mapped byte
+
+        Window(const std::string &filename, offset_type start, offset_type end);
+
+        /// Address of the byte at file offset @a offset
+        char *address(offset_type offset) const { return sink.data() + (offset - start); }
+    };
+
+    /// Pointer into a window, which keeps the window mapped
+    class Mapping : public BinaryWriter::Mapping
+    {
+    private:
+        boost::shared_ptr<Window> window;
+        char *ptr;
+
+    public:
+        Mapping(const boost::shared_ptr<Window> &window, offset_type offset)
+            : window(window), ptr(window->address(offset)) {}
+
+        virtual void *get() const { return ptr; }
+    };
+
+    mutable boost::mutex mutex;                ///< Protects @ref window and @ref fileSize
+    mutable boost::shared_ptr<Window> window;  ///< Most recently mapped window, if any
+    mutable offset_type fileSize;              ///< Size most recently passed to @ref resize
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual void resizeImpl(offset_type size) const;
+    virtual BinaryWriter::Mapping *mapImpl(offset_type offset, std::size_t count) const;
+};
+
+const std::size_t MmapWriter::windowSize;
+
+MmapWriter::Window::Window(const std::string &filename, offset_type start, offset_type end)
+    : start(start), end(end)
+{
+    boost::iostreams::mapped_file_params params(filename);
+    params.offset = start;
+    params.length = end - start;
+    try
+    {
+        sink.open(params);
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e) << boost::errinfo_errno(errno);
+    }
+    if (!sink.is_open())
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not create mapping"))
+            << boost::errinfo_errno(errno);
+    }
+}
+
+void MmapWriter::openImpl(const boost::filesystem::path &path)
+{
+    SyscallWriter::openImpl(path);
+    fileSize = 0;
+}
+
+void MmapWriter::closeImpl()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        // Existing mappings keep the window alive
+        window.reset();
+    }
+    SyscallWriter::closeImpl();
+}
+
+void MmapWriter::resizeImpl(offset_type size) const
+{
+    SyscallWriter::resizeImpl(size);
+    boost::lock_guard<boost::mutex> lock(mutex);
+    fileSize = size;
+    // A window extending past the end of the file would fault when touched
+    if (window && window->end > size)
+        window.reset();
+}
+
+BinaryWriter::Mapping *MmapWriter::mapImpl(offset_type offset, std::size_t count) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!window || offset < window->start || offset + count > window->end)
+    {
+        // The start of the mapping must be aligned to the allocation granularity
+        const offset_type alignment = boost::iostreams::mapped_file::alignment();
+        const offset_type start = offset - offset % alignment;
+        offset_type end = std::min(start + offset_type(windowSize), fileSize);
+        end = std::max(end, offset + offset_type(count));
+        window.reset();  // release the old window before mapping the new one
+        window.reset(new Window(filename(), start, end));
+    }
+    return new Mapping(window, offset);
+}
+
 } // anonymous namespace
 
 BinaryReaderSource::BinaryReaderSource(const BinaryReader &reader)
@@ -707,6 +885,7 @@ std::map<std::string, WriterType> WriterTypeWrapper::getNameMap()
     std::map<std::string, WriterType> ans;
     ans["stream"] = STREAM_WRITER;
     ans["syscall"] = SYSCALL_WRITER;
+    ans["mmap"] = MMAP_WRITER;
     return ans;
 }
 
@@ -729,6 +908,7 @@ BinaryWriter *createWriter(WriterType type)
     {
     case STREAM_WRITER:  return new StreamWriter;
     case SYSCALL_WRITER: return new SyscallWriter;
+    case MMAP_WRITER:    return new MmapWriter;
     default:
         MLSGPU_ASSERT(false, std::invalid_argument);
         return NULL;
@@ -51,7 +51,8 @@ enum ReaderType
 enum WriterType
 {
     STREAM_WRITER,
-    SYSCALL_WRITER
+    SYSCALL_WRITER,
+    MMAP_WRITER
 };
 
 /// Wrapper around @ref ReaderType for use with @ref Choice.
@@ -162,6 +163,15 @@ public:
      */
     offset_type size() const;
 
+    /**
+     * Advise that the range of @a count bytes starting at @a offset will be
+     * read soon, so that it may be fetched in the background. This is only a
+     * hint and has no effect for some implementations.
+     *
+     * @pre The file is open.
+     */
+    void willNeed(offset_type offset, offset_type count) const;
+
 private:
     /**
      * Implements @ref read. It does not need to check whether the file is
@@ -174,6 +184,11 @@ private:
      * open or put the filename into exceptions.
      */
     virtual offset_type sizeImpl() const = 0;
+
+    /**
+     * Implements @ref willNeed. The default implementation does nothing.
+     */
+    virtual void willNeedImpl(offset_type offset, offset_type count) const;
 };
 
 /**
@@ -182,6 +197,19 @@ private:
 class BinaryWriter : public BinaryIO
 {
 public:
+    /**
+     * A writable view of part of the file, obtained from @ref map. The data
+     * are written to the file at the latest when the object is destroyed.
+     */
+    class Mapping : public boost::noncopyable
+    {
+    public:
+        /// Pointer to the first byte of the mapped range
+        virtual void *get() const = 0;
+
+        virtual ~Mapping() {}
+    };
+
     /**
      * Writes up to @a count bytes from the file, starting at @a offset.
      *
@@ -204,6 +232,21 @@ public:
      */
     void resize(offset_type size) const;
 
+    /**
+     * Obtain direct access to @a count bytes of the file starting at @a
+     * offset, so that they can be filled in place without staging them in a
+     * separate buffer. This is only supported by some implementations; the
+     * others return @c NULL. It is thread-safe, and the caller takes
+     * ownership of the returned object. The mapping remains valid even if
+     * the file is closed.
+     *
+     * @throw boost::exception if there was a low-level I/O error
+     *
+     * @pre The file is open, <code>count &gt; 0</code>, and the range lies
+     * within the current size of the file (see @ref resize).
+     */
+    Mapping *map(offset_type offset, std::size_t count) const;
+
 private:
     /**
      * Implements @ref write. It does not need to check that the file is open or
@@ -216,6 +259,11 @@ private:
      * put the filename into exceptions.
      */
     virtual void resizeImpl(offset_type size) const = 0;
+
+    /**
+     * Implements @ref map. The default implementation returns @c NULL.
+     */
+    virtual Mapping *mapImpl(offset_type offset, std::size_t count) const;
 };
 
 /**
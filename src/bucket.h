@@ -80,6 +80,11 @@ struct Recursion
     unsigned int depth;              ///< Current depth of recursion.
     std::size_t totalRanges;         ///< Blob ranges held in memory at all levels.
     boost::array<Grid::size_type, 3> chunk; ///< Output file chunk.
+    /**
+     * Region covered by the output chunk. It is not clipped to the region
+     * passed to @ref bucket, so all chunks have the same size.
+     */
+    Grid chunkGrid;
 
     Recursion() : depth(0), totalRanges(0)
     {
@@ -132,9 +137,15 @@ public:
  * @param recursionState Optional parameter indicating recursion statistics
  *                   on entry. This is intended for use when the processing
  *                   callback calls this function again.
+ * @param microAlign Power of two that divides every microblock size, and
+ *                   hence the bounds of every bucket relative to @a region
+ *                   (other than those clipped to its upper bounds). This
+ *                   allows the buckets to be coarsened by up to this factor.
+ *                   It must divide @a microCells.
  *
- * @throw DensityError If any single grid cell conservatively intersects more
- *                     than @a maxSplats splats.
+ * @throw DensityError If any single grid cell (or aligned block of @a
+ *                     microAlign cells) conservatively intersects more than
+ *                     @a maxSplats splats.
  *
  * @note If any splat falls completely outside of @a region, it is undefined
  * whether it will be passed to the processing function at all.
@@ -186,7 +197,8 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState = Recursion());
+            const Recursion &recursionState = Recursion(),
+            Grid::size_type microAlign = 1);
 
 } // namespace Bucket
 
@@ -29,6 +29,7 @@
 #endif
 #include <boost/function.hpp>
 #include <boost/ref.hpp>
+#include <stdexcept>
 #include "splat_set.h"
 #include "statistics.h"
 #include "allocator.h"
@@ -36,10 +37,11 @@
 #include "chunk_id.h"
 #include "bucket.h"
 #include "bucket_collector.h"
+#include "errors.h"
 
 BucketCollector::BucketCollector(SplatSet::splat_id maxSplats, Functor functor)
     : maxSplats(maxSplats), functor(functor),
-    bins("mem.BucketCollector.bins"), numSplats(0),
+    bins("mem.BucketCollector.bins"), numSplats(0), skipBins(0), seenBins(0),
     binsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.bins")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.splats"))
 {
@@ -51,13 +53,26 @@ void BucketCollector::operator()(
     const Bucket::Recursion &recursionState)
 {
     if (numSplats + splats.numSplats() > maxSplats)
+    {
         flush();
+        // While skipping, the bins already processed are not yet all counted
+        if (postFlush && seenBins >= skipBins)
+            postFlush(seenBins);
+    }
 
-    if (recursionState.chunk != curChunkId.coords)
+    const bool newChunk = recursionState.chunk != curChunkId.coords;
+    if (newChunk)
     {
         curChunkId.gen++;
         curChunkId.coords = recursionState.chunk;
     }
+    // The first chunk keeps the initial ID if its coordinates are zero
+    if ((newChunk || seenBins == 0) && chunkFunctor)
+        chunkFunctor(curChunkId, recursionState.chunkGrid);
+
+    seenBins++;
+    if (seenBins <= skipBins)
+        return;
 
     bins.push_back(Bin());
     Bin &bin = bins.back();
@@ -81,3 +96,11 @@ void BucketCollector::flush()
     bins.clear();
     numSplats = 0;
 }
+
+void BucketCollector::reset()
+{
+    MLSGPU_ASSERT(bins.empty(), std::logic_error);
+    curChunkId = ChunkId();
+    skipBins = 0;
+    seenBins = 0;
+}
@@ -31,6 +31,7 @@
 # include <config.h>
 #endif
 #include <boost/function.hpp>
+#include "tr1_cstdint.h"
 #include "splat_set.h"
 #include "statistics.h"
 #include "allocator.h"
@@ -44,6 +45,10 @@
  * makes a callback with the collected results.
  *
  * It also assigns generation numbers to chunk IDs.
+ *
+ * Bins are numbered in the order they are received, which is deterministic
+ * for a given input. This allows an interrupted run to be continued by
+ * skipping the bins that were already processed (see @ref setSkip).
  */
 class BucketCollector : public boost::noncopyable
 {
@@ -57,6 +62,20 @@ public:
 
     typedef boost::function<void(const Statistics::Container::vector<Bin> &bins)> Functor;
 
+    /**
+     * Callback made after the collector flushes because it is full. It is
+     * passed the number of bins that have been handed to the functor (or
+     * skipped) so far.
+     */
+    typedef boost::function<void(std::tr1::uint64_t bins)> PostFlushFunctor;
+
+    /**
+     * Callback made when the first bucket of a new output chunk is seen. It
+     * is passed the chunk ID and the region covered by the chunk (see @ref
+     * Bucket::Recursion::chunkGrid).
+     */
+    typedef boost::function<void(const ChunkId &chunkId, const Grid &chunkGrid)> ChunkFunctor;
+
     void operator()(
         const SplatSet::SubsetBase &splats,
         const Grid &grid,
@@ -72,12 +91,44 @@ public:
 
     void flush(); ///< Flush any partial bins to the output
 
+    /**
+     * Prepare for another run over the buckets, such as the next pass of a
+     * multi-pass mesher or the next level. Chunk generation numbers and bin
+     * numbers start again from the beginning, so that each run assigns the
+     * same chunk IDs. Any skip set with @ref setSkip is cleared.
+     *
+     * @pre There are no partial bins i.e. @ref flush has been called.
+     */
+    void reset();
+
+    /**
+     * Discard the first @a bins bins rather than passing them to the
+     * functor. They are still used to assign chunk IDs.
+     */
+    void setSkip(std::tr1::uint64_t bins) { skipBins = bins; }
+
+    /**
+     * Set a callback to make after each flush caused by the collector filling
+     * up. It is not made by explicit calls to @ref flush.
+     */
+    void setPostFlush(const PostFlushFunctor &postFlush) { this->postFlush = postFlush; }
+
+    /**
+     * Set a callback to make when a new chunk is started. It is also made
+     * for chunks whose bins are skipped.
+     */
+    void setChunkFunctor(const ChunkFunctor &chunkFunctor) { this->chunkFunctor = chunkFunctor; }
+
 private:
     ChunkId curChunkId;           ///< Last-seen chunk ID
     SplatSet::splat_id maxSplats; ///< Limit on splats to pass to @ref functor
     Functor functor;              ///< Callback function
     Statistics::Container::vector<Bin> bins;  ///< Buffer of splat ranges
     SplatSet::splat_id numSplats; ///< Splats collected in @ref bins
+    std::tr1::uint64_t skipBins;  ///< Number of initial bins to discard
+    std::tr1::uint64_t seenBins;  ///< Number of bins received so far
+    PostFlushFunctor postFlush;   ///< Callback after flushing a full collection
+    ChunkFunctor chunkFunctor;    ///< Callback when a new chunk is started
 
     Statistics::Variable &binsStat;   ///< Number of bins per flush
     Statistics::Variable &splatsStat; ///< Number of splats per flush
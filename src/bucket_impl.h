@@ -113,12 +113,14 @@ struct BucketParameters
     std::tr1::uint64_t maxSplats;       ///< Maximum splats permitted for processing
     Grid::size_type maxCells;           ///< Maximum cells along any dimension
     std::size_t maxSplit;               ///< Maximum fan-out for recursion
+    Grid::size_type microAlign;         ///< Microblock sizes are multiples of this
 
     BucketParameters(std::tr1::uint64_t maxSplats,
                      Grid::size_type maxCells,
-                     std::size_t maxSplit)
+                     std::size_t maxSplit,
+                     Grid::size_type microAlign)
         : maxSplats(maxSplats), maxCells(maxCells),
-        maxSplit(maxSplit) {}
+        maxSplit(maxSplit), microAlign(microAlign) {}
 };
 
 /**
@@ -461,9 +463,9 @@ void bucketRecurse(
     {
         // The bucketCallback in the if statement did the work
     }
-    else if (maxCellDim == 1)
+    else if (maxCellDim <= params.microAlign)
     {
-        throw DensityError(splats.maxSplats()); // can't subdivide a 1x1x1 cell
+        throw DensityError(splats.maxSplats()); // can't subdivide a single (aligned) microblock
     }
     else
     {
@@ -477,6 +479,7 @@ void bucketRecurse(
         {
             // Either no request, or request was useless
             microSize = chooseMicroSize(cellDims, params.maxSplit, splats.maxSplats(), params.maxSplats, params.maxCells);
+            microSize = std::max(microSize, params.microAlign);
         }
 
         /* Coarsen until we have sufficiently few microblocks */
@@ -554,7 +557,17 @@ void bucketRecurse(
             for (chunkCoord[1] = 0; chunkCoord[1] < chunks[1]; chunkCoord[1]++)
                 for (chunkCoord[2] = 0; chunkCoord[2] < chunks[2]; chunkCoord[2]++)
                 {
-                    states(chunkCoord)->doCallbacks(splats, process, recursionState, chunkCoord);
+                    Recursion chunkRecursion = recursionState;
+                    if (recursionState.depth == 0)
+                    {
+                        // Deeper levels are confined to a single chunk
+                        const Grid::difference_type c = chunkCells;
+                        chunkRecursion.chunkGrid = grid.subGrid(
+                            chunkCoord[0] * c, (chunkCoord[0] + 1) * c,
+                            chunkCoord[1] * c, (chunkCoord[1] + 1) * c,
+                            chunkCoord[2] * c, (chunkCoord[2] + 1) * c);
+                    }
+                    states(chunkCoord)->doCallbacks(splats, process, chunkRecursion, chunkCoord);
                 }
     }
 }
@@ -570,10 +583,22 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState)
+            const Recursion &recursionState,
+            Grid::size_type microAlign)
 {
-    detail::BucketParameters params(maxSplats, maxCells, maxSplit);
-    detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, recursionState);
+    MLSGPU_ASSERT(microAlign > 0 && (microAlign & (microAlign - 1)) == 0, std::invalid_argument);
+    MLSGPU_ASSERT(microCells % microAlign == 0, std::invalid_argument);
+    detail::BucketParameters params(maxSplats, maxCells, maxSplit, microAlign);
+    Recursion initialState = recursionState;
+    if (initialState.depth == 0)
+    {
+        // Used if the region turns out to be a single chunk
+        if (chunkCells > 0)
+            initialState.chunkGrid = region.subGrid(0, chunkCells, 0, chunkCells, 0, chunkCells);
+        else
+            initialState.chunkGrid = region;
+    }
+    detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, initialState);
 }
 
 } // namespace Bucket
@@ -0,0 +1,214 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref CompactWriter.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "tr1_cstdint.h"
+#include "compact_writer.h"
+#include "binary_io.h"
+#include "statistics.h"
+#include "grid.h"
+#include "errors.h"
+
+const CompactWriter::size_type CompactWriter::vertexSize;
+const CompactWriter::size_type CompactWriter::headerSize;
+const std::tr1::uint32_t CompactWriter::maxQuantized;
+
+CompactWriter::CompactWriter(WriterType writerType) :
+    writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.compact.writeVertices.time")),
+    writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.compact.writeTriangles.time")),
+    handleFactory(InternalFactory(writerType)),
+    numVertices(0), numTriangles(0),
+    writtenTriangles(0), triangleBytes(0), prevIndex(0)
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        origin[i] = 0.0f;
+        step[i] = 0.0f;
+    }
+}
+
+CompactWriter::CompactWriter(boost::function<boost::shared_ptr<BinaryWriter>()> handleFactory) :
+    writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.compact.writeVertices.time")),
+    writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.compact.writeTriangles.time")),
+    handleFactory(handleFactory),
+    numVertices(0), numTriangles(0),
+    writtenTriangles(0), triangleBytes(0), prevIndex(0)
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        origin[i] = 0.0f;
+        step[i] = 0.0f;
+    }
+}
+
+bool CompactWriter::isOpen() const
+{
+    return handle.get() != NULL;
+}
+
+void CompactWriter::setNumVertices(size_type numVertices)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    this->numVertices = numVertices;
+}
+
+void CompactWriter::setNumTriangles(size_type numTriangles)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    this->numTriangles = numTriangles;
+}
+
+void CompactWriter::setGrid(const Grid &grid)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    grid.getVertex(0, 0, 0, origin);
+    for (unsigned int i = 0; i < 3; i++)
+        step[i] = double(grid.getSpacing()) * grid.numCells(i) / maxQuantized;
+}
+
+CompactWriter::size_type CompactWriter::getNumVertices() const
+{
+    return numVertices;
+}
+
+CompactWriter::size_type CompactWriter::getNumTriangles() const
+{
+    return numTriangles;
+}
+
+void CompactWriter::open(const std::string &filename)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    handle = handleFactory();
+    handle->open(filename);
+    handle->resize(triangleStart());
+    writtenTriangles = 0;
+    triangleBytes = 0;
+    prevIndex = 0;
+}
+
+void CompactWriter::close()
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(writtenTriangles == numTriangles, state_error);
+
+    char header[headerSize];
+    char *ptr = header;
+    const std::tr1::uint32_t version = 1;
+    const std::tr1::uint64_t counts[3] = { numVertices, numTriangles, triangleBytes };
+    std::memcpy(ptr, "MLSQ", 4); ptr += 4;
+    std::memcpy(ptr, &version, sizeof(version)); ptr += sizeof(version);
+    std::memcpy(ptr, counts, sizeof(counts)); ptr += sizeof(counts);
+    std::memcpy(ptr, origin, sizeof(origin)); ptr += sizeof(origin);
+    std::memcpy(ptr, step, sizeof(step)); ptr += sizeof(step);
+    assert(ptr == header + headerSize);
+    handle->write(header, headerSize, 0);
+    handle->close();
+    handle.reset();
+}
+
+void CompactWriter::writeVertices(size_type first, size_type count, const float *data)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
+
+    Statistics::Timer timer(writeVerticesTime);
+    float scale[3];
+    for (unsigned int i = 0; i < 3; i++)
+        scale[i] = step[i] > 0.0f ? 1.0f / step[i] : 0.0f;
+
+    BinaryWriter::offset_type pos = headerSize + first * vertexSize;
+    while (count > 0)
+    {
+        const unsigned int bufferVertices = 8192;
+        std::tr1::uint16_t buffer[bufferVertices * 3];
+        unsigned int vertices = std::min(size_type(bufferVertices), count);
+        for (unsigned int j = 0; j < vertices * 3; j++, data++)
+        {
+            const unsigned int axis = j % 3;
+            float q = std::floor((*data - origin[axis]) * scale[axis] + 0.5f);
+            // Written so that NaN ends up as zero
+            if (!(q >= 0.0f))
+                q = 0.0f;
+            else if (q > maxQuantized)
+                q = maxQuantized;
+            buffer[j] = (std::tr1::uint16_t) q;
+        }
+        pos += handle->write(buffer, vertices * vertexSize, pos);
+        count -= vertices;
+    }
+}
+
+std::size_t CompactWriter::encodeIndices(
+    std::size_t count, const std::tr1::uint32_t *indices,
+    std::tr1::uint32_t &prev, std::tr1::uint8_t *out)
+{
+    std::tr1::uint8_t *ptr = out;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const std::tr1::int64_t delta = std::tr1::int64_t(indices[i]) - std::tr1::int64_t(prev);
+        // Zig-zag encoding: 0, -1, 1, -2, 2, ... map to 0, 1, 2, 3, 4, ...
+        std::tr1::uint64_t code = delta < 0 ? ((std::tr1::uint64_t(~delta)) << 1) | 1 : std::tr1::uint64_t(delta) << 1;
+        while (code >= 0x80)
+        {
+            *ptr++ = std::tr1::uint8_t(code & 0x7F) | 0x80;
+            code >>= 7;
+        }
+        *ptr++ = std::tr1::uint8_t(code);
+        prev = indices[i];
+    }
+    return ptr - out;
+}
+
+void CompactWriter::writeTriangles(size_type count, const std::tr1::uint32_t *data)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(writtenTriangles + count <= getNumTriangles(), std::out_of_range);
+
+    Statistics::Timer timer(writeTrianglesTime);
+    while (count > 0)
+    {
+        const unsigned int bufferTriangles = 4096;
+        std::tr1::uint8_t buffer[bufferTriangles * 3 * 5];
+        unsigned int triangles = std::min(size_type(bufferTriangles), count);
+        std::size_t bytes = encodeIndices(3 * triangles, data, prevIndex, buffer);
+        handle->write(buffer, bytes, triangleStart() + triangleBytes);
+        triangleBytes += bytes;
+        writtenTriangles += triangles;
+        data += 3 * triangles;
+        count -= triangles;
+    }
+}
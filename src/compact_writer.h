@@ -0,0 +1,196 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Writer for a quantized, compact mesh format intended for streaming.
+ */
+
+#ifndef COMPACT_WRITER_H
+#define COMPACT_WRITER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <cstddef>
+#include <boost/function.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include "tr1_cstdint.h"
+#include "binary_io.h"
+#include "statistics.h"
+#include "grid.h"
+
+/**
+ * Writes meshes in a compact form, which is much smaller than PLY output.
+ *
+ * The file consists of
+ *  -# A header of @ref headerSize bytes, holding (in native byte order)
+ *     - the four characters <code>MLSQ</code>;
+ *     - a 32-bit version number (currently 1);
+ *     - 64-bit counts of vertices and triangles;
+ *     - the 64-bit number of bytes in the triangle section;
+ *     - a <code>float[3]</code> origin and a <code>float[3]</code> step size.
+ *  -# The vertices, each stored as three 16-bit unsigned integers @a q, which
+ *     encode the position <code>origin + q * step</code>.
+ *  -# The triangles, stored as a stream of indices. Each index is replaced by
+ *     its difference from the previous index (the first is relative to
+ *     zero), zig-zag encoded so that small negative values remain small,
+ *     and then written as a little-endian base-128 varint.
+ *
+ * The usage pattern is
+ *  -# Call @ref setNumVertices, @ref setNumTriangles and @ref setGrid.
+ *  -# Call @ref open.
+ *  -# Write the vertices with @ref writeVertices, which may be done in any
+ *     order, and append the triangles in order with @ref writeTriangles.
+ *     The two may be interleaved.
+ *  -# Call @ref close, which writes the header.
+ *
+ * Unlike @ref FastPly::Writer, a single writer may not be used from multiple
+ * threads at once. However, it may be copied while closed to obtain an
+ * independent writer.
+ */
+class CompactWriter
+{
+public:
+    /// Size capable of holding maximum supported file size
+    typedef BinaryWriter::offset_type size_type;
+
+    /// Bytes per vertex
+    static const size_type vertexSize = 3 * sizeof(std::tr1::uint16_t);
+    /// Bytes in the file header
+    static const size_type headerSize = 56;
+    /// Largest quantized coordinate
+    static const std::tr1::uint32_t maxQuantized = 65535;
+
+    /// Determines whether @ref open has been successfully called.
+    bool isOpen() const;
+
+    /**
+     * Set the number of vertices that will be in the file.
+     * @pre @ref open has not yet been successfully called.
+     */
+    void setNumVertices(size_type numVertices);
+
+    /**
+     * Set the number of triangles that will be in the file.
+     * @pre @ref open has not yet been successfully called.
+     */
+    void setNumTriangles(size_type numTriangles);
+
+    /**
+     * Set the region of space covered by the file, which determines the
+     * quantization. The origin is the lower corner of @a grid, and the
+     * region is divided into @ref maxQuantized steps along each axis.
+     * Grids of the same size thus share a step, and grids that tile space
+     * share a lattice. Vertices outside the region are clamped to it.
+     * @pre @ref open has not yet been successfully called.
+     */
+    void setGrid(const Grid &grid);
+
+    /**
+     * Create the file.
+     * @pre @ref open has not yet been successfully called.
+     */
+    void open(const std::string &filename);
+
+    /**
+     * Write the header and prepare to write another file.
+     * @pre All the triangles set with @ref setNumTriangles have been written.
+     */
+    void close();
+
+    /**
+     * Quantize and write a range of vertices.
+     * @param first          Index of first vertex to write.
+     * @param count          Number of vertices to write.
+     * @param data           Array of <code>float[3]</code> values.
+     * @pre @a first + @a count <= @a numVertices.
+     */
+    void writeVertices(size_type first, size_type count, const float *data);
+
+    /**
+     * Append triangles to the file.
+     * @param count          Number of triangles to write.
+     * @param data           Array of <code>uint32_t[3]</code> values containing indices.
+     * @pre The total number written does not exceed the number set with @ref setNumTriangles.
+     */
+    void writeTriangles(size_type count, const std::tr1::uint32_t *data);
+
+    size_type getNumVertices() const;  ///< Return the number of vertices
+    size_type getNumTriangles() const; ///< Return the number of triangles
+
+    /**
+     * Encode indices in the form used in the file.
+     *
+     * @param count          Number of indices to encode.
+     * @param indices        Indices to encode.
+     * @param prev           The index preceding the first one, which is
+     *                       updated to the last one encoded.
+     * @param out            Buffer with room for at least 5 bytes per index.
+     * @return The number of bytes written to @a out.
+     */
+    static std::size_t encodeIndices(
+        std::size_t count, const std::tr1::uint32_t *indices,
+        std::tr1::uint32_t &prev, std::tr1::uint8_t *out);
+
+    /// Constructor
+    explicit CompactWriter(WriterType writerType);
+
+    /// Constructor with a custom low-level writer.
+    explicit CompactWriter(boost::function<boost::shared_ptr<BinaryWriter>()> handleFactory);
+
+private:
+    /// Generates a new @ref BinaryWriter from a writer type.
+    class InternalFactory
+    {
+    private:
+        const WriterType writerType;
+    public:
+        typedef boost::shared_ptr<BinaryWriter> result_type;
+
+        result_type operator()() { return result_type(createWriter(writerType)); }
+        explicit InternalFactory(WriterType writerType) : writerType(writerType) {}
+    };
+
+    Statistics::Variable &writeVerticesTime;
+    Statistics::Variable &writeTrianglesTime;
+
+    /// Handle factory, used when the file is opened to make a new handle
+    boost::function<boost::shared_ptr<BinaryWriter>()> handleFactory;
+    /// File handle (non-NULL if the file is open)
+    boost::shared_ptr<BinaryWriter> handle;
+
+    size_type numVertices;              ///< Number of vertices (defaults to zero)
+    size_type numTriangles;             ///< Number of triangles (defaults to zero)
+    float origin[3];                    ///< Position of quantized zero
+    float step[3];                      ///< Quantization step on each axis
+
+    size_type writtenTriangles;         ///< Triangles appended since @ref open
+    size_type triangleBytes;            ///< Bytes of triangle data appended since @ref open
+    std::tr1::uint32_t prevIndex;       ///< Last index written, for delta coding
+
+    /// Offset in file to the start of the triangles
+    size_type triangleStart() const { return headerSize + numVertices * vertexSize; }
+};
+
+#endif /* !COMPACT_WRITER_H */
@@ -0,0 +1,239 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Block-compressed files that still support random-access reads.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <ios>
+#include <boost/exception/all.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#if HAVE_LZ4
+# include <lz4.h>
+#endif
+#include "tr1_cstdint.h"
+#include "compressed_io.h"
+#include "binary_io.h"
+#include "errors.h"
+
+namespace
+{
+
+/// Apply @ref BLOCK_FILTER_DELTA3 to the 32-bit words in @a data
+void encodeDelta3(char *data, std::size_t bytes)
+{
+    std::tr1::uint32_t *words = reinterpret_cast<std::tr1::uint32_t *>(data);
+    const std::size_t n = bytes / sizeof(std::tr1::uint32_t);
+    for (std::size_t i = n; i > 3; i--)
+        words[i - 1] -= words[i - 4];
+}
+
+/// Invert @ref encodeDelta3
+void decodeDelta3(char *data, std::size_t bytes)
+{
+    std::tr1::uint32_t *words = reinterpret_cast<std::tr1::uint32_t *>(data);
+    const std::size_t n = bytes / sizeof(std::tr1::uint32_t);
+    for (std::size_t i = 3; i < n; i++)
+        words[i] += words[i - 3];
+}
+
+} // anonymous namespace
+
+bool blockCompressionSupported()
+{
+#if HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+const std::size_t BlockCompressor::defaultBlockSize;
+
+BlockCompressor::BlockCompressor(BlockFilter filter, std::size_t blockSize)
+    : out(NULL),
+    buffer("mem.BlockCompressor::buffer"),
+    fill(0),
+    compressed("mem.BlockCompressor::compressed")
+{
+    MLSGPU_ASSERT(blockSize > 0 && blockSize % sizeof(std::tr1::uint32_t) == 0, std::invalid_argument);
+#if HAVE_LZ4
+    MLSGPU_ASSERT(blockSize <= std::size_t(LZ4_MAX_INPUT_SIZE), std::invalid_argument);
+#endif
+    index.blockSize = blockSize;
+    index.filter = filter;
+}
+
+void BlockCompressor::start(std::ostream &out)
+{
+    this->out = &out;
+    index.size = 0;
+    index.offsets.clear();
+    index.offsets.push_back(0);
+    fill = 0;
+    buffer.resize(index.blockSize);
+#if HAVE_LZ4
+    compressed.resize(LZ4_compressBound(index.blockSize));
+#endif
+}
+
+void BlockCompressor::write(const void *data, std::size_t size)
+{
+    MLSGPU_ASSERT(out != NULL, state_error);
+    const char *ptr = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        const std::size_t n = std::min(size, index.blockSize - fill);
+        std::memcpy(&buffer[fill], ptr, n);
+        fill += n;
+        ptr += n;
+        size -= n;
+        index.size += n;
+        if (fill == index.blockSize)
+            flushBlock();
+    }
+}
+
+void BlockCompressor::finish()
+{
+    MLSGPU_ASSERT(out != NULL, state_error);
+    if (fill > 0)
+        flushBlock();
+    out = NULL;
+}
+
+void BlockCompressor::flushBlock()
+{
+    if (index.filter == BLOCK_FILTER_DELTA3)
+        encodeDelta3(&buffer[0], fill);
+
+    const char *data = &buffer[0];
+    std::size_t size = fill;
+#if HAVE_LZ4
+    int c = LZ4_compress_default(&buffer[0], &compressed[0], fill, compressed.size());
+    if (c > 0 && std::size_t(c) < fill)
+    {
+        data = &compressed[0];
+        size = c;
+    }
+#endif
+    out->write(data, size);
+    index.offsets.push_back(index.offsets.back() + size);
+    fill = 0;
+}
+
+BlockDecompressor::BlockDecompressor(const BlockIndex &index, ReaderType readerType)
+    : index(index), base(createReader(readerType)),
+    cachedBlock(index.numBlocks()),
+    block("mem.BlockDecompressor::block"),
+    compressed("mem.BlockDecompressor::compressed")
+{
+}
+
+BlockDecompressor::~BlockDecompressor()
+{
+    if (isOpen())
+        close();
+}
+
+void BlockDecompressor::openImpl(const boost::filesystem::path &path)
+{
+    base->open(path);
+    cachedBlock = index.numBlocks();
+}
+
+void BlockDecompressor::closeImpl()
+{
+    base->close();
+    cachedBlock = index.numBlocks();
+}
+
+void BlockDecompressor::loadBlock(std::size_t b) const
+{
+    if (b == cachedBlock)
+        return;
+
+    const std::size_t size = std::min(
+        std::tr1::uint64_t(index.blockSize), index.size - std::tr1::uint64_t(b) * index.blockSize);
+    const std::size_t stored = index.offsets[b + 1] - index.offsets[b];
+    block.resize(size);
+    cachedBlock = index.numBlocks(); // in case of failure
+    if (stored == size)
+    {
+        if (base->read(&block[0], size, index.offsets[b]) != size)
+            throw boost::enable_error_info(std::ios::failure("Unexpected end of file"));
+    }
+    else
+    {
+#if HAVE_LZ4
+        compressed.resize(stored);
+        if (base->read(&compressed[0], stored, index.offsets[b]) != stored)
+            throw boost::enable_error_info(std::ios::failure("Unexpected end of file"));
+        int d = LZ4_decompress_safe(&compressed[0], &block[0], stored, size);
+        if (d < 0 || std::size_t(d) != size)
+            throw boost::enable_error_info(std::ios::failure("Corrupt compressed data"));
+#else
+        throw boost::enable_error_info(std::ios::failure("Compressed data is not supported"));
+#endif
+    }
+    if (index.filter == BLOCK_FILTER_DELTA3)
+        decodeDelta3(&block[0], size);
+    cachedBlock = b;
+}
+
+std::size_t BlockDecompressor::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (offset >= index.size)
+        return 0;
+    count = std::min(std::tr1::uint64_t(count), index.size - offset);
+
+    char *ptr = static_cast<char *>(buf);
+    std::size_t remain = count;
+    while (remain > 0)
+    {
+        const std::size_t b = offset / index.blockSize;
+        const std::size_t start = offset - std::tr1::uint64_t(b) * index.blockSize;
+        loadBlock(b);
+        const std::size_t n = std::min(remain, block.size() - start);
+        std::memcpy(ptr, &block[start], n);
+        ptr += n;
+        offset += n;
+        remain -= n;
+    }
+    return count;
+}
+
+BinaryIO::offset_type BlockDecompressor::sizeImpl() const
+{
+    return index.size;
+}
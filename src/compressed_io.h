@@ -0,0 +1,187 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Block-compressed files that still support random-access reads.
+ */
+
+#ifndef COMPRESSED_IO_H
+#define COMPRESSED_IO_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/serialization/vector.hpp>
+#include "tr1_cstdint.h"
+#include "binary_io.h"
+#include "allocator.h"
+
+/// Reversible transformations applied to each block before it is compressed
+enum BlockFilter
+{
+    /// Data is compressed unchanged
+    BLOCK_FILTER_NONE,
+    /**
+     * Each 32-bit word is replaced by its difference from the word three
+     * before it in the same block. This suits arrays of triangles, where
+     * consecutive triangles tend to have similar indices.
+     */
+    BLOCK_FILTER_DELTA3
+};
+
+/**
+ * Layout of a file written by @ref BlockCompressor. Every block except the
+ * last holds @ref blockSize bytes before compression. A block whose stored
+ * size equals its uncompressed size is stored without compression.
+ */
+struct BlockIndex
+{
+    std::size_t blockSize;       ///< Uncompressed bytes per block
+    BlockFilter filter;          ///< Filter applied to each block
+    std::tr1::uint64_t size;     ///< Total uncompressed bytes
+    /// File position of each block, followed by the file size
+    std::vector<std::tr1::uint64_t> offsets;
+
+    BlockIndex() : blockSize(0), filter(BLOCK_FILTER_NONE), size(0) {}
+
+    /// Number of blocks in the file
+    std::size_t numBlocks() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    template<typename Archive>
+    void serialize(Archive &ar, const unsigned int)
+    {
+        ar & blockSize;
+        ar & filter;
+        ar & size;
+        ar & offsets;
+    }
+};
+
+/**
+ * Whether @ref BlockCompressor actually compresses data. If not, it still
+ * produces a valid file, in which every block is stored.
+ */
+bool blockCompressionSupported();
+
+/**
+ * Compresses a sequential stream of data in fixed-size blocks, recording the
+ * position of each block so that @ref BlockDecompressor can later read any
+ * range without decompressing the whole file.
+ *
+ * Errors are reported through the state of the output stream, which the
+ * caller must check.
+ */
+class BlockCompressor : public boost::noncopyable
+{
+public:
+    /// Default for @a blockSize in the constructor: a multiple of both a vertex and a triangle
+    static const std::size_t defaultBlockSize = 12 * 65536;
+
+    /**
+     * Constructor.
+     *
+     * @param filter      Filter to apply to each block.
+     * @param blockSize   Uncompressed bytes per block.
+     *
+     * @pre @a blockSize is a positive multiple of 4.
+     */
+    explicit BlockCompressor(BlockFilter filter, std::size_t blockSize = defaultBlockSize);
+
+    /**
+     * Start a new file. Any previous index is discarded.
+     */
+    void start(std::ostream &out);
+
+    /// Append data to the file
+    void write(const void *data, std::size_t size);
+
+    /**
+     * Write out the final partial block. After this, @ref getIndex describes the
+     * whole file, and @ref write may not be called until the next @ref start.
+     */
+    void finish();
+
+    /// Layout of the file written so far
+    const BlockIndex &getIndex() const { return index; }
+
+private:
+    std::ostream *out;
+    BlockIndex index;
+    /// Data for the block currently being accumulated
+    Statistics::Container::vector<char> buffer;
+    /// Number of bytes of @ref buffer that are in use
+    std::size_t fill;
+    /// Scratch space for the compressed form of a block
+    Statistics::Container::vector<char> compressed;
+
+    /// Compress and write the first @ref fill bytes of @ref buffer
+    void flushBlock();
+};
+
+/**
+ * Reader for files written by @ref BlockCompressor. Reads are in terms of
+ * the uncompressed data. The most recently decompressed block is cached, so
+ * that sequential reads in small pieces do not decompress a block repeatedly.
+ */
+class BlockDecompressor : public BinaryReader
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param index       Layout of the file (from @ref BlockCompressor::getIndex).
+     * @param readerType  Type of reader used for the compressed data.
+     */
+    explicit BlockDecompressor(const BlockIndex &index, ReaderType readerType = SYSCALL_READER);
+
+    virtual ~BlockDecompressor();
+
+private:
+    const BlockIndex index;
+    const boost::scoped_ptr<BinaryReader> base;
+
+    /// Mutex protecting the cache
+    mutable boost::mutex mutex;
+    /// Index of the block held in @ref block, or @ref numBlocks if none
+    mutable std::size_t cachedBlock;
+    /// Uncompressed data of @ref cachedBlock
+    mutable Statistics::Container::vector<char> block;
+    /// Scratch space for reading compressed data
+    mutable Statistics::Container::vector<char> compressed;
+
+    /// Decompress block @a b into @ref block, unless it is already there
+    void loadBlock(std::size_t b) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+};
+
+#endif /* !COMPRESSED_IO_H */
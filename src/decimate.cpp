@@ -0,0 +1,435 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref Decimator.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "tr1_cstdint.h"
+#include "decimate.h"
+#include "mesh.h"
+#include "statistics.h"
+
+const unsigned int Decimator::maxValence;
+
+namespace
+{
+
+const std::tr1::uint32_t badIndex = std::numeric_limits<std::tr1::uint32_t>::max();
+
+/// Compute the (unnormalised) normal of the triangle @a p0, @a p1, @a p2
+void triangleNormal(
+    const boost::array<cl_float, 3> &p0,
+    const boost::array<cl_float, 3> &p1,
+    const boost::array<cl_float, 3> &p2,
+    double n[3])
+{
+    double e1[3], e2[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        e1[i] = double(p1[i]) - p0[i];
+        e2[i] = double(p2[i]) - p0[i];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+} // anonymous namespace
+
+void Decimator::Quadric::clear()
+{
+    std::fill(a, a + 10, 0.0);
+}
+
+void Decimator::Quadric::addPlane(const double n[3], double d)
+{
+    a[0] += n[0] * n[0]; a[1] += n[0] * n[1]; a[2] += n[0] * n[2]; a[3] += n[0] * d;
+    a[4] += n[1] * n[1]; a[5] += n[1] * n[2]; a[6] += n[1] * d;
+    a[7] += n[2] * n[2]; a[8] += n[2] * d;
+    a[9] += d * d;
+}
+
+void Decimator::Quadric::operator+=(const Quadric &q)
+{
+    for (unsigned int i = 0; i < 10; i++)
+        a[i] += q.a[i];
+}
+
+double Decimator::Quadric::evaluate(const boost::array<cl_float, 3> &p) const
+{
+    const double x = p[0], y = p[1], z = p[2];
+    return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x
+        + a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y
+        + a[7] * z * z + 2.0 * a[8] * z
+        + a[9];
+}
+
+Decimator::Decimator()
+    : quadrics("mem.Decimator::quadrics"),
+    vState("mem.Decimator::vState"),
+    vStart("mem.Decimator::vStart"),
+    vEnd("mem.Decimator::vEnd"),
+    vTriangles("mem.Decimator::vTriangles"),
+    tDead("mem.Decimator::tDead"),
+    remap("mem.Decimator::remap")
+{
+}
+
+void Decimator::gatherTriangles(
+    const HostKeyMesh &mesh, std::tr1::uint32_t v, std::vector<std::tr1::uint32_t> &out) const
+{
+    out.clear();
+    for (std::tr1::uint32_t i = vStart[v]; i < vEnd[v]; i++)
+    {
+        const std::tr1::uint32_t t = vTriangles[i];
+        if (!tDead[t])
+        {
+            assert(mesh.triangles[t][0] == v || mesh.triangles[t][1] == v || mesh.triangles[t][2] == v);
+            out.push_back(t);
+        }
+    }
+}
+
+void Decimator::gatherNeighbours(
+    const HostKeyMesh &mesh, std::tr1::uint32_t v,
+    const std::vector<std::tr1::uint32_t> &tris, std::vector<std::tr1::uint32_t> &out)
+{
+    out.clear();
+    for (std::size_t i = 0; i < tris.size(); i++)
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            const std::tr1::uint32_t w = mesh.triangles[tris[i]][k];
+            if (w != v)
+                out.push_back(w);
+        }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void Decimator::pushCandidate(
+    const HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v, double maxCost)
+{
+    Quadric q = quadrics[u];
+    q += quadrics[v];
+    Candidate c;
+    c.cost = q.evaluate(mesh.vertices[v]);
+    c.u = u;
+    c.v = v;
+    if (c.cost <= maxCost)
+    {
+        heap.push_back(c);
+        std::push_heap(heap.begin(), heap.end());
+    }
+}
+
+double Decimator::checkCollapse(const HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v)
+{
+    if (vState[u] != VERTEX_FREE || vState[v] == VERTEX_REMOVED)
+        return -1.0;
+
+    gatherTriangles(mesh, u, uTriangles);
+    gatherTriangles(mesh, v, vTriangleScratch);
+
+    // The edge must exist and be shared by exactly two triangles
+    unsigned int shared = 0;
+    for (std::size_t i = 0; i < uTriangles.size(); i++)
+    {
+        const boost::array<cl_uint, 3> &t = mesh.triangles[uTriangles[i]];
+        if (t[0] == v || t[1] == v || t[2] == v)
+            shared++;
+    }
+    if (shared != 2)
+        return -1.0;
+
+    /* Link condition: the only vertices adjacent to both u and v must be
+     * the apexes of the two shared triangles, otherwise the collapse would
+     * pinch the surface.
+     */
+    gatherNeighbours(mesh, u, uTriangles, uNeighbours);
+    gatherNeighbours(mesh, v, vTriangleScratch, vNeighbours);
+    std::size_t common = 0;
+    std::vector<std::tr1::uint32_t>::const_iterator pu = uNeighbours.begin(), pv = vNeighbours.begin();
+    while (pu != uNeighbours.end() && pv != vNeighbours.end())
+    {
+        if (*pu < *pv)
+            ++pu;
+        else if (*pv < *pu)
+            ++pv;
+        else
+        {
+            common++;
+            ++pu;
+            ++pv;
+        }
+    }
+    if (common != 2)
+        return -1.0;
+    // Neighbours of the merged vertex, excluding u and v themselves
+    if (uNeighbours.size() + vNeighbours.size() - 4 > maxValence)
+        return -1.0;
+
+    // Reject collapses that would flip or degenerate a remaining triangle
+    for (std::size_t i = 0; i < uTriangles.size(); i++)
+    {
+        const boost::array<cl_uint, 3> &t = mesh.triangles[uTriangles[i]];
+        if (t[0] == v || t[1] == v || t[2] == v)
+            continue;
+        boost::array<cl_float, 3> p[3];
+        for (unsigned int k = 0; k < 3; k++)
+            p[k] = mesh.vertices[t[k]];
+        double before[3], after[3];
+        triangleNormal(p[0], p[1], p[2], before);
+        for (unsigned int k = 0; k < 3; k++)
+            if (t[k] == u)
+                p[k] = mesh.vertices[v];
+        triangleNormal(p[0], p[1], p[2], after);
+        if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+            return -1.0;
+    }
+
+    Quadric q = quadrics[u];
+    q += quadrics[v];
+    // Clamp, since rounding can make it slightly negative
+    return std::max(q.evaluate(mesh.vertices[v]), 0.0);
+}
+
+void Decimator::collapse(HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v, double maxCost)
+{
+    // uTriangles and vTriangleScratch were filled in by checkCollapse
+    const std::tr1::uint32_t start = vTriangles.size();
+    for (std::size_t i = 0; i < vTriangleScratch.size(); i++)
+    {
+        const std::tr1::uint32_t t = vTriangleScratch[i];
+        const boost::array<cl_uint, 3> &tri = mesh.triangles[t];
+        if (tri[0] != u && tri[1] != u && tri[2] != u)
+            vTriangles.push_back(t);
+    }
+    for (std::size_t i = 0; i < uTriangles.size(); i++)
+    {
+        const std::tr1::uint32_t t = uTriangles[i];
+        boost::array<cl_uint, 3> &tri = mesh.triangles[t];
+        if (tri[0] == v || tri[1] == v || tri[2] == v)
+            tDead[t] = 1;
+        else
+        {
+            for (unsigned int k = 0; k < 3; k++)
+                if (tri[k] == u)
+                    tri[k] = v;
+            vTriangles.push_back(t);
+        }
+    }
+    vStart[v] = start;
+    vEnd[v] = vTriangles.size();
+    quadrics[v] += quadrics[u];
+    vState[u] = VERTEX_REMOVED;
+
+    // The costs of all collapses involving v have changed
+    gatherTriangles(mesh, v, vTriangleScratch);
+    gatherNeighbours(mesh, v, vTriangleScratch, vNeighbours);
+    for (std::size_t i = 0; i < vNeighbours.size(); i++)
+    {
+        const std::tr1::uint32_t w = vNeighbours[i];
+        if (vState[w] == VERTEX_FREE)
+            pushCandidate(mesh, w, v, maxCost);
+        if (vState[v] == VERTEX_FREE)
+            pushCandidate(mesh, v, w, maxCost);
+    }
+}
+
+void Decimator::compact(HostKeyMesh &mesh)
+{
+    const std::size_t numVertices = mesh.numVertices();
+    const std::size_t numInternal = mesh.numInternalVertices();
+
+    remap.reserve(numVertices, false);
+    std::tr1::uint32_t next = 0;
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        if (vState[i] == VERTEX_REMOVED)
+            remap[i] = badIndex;
+        else
+        {
+            // Order is preserved, so it is safe to move the data down in place
+            remap[i] = next;
+            mesh.vertices[next] = mesh.vertices[i];
+            if (mesh.normals != NULL)
+                mesh.normals[next] = mesh.normals[i];
+            next++;
+        }
+    }
+    const std::size_t newInternal = numInternal - (numVertices - next);
+
+    std::size_t numTriangles = 0;
+    for (std::size_t i = 0; i < mesh.numTriangles(); i++)
+    {
+        if (!tDead[i])
+        {
+            boost::array<cl_uint, 3> &t = mesh.triangles[numTriangles++];
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                t[k] = remap[mesh.triangles[i][k]];
+                assert(t[k] != badIndex);
+            }
+        }
+    }
+    mesh.assign(next, numTriangles, newInternal);
+}
+
+void Decimator::operator()(HostKeyMesh &mesh, double maxError)
+{
+    const std::size_t numVertices = mesh.numVertices();
+    const std::size_t numInternal = mesh.numInternalVertices();
+    const std::size_t numTriangles = mesh.numTriangles();
+    if (maxError <= 0.0 || numInternal == 0 || numTriangles == 0)
+        return;
+
+    Statistics::Timer timer("mesher.decimate.time");
+    const double maxCost = maxError * maxError;
+
+    quadrics.reserve(numVertices, false);
+    vState.reserve(numVertices, false);
+    vStart.reserve(numVertices, false);
+    vEnd.reserve(numVertices, false);
+    tDead.reserve(numTriangles, false);
+
+    // Build the vertex-to-triangle lists, using vEnd as counters
+    std::fill(vEnd.data(), vEnd.data() + numVertices, 0);
+    for (std::size_t i = 0; i < numTriangles; i++)
+        for (unsigned int k = 0; k < 3; k++)
+            vEnd[mesh.triangles[i][k]]++;
+    std::tr1::uint32_t pos = 0;
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        vStart[i] = pos;
+        pos += vEnd[i];
+        vEnd[i] = vStart[i];
+    }
+    vTriangles.clear();
+    vTriangles.resize(3 * numTriangles);
+    for (std::size_t i = 0; i < numTriangles; i++)
+        for (unsigned int k = 0; k < 3; k++)
+            vTriangles[vEnd[mesh.triangles[i][k]]++] = i;
+
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        quadrics[i].clear();
+        vState[i] = i < numInternal ? VERTEX_FREE : VERTEX_LOCKED;
+    }
+    std::fill(tDead.data(), tDead.data() + numTriangles, 0);
+
+    // Accumulate the plane of each triangle into its vertices
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        const boost::array<cl_uint, 3> &t = mesh.triangles[i];
+        double n[3];
+        triangleNormal(mesh.vertices[t[0]], mesh.vertices[t[1]], mesh.vertices[t[2]], n);
+        const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len > 0.0)
+        {
+            for (unsigned int j = 0; j < 3; j++)
+                n[j] /= len;
+            const double d = -(n[0] * mesh.vertices[t[0]][0]
+                               + n[1] * mesh.vertices[t[0]][1]
+                               + n[2] * mesh.vertices[t[0]][2]);
+            for (unsigned int k = 0; k < 3; k++)
+                quadrics[t[k]].addPlane(n, d);
+        }
+    }
+
+    /* Lock internal vertices on the boundary of the mesh (or where it is
+     * non-manifold): every edge out of a free vertex must be shared by
+     * exactly two triangles.
+     */
+    for (std::size_t i = 0; i < numInternal; i++)
+    {
+        gatherTriangles(mesh, i, uTriangles);
+        uNeighbours.clear();
+        for (std::size_t j = 0; j < uTriangles.size(); j++)
+            for (unsigned int k = 0; k < 3; k++)
+                if (mesh.triangles[uTriangles[j]][k] != i)
+                    uNeighbours.push_back(mesh.triangles[uTriangles[j]][k]);
+        std::sort(uNeighbours.begin(), uNeighbours.end());
+        bool manifold = !uNeighbours.empty() && uNeighbours.size() % 2 == 0;
+        for (std::size_t j = 0; j < uNeighbours.size() && manifold; j += 2)
+            if (uNeighbours[j] != uNeighbours[j + 1]
+                || (j + 2 < uNeighbours.size() && uNeighbours[j + 2] == uNeighbours[j]))
+                manifold = false;
+        if (!manifold)
+            vState[i] = VERTEX_LOCKED;
+    }
+
+    heap.clear();
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        const boost::array<cl_uint, 3> &t = mesh.triangles[i];
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            const std::tr1::uint32_t a = t[k], b = t[(k + 1) % 3];
+            if (vState[a] == VERTEX_FREE)
+                pushCandidate(mesh, a, b, maxCost);
+            if (vState[b] == VERTEX_FREE)
+                pushCandidate(mesh, b, a, maxCost);
+        }
+    }
+
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end());
+        const Candidate c = heap.back();
+        heap.pop_back();
+
+        const double cost = checkCollapse(mesh, c.u, c.v);
+        if (cost < 0.0)
+            continue;
+        /* Costs only ever increase as quadrics are merged, so if the
+         * candidate is stale it is requeued with its true cost.
+         */
+        if (cost > c.cost * (1.0 + 1e-9) + 1e-30)
+        {
+            if (cost <= maxCost)
+            {
+                Candidate d = c;
+                d.cost = cost;
+                heap.push_back(d);
+                std::push_heap(heap.begin(), heap.end());
+            }
+            continue;
+        }
+        collapse(mesh, c.u, c.v, maxCost);
+    }
+
+    const std::size_t oldTriangles = mesh.numTriangles();
+    compact(mesh);
+    Statistics::getStatistic<Statistics::Counter>("mesher.decimate.triangles.removed")
+        .add(oldTriangles - mesh.numTriangles());
+}
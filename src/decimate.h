@@ -0,0 +1,158 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Simplification of host meshes by quadric-error edge collapses.
+ */
+
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "allocator.h"
+#include "mesh.h"
+
+/**
+ * Simplifies a mesh in place using the quadric error metric of Garland and
+ * Heckbert. Each step collapses an internal vertex onto one of its
+ * neighbours, so no new vertex positions are created and any per-vertex
+ * attributes (such as normals) remain valid. A collapse is only made if the
+ * sum of squared distances from the surviving vertex to the planes of the
+ * triangles that have been merged into it is within a bound.
+ *
+ * External vertices are never moved or removed, and neither are internal
+ * vertices on the boundary of the mesh, so that the result still stitches
+ * with neighbouring blocks. Collapses that would make the mesh
+ * non-manifold or fold a triangle over are rejected, as are collapses that
+ * would leave a vertex with more than @ref maxValence neighbours. The
+ * latter keeps long thin triangles out of flat regions and bounds the
+ * work per collapse.
+ *
+ * An instance holds working memory that is reused between calls. It is not
+ * thread-safe.
+ */
+class Decimator : public boost::noncopyable
+{
+public:
+    /// Maximum number of neighbours a vertex may have after a collapse
+    static const unsigned int maxValence = 16;
+
+    Decimator();
+
+    /**
+     * Simplify a mesh in place. The internal vertices and the triangles are
+     * compacted, and the sizes of @a mesh are updated to match. The external
+     * vertices are moved down (together with their normals, if any) but
+     * keep their relative order, so the vertex keys remain valid.
+     *
+     * @param mesh        Mesh to simplify
+     * @param maxError    Bound on the error of each surviving vertex, as a distance
+     */
+    void operator()(HostKeyMesh &mesh, double maxError);
+
+private:
+    /// Symmetric 4x4 matrix measuring squared distance to a set of planes
+    struct Quadric
+    {
+        /// Upper triangle, in the order xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+        double a[10];
+
+        void clear();
+        void addPlane(const double n[3], double d);
+        void operator+=(const Quadric &q);
+        /// Evaluate at the point (x, y, z, 1)
+        double evaluate(const boost::array<cl_float, 3> &p) const;
+    };
+
+    /// A proposed collapse of vertex @a u onto vertex @a v
+    struct Candidate
+    {
+        double cost;
+        std::tr1::uint32_t u, v;
+
+        /// Ordering that makes @c std::push_heap produce a min-heap
+        bool operator<(const Candidate &b) const { return cost > b.cost; }
+    };
+
+    /// State of each vertex
+    enum
+    {
+        VERTEX_FREE,       ///< May be collapsed onto a neighbour
+        VERTEX_LOCKED,     ///< Must keep its position, but other vertices may be collapsed onto it
+        VERTEX_REMOVED     ///< Already collapsed
+    };
+
+    /// Collect the live triangles incident on @a v into @a out
+    void gatherTriangles(const HostKeyMesh &mesh, std::tr1::uint32_t v, std::vector<std::tr1::uint32_t> &out) const;
+
+    /**
+     * Collect the distinct vertices that share a live triangle with @a v
+     * into @a out. @a tris must hold the result of @ref gatherTriangles.
+     */
+    static void gatherNeighbours(
+        const HostKeyMesh &mesh, std::tr1::uint32_t v,
+        const std::vector<std::tr1::uint32_t> &tris, std::vector<std::tr1::uint32_t> &out);
+
+    /// Add a candidate to @ref heap if it is within @a maxCost
+    void pushCandidate(const HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v, double maxCost);
+
+    /**
+     * Check whether collapsing @a u onto @a v is legal, and if so return its
+     * cost. Returns a negative value if it is not legal. On success, @ref
+     * uTriangles holds the live triangles incident on @a u.
+     */
+    double checkCollapse(const HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v);
+
+    /// Collapse @a u onto @a v, after a successful @ref checkCollapse
+    void collapse(HostKeyMesh &mesh, std::tr1::uint32_t u, std::tr1::uint32_t v, double maxCost);
+
+    /// Remove the dead vertices and triangles from @a mesh
+    void compact(HostKeyMesh &mesh);
+
+    Statistics::Container::PODBuffer<Quadric> quadrics;          ///< Quadric for each vertex
+    Statistics::Container::PODBuffer<std::tr1::uint8_t> vState;  ///< State of each vertex
+    /// Start of each vertex's triangle list in @ref vTriangles
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vStart;
+    /// End of each vertex's triangle list in @ref vTriangles
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vEnd;
+    /**
+     * Triangle lists, which may include dead triangles. When a vertex gains
+     * triangles from a collapse, its new list is appended rather than
+     * updated in place, which the valence limit keeps cheap.
+     */
+    Statistics::Container::vector<std::tr1::uint32_t> vTriangles;
+    Statistics::Container::PODBuffer<std::tr1::uint8_t> tDead;   ///< Nonzero for removed triangles
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> remap;  ///< New index for each vertex during compaction
+    std::vector<Candidate> heap;                                 ///< Pending collapses
+
+    /// Scratch space for @ref checkCollapse and @ref collapse
+    std::vector<std::tr1::uint32_t> uTriangles, vTriangleScratch, uNeighbours, vNeighbours;
+};
+
+#endif /* !DECIMATE_H */
@@ -0,0 +1,92 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Implementation of @ref DeviceArena.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "device_arena.h"
+#include "circular_buffer.h"
+#include "errors.h"
+#include "misc.h"
+
+std::size_t DeviceArena::getAlignment(const cl::Device &device)
+{
+    // CL_DEVICE_MEM_BASE_ADDR_ALIGN is in bits
+    std::size_t align = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8;
+    return std::max(align, std::size_t(1));
+}
+
+DeviceArena::DeviceArena(
+    const std::string &name,
+    const cl::Context &context, const cl::Device &device,
+    std::size_t bytes)
+    : CircularBufferBase(name, bytes / getAlignment(device)),
+    alignment(getAlignment(device))
+{
+    buffer = cl::Buffer(context, CL_MEM_READ_WRITE, CircularBufferBase::size() * alignment);
+}
+
+DeviceArena::Allocation DeviceArena::allocate(
+    Timeplot::Worker &tworker, std::size_t bytes,
+    Statistics::Variable *stat)
+{
+    MLSGPU_ASSERT(bytes > 0, std::invalid_argument);
+    MLSGPU_ASSERT(bytes <= size(), std::out_of_range);
+
+    Allocation ans;
+    const std::size_t n = divUp(bytes, alignment);
+    ans.base = CircularBufferBase::allocate(tworker, n, stat);
+    ans.offset = ans.base.get() * alignment;
+    ans.bytes = n * alignment;
+    return ans;
+}
+
+cl::Buffer DeviceArena::subBuffer(const Allocation &alloc, std::size_t offset, std::size_t bytes)
+{
+    MLSGPU_ASSERT(offset % alignment == 0, std::invalid_argument);
+    MLSGPU_ASSERT(bytes > 0 && offset <= alloc.bytes && bytes <= alloc.bytes - offset, std::out_of_range);
+
+    cl_buffer_region region;
+    region.origin = alloc.offset + offset;
+    region.size = bytes;
+    return buffer.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+}
+
+void DeviceArena::free(const Allocation &alloc)
+{
+    CircularBufferBase::free(alloc.base);
+}
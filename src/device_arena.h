@@ -0,0 +1,143 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Thread-safe sub-allocation of device memory from a single buffer.
+ */
+
+#ifndef DEVICE_ARENA_H
+#define DEVICE_ARENA_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <string>
+#include "circular_buffer.h"
+#include "statistics.h"
+#include "timeplot.h"
+
+/**
+ * Device buffer from which variable-sized regions are handed out as
+ * sub-buffers. It uses the same allocation strategy as
+ * @ref CircularBuffer, so allocations block until space is available, and
+ * should be freed roughly in the order they were made.
+ *
+ * This allows several workers on a device to share memory for data whose
+ * size depends on the bucket being processed, rather than each allocating
+ * for the worst case. It is currently used only for the octree scratch
+ * buffers (see @ref SplatTreeCL), and only when @c --mem-octree is given.
+ * The arena has a fixed size and does not grow.
+ */
+class DeviceArena : protected CircularBufferBase
+{
+public:
+    enum
+    {
+        /**
+         * Upper bound on the alignment (in bytes) that is assumed when
+         * estimating memory requirements without a specific device.
+         */
+        MAX_ALIGNMENT = 4096
+    };
+
+    /**
+     * Information about an allocation from @ref allocate.
+     */
+    class Allocation
+    {
+        friend class DeviceArena;
+    private:
+        CircularBufferBase::Allocation base;
+        std::size_t offset;       ///< Start of the allocation in bytes
+        std::size_t bytes;        ///< Size of the allocation in bytes
+
+    public:
+        /// Creates an invalid allocation
+        Allocation() : offset(0), bytes(0) {}
+        /// Size of the allocation in bytes (rounded up to the alignment)
+        std::size_t size() const { return bytes; }
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param name      Name used for memory statistics.
+     * @param context   Context in which to allocate the buffer.
+     * @param device    Device whose alignment requirements are used.
+     * @param bytes     Size of the arena (rounded down to the alignment).
+     *
+     * @pre @a bytes is at least the alignment for @a device.
+     */
+    DeviceArena(const std::string &name,
+                const cl::Context &context, const cl::Device &device,
+                std::size_t bytes);
+
+    /// Alignment (in bytes) required for sub-buffers on @a device.
+    static std::size_t getAlignment(const cl::Device &device);
+
+    /// Alignment (in bytes) of allocations from this arena.
+    std::size_t getAlignment() const { return alignment; }
+
+    /// Size of the arena in bytes.
+    std::size_t size() const { return CircularBufferBase::size() * alignment; }
+
+    /**
+     * Allocate a region. If the space is not yet available, this will block
+     * until it is.
+     *
+     * @param tworker    Worker to which waiting time is accounted.
+     * @param bytes      Number of bytes required.
+     * @param stat       Statistic to which the waiting time will be recorded (may be @c NULL).
+     *
+     * @pre 0 &lt; @a bytes &lt;= @ref size().
+     */
+    Allocation allocate(Timeplot::Worker &tworker, std::size_t bytes,
+                        Statistics::Variable *stat = NULL);
+
+    /**
+     * Create a buffer covering part of an allocation.
+     *
+     * @param alloc      Allocation returned by @ref allocate.
+     * @param offset     Start of the region within @a alloc, in bytes.
+     * @param bytes      Size of the region.
+     *
+     * @pre
+     * - @a offset is a multiple of @ref getAlignment().
+     * - The region lies within @a alloc and is non-empty.
+     */
+    cl::Buffer subBuffer(const Allocation &alloc, std::size_t offset, std::size_t bytes);
+
+    /**
+     * Free an allocation. Any sub-buffers must no longer be in use on the device.
+     */
+    void free(const Allocation &alloc);
+
+private:
+    std::size_t alignment;   ///< Bytes per element of the underlying circular buffer
+    cl::Buffer buffer;       ///< Backing store
+};
+
+#endif /* !DEVICE_ARENA_H */
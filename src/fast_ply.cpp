@@ -414,11 +414,18 @@ void Writer::setNumTriangles(size_type numTriangles)
     this->numTriangles = numTriangles;
 }
 
+void Writer::setNormals(bool normals)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    this->normals = normals;
+}
+
 Writer::Writer(WriterType writerType) :
     writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeVertices.time")),
     writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeTriangles.time")),
     handleFactory(InternalFactory(writerType)),
-    comments(), numVertices(0), numTriangles(0)
+    comments(), numVertices(0), numTriangles(0), unsized(false),
+    mappable(writerType == MMAP_WRITER), normals(false)
 {
 }
 
@@ -426,7 +433,8 @@ Writer::Writer(boost::function<boost::shared_ptr<BinaryWriter>()> handleFactory)
     writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeVertices.time")),
     writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeTriangles.time")),
     handleFactory(handleFactory),
-    comments(), numVertices(0), numTriangles(0)
+    comments(), numVertices(0), numTriangles(0), unsized(false),
+    mappable(false), normals(false)
 {
 }
 
@@ -440,7 +448,7 @@ Writer::size_type Writer::getNumTriangles() const
     return numTriangles;
 }
 
-std::string Writer::makeHeader()
+std::string Writer::makeHeader(std::size_t minSize)
 {
     std::ostringstream out;
     out.imbue(std::locale::classic());
@@ -461,8 +469,12 @@ std::string Writer::makeHeader()
     out << "element vertex " << numVertices << '\n'
         << "property float32 x\n"
         << "property float32 y\n"
-        << "property float32 z\n"
-        << "element face " << numTriangles << '\n'
+        << "property float32 z\n";
+    if (normals)
+        out << "property float32 nx\n"
+            << "property float32 ny\n"
+            << "property float32 nz\n";
+    out << "element face " << numTriangles << '\n'
         << "property list uint8 uint32 vertex_indices\n"
         << "comment padding:";
     /* Use a comment to pad the header to a multiple of 4 bytes, so that the
@@ -470,7 +482,7 @@ std::string Writer::makeHeader()
      */
 
     std::size_t size = (int) out.tellp() + 12; /* 12 for \nend_header\n */
-    while (size % 4 != 0)
+    while (size % 4 != 0 || size < minSize)
     {
         out << 'X';
         size++;
@@ -487,15 +499,47 @@ void Writer::open(const std::string &filename)
     handle->open(filename);
 
     std::string header = makeHeader();
-    handle->resize(header.size() + getNumVertices() * vertexSize + getNumTriangles() * triangleSize);
+    handle->resize(header.size() + getNumVertices() * getVertexSize() + getNumTriangles() * triangleSize);
     handle->write(header.data(), header.size(), 0);
     vertexStart = header.size();
-    triangleStart = vertexStart + getNumVertices() * vertexSize;
+    triangleStart = vertexStart + getNumVertices() * getVertexSize();
+}
+
+void Writer::openUnsized(const std::string &filename)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    handle = handleFactory();
+    handle->open(filename);
+
+    /* Reserve space for the longest possible header. Until the counts are
+     * known, any number of vertices may be written but no triangles.
+     */
+    numVertices = std::numeric_limits<size_type>::max();
+    numTriangles = std::numeric_limits<size_type>::max();
+    vertexStart = makeHeader().size();
+    numTriangles = 0;
+    triangleStart = vertexStart;
+    unsized = true;
+}
+
+void Writer::setFinalCounts(size_type numVertices, size_type numTriangles)
+{
+    MLSGPU_ASSERT(isOpen() && unsized, state_error);
+    this->numVertices = numVertices;
+    this->numTriangles = numTriangles;
+    unsized = false;
+
+    std::string header = makeHeader(vertexStart);
+    assert(header.size() == vertexStart);
+    triangleStart = vertexStart + numVertices * getVertexSize();
+    handle->resize(triangleStart + numTriangles * triangleSize);
+    handle->write(header.data(), header.size(), 0);
 }
 
 void Writer::close()
 {
     MLSGPU_ASSERT(isOpen(), state_error);
+    unsized = false;
     // Note: the handle is not closed, because it may still be accessed by an AsyncWriter
     handle.reset();
 }
@@ -505,7 +549,7 @@ void Writer::writeVertices(size_type first, size_type count, const float *data)
     MLSGPU_ASSERT(isOpen(), state_error);
     MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
     Statistics::Timer timer(writeVerticesTime);
-    handle->write(data, count * vertexSize, vertexStart + first * vertexSize);
+    handle->write(data, count * getVertexSize(), vertexStart + first * getVertexSize());
 }
 
 void Writer::writeVertices(
@@ -516,7 +560,7 @@ void Writer::writeVertices(
 {
     MLSGPU_ASSERT(isOpen(), state_error);
     MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
-    async.push(tworker, data, handle, count * vertexSize, vertexStart + first * vertexSize);
+    async.push(tworker, data, handle, count * getVertexSize(), vertexStart + first * getVertexSize());
 }
 
 void Writer::writeTrianglesRaw(size_type first, size_type count, const std::tr1::uint8_t *data)
@@ -538,6 +582,20 @@ void Writer::writeTrianglesRaw(
     async.push(tworker, data, handle, count * triangleSize, triangleStart + first * triangleSize);
 }
 
+BinaryWriter::Mapping *Writer::mapVertices(size_type first, size_type count)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
+    return handle->map(vertexStart + first * getVertexSize(), count * getVertexSize());
+}
+
+BinaryWriter::Mapping *Writer::mapTriangles(size_type first, size_type count)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(first + count <= getNumTriangles() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
+    return handle->map(triangleStart + first * triangleSize, count * triangleSize);
+}
+
 void Writer::writeTriangles(size_type first, size_type count, const std::tr1::uint32_t *data)
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -242,7 +242,8 @@ private:
  * PLY file writer that only supports one format.
  * The supported format has:
  *  - Binary format with host endianness;
- *  - Vertices with x, y, z as 32-bit floats (no normals);
+ *  - Vertices with x, y, z as 32-bit floats, optionally followed by
+ *    nx, ny, nz as 32-bit floats (see @ref setNormals);
  *  - Faces with 32-bit unsigned integer indices;
  *  - 3 indices per face;
  *  - Arbitrary user-provided comments.
@@ -290,12 +291,51 @@ public:
      */
     void setNumTriangles(size_type numTriangles);
 
+    /**
+     * Set whether each vertex is followed by a normal. This changes the
+     * layout of the data passed to @ref writeVertices. It defaults to false.
+     * @pre @ref open has not yet been successfully called.
+     */
+    void setNormals(bool normals);
+
+    /// Whether vertices carry normals (see @ref setNormals)
+    bool hasNormals() const { return normals; }
+
+    /**
+     * Bytes per vertex in the file, which is @ref vertexSize, or twice that
+     * if there are normals.
+     */
+    size_type getVertexSize() const { return normals ? 2 * vertexSize : vertexSize; }
+
     /**
      * Create the file and write the header.
      * @pre @ref open has not yet been successfully called.
      */
     void open(const std::string &filename);
 
+    /**
+     * Create the file without yet knowing how many vertices and triangles
+     * it will hold. Space is reserved for a header large enough for any
+     * counts, after which vertices may be written with @ref writeVertices
+     * without an upper bound. Triangles may only be written once the counts
+     * have been fixed with @ref setFinalCounts.
+     *
+     * The values set with @ref setNumVertices and @ref setNumTriangles are
+     * ignored.
+     *
+     * @pre @ref open has not yet been successfully called.
+     */
+    void openUnsized(const std::string &filename);
+
+    /**
+     * Fix the number of vertices and triangles for a file opened with @ref
+     * openUnsized, and write the final header. The header is padded to the
+     * size that was reserved, so vertices already written do not move.
+     *
+     * @pre The file was opened with @ref openUnsized and this has not yet been called.
+     */
+    void setFinalCounts(size_type numVertices, size_type numTriangles);
+
     /**
      * Prepare to write another file. This will usually cause the old file
      * to be closed, but if it has been used with the asynchronous write
@@ -307,7 +347,9 @@ public:
      * Write a range of vertices.
      * @param first          Index of first vertex to write.
      * @param count          Number of vertices to write.
-     * @param data           Array of <code>float[3]</code> values.
+     * @param data           Array of <code>float[3]</code> values, or
+     *                       <code>float[6]</code> values (position then normal)
+     *                       if @ref hasNormals.
      * @pre @a first + @a count <= @a numVertices.
      */
     void writeVertices(size_type first, size_type count, const float *data);
@@ -318,7 +360,7 @@ public:
      * @param tworker        Worker for accounting the time (possibly unused?)
      * @param first          Index of first vertex to write.
      * @param count          Number of vertices to write.
-     * @param data           Array of <code>float[3]</code> values.
+     * @param data           Vertices, laid out as for the synchronous version.
      * @param async          Asynchronous writer that will do the writing.
      * @pre @a first + @a count <= @a numVertices.
      */
@@ -366,10 +408,38 @@ public:
         const boost::shared_ptr<AsyncWriterItem> &data,
         AsyncWriter &async);
 
+    /**
+     * Obtain direct access to the storage for a range of vertices in the
+     * file, using @ref BinaryWriter::map. The vertices must be stored as
+     * for @ref writeVertices. This is only supported for some writer types
+     * (such as @ref MMAP_WRITER); for others, it returns @c NULL.
+     *
+     * @param first          Index of first vertex to map.
+     * @param count          Number of vertices to map.
+     * @pre @a first + @a count <= @a numVertices, and @a count &gt; 0.
+     */
+    BinaryWriter::Mapping *mapVertices(size_type first, size_type count);
+
+    /**
+     * Obtain direct access to the storage for a range of triangles, which
+     * must be stored in the same form as for @ref writeTrianglesRaw. This
+     * is otherwise similar to @ref mapVertices.
+     *
+     * @pre @a first + @a count <= @a numTriangles, and @a count &gt; 0.
+     */
+    BinaryWriter::Mapping *mapTriangles(size_type first, size_type count);
+
     size_type getNumVertices() const;  ///< Return the number of vertices
     size_type getNumTriangles() const; ///< Return the number of triangles
 
-    /// Bytes per vertex
+    /**
+     * Whether @ref mapVertices and @ref mapTriangles are supported. This is
+     * only known for writers constructed from a @ref WriterType, and is
+     * false otherwise.
+     */
+    bool canMap() const { return mappable; }
+
+    /// Bytes per vertex position
     static const size_type vertexSize = 3 * sizeof(float);
     /// Bytes per triangle
     static const size_type triangleSize = 1 + 3 * sizeof(std::tr1::uint32_t);
@@ -407,6 +477,9 @@ private:
     std::vector<std::string> comments;
     size_type numVertices;              ///< Number of vertices (defaults to zero)
     size_type numTriangles;             ///< Number of triangles (defaults to zero)
+    bool unsized;                       ///< Set between @ref openUnsized and @ref setFinalCounts
+    bool mappable;                      ///< Value returned by @ref canMap
+    bool normals;                       ///< Value returned by @ref hasNormals
 
 protected:
     /// File handle (non-NULL if the file is open)
@@ -415,8 +488,11 @@ protected:
     BinaryWriter::offset_type vertexStart;   ///< Offset in file to start of vertices
     BinaryWriter::offset_type triangleStart; ///< Offset in file to start of triangles
 
-    /// Returns the header based on stored values
-    std::string makeHeader();
+    /**
+     * Returns the header based on stored values. It is padded to a multiple
+     * of 4 bytes, and to at least @a minSize bytes.
+     */
+    std::string makeHeader(std::size_t minSize = 0);
 };
 
 
@@ -71,11 +71,11 @@ void WriterMPI::open(const std::string &filename, MPI_Comm comm, int root)
 
     handle = boost::make_shared<BinaryWriterMPI>(comm);
     handle->open(filename);
-    handle->resize(sizes[0] + getNumVertices() * vertexSize + getNumTriangles() * triangleSize);
+    handle->resize(sizes[0] + getNumVertices() * getVertexSize() + getNumTriangles() * triangleSize);
     if (rank == root)
         handle->write(header.data(), header.size(), 0);
     vertexStart = sizes[0];
-    triangleStart = vertexStart + getNumVertices() * vertexSize;
+    triangleStart = vertexStart + getNumVertices() * getVertexSize();
 }
 
 } // namespace FastPly
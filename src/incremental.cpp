@@ -0,0 +1,373 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Incremental reconstruction.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <cerrno>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/exception/all.hpp>
+#include "tr1_cstdint.h"
+#include "incremental.h"
+#include "grid.h"
+#include "misc.h"
+#include "logging.h"
+#include "errors.h"
+
+namespace Incremental
+{
+
+/// First line of a manifest file, which also identifies the format version
+static const char * const manifestHeader = "mlsgpu-incremental 1";
+
+FileInfo::FileInfo(const boost::filesystem::path &path)
+    : path(boost::filesystem::absolute(path).string()),
+    size(boost::filesystem::file_size(path)),
+    mtime(boost::filesystem::last_write_time(path))
+{
+}
+
+bool FileInfo::operator==(const FileInfo &other) const
+{
+    return path == other.path && size == other.size && mtime == other.mtime;
+}
+
+Manifest::Manifest() : chunkCells(0)
+{
+    for (unsigned int i = 0; i < 3; i++)
+        origin[i] = 0;
+}
+
+bool Manifest::read(std::istream &in)
+{
+    *this = Manifest();
+
+    std::string line, keyword;
+    std::size_t numFiles, numChunks;
+    bool good = std::getline(in, line) && line == manifestHeader;
+    good = good && (in >> keyword) && keyword == "options" && in.get() == ' '
+        && std::getline(in, options);
+    good = good && (in >> keyword >> chunkCells) && keyword == "chunk-cells";
+    good = good && (in >> keyword >> origin[0] >> origin[1] >> origin[2]) && keyword == "origin";
+    good = good && (in >> keyword >> numFiles) && keyword == "files" && std::getline(in, line);
+    for (std::size_t i = 0; good && i < numFiles; i++)
+    {
+        FileInfo info;
+        good = !std::getline(in, line).fail();
+        std::istringstream fields(line);
+        good = good && (fields >> info.size >> info.mtime) && fields.get() == ' '
+            && std::getline(fields, info.path);
+        files.push_back(info);
+    }
+    good = good && (in >> keyword >> numChunks) && keyword == "chunks";
+    for (std::size_t i = 0; good && i < numChunks; i++)
+    {
+        ChunkCoords coords;
+        ChunkInfo info;
+        std::size_t numChunkFiles;
+        good = !(in >> coords[0] >> coords[1] >> coords[2] >> info.hasOutput >> numChunkFiles).fail();
+        for (std::size_t j = 0; good && j < numChunkFiles; j++)
+        {
+            std::size_t index;
+            good = (in >> index) && index < files.size()
+                && (info.files.empty() || info.files.back() < index);
+            info.files.push_back(index);
+        }
+        chunks[coords] = info;
+    }
+
+    if (!good)
+        *this = Manifest();
+    return good;
+}
+
+void Manifest::write(std::ostream &out) const
+{
+    out << manifestHeader << '\n';
+    out << "options " << options << '\n';
+    out << "chunk-cells " << chunkCells << '\n';
+    out << "origin " << origin[0] << ' ' << origin[1] << ' ' << origin[2] << '\n';
+    out << "files " << files.size() << '\n';
+    for (std::size_t i = 0; i < files.size(); i++)
+        out << files[i].size << ' ' << files[i].mtime << ' ' << files[i].path << '\n';
+    out << "chunks " << chunks.size() << '\n';
+    for (std::map<ChunkCoords, ChunkInfo>::const_iterator i = chunks.begin(); i != chunks.end(); ++i)
+    {
+        const ChunkInfo &info = i->second;
+        out << i->first[0] << ' ' << i->first[1] << ' ' << i->first[2] << ' '
+            << info.hasOutput << ' ' << info.files.size();
+        for (std::size_t j = 0; j < info.files.size(); j++)
+            out << ' ' << info.files[j];
+        out << '\n';
+    }
+}
+
+void Manifest::load(const boost::filesystem::path &path)
+{
+    *this = Manifest();
+    boost::filesystem::ifstream in(path);
+    if (!in)
+        return;
+    if (!read(in))
+        Log::log[Log::warn] << "Warning: ignoring malformed manifest " << path.string() << '\n';
+}
+
+void Manifest::save(const boost::filesystem::path &path) const
+{
+    try
+    {
+        boost::filesystem::ofstream out;
+        out.exceptions(std::ios::failbit | std::ios::badbit);
+        out.open(path);
+        write(out);
+        out.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(errno);
+    }
+}
+
+Grid::size_type alignGrid(Grid &grid, Grid::size_type chunkCells,
+                          Grid::size_type microCells, Grid::size_type maxCells,
+                          std::size_t maxSplit)
+{
+    MLSGPU_ASSERT(chunkCells > 0 && microCells > 0 && microCells <= maxCells, std::invalid_argument);
+
+    /* Apply the same rounding as Bucket::bucket until it has no further
+     * effect, so that it will use the result unchanged.
+     */
+    Grid::size_type cells = chunkCells;
+    while (true)
+    {
+        Grid::size_type rounded;
+        if (cells > maxCells)
+        {
+            const Grid::size_type grain = maxCells / microCells * microCells;
+            rounded = roundUp(cells, grain);
+        }
+        else
+            rounded = roundUp(cells, microCells);
+        if (rounded == cells)
+            break;
+        cells = rounded;
+    }
+
+    std::size_t microBlocks = 1;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const Grid::extent_type &e = grid.getExtent(i);
+        const Grid::difference_type lo = divDown(e.first, cells) * Grid::difference_type(cells);
+        const Grid::difference_type hi = lo + roundUp(Grid::size_type(e.second - lo), cells);
+        grid.setExtent(i, lo, hi);
+        microBlocks = mulSat(microBlocks, std::size_t(divUp(grid.numCells(i), microCells)));
+    }
+    if (microBlocks > maxSplit)
+        throw std::runtime_error("The bounding box is too big for incremental reconstruction.\n"
+                                 "Try increasing --max-split.");
+    return cells;
+}
+
+Tracker::Tracker(const Manifest &previous, const Manifest &current, const Namer &namer)
+    : previous(previous), current(current), namer(namer)
+{
+    this->current.chunks.clear();
+    compatible = previous.chunkCells != 0
+        && previous.chunkCells == current.chunkCells
+        && previous.options == current.options;
+
+    std::map<std::string, std::size_t> previousFiles;
+    for (std::size_t i = 0; i < previous.files.size(); i++)
+        previousFiles[previous.files[i].path] = i;
+    previousIndex.resize(current.files.size(), std::size_t(-1));
+    for (std::size_t i = 0; i < current.files.size(); i++)
+    {
+        std::map<std::string, std::size_t>::const_iterator pos = previousFiles.find(current.files[i].path);
+        if (pos != previousFiles.end() && previous.files[pos->second] == current.files[i])
+            previousIndex[i] = pos->second;
+    }
+}
+
+std::string Tracker::previousName(const ChunkCoords &coords) const
+{
+    ChunkId id;
+    for (unsigned int i = 0; i < 3; i++)
+        id.coords[i] = coords[i] - previous.origin[i];
+    return namer(id);
+}
+
+std::string Tracker::currentName(const ChunkCoords &coords) const
+{
+    ChunkId id;
+    for (unsigned int i = 0; i < 3; i++)
+        id.coords[i] = coords[i] - current.origin[i];
+    return namer(id);
+}
+
+bool Tracker::update(const boost::array<Grid::size_type, 3> &chunk, const std::vector<std::size_t> &files)
+{
+    ChunkCoords coords;
+    for (unsigned int i = 0; i < 3; i++)
+        coords[i] = current.origin[i] + Grid::difference_type(chunk[i]);
+    ChunkInfo &info = current.chunks[coords];
+    info.files = files;
+
+    bool recompute = true;
+    std::map<ChunkCoords, ChunkInfo>::const_iterator pos = previous.chunks.find(coords);
+    if (compatible && pos != previous.chunks.end())
+    {
+        /* Translate the file indices to those of the previous run. New and
+         * changed files map to -1, which never matches.
+         */
+        std::vector<std::size_t> mapped;
+        mapped.reserve(files.size());
+        for (std::size_t i = 0; i < files.size(); i++)
+            mapped.push_back(previousIndex[files[i]]);
+        std::sort(mapped.begin(), mapped.end());
+        recompute = mapped != pos->second.files;
+        // The user may have deleted the output file
+        if (!recompute && pos->second.hasOutput
+            && !boost::filesystem::exists(previousName(coords)))
+            recompute = true;
+    }
+
+    if (recompute)
+        dirty.insert(coords);
+    else
+    {
+        dirty.erase(coords);
+        info.hasOutput = pos->second.hasOutput;
+    }
+    return recompute;
+}
+
+std::size_t Tracker::prepareOutputs()
+{
+    std::size_t kept = 0;
+    std::vector<std::pair<std::string, std::string> > moved;
+    for (std::map<ChunkCoords, ChunkInfo>::const_iterator i = previous.chunks.begin();
+         i != previous.chunks.end(); ++i)
+    {
+        if (!i->second.hasOutput)
+            continue;
+        const std::string oldName = previousName(i->first);
+        if (compatible && current.chunks.count(i->first) && !dirty.count(i->first))
+        {
+            kept++;
+            const std::string newName = currentName(i->first);
+            if (newName != oldName)
+            {
+                /* Move out of the way first, since the new name may belong
+                 * to another chunk that has not yet been processed.
+                 */
+                const std::string tmpName = oldName + ".tmp";
+                boost::filesystem::rename(oldName, tmpName);
+                moved.push_back(std::make_pair(tmpName, newName));
+            }
+        }
+        else
+            boost::filesystem::remove(oldName);
+    }
+    for (std::size_t i = 0; i < moved.size(); i++)
+        boost::filesystem::rename(moved[i].first, moved[i].second);
+    return kept;
+}
+
+void Tracker::recordOutputs()
+{
+    for (std::set<ChunkCoords>::const_iterator i = dirty.begin(); i != dirty.end(); ++i)
+    {
+        std::map<ChunkCoords, ChunkInfo>::iterator pos = current.chunks.find(*i);
+        if (pos != current.chunks.end())
+            pos->second.hasOutput = boost::filesystem::exists(currentName(*i));
+    }
+}
+
+Filter::Filter(Tracker &tracker, BucketCollector &collector)
+    : tracker(tracker), collector(collector)
+{
+    for (unsigned int i = 0; i < 3; i++)
+        curChunk[i] = 0;
+}
+
+void Filter::operator()(
+    const SplatSet::SubsetBase &splats,
+    const Grid &grid,
+    const Bucket::Recursion &recursionState)
+{
+    if (!pending.empty() && recursionState.chunk != curChunk)
+        flush();
+    curChunk = recursionState.chunk;
+
+    pending.push_back(Pending());
+    Pending &p = pending.back();
+    p.splats = splats;
+    p.grid = grid;
+    p.recursionState = recursionState;
+
+    const unsigned int shift = SplatSet::FileSet::scanIdShift;
+    for (SplatSet::SubsetBase::const_iterator i = splats.begin(); i != splats.end(); ++i)
+    {
+        const std::size_t first = i->first >> shift;
+        const std::size_t last = (i->second - 1) >> shift;
+        for (std::size_t f = first; f <= last; f++)
+            if (files.empty() || files.back() != f)
+                files.push_back(f);
+    }
+}
+
+void Filter::flush()
+{
+    if (pending.empty())
+        return;
+
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    if (tracker.update(curChunk, files))
+    {
+        for (std::size_t i = 0; i < pending.size(); i++)
+            collector(pending[i].splats, pending[i].grid, pending[i].recursionState);
+    }
+    pending.clear();
+    files.clear();
+}
+
+} // namespace Incremental
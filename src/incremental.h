@@ -0,0 +1,290 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Incremental reconstruction, in which only the output chunks whose input
+ * has changed since a previous run are recomputed.
+ */
+
+#ifndef MLSGPU_INCREMENTAL_H
+#define MLSGPU_INCREMENTAL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem/path.hpp>
+#include "tr1_cstdint.h"
+#include "grid.h"
+#include "chunk_id.h"
+#include "splat_set.h"
+#include "bucket.h"
+#include "bucket_collector.h"
+
+/**
+ * Support for re-running a split reconstruction after some input files have
+ * been added, removed or modified. A manifest records, for each output chunk,
+ * which input files contributed splats to it. On the next run, a chunk is
+ * only recomputed if that set of files differs or if any of the files in it
+ * have changed; the output files of the other chunks are kept.
+ *
+ * For this to work, chunks must cover the same region of space on every run.
+ * The chunk grid is thus anchored to the world origin (see @ref alignGrid),
+ * and the manifest stores chunk coordinates relative to the origin rather
+ * than to the bounding box. If the bounding box grows, the output files of
+ * unchanged chunks are renamed to match their new positions.
+ */
+namespace Incremental
+{
+
+/// Chunk coordinates relative to the world origin, in units of chunks
+typedef boost::array<Grid::difference_type, 3> ChunkCoords;
+
+/**
+ * Identification of an input file. A file is considered to have changed if
+ * either its size or its modification time differs.
+ */
+struct FileInfo
+{
+    std::string path;             ///< Absolute path to the file
+    std::tr1::uint64_t size;      ///< Size in bytes
+    std::tr1::int64_t mtime;      ///< Modification time, in seconds since the epoch
+
+    FileInfo() : size(0), mtime(0) {}
+
+    /**
+     * Construct from the file system.
+     *
+     * @throw boost::filesystem::filesystem_error if the file cannot be examined.
+     */
+    explicit FileInfo(const boost::filesystem::path &path);
+
+    bool operator==(const FileInfo &other) const;
+    bool operator!=(const FileInfo &other) const { return !(*this == other); }
+};
+
+/// Record of a single output chunk
+struct ChunkInfo
+{
+    /// Indices into @ref Manifest::files of the files that touch the chunk, in increasing order
+    std::vector<std::size_t> files;
+    /// Whether an output file was written for the chunk
+    bool hasOutput;
+
+    ChunkInfo() : hasOutput(false) {}
+};
+
+/**
+ * Persistent description of a previous run. The file is a plain text file.
+ */
+class Manifest
+{
+public:
+    /// Command-line options that affect the output (see @ref getIncrementalOptions)
+    std::string options;
+    /// Side length of a chunk, in grid cells (0 if there is no previous run)
+    Grid::size_type chunkCells;
+    /// Position of chunk (0, 0, 0) in the output file names
+    ChunkCoords origin;
+    /// Input files
+    std::vector<FileInfo> files;
+    /// Information about each non-empty chunk
+    std::map<ChunkCoords, ChunkInfo> chunks;
+
+    Manifest();
+
+    /**
+     * Replace the contents from a stream.
+     *
+     * @return @c false if the stream is not a valid manifest, in which case
+     * the manifest is left empty.
+     */
+    bool read(std::istream &in);
+
+    /// Write the contents to a stream
+    void write(std::ostream &out) const;
+
+    /**
+     * Load from a file. A missing file is treated as an empty manifest, and
+     * a malformed one is ignored with a warning.
+     */
+    void load(const boost::filesystem::path &path);
+
+    /**
+     * Write to a file.
+     *
+     * @throw std::ios::failure if the file could not be written (with boost error
+     * info on the filename and errno).
+     */
+    void save(const boost::filesystem::path &path) const;
+};
+
+/**
+ * Round up a chunk size so that it will be used unchanged by @ref
+ * Bucket::bucket, and extend a grid so that its lower extents lie on chunk
+ * boundaries and it covers a whole number of chunks in each dimension. The
+ * boundaries are thus at the same place in space regardless of the bounding
+ * box.
+ *
+ * @param grid          Grid to align, which must have its reference at the origin
+ * @param chunkCells    Requested chunk size, in cells (non-zero)
+ * @param microCells    Microblock size passed to @ref Bucket::bucket
+ * @param maxCells      Maximum bucket size passed to @ref Bucket::bucket
+ * @param maxSplit      Maximum fan-out passed to @ref Bucket::bucket
+ * @return The rounded chunk size.
+ * @throw std::runtime_error if @a maxSplit would force @ref Bucket::bucket to
+ * use larger microblocks, which would change the chunk size.
+ */
+Grid::size_type alignGrid(Grid &grid, Grid::size_type chunkCells,
+                          Grid::size_type microCells, Grid::size_type maxCells,
+                          std::size_t maxSplit);
+
+/**
+ * Decides which chunks must be recomputed, and builds the manifest for the
+ * new run.
+ */
+class Tracker : public boost::noncopyable
+{
+public:
+    /// Maps a chunk ID to the name of its output file
+    typedef boost::function<std::string(const ChunkId &)> Namer;
+
+    /**
+     * Constructor.
+     *
+     * @param previous    Manifest from the previous run (possibly empty)
+     * @param current     Manifest for this run, with everything except the chunks filled in
+     * @param namer       Output file namer
+     *
+     * If @a previous was produced with different options or chunk size, all
+     * chunks are recomputed.
+     */
+    Tracker(const Manifest &previous, const Manifest &current, const Namer &namer);
+
+    /// Whether the previous manifest can be used to skip chunks
+    bool isCompatible() const { return compatible; }
+
+    /**
+     * Record the input files that touch a chunk, and determine whether it
+     * must be recomputed. It may be called again for the same chunk (on a
+     * later pass), in which case it gives the same answer.
+     *
+     * @param chunk      Chunk coordinates relative to the grid
+     * @param files      Indices of the files, in increasing order and without duplicates
+     * @return Whether the chunk must be recomputed.
+     */
+    bool update(const boost::array<Grid::size_type, 3> &chunk, const std::vector<std::size_t> &files);
+
+    /**
+     * Bring the output files of the previous run into line with the new
+     * one, once @ref update has been called for all chunks. Output files of
+     * chunks that will be recomputed or that are now empty are deleted, and
+     * those of unchanged chunks are renamed if the chunk origin has moved.
+     *
+     * @return The number of output files that are kept.
+     */
+    std::size_t prepareOutputs();
+
+    /**
+     * Record which chunks have an output file. This must be called after
+     * the output has been written.
+     */
+    void recordOutputs();
+
+    /// Number of chunks that will be recomputed
+    std::size_t numDirty() const { return dirty.size(); }
+
+    /// The manifest for this run
+    const Manifest &getManifest() const { return current; }
+
+private:
+    Manifest previous;
+    Manifest current;
+    Namer namer;
+    bool compatible;
+
+    /**
+     * For each file in @ref current, its index in @ref previous, or @c -1 if
+     * it is new or has changed.
+     */
+    std::vector<std::size_t> previousIndex;
+    /// Chunks that will be recomputed
+    std::set<ChunkCoords> dirty;
+
+    /// Name of an output file from the previous run
+    std::string previousName(const ChunkCoords &coords) const;
+    /// Name of an output file for this run
+    std::string currentName(const ChunkCoords &coords) const;
+};
+
+/**
+ * Bucket processor that passes on the buckets of the chunks that must be
+ * recomputed, and drops the rest. It relies on all the buckets of a chunk
+ * being produced consecutively, which is the case for @ref Bucket::bucket.
+ */
+class Filter : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param tracker     Decides which chunks to keep
+     * @param collector   Destination for the kept buckets
+     */
+    Filter(Tracker &tracker, BucketCollector &collector);
+
+    void operator()(
+        const SplatSet::SubsetBase &splats,
+        const Grid &grid,
+        const Bucket::Recursion &recursionState);
+
+    /// Make the decision for the last chunk. This must be called at the end of each pass.
+    void flush();
+
+private:
+    /// A bucket held back until the decision is made
+    struct Pending
+    {
+        SplatSet::SubsetBase splats;
+        Grid grid;
+        Bucket::Recursion recursionState;
+    };
+
+    Tracker &tracker;
+    BucketCollector &collector;
+    boost::array<Grid::size_type, 3> curChunk;
+    std::vector<Pending> pending;
+    std::vector<std::size_t> files;   ///< Files touching the current chunk, possibly with duplicates
+};
+
+} // namespace Incremental
+
+#endif /* !MLSGPU_INCREMENTAL_H */
@@ -0,0 +1,394 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Open-addressing hash table keyed by vertex keys.
+ */
+
+#ifndef KEY_MAP_H
+#define KEY_MAP_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <stdexcept>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/split_member.hpp>
+#include "tr1_cstdint.h"
+#include "allocator.h"
+#include "errors.h"
+
+class TestKeyMap;
+
+/**
+ * Hash table mapping 64-bit vertex keys to small values, for use in place of
+ * @c std::tr1::unordered_map when there are very many entries. It avoids a
+ * separate heap node per entry by storing keys and values inline, in
+ * separate arrays so that small values do not cause padding, and uses linear
+ * probing so that probe sequences stay within a few cache lines.
+ *
+ * The table is split into a fixed number of segments selected by the high
+ * bits of the hash, each of which grows independently. This bounds the
+ * transient memory needed while growing to a fraction of the total, which
+ * matters when the table itself occupies gigabytes.
+ *
+ * Erasing an entry shifts later entries of the same probe sequence back, so
+ * there are no tombstones and lookups never degrade after many erasures.
+ * Note that @ref OOCMesher does not currently erase anything: it cannot tell
+ * cheaply when the last block sharing a vertex has been seen.
+ *
+ * Each segment is a separate @ref Statistics::Container::vector, so there is
+ * no shared arena; the memory is accounted under the name given to the
+ * constructor.
+ *
+ * A key with all bits set is used to mark empty slots, and so may not be
+ * inserted. Vertex keys produced by @ref Marching never have the high bit set.
+ *
+ * Pointers returned by @ref insert and @ref find are invalidated by any
+ * subsequent call to @ref insert, @ref erase, @ref reserve or @ref clear.
+ */
+template<typename T>
+class KeyMap
+{
+    friend class ::TestKeyMap;
+    friend class boost::serialization::access;
+public:
+    typedef std::tr1::uint64_t key_type;
+    typedef T mapped_type;
+    typedef std::size_t size_type;
+
+    /// Key value reserved to indicate an empty slot
+    static const key_type emptyKey = ~key_type(0);
+
+    /**
+     * Constructor.
+     *
+     * @param allocName   Name of the statistic to which memory is accounted.
+     */
+    explicit KeyMap(const std::string &allocName)
+        : segments(numSegments, Segment(allocName)), numEntries(0)
+    {
+    }
+
+    /// Number of entries in the table
+    size_type size() const { return numEntries; }
+
+    /// Whether the table has no entries
+    bool empty() const { return numEntries == 0; }
+
+    /// Number of slots currently allocated
+    size_type capacity() const
+    {
+        size_type ans = 0;
+        for (size_type i = 0; i < numSegments; i++)
+            ans += segments[i].keys.size();
+        return ans;
+    }
+
+    /// Number of bytes allocated for the slots
+    std::size_t memory() const
+    {
+        return capacity() * (sizeof(key_type) + sizeof(T));
+    }
+
+    /**
+     * Write every entry to @a out as a <code>std::pair<key_type, T></code>,
+     * in no particular order.
+     */
+    template<typename OutputIterator>
+    OutputIterator copy(OutputIterator out) const
+    {
+        for (size_type i = 0; i < numSegments; i++)
+        {
+            const Segment &seg = segments[i];
+            for (size_type j = 0; j < seg.keys.size(); j++)
+                if (seg.keys[j] != emptyKey)
+                    *out++ = std::make_pair(seg.keys[j], seg.values[j]);
+        }
+        return out;
+    }
+
+    /**
+     * Insert @a value for @a key, if the key is not already present.
+     *
+     * @return A pointer to the value stored for @a key, and whether it was newly inserted.
+     * @pre @a key is not @ref emptyKey.
+     */
+    std::pair<T *, bool> insert(key_type key, const T &value)
+    {
+        MLSGPU_ASSERT(key != emptyKey, std::invalid_argument);
+        const key_type h = hash(key);
+        Segment &seg = segments[h >> segmentShift];
+        if (seg.full())
+            seg.rehash(seg.keys.empty() ? size_type(minCapacity) : seg.keys.size() * 2);
+
+        size_type pos = size_type(h) & seg.mask;
+        while (seg.keys[pos] != emptyKey)
+        {
+            if (seg.keys[pos] == key)
+                return std::make_pair(&seg.values[pos], false);
+            pos = (pos + 1) & seg.mask;
+        }
+        seg.keys[pos] = key;
+        seg.values[pos] = value;
+        seg.used++;
+        numEntries++;
+        return std::make_pair(&seg.values[pos], true);
+    }
+
+    /**
+     * Find the value for @a key.
+     *
+     * @return A pointer to the value, or @c NULL if the key is not present.
+     */
+    T *find(key_type key)
+    {
+        const key_type h = hash(key);
+        Segment &seg = segments[h >> segmentShift];
+        size_type pos = seg.findSlot(key, h);
+        return pos == seg.keys.size() ? NULL : &seg.values[pos];
+    }
+
+    /// @copydoc find(key_type)
+    const T *find(key_type key) const
+    {
+        const key_type h = hash(key);
+        const Segment &seg = segments[h >> segmentShift];
+        size_type pos = seg.findSlot(key, h);
+        return pos == seg.keys.size() ? NULL : &seg.values[pos];
+    }
+
+    /**
+     * Remove the entry for @a key, if present.
+     *
+     * @return Whether an entry was removed.
+     */
+    bool erase(key_type key)
+    {
+        const key_type h = hash(key);
+        Segment &seg = segments[h >> segmentShift];
+        size_type hole = seg.findSlot(key, h);
+        if (hole == seg.keys.size())
+            return false;
+
+        /* Shift back later entries that would otherwise become unreachable.
+         * An entry at @a pos may fill the hole if its home slot does not lie
+         * cyclically in (hole, pos].
+         */
+        size_type pos = hole;
+        while (true)
+        {
+            pos = (pos + 1) & seg.mask;
+            if (seg.keys[pos] == emptyKey)
+                break;
+            size_type home = size_type(hash(seg.keys[pos])) & seg.mask;
+            if (((pos - home) & seg.mask) >= ((pos - hole) & seg.mask))
+            {
+                seg.keys[hole] = seg.keys[pos];
+                seg.values[hole] = seg.values[pos];
+                hole = pos;
+            }
+        }
+        seg.keys[hole] = emptyKey;
+        seg.used--;
+        numEntries--;
+        return true;
+    }
+
+    /// Remove all entries and release the memory
+    void clear()
+    {
+        for (size_type i = 0; i < numSegments; i++)
+            segments[i].clear();
+        numEntries = 0;
+    }
+
+    /**
+     * Ensure that at least @a n entries can be held without growing the
+     * table, assuming that they are evenly spread over the segments.
+     */
+    void reserve(size_type n)
+    {
+        const size_type perSegment = (n + numSegments - 1) / numSegments;
+        for (size_type i = 0; i < numSegments; i++)
+        {
+            Segment &seg = segments[i];
+            size_type cap = seg.keys.empty() ? size_type(minCapacity) : seg.keys.size();
+            while (perSegment * loadDen > cap * loadNum)
+                cap *= 2;
+            if (cap > seg.keys.size())
+                seg.rehash(cap);
+        }
+    }
+
+private:
+    /**
+     * Serialize the entries. Only the entries are stored, not the layout, so
+     * the table is rebuilt on load.
+     */
+    template<typename Archive>
+    void save(Archive &ar, const unsigned int) const
+    {
+        ar << numEntries;
+        for (size_type i = 0; i < numSegments; i++)
+        {
+            const Segment &seg = segments[i];
+            for (size_type j = 0; j < seg.keys.size(); j++)
+                if (seg.keys[j] != emptyKey)
+                {
+                    ar << seg.keys[j];
+                    ar << seg.values[j];
+                }
+        }
+    }
+
+    /// Inverse of @ref save
+    template<typename Archive>
+    void load(Archive &ar, const unsigned int)
+    {
+        size_type n;
+        ar >> n;
+        clear();
+        reserve(n);
+        for (size_type i = 0; i < n; i++)
+        {
+            key_type key;
+            T value;
+            ar >> key;
+            ar >> value;
+            insert(key, value);
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    enum
+    {
+        segmentBits = 6,                       ///< Log base 2 of the number of segments
+        numSegments = 1 << segmentBits,        ///< Number of independently grown segments
+        segmentShift = 64 - segmentBits,       ///< Shift applied to the hash to select the segment
+        minCapacity = 16,                      ///< Smallest non-zero segment size
+        loadNum = 4,                           ///< Numerator of the maximum load factor
+        loadDen = 5                            ///< Denominator of the maximum load factor
+    };
+
+    typedef Statistics::Container::vector<key_type> KeyVector;
+    typedef Statistics::Container::vector<T> ValueVector;
+    /// Base classes of @ref KeyVector and @ref ValueVector, for temporaries sharing the allocator
+    typedef std::vector<key_type, KeyVector::allocator_type> KeyStorage;
+    typedef std::vector<T, typename ValueVector::allocator_type> ValueStorage;
+
+    /// Independently sized piece of the table
+    struct Segment
+    {
+        KeyVector keys;       ///< Keys, with unused slots set to @ref emptyKey
+        ValueVector values;   ///< Values corresponding to @ref keys
+        size_type used;       ///< Number of slots in use
+        size_type mask;       ///< One less than the number of slots (or zero if empty)
+
+        explicit Segment(const std::string &allocName)
+            : keys(allocName), values(allocName), used(0), mask(0) {}
+
+        /// Whether another entry would exceed the maximum load factor
+        bool full() const
+        {
+            return (used + 1) * loadDen > keys.size() * loadNum;
+        }
+
+        /// Slot containing @a key with hash @a h, or the segment size if not present
+        size_type findSlot(key_type key, key_type h) const
+        {
+            if (keys.empty() || key == emptyKey)
+                return keys.size();
+            size_type pos = size_type(h) & mask;
+            while (keys[pos] != emptyKey)
+            {
+                if (keys[pos] == key)
+                    return pos;
+                pos = (pos + 1) & mask;
+            }
+            return keys.size();
+        }
+
+        /// Move all entries into @a newCapacity slots (a power of 2)
+        void rehash(size_type newCapacity)
+        {
+            KeyStorage newKeys(newCapacity, emptyKey, keys.get_allocator());
+            ValueStorage newValues(newCapacity, T(), values.get_allocator());
+            const size_type newMask = newCapacity - 1;
+            for (size_type i = 0; i < keys.size(); i++)
+            {
+                if (keys[i] != emptyKey)
+                {
+                    size_type pos = size_type(hash(keys[i])) & newMask;
+                    while (newKeys[pos] != emptyKey)
+                        pos = (pos + 1) & newMask;
+                    newKeys[pos] = keys[i];
+                    newValues[pos] = values[i];
+                }
+            }
+            keys.swap(newKeys);
+            values.swap(newValues);
+            mask = newMask;
+        }
+
+        /// Remove all entries and release the memory
+        void clear()
+        {
+            // clear() would retain the capacity, so swap with empty vectors
+            KeyStorage(keys.get_allocator()).swap(keys);
+            ValueStorage(values.get_allocator()).swap(values);
+            used = 0;
+            mask = 0;
+        }
+    };
+
+    /// The segments, indexed by the top bits of the hash
+    std::vector<Segment> segments;
+    /// Number of slots that are in use
+    size_type numEntries;
+
+    /**
+     * Mixing function. Vertex keys are packed coordinates, so the low bits
+     * alone are poorly distributed.
+     */
+    static key_type hash(key_type key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+};
+
+template<typename T>
+const typename KeyMap<T>::key_type KeyMap<T>::emptyKey;
+
+#endif /* !KEY_MAP_H */
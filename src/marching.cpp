@@ -384,7 +384,7 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     const std::size_t sliceCells = (maxWidth - 1) * (maxHeight - 1);
     const std::size_t swatheCells = sliceCells * maxSwathe;
     const std::size_t meshCells = meshMemory / MAX_CELL_BYTES;
-    vertexSpace = meshCells * MAX_CELL_VERTICES;
+    vertexSpace = maxOutputVertices(meshMemory);
     indexSpace = meshCells * MAX_CELL_INDICES;
 
     // If these are updated, also update deviceMemory
@@ -551,7 +551,7 @@ std::size_t Marching::generateCells(
 }
 
 void Marching::shipOut(const cl::CommandQueue &queue,
-                       const cl_uint3 &keyOffset,
+                       cl_ulong keyOffset,
                        const cl_uint2 &sizes,
                        cl_uint zMax,
                        const OutputFunctor &output,
@@ -591,12 +591,8 @@ void Marching::shipOut(const cl::CommandQueue &queue,
     // twice, and most of them will be eliminated entirely! However, sorting them does
     // give later passes better spatial locality and fewer indirections.
     cl_ulong minExternalKey = cl_ulong(zMax) << (2 * KEY_AXIS_BITS + 1);
-    cl_ulong keyOffsetL =
-        (cl_ulong(keyOffset.s[2]) << (2 * KEY_AXIS_BITS + 1))
-        | (cl_ulong(keyOffset.s[1]) << (KEY_AXIS_BITS + 1))
-        | (cl_ulong(keyOffset.s[0]) << 1);
     compactVerticesKernel.setArg(7, minExternalKey);
-    compactVerticesKernel.setArg(8, keyOffsetL);
+    compactVerticesKernel.setArg(8, keyOffset);
     CLH::enqueueNDRangeKernel(queue,
                               compactVerticesKernel,
                               cl::NullRange,
@@ -628,7 +624,7 @@ Grid::size_type Marching::addSlices(
     const cl::CommandQueue &queue,
     const OutputFunctor &output,
     const Swathe &swathe,
-    const cl_uint3 &keyOffset,
+    cl_ulong keyOffset,
     std::size_t localSize,
     cl_uint2 &offsets, cl_uint &zTop,
     const std::vector<cl::Event> *events,
@@ -748,7 +744,8 @@ void Marching::generate(
     const OutputFunctor &output,
     const Grid::size_type size[3],
     const cl_uint3 &keyOffset,
-    const std::vector<cl::Event> *events)
+    const std::vector<cl::Event> *events,
+    cl_uint keyShift)
 {
     std::size_t localSize = queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
     // Work group size for kernels that operate on compacted cells.
@@ -777,6 +774,14 @@ void Marching::generate(
 
     generateElementsKernel.setArg(9, swathe.zStride);
     generateElementsKernel.setArg(11, keyOffset);
+    /* The key shift is only applied to the keys and not to the vertices.
+     * Each field of a key has one fractional bit.
+     */
+    const cl_ulong keyOffsetL =
+        (cl_ulong(keyOffset.s[2]) << (2 * KEY_AXIS_BITS + 1 + keyShift))
+        | (cl_ulong(keyOffset.s[1]) << (KEY_AXIS_BITS + 1 + keyShift))
+        | (cl_ulong(keyOffset.s[0]) << (1 + keyShift));
+    compactVerticesKernel.setArg(9, keyShift);
     generateElementsKernel.setArg(13, CLH_LOCAL(NUM_EDGES * wgsCompacted * sizeof(cl_float3)));
 
     Grid::size_type shipOuts = 0;
@@ -803,7 +808,7 @@ void Marching::generate(
 
         shipOuts += addSlices(
             queue, output,
-            swathe, keyOffset,
+            swathe, keyOffsetL,
             wgsCompacted,
             offsets, zTop,
             &wait, &last);
@@ -813,7 +818,7 @@ void Marching::generate(
 
     if (offsets.s[0] > 0)
     {
-        shipOut(queue, keyOffset, offsets, depth - 1, output, &wait, &last);
+        shipOut(queue, keyOffsetL, offsets, depth - 1, output, &wait, &last);
         shipOuts++;
         wait.resize(1);
         wait[0] = last;
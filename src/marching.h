@@ -512,6 +512,15 @@ public:
         std::size_t meshMemory,
         const Grid::size_type alignment[3]);
 
+    /**
+     * Maximum number of vertices in a single mesh passed to the output
+     * functor, when @a meshMemory is passed to the constructor.
+     */
+    static std::size_t maxOutputVertices(std::size_t meshMemory)
+    {
+        return meshMemory / MAX_CELL_BYTES * MAX_CELL_VERTICES;
+    }
+
     /**
      * The function type to pass to @ref generate for receiving output data.
      * When invoked, this function must enqueue commands to retrieve the data
@@ -589,6 +598,10 @@ public:
      * @param size           Number of vertices in each dimension to process.
      * @param keyOffset      XYZ values to add to vertex keys of external vertices.
      * @param events         Previous events to wait for (can be @c NULL).
+     * @param keyShift       Log base 2 of a factor by which to scale the vertex keys
+     *                       and @a keyOffset of external vertices, without affecting
+     *                       the vertices. This places the keys of a coarsened grid
+     *                       on the lattice of the finer grid it was derived from.
      *
      * @note @a keyOffset is specified in integer units, not fixed-point.
      *
@@ -605,7 +618,8 @@ public:
                   const OutputFunctor &output,
                   const Grid::size_type size[3],
                   const cl_uint3 &keyOffset,
-                  const std::vector<cl::Event> *events = NULL);
+                  const std::vector<cl::Event> *events = NULL,
+                  cl_uint keyShift = 0);
 
 private:
     /**
@@ -668,7 +682,7 @@ private:
      * @ref indexRemap are clobbered.
      *
      * @param queue           Command queue to use for enqueuing work.
-     * @param keyOffset       Value added to keys (see @ref generate for details).
+     * @param keyOffset       Value added to keys, in the packed key format (see @ref generate for details).
      * @param sizes           Number of vertices and indices in input.
      * @param zMax            Maximum potential z value of vertices (not cells).
      * @param output          Functor to which the welded geometry is passed.
@@ -676,7 +690,7 @@ private:
      * @param[out] event      Event signalled on completion (may be @c NULL).
      */
     void shipOut(const cl::CommandQueue &queue,
-                 const cl_uint3 &keyOffset,
+                 cl_ulong keyOffset,
                  const cl_uint2 &sizes,
                  cl_uint zMax,
                  const OutputFunctor &output,
@@ -707,7 +721,7 @@ private:
         const cl::CommandQueue &queue,
         const OutputFunctor &output,
         const Swathe &swathe,
-        const cl_uint3 &keyOffset,
+        cl_ulong keyOffset,
         std::size_t localSize,
         cl_uint2 &offsets, cl_uint &zTop,
         const std::vector<cl::Event> *events,
@@ -48,7 +48,7 @@ DeviceKeyMesh::DeviceKeyMesh(
 {
 }
 
-HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes)
+HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes, bool normals)
     : MeshSizes(sizes)
 {
     std::tr1::uintptr_t ptrInt = reinterpret_cast<std::tr1::uintptr_t>(ptr);
@@ -56,7 +56,9 @@ HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes)
 
     vertexKeys = reinterpret_cast<cl_ulong *>(ptr);
     vertices = reinterpret_cast<boost::array<cl_float, 3> *>(vertexKeys + numExternalVertices());
-    triangles = reinterpret_cast<boost::array<cl_uint, 3> *>(vertices + numVertices());
+    this->normals = normals ? vertices + numVertices() : NULL;
+    triangles = reinterpret_cast<boost::array<cl_uint, 3> *>(
+        vertices + (normals ? 2 : 1) * numVertices());
 }
 
 void enqueueReadMesh(const cl::CommandQueue &queue,
@@ -92,6 +94,21 @@ void enqueueReadMesh(const cl::CommandQueue &queue,
 
     if (verticesEvent != NULL)
     {
+        std::vector<cl::Event> wait;
+        if (hMesh.normals != NULL)
+        {
+            MLSGPU_ASSERT(dMesh.normals() != NULL, std::invalid_argument);
+            cl::Event normalsEvent;
+            CLH::enqueueReadBuffer(queue,
+                                   dMesh.normals, CL_FALSE,
+                                   0, dMesh.numVertices() * (3 * sizeof(cl_float)),
+                                   hMesh.normals,
+                                   events, &normalsEvent);
+            if (events != NULL)
+                wait = *events;
+            wait.push_back(normalsEvent);
+            events = &wait;
+        }
         CLH::enqueueReadBuffer(queue,
                                dMesh.vertices, CL_FALSE,
                                0, dMesh.numVertices() * (3 * sizeof(cl_float)),
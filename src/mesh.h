@@ -74,11 +74,13 @@ public:
     std::size_t numExternalVertices() const { return numVertices_ - numInternalVertices_; }
 
     /**
-     * Number of bytes that need to be allocated for @ref HostKeyMesh::HostKeyMesh(void *, const MeshSizes &).
+     * Number of bytes that need to be allocated for @ref HostKeyMesh::HostKeyMesh(void *, const MeshSizes &, bool).
+     *
+     * @param normals  Whether space is needed for vertex normals.
      */
-    std::size_t getHostBytes() const
+    std::size_t getHostBytes(bool normals = false) const
     {
-        return 3 * sizeof(cl_float) * numVertices_
+        return 3 * sizeof(cl_float) * numVertices_ * (normals ? 2 : 1)
             +  3 * sizeof(cl_uint) * numTriangles_
             +  sizeof(cl_ulong) * numExternalVertices();
     }
@@ -113,13 +115,19 @@ struct DeviceKeyMesh : public MeshSizes
      * Buffer containing vertex keys, which are @c cl_ulong values.
      */
     cl::Buffer vertexKeys;                 ///< Vertex keys
+    /**
+     * Buffer containing a normal for each vertex, as tightly-packed @c
+     * cl_float xyz triplets. This is optional, and is a null buffer if
+     * normals are not being computed.
+     */
+    cl::Buffer normals;
 
     DeviceKeyMesh() {}
 
     /**
      * Constructor. The buffers are allocated with just enough space to hold
      * the specified number of vertices and triangles. It is legal for
-     * any of the sizes to be zero.
+     * any of the sizes to be zero. No buffer is allocated for normals.
      */
     DeviceKeyMesh(const cl::Context &context, cl_mem_flags flags, const MeshSizes &sizes);
 };
@@ -135,16 +143,19 @@ struct HostKeyMesh : public MeshSizes
     boost::array<cl_float, 3> *vertices;
     boost::array<cl_uint, 3> *triangles;
     cl_ulong *vertexKeys;
+    /// Normals corresponding to @ref vertices, or @c NULL if there are none
+    boost::array<cl_float, 3> *normals;
 
     HostKeyMesh() :
-        vertices(NULL), triangles(NULL), vertexKeys(NULL) {}
+        vertices(NULL), triangles(NULL), vertexKeys(NULL), normals(NULL) {}
 
     /**
-     * Construct from an existing pool of memory.
+     * Construct from an existing pool of memory, which must be at least
+     * @ref MeshSizes::getHostBytes(@a normals) bytes.
      *
      * @pre @a ptr is @c cl_ulong aligned.
      */
-    HostKeyMesh(void *ptr, const MeshSizes &sizes);
+    HostKeyMesh(void *ptr, const MeshSizes &sizes, bool normals = false);
 };
 
 /**
@@ -157,6 +168,10 @@ struct HostKeyMesh : public MeshSizes
  * are discarded. Properties that are not transferred as preserved in @a
  * hMesh.
  *
+ * If @a hMesh has storage for normals, then they are transferred together
+ * with the vertices, and @a verticesEvent covers both. In this case
+ * @a dMesh must have normals.
+ *
  * @param queue          Queue in which to enqueue the transfers.
  * @param dMesh          Source of the copy.
  * @param hMesh          Target of the copy.
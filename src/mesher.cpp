@@ -43,10 +43,12 @@
 #include <boost/ref.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/foreach.hpp>
 #include <boost/type_traits/make_unsigned.hpp>
@@ -54,13 +56,17 @@
 #include <boost/filesystem.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/iostreams/positioning.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 #include "tr1_unordered_map.h"
 #include <cassert>
 #include <cstdlib>
 #include <utility>
 #include <iterator>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include <map>
 #include <string>
 #include <ostream>
@@ -82,6 +88,8 @@ std::map<std::string, MesherType> MesherTypeWrapper::getNameMap()
 {
     std::map<std::string, MesherType> ans;
     ans["ooc"] = OOC_MESHER;
+    ans["recompute"] = RECOMPUTE_MESHER;
+    ans["stream"] = STREAM_MESHER;
     return ans;
 }
 
@@ -91,13 +99,27 @@ std::string ChunkNamer::operator()(const ChunkId &chunkId) const
     nameStream << baseName;
     for (unsigned int i = 0; i < 3; i++)
         nameStream << '_' << std::setw(4) << std::setfill('0') << chunkId.coords[i];
-    nameStream << ".ply";
+    nameStream << extension;
     return nameStream.str();
 }
 
+void MesherBase::setChunkGrid(const ChunkId &chunkId, const Grid &grid)
+{
+    boost::lock_guard<boost::mutex> lock(chunkGridsMutex);
+    chunkGrids[chunkId.gen] = grid;
+}
+
+Grid MesherBase::getChunkGrid(const ChunkId &chunkId) const
+{
+    boost::lock_guard<boost::mutex> lock(chunkGridsMutex);
+    std::map<ChunkId::gen_type, Grid>::const_iterator pos = chunkGrids.find(chunkId.gen);
+    MLSGPU_ASSERT(pos != chunkGrids.end(), state_error);
+    return pos->second;
+}
 
 OOCMesher::TmpWriterItem::TmpWriterItem()
     : vertices("mem.OOCMesher::TmpWriterItem::vertices"),
+    normals("mem.OOCMesher::TmpWriterItem::normals"),
     triangles("mem.OOCMesher::TmpWriterItem::triangles"),
     vertexRanges("mem.OOCMesher::TmpWriterItem::vertexRanges"),
     triangleRanges("mem.OOCMesher::TmpWriterItem::triangleRanges")
@@ -108,15 +130,36 @@ void OOCMesher::TmpWriterWorker::operator()(TmpWriterItem &item)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
     typedef std::pair<std::size_t, std::size_t> range;
+    const bool compress = owner.isCompressed();
     BOOST_FOREACH(const range &r, item.vertexRanges)
     {
-        verticesFile.write(reinterpret_cast<char *>(&item.vertices[r.first]),
-                           (r.second - r.first) * sizeof(vertex_type));
+        const char *data = reinterpret_cast<char *>(&item.vertices[r.first]);
+        std::size_t bytes = (r.second - r.first) * sizeof(vertex_type);
+        if (!item.normals.empty())
+        {
+            // Interleave so that the records match the output file
+            interleaved.clear();
+            for (std::size_t i = r.first; i < r.second; i++)
+            {
+                interleaved.push_back(item.vertices[i]);
+                interleaved.push_back(item.normals[i]);
+            }
+            data = reinterpret_cast<char *>(&interleaved[0]);
+            bytes *= 2;
+        }
+        if (compress)
+            verticesCompressor.write(data, bytes);
+        else
+            verticesFile.write(data, bytes);
     }
     BOOST_FOREACH(const range &r, item.triangleRanges)
     {
-        trianglesFile.write(reinterpret_cast<char *>(&item.triangles[r.first]),
-                            (r.second - r.first) * sizeof(triangle_type));
+        const char *data = reinterpret_cast<char *>(&item.triangles[r.first]);
+        const std::size_t bytes = (r.second - r.first) * sizeof(triangle_type);
+        if (compress)
+            trianglesCompressor.write(data, bytes);
+        else
+            trianglesFile.write(data, bytes);
     }
     if (!verticesFile || !trianglesFile)
     {
@@ -128,9 +171,13 @@ void OOCMesher::TmpWriterWorker::operator()(TmpWriterItem &item)
 
 OOCMesher::TmpWriterWorkerGroup::TmpWriterWorkerGroup(std::size_t slots)
     : WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>("tmpwriter", 1),
+    compress(false),
+    verticesCompressor(BLOCK_FILTER_NONE),
+    trianglesCompressor(BLOCK_FILTER_DELTA3),
     itemAllocator("mem.OOCMesher::TmpWriterWorkerGroup::itemAllocator", slots)
 {
-    addWorker(new TmpWriterWorker(*this, verticesFile, trianglesFile));
+    addWorker(new TmpWriterWorker(*this, verticesFile, trianglesFile,
+                                  verticesCompressor, trianglesCompressor));
     for (std::size_t i = 0; i < itemAllocator.size(); i++)
         itemPool.push_back(boost::make_shared<TmpWriterItem>());
 }
@@ -139,11 +186,35 @@ void OOCMesher::TmpWriterWorkerGroup::start()
 {
     createTmpFile(verticesPath, verticesFile);
     createTmpFile(trianglesPath, trianglesFile);
+    if (compress)
+    {
+        verticesCompressor.start(verticesFile);
+        trianglesCompressor.start(trianglesFile);
+    }
+    WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
+}
+
+void OOCMesher::TmpWriterWorkerGroup::restart(std::tr1::uint64_t verticesSize, std::tr1::uint64_t trianglesSize)
+{
+    MLSGPU_ASSERT(!compress, state_error);
+    reopenTmpFile(verticesPath, verticesSize, verticesFile);
+    reopenTmpFile(trianglesPath, trianglesSize, trianglesFile);
     WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
 }
 
 void OOCMesher::TmpWriterWorkerGroup::stopPostJoin()
 {
+    if (compress)
+    {
+        verticesCompressor.finish();
+        trianglesCompressor.finish();
+        verticesIndex = verticesCompressor.getIndex();
+        trianglesIndex = trianglesCompressor.getIndex();
+        Statistics::getStatistic<Statistics::Variable>("mesher.tmp.vertices.ratio").add(
+            double(verticesIndex.offsets.back()) / std::max(verticesIndex.size, std::tr1::uint64_t(1)));
+        Statistics::getStatistic<Statistics::Variable>("mesher.tmp.triangles.ratio").add(
+            double(trianglesIndex.offsets.back()) / std::max(trianglesIndex.size, std::tr1::uint64_t(1)));
+    }
     verticesFile.close();
     trianglesFile.close();
     if (!verticesFile || !trianglesFile)
@@ -154,6 +225,22 @@ void OOCMesher::TmpWriterWorkerGroup::stopPostJoin()
     }
 }
 
+BinaryReader *OOCMesher::TmpWriterWorkerGroup::openVertices() const
+{
+    std::auto_ptr<BinaryReader> reader(
+        compress ? new BlockDecompressor(verticesIndex) : createReader(SYSCALL_READER));
+    reader->open(verticesPath);
+    return reader.release();
+}
+
+BinaryReader *OOCMesher::TmpWriterWorkerGroup::openTriangles() const
+{
+    std::auto_ptr<BinaryReader> reader(
+        compress ? new BlockDecompressor(trianglesIndex) : createReader(SYSCALL_READER));
+    reader->open(trianglesPath);
+    return reader.release();
+}
+
 boost::shared_ptr<OOCMesher::TmpWriterItem> OOCMesher::TmpWriterWorkerGroup::get(Timeplot::Worker &tworker, std::size_t size)
 {
     (void) size;
@@ -166,6 +253,7 @@ boost::shared_ptr<OOCMesher::TmpWriterItem> OOCMesher::TmpWriterWorkerGroup::get
 void OOCMesher::TmpWriterWorkerGroup::freeItem(boost::shared_ptr<TmpWriterItem> item)
 {
     item->vertices.clear();
+    item->normals.clear();
     item->triangles.clear();
     item->vertexRanges.clear();
     item->triangleRanges.clear();
@@ -173,18 +261,31 @@ void OOCMesher::TmpWriterWorkerGroup::freeItem(boost::shared_ptr<TmpWriterItem>
 }
 
 const int OOCMesher::reorderSlots = 3;
+const int OOCMesher::reorderShrink = 16;
+
+OOCMesher::Scratch::Scratch()
+    : nodes("mem.OOCMesher::tmpNodes"),
+    clumpId("mem.OOCMesher::tmpClumpId"),
+    clumps("mem.OOCMesher::tmpClumps"),
+    vertexLabel("mem.OOCMesher::tmpVertexLabel"),
+    firstVertex("mem.OOCMesher::tmpFirstVertex"),
+    nextVertex("mem.OOCMesher::tmpNextVertex"),
+    firstTriangle("mem.OOCMesher::tmpFirstTriangle"),
+    nextTriangle("mem.OOCMesher::tmpNextTriangle")
+{
+}
 
 OOCMesher::OOCMesher(FastPly::Writer &writer, const Namer &namer)
     : MesherBase(writer, namer),
-    tmpNodes("mem.OOCMesher::tmpNodes"),
-    tmpClumpId("mem.OOCMesher::tmpClumpId"),
-    tmpVertexLabel("mem.OOCMesher::tmpVertexLabel"),
-    tmpFirstVertex("mem.OOCMesher::tmpFirstVertex"),
-    tmpNextVertex("mem.OOCMesher::tmpNextVertex"),
-    tmpFirstTriangle("mem.OOCMesher::tmpFirstTriangle"),
-    tmpNextTriangle("mem.OOCMesher::tmpNextTriangle"),
+    scratchPool("mem.OOCMesher::scratchPool"),
+    addedInternalVertices(0),
+    reorderLimit(1),
     clumps("mem.OOCMesher::clumps"),
     clumpIdMap("mem.OOCMesher::clumpIdMap"),
+    keyRuns("mem.OOCMesher::keyRuns"),
+    externalVertices(0),
+    resumedPartial(false),
+    keepPartial(false),
     retainFiles(false),
     tmpWriter(reorderSlots),
     chunks("mem.OOCMesher::chunks")
@@ -196,7 +297,17 @@ OOCMesher::~OOCMesher()
     if (tmpWriter.running())
         tmpWriter.stop();
 
-    if (!retainFiles)
+    if (!keysPath.empty() && !keepPartial)
+    {
+        // Only present if finalize was not reached, so only needed for resumePartial
+        keysFile.close();
+        boost::system::error_code ec;
+        remove(keysPath, ec);
+        if (ec)
+            Log::log[Log::warn] << "Could not delete " << keysPath.string() << ": " << ec.message() << std::endl;
+    }
+
+    if (!retainFiles && !keepPartial)
     {
         boost::filesystem::path verticesTmpPath = tmpWriter.getVerticesPath();
         boost::filesystem::path trianglesTmpPath = tmpWriter.getTrianglesPath();
@@ -234,31 +345,24 @@ void OOCMesher::computeLocalComponents(
     }
 }
 
-void OOCMesher::updateGlobalClumps(
+void OOCMesher::computeLocalClumps(
     std::size_t numTriangles,
     const Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes,
     const triangle_type *triangles,
-    Statistics::Container::PODBuffer<clump_id> &clumpId)
+    Statistics::Container::PODBuffer<clump_id> &clumpId,
+    Statistics::Container::vector<Clump> &localClumps)
 {
     std::size_t numVertices = nodes.size();
 
     // Allocate clumps for the local components
+    localClumps.clear();
     clumpId.reserve(numVertices, false);
     for (std::size_t i = 0; i < numVertices; i++)
     {
         if (nodes[i].isRoot())
         {
-            if (clumps.size() >= boost::make_unsigned<clump_id>::type(std::numeric_limits<clump_id>::max()))
-            {
-                /* Ideally this would throw, but it's called from a worker
-                 * thread and there is no easy way to immediately notify the
-                 * master thread that it should shut everything down.
-                 */
-                std::cerr << "There were too many connected components.\n";
-                std::exit(1);
-            }
-            clumpId[i] = clumps.size();
-            clumps.push_back(Clump(nodes[i].size()));
+            clumpId[i] = localClumps.size();
+            localClumps.push_back(Clump(nodes[i].size()));
         }
     }
 
@@ -272,30 +376,74 @@ void OOCMesher::updateGlobalClumps(
     // Compute triangle counts for the clumps
     for (std::size_t i = 0; i < numTriangles; i++)
     {
-        Clump &clump = clumps[clumpId[triangles[i][0]]];
+        Clump &clump = localClumps[clumpId[triangles[i][0]]];
         clump.triangles++;
     }
 }
 
+void OOCMesher::linkLocalClumps(Scratch &scratch, const HostKeyMesh &mesh)
+{
+    const std::size_t numVertices = mesh.numVertices();
+    const clump_id numClumps = scratch.clumps.size();
+
+    scratch.firstVertex.reserve(numClumps, false);
+    std::fill(scratch.firstVertex.data(), scratch.firstVertex.data() + numClumps, -1);
+    scratch.firstTriangle.reserve(numClumps, false);
+    std::fill(scratch.firstTriangle.data(), scratch.firstTriangle.data() + numClumps, -1);
+    scratch.nextVertex.reserve(numVertices, false);
+    scratch.nextTriangle.reserve(mesh.numTriangles(), false);
+
+    for (std::tr1::int32_t i = (std::tr1::int32_t) numVertices - 1; i >= 0; i--)
+    {
+        clump_id cid = scratch.clumpId[i];
+        scratch.nextVertex[i] = scratch.firstVertex[cid];
+        scratch.firstVertex[cid] = i;
+    }
+
+    for (std::tr1::int32_t i = (std::tr1::int32_t) mesh.numTriangles() - 1; i >= 0; i--)
+    {
+        clump_id cid = scratch.clumpId[mesh.triangles[i][0]];
+        scratch.nextTriangle[i] = scratch.firstTriangle[cid];
+        scratch.firstTriangle[cid] = i;
+    }
+}
+
+OOCMesher::clump_id OOCMesher::updateGlobalClumps(const Statistics::Container::vector<Clump> &localClumps)
+{
+    if (clumps.size() + localClumps.size()
+        > boost::make_unsigned<clump_id>::type(std::numeric_limits<clump_id>::max()))
+    {
+        /* Ideally this would throw, but it's called from a worker
+         * thread and there is no easy way to immediately notify the
+         * master thread that it should shut everything down.
+         */
+        std::cerr << "There were too many connected components.\n";
+        std::exit(1);
+    }
+    clump_id first = clumps.size();
+    clumps.insert(clumps.end(), localClumps.begin(), localClumps.end());
+    return first;
+}
+
 void OOCMesher::updateClumpKeyMap(
     std::size_t numVertices,
     std::size_t numExternalVertices,
     const cl_ulong *keys,
-    const Statistics::Container::PODBuffer<clump_id> &clumpId)
+    const Statistics::Container::PODBuffer<clump_id> &clumpId,
+    clump_id clumpIdFirst)
 {
     const std::size_t numInternalVertices = numVertices - numExternalVertices;
 
     for (std::size_t i = 0; i < numExternalVertices; i++)
     {
         cl_ulong key = keys[i];
-        clump_id cid = clumpId[i + numInternalVertices];
+        clump_id cid = clumpId[i + numInternalVertices] + clumpIdFirst;
 
-        std::pair<Statistics::Container::unordered_map<cl_ulong, clump_id>::const_iterator, bool> added;
-        added = clumpIdMap.insert(std::make_pair(key, cid));
+        std::pair<clump_id *, bool> added = clumpIdMap.insert(key, cid);
         if (!added.second)
         {
             // Unified two external vertices. Also need to unify their clumps.
-            clump_id cid2 = added.first->second;
+            clump_id cid2 = *added.first;
             UnionFind::merge(clumps, cid, cid2);
             // They will both have counted the common vertex, so we need to
             // subtract it.
@@ -303,107 +451,367 @@ void OOCMesher::updateClumpKeyMap(
             clumps[cid].vertices--;
         }
     }
+
+    /* Only half the budget is used for the map, since spilling needs a
+     * sorted copy of it.
+     */
+    if (getKeysCapacity() > 0 && clumpIdMap.memory() > getKeysCapacity() / 2)
+        spillClumpKeyMap();
+}
+
+void OOCMesher::spillClumpKeyMap()
+{
+    if (clumpIdMap.empty())
+        return;
+
+    Statistics::Timer spillTimer("mesher.keys.spill");
+    Statistics::Container::vector<key_record_type> records("mem.OOCMesher::keyRecords");
+    records.reserve(clumpIdMap.size());
+    clumpIdMap.copy(std::back_inserter(records));
+    clumpIdMap.clear();
+    std::sort(records.begin(), records.end());
+
+    if (keysPath.empty())
+        createTmpFile(keysPath, keysFile);
+    keysFile.write(reinterpret_cast<const char *>(&records[0]),
+                   records.size() * sizeof(key_record_type));
+    if (!keysFile)
+    {
+        Log::log[Log::error] << "Failed while writing temporary files: "
+            << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+        std::exit(1);
+    }
+    keyRuns.push_back(records.size());
+}
+
+/**
+ * Buffered reader for one sorted run written by @ref OOCMesher::spillClumpKeyMap.
+ */
+class OOCMesher::KeyRunReader
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param reader      Reader for @ref OOCMesher::keysPath.
+     * @param buffer      Storage for @a bufferSize records, owned by the caller.
+     * @param bufferSize  Number of records to read at a time.
+     * @param first,last  Range of records in the file that make up the run.
+     */
+    KeyRunReader(const BinaryReader &reader, key_record_type *buffer, std::size_t bufferSize,
+                 std::tr1::uint64_t first, std::tr1::uint64_t last)
+        : reader(&reader), buffer(buffer), bufferSize(bufferSize),
+        next(first), last(last), pos(0), len(0)
+    {
+        refill();
+    }
+
+    /// Whether all records have been consumed
+    bool empty() const { return pos == len; }
+
+    /// The current record. @pre <code>!empty()</code>
+    const key_record_type &front() const { return buffer[pos]; }
+
+    /// Advance to the next record. @pre <code>!empty()</code>
+    void pop()
+    {
+        if (++pos == len)
+            refill();
+    }
+
+private:
+    const BinaryReader *reader;
+    key_record_type *buffer;
+    std::size_t bufferSize;
+    std::tr1::uint64_t next;    ///< Next record to load from the file
+    std::tr1::uint64_t last;    ///< End of the run in the file
+    std::size_t pos;            ///< Current record within @ref buffer
+    std::size_t len;            ///< Number of valid records in @ref buffer
+
+    void refill()
+    {
+        pos = 0;
+        len = std::min(std::tr1::uint64_t(bufferSize), last - next);
+        reader->read(buffer, len * sizeof(key_record_type), next * sizeof(key_record_type));
+        next += len;
+    }
+};
+
+void OOCMesher::resolveClumpKeys()
+{
+    if (keyRuns.empty())
+    {
+        externalVertices = clumpIdMap.size();
+        return;
+    }
+
+    // Whatever is left in memory becomes one more run
+    spillClumpKeyMap();
+    keysFile.close();
+    if (!keysFile)
+        throw boost::enable_error_info(std::ios::failure("Failed to write temporary file"))
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(keysPath.string());
+
+    Statistics::Timer resolveTimer("mesher.keys.resolve");
+    Statistics::getStatistic<Statistics::Variable>("mesher.keys.runs").add(keyRuns.size());
+
+    boost::scoped_ptr<BinaryReader> reader(createReader(SYSCALL_READER));
+    reader->open(keysPath);
+
+    /* The budget is shared between the read buffers, but each needs to be
+     * big enough to amortise the cost of a seek.
+     */
+    const std::size_t numRuns = keyRuns.size();
+    const std::size_t bufferSize = std::max(
+        getKeysCapacity() / (numRuns * sizeof(key_record_type)), std::size_t(4096));
+    Statistics::Container::vector<key_record_type> buffers("mem.OOCMesher::keyBuffers");
+    buffers.resize(numRuns * bufferSize);
+
+    std::vector<KeyRunReader> runs;
+    runs.reserve(numRuns);
+    typedef std::pair<std::tr1::uint64_t, std::size_t> heap_entry;
+    std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry> > heap;
+    std::tr1::uint64_t first = 0;
+    for (std::size_t i = 0; i < numRuns; i++)
+    {
+        runs.push_back(KeyRunReader(*reader, &buffers[i * bufferSize], bufferSize,
+                                    first, first + keyRuns[i]));
+        first += keyRuns[i];
+        if (!runs[i].empty())
+            heap.push(heap_entry(runs[i].front().first, i));
+    }
+
+    /* Pop the keys in sorted order. Each key appears at most once per run,
+     * and further occurrences are unified in the same way as in
+     * updateClumpKeyMap.
+     */
+    externalVertices = 0;
+    std::tr1::uint64_t prevKey = 0;
+    clump_id prevCid = -1;
+    while (!heap.empty())
+    {
+        const std::size_t r = heap.top().second;
+        heap.pop();
+        const key_record_type record = runs[r].front();
+        runs[r].pop();
+        if (!runs[r].empty())
+            heap.push(heap_entry(runs[r].front().first, r));
+
+        if (prevCid != -1 && record.first == prevKey)
+        {
+            UnionFind::merge(clumps, record.second, prevCid);
+            clump_id root = UnionFind::findRoot(clumps, prevCid);
+            clumps[root].vertices--;
+        }
+        else
+        {
+            prevKey = record.first;
+            prevCid = record.second;
+            externalVertices++;
+        }
+    }
+
+    reader->close();
+    boost::system::error_code ec;
+    remove(keysPath, ec);
+    if (ec)
+        Log::log[Log::warn] << "Could not delete " << keysPath.string() << ": " << ec.message() << std::endl;
+    keysPath.clear();
+    keyRuns.clear();
+}
+
+bool OOCMesher::isClosed(const Chunk::Clump &clump) const
+{
+    const Clump &global = clumps[clump.globalId];
+    return clump.numExternalVertices == 0
+        && global.isRoot()
+        && global.vertices == clump.numInternalVertices;
+}
+
+std::tr1::uint64_t OOCMesher::bufferedBytes(const Chunk &chunk) const
+{
+    std::tr1::uint64_t bytes = 0;
+    BOOST_FOREACH(const Chunk::Clump &clump, chunk.bufferedClumps)
+    {
+        bytes += (clump.numInternalVertices + clump.numExternalVertices) * tmpVertexSize();
+        bytes += clump.numTriangles * sizeof(triangle_type);
+    }
+    return bytes;
 }
 
-void OOCMesher::flushBuffer(Timeplot::Worker &tworker)
+void OOCMesher::flushBuffer(Timeplot::Worker &tworker, bool all)
 {
     if (!reorderBuffer)
         return;
     Statistics::Timer flushTimer("mesher.flush");
-    BOOST_FOREACH(Chunk &chunk, chunks)
+
+    /* Vertices are only ever added, and the keys in clumpIdMap are distinct
+     * from each other and from internal vertices, so this cannot exceed the
+     * threshold eventually computed by getStatistics.
+     */
+    const std::tr1::uint64_t thresholdVertices = std::tr1::uint64_t(
+        (addedInternalVertices + clumpIdMap.size()) * getPruneThreshold());
+    std::tr1::uint64_t prunedVertices = 0;
+    std::tr1::uint64_t prunedClumps = 0;
+
+    typedef std::pair<std::tr1::uint64_t, std::size_t> chunk_bytes;
+    std::vector<chunk_bytes> buffered;
+    std::tr1::uint64_t totalBytes = 0;
+    for (std::size_t i = 0; i < chunks.size(); i++)
+        if (!chunks[i].bufferedClumps.empty())
+        {
+            buffered.push_back(chunk_bytes(bufferedBytes(chunks[i]), i));
+            totalBytes += buffered.back().first;
+        }
+
+    /* Each chunk in the flush becomes a separate run in the temporary files,
+     * so if chunks are interleaved, the buffer is allowed to grow to make
+     * the runs longer. If not, there is nothing to be gained from a large
+     * buffer.
+     */
+    const std::size_t maxLimit = std::max(getReorderCapacity() / reorderSlots, std::size_t(1));
+    if (buffered.size() > 1)
+        reorderLimit = std::min(reorderLimit * 2, maxLimit);
+    else
+        reorderLimit = std::max(reorderLimit / 2, maxLimit / reorderShrink);
+
+    /* When not forced to write everything, the chunks with the least data
+     * are held back for the next flush rather than producing short runs,
+     * provided that they take up only a small part of the buffer.
+     */
+    std::vector<bool> carry(chunks.size(), false);
+    std::tr1::uint64_t carriedBytes = 0;
+    if (!all && buffered.size() > 1)
+    {
+        std::sort(buffered.begin(), buffered.end());
+        BOOST_FOREACH(const chunk_bytes &b, buffered)
+        {
+            if (b.first * buffered.size() >= totalBytes
+                || carriedBytes + b.first > reorderLimit / 4)
+                break;
+            carry[b.second] = true;
+            carriedBytes += b.first;
+        }
+    }
+
+    boost::shared_ptr<TmpWriterItem> next;
+    if (carriedBytes > 0)
+        next = tmpWriter.get(tworker, 1);
+
+    std::size_t writtenChunks = 0;
+    BOOST_FOREACH(const chunk_bytes &b, buffered)
     {
-        if (!chunk.bufferedClumps.empty())
+        Chunk &chunk = chunks[b.second];
+        if (carry[b.second])
         {
-            BOOST_FOREACH(const Chunk::Clump &clump, chunk.bufferedClumps)
+            // Move the data to the next buffer, and update the offsets to match
+            BOOST_FOREACH(Chunk::Clump &clump, chunk.bufferedClumps)
             {
                 const std::size_t numVertices = clump.numInternalVertices + clump.numExternalVertices;
-                const std::tr1::uint64_t firstVertex = writtenVerticesTmp;
-                const std::tr1::uint64_t firstTriangle = writtenTrianglesTmp;
-                reorderBuffer->vertexRanges.push_back(std::make_pair(
-                        clump.firstVertex, clump.firstVertex + numVertices));
-                reorderBuffer->triangleRanges.push_back(std::make_pair(
-                        clump.firstTriangle, clump.firstTriangle + clump.numTriangles));
-                writtenVerticesTmp += numVertices;
-                writtenTrianglesTmp += clump.numTriangles;
-                chunk.clumps.push_back(Chunk::Clump(
-                    firstVertex,
-                    clump.numInternalVertices,
-                    clump.numExternalVertices,
-                    firstTriangle,
-                    clump.numTriangles,
-                    clump.globalId));
-            }
-            chunk.bufferedClumps.clear();
+                const std::size_t firstVertex = next->vertices.size();
+                const std::size_t firstTriangle = next->triangles.size();
+                next->vertices.insert(next->vertices.end(),
+                                      reorderBuffer->vertices.begin() + clump.firstVertex,
+                                      reorderBuffer->vertices.begin() + clump.firstVertex + numVertices);
+                if (!reorderBuffer->normals.empty())
+                    next->normals.insert(next->normals.end(),
+                                         reorderBuffer->normals.begin() + clump.firstVertex,
+                                         reorderBuffer->normals.begin() + clump.firstVertex + numVertices);
+                next->triangles.insert(next->triangles.end(),
+                                       reorderBuffer->triangles.begin() + clump.firstTriangle,
+                                       reorderBuffer->triangles.begin() + clump.firstTriangle + clump.numTriangles);
+                clump.firstVertex = firstVertex;
+                clump.firstTriangle = firstTriangle;
+            }
+            continue;
+        }
+
+        BOOST_FOREACH(const Chunk::Clump &clump, chunk.bufferedClumps)
+        {
+            if (clump.numInternalVertices < thresholdVertices && isClosed(clump))
+            {
+                prunedVertices += clump.numInternalVertices;
+                prunedClumps++;
+                continue;
+            }
+            const std::size_t numVertices = clump.numInternalVertices + clump.numExternalVertices;
+            const std::tr1::uint64_t firstVertex = writtenVerticesTmp;
+            const std::tr1::uint64_t firstTriangle = writtenTrianglesTmp;
+            reorderBuffer->vertexRanges.push_back(std::make_pair(
+                    clump.firstVertex, clump.firstVertex + numVertices));
+            reorderBuffer->triangleRanges.push_back(std::make_pair(
+                    clump.firstTriangle, clump.firstTriangle + clump.numTriangles));
+            writtenVerticesTmp += numVertices;
+            writtenTrianglesTmp += clump.numTriangles;
+            chunk.clumps.push_back(Chunk::Clump(
+                firstVertex,
+                clump.numInternalVertices,
+                clump.numExternalVertices,
+                firstTriangle,
+                clump.numTriangles,
+                clump.globalId));
         }
+        chunk.bufferedClumps.clear();
+        Statistics::getStatistic<Statistics::Variable>("mesher.flush.run.bytes").add(b.first);
+        writtenChunks++;
     }
+
+    Statistics::Registry &registry = Statistics::Registry::getInstance();
+    registry.getStatistic<Statistics::Variable>("mesher.flush.bytes").add(totalBytes - carriedBytes);
+    registry.getStatistic<Statistics::Variable>("mesher.flush.chunks").add(writtenChunks);
+    registry.getStatistic<Statistics::Variable>("mesher.flush.carried.bytes").add(carriedBytes);
+    registry.getStatistic<Statistics::Variable>("mesher.flush.limit").add(reorderLimit);
+    registry.getStatistic<Statistics::Variable>("mesher.prune.early.vertices").add(prunedVertices);
+    registry.getStatistic<Statistics::Variable>("mesher.prune.early.components").add(prunedClumps);
     tmpWriter.push(tworker, reorderBuffer);
-    reorderBuffer.reset();
+    reorderBuffer = next;
 }
 
 void OOCMesher::updateLocalClumps(
     Chunk &chunk,
-    const Statistics::Container::PODBuffer<clump_id> &globalClumpId,
+    Scratch &scratch,
     clump_id clumpIdFirst,
-    clump_id clumpIdLast,
     HostKeyMesh &mesh,
     Timeplot::Worker &tworker)
 {
     const std::size_t numVertices = mesh.numVertices();
     const std::size_t numInternalVertices = mesh.numInternalVertices();
-    const clump_id numClumps = clumpIdLast - clumpIdFirst;
-
-    tmpFirstVertex.reserve(numClumps, false);
-    std::fill(tmpFirstVertex.data(), tmpFirstVertex.data() + numClumps, -1);
-    tmpFirstTriangle.reserve(numClumps, false);
-    std::fill(tmpFirstTriangle.data(), tmpFirstTriangle.data() + numClumps, -1);
-    tmpNextVertex.reserve(numVertices, false);
-    tmpNextTriangle.reserve(mesh.numTriangles(), false);
-
-    for (std::tr1::int32_t i = (std::tr1::int32_t) numVertices - 1; i >= 0; i--)
-    {
-        clump_id cid = globalClumpId[i] - clumpIdFirst;
-        tmpNextVertex[i] = tmpFirstVertex[cid];
-        tmpFirstVertex[cid] = i;
-    }
-
-    for (std::tr1::int32_t i = (std::tr1::int32_t) mesh.numTriangles() - 1; i >= 0; i--)
-    {
-        clump_id cid = globalClumpId[mesh.triangles[i][0]] - clumpIdFirst;
-        tmpNextTriangle[i] = tmpFirstTriangle[cid];
-        tmpFirstTriangle[cid] = i;
-    }
+    const clump_id numClumps = scratch.clumps.size();
 
-    tmpVertexLabel.reserve(numVertices, false);
+    scratch.vertexLabel.reserve(numVertices, false);
+    const bool normals = getWriter().hasNormals();
+    MLSGPU_ASSERT(!normals || numVertices == 0 || mesh.normals != NULL, std::invalid_argument);
 
     if (reorderBuffer)
     {
-        if ((numVertices + reorderBuffer->vertices.size()) * sizeof(vertex_type)
+        if ((numVertices + reorderBuffer->vertices.size()) * tmpVertexSize()
             + (mesh.numTriangles() + reorderBuffer->triangles.size()) * sizeof(triangle_type)
-            > getReorderCapacity() / reorderSlots)
-            flushBuffer(tworker);
+            > reorderLimit)
+            flushBuffer(tworker, false);
     }
     if (!reorderBuffer)
         reorderBuffer = tmpWriter.get(tworker, 1);
 
-    for (clump_id gid = clumpIdFirst; gid < clumpIdLast; gid++)
+    for (clump_id cid = 0; cid < numClumps; cid++)
     {
-        clump_id cid = gid - clumpIdFirst;
+        clump_id gid = cid + clumpIdFirst;
 
         // These count *emitted* vertices - which for external vertices can be less than
         // incoming ones due to sharing within the chunk.
         std::size_t clumpInternalVertices = 0;
         std::size_t clumpExternalVertices = 0;
         std::size_t clumpTriangles = 0;
-        for (std::tr1::int32_t vid = tmpFirstVertex[cid]; vid != -1; vid = tmpNextVertex[vid])
+        for (std::tr1::int32_t vid = scratch.firstVertex[cid]; vid != -1; vid = scratch.nextVertex[vid])
         {
             bool elide = false; // true if the vertex is elided due to sharing
             if (std::size_t(vid) >= numInternalVertices)
             {
                 // external vertex
-                std::pair<Chunk::vertex_id_map_type::iterator, bool> added;
+                std::pair<std::tr1::uint32_t *, bool> added;
                 added = chunk.vertexIdMap.insert(
-                    std::make_pair(mesh.vertexKeys[vid - numInternalVertices],
-                                   (std::tr1::uint32_t) ~chunk.numExternalVertices));
+                    mesh.vertexKeys[vid - numInternalVertices],
+                    (std::tr1::uint32_t) ~chunk.numExternalVertices);
                 if (added.second)
                 {
                     chunk.numExternalVertices++;
@@ -411,25 +819,29 @@ void OOCMesher::updateLocalClumps(
                 }
                 else
                     elide = true;
-                tmpVertexLabel[vid] = added.first->second;
+                scratch.vertexLabel[vid] = *added.first;
             }
             else
             {
                 // internal vertex
-                tmpVertexLabel[vid] = clumpInternalVertices++;
+                scratch.vertexLabel[vid] = clumpInternalVertices++;
             }
 
             if (!elide)
+            {
                 reorderBuffer->vertices.push_back(mesh.vertices[vid]);
+                if (normals)
+                    reorderBuffer->normals.push_back(mesh.normals[vid]);
+            }
         }
 
-        // tmpVertexLabel now contains the intermediate encoded ID for each vertex.
+        // scratch.vertexLabel now contains the intermediate encoded ID for each vertex.
         // Transform and emit the triangles using this mapping.
-        for (std::tr1::int32_t tid = tmpFirstTriangle[cid]; tid != -1; tid = tmpNextTriangle[tid])
+        for (std::tr1::int32_t tid = scratch.firstTriangle[cid]; tid != -1; tid = scratch.nextTriangle[tid])
         {
             triangle_type out;
             for (int j = 0; j < 3; j++)
-                out[j] = tmpVertexLabel[mesh.triangles[tid][j]];
+                out[j] = scratch.vertexLabel[mesh.triangles[tid][j]];
             reorderBuffer->triangles.push_back(out);
             clumpTriangles++;
         }
@@ -444,28 +856,71 @@ void OOCMesher::updateLocalClumps(
     }
 }
 
+boost::shared_ptr<OOCMesher::Scratch> OOCMesher::acquireScratch()
+{
+    boost::shared_ptr<Scratch> scratch;
+    boost::lock_guard<boost::mutex> scratchLock(scratchMutex);
+    if (scratchPool.empty())
+        scratch.reset(new Scratch);
+    else
+    {
+        scratch = scratchPool.back();
+        scratchPool.pop_back();
+    }
+    return scratch;
+}
+
+void OOCMesher::releaseScratch(const boost::shared_ptr<Scratch> &scratch)
+{
+    boost::lock_guard<boost::mutex> scratchLock(scratchMutex);
+    scratchPool.push_back(scratch);
+}
+
 void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 {
-    if (work.chunkId.gen >= chunks.size())
-        chunks.resize(work.chunkId.gen + 1);
-    Chunk &chunk = chunks[work.chunkId.gen];
-    chunk.chunkId = work.chunkId;
+    boost::shared_ptr<Scratch> scratch = acquireScratch();
 
     HostKeyMesh &mesh = work.mesh;
 
+    // Block-local work, which can proceed in parallel
+    if (getDecimateError() > 0.0)
+    {
+        // Simplification needs the whole mesh up front
+        if (work.hasEvents)
+        {
+            work.trianglesEvent.wait();
+            work.vertexKeysEvent.wait();
+            work.verticesEvent.wait();
+        }
+        scratch->decimator(mesh, getDecimateError());
+    }
     if (work.hasEvents)
         work.trianglesEvent.wait();
-    clump_id oldClumps = clumps.size();
-    computeLocalComponents(mesh.numVertices(), mesh.numTriangles(), mesh.triangles, tmpNodes);
-    updateGlobalClumps(mesh.numTriangles(), tmpNodes, mesh.triangles, tmpClumpId);
+    computeLocalComponents(mesh.numVertices(), mesh.numTriangles(), mesh.triangles, scratch->nodes);
+    computeLocalClumps(mesh.numTriangles(), scratch->nodes, mesh.triangles, scratch->clumpId, scratch->clumps);
+    linkLocalClumps(*scratch, mesh);
 
     if (work.hasEvents)
+    {
         work.vertexKeysEvent.wait();
-    updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys, tmpClumpId);
-
-    if (work.hasEvents)
         work.verticesEvent.wait();
-    updateLocalClumps(chunk, tmpClumpId, oldClumps, clumps.size(), mesh, tworker);
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (work.chunkId.gen >= chunks.size())
+            chunks.resize(work.chunkId.gen + 1);
+        Chunk &chunk = chunks[work.chunkId.gen];
+        chunk.chunkId = work.chunkId;
+
+        addedInternalVertices += mesh.numInternalVertices();
+        clump_id clumpIdFirst = updateGlobalClumps(scratch->clumps);
+        updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys,
+                          scratch->clumpId, clumpIdFirst);
+        updateLocalClumps(chunk, *scratch, clumpIdFirst, mesh, tworker);
+    }
+
+    releaseScratch(scratch);
 }
 
 MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
@@ -474,9 +929,20 @@ MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
     (void) pass;
     assert(pass == 0);
 
-    writtenVerticesTmp = 0;
-    writtenTrianglesTmp = 0;
-    tmpWriter.start();
+    reorderLimit = std::max(getReorderCapacity() / (reorderSlots * reorderShrink), std::size_t(1));
+    if (resumedPartial)
+    {
+        // Continue from the state loaded by resumePartial
+        tmpWriter.restart(writtenVerticesTmp * tmpVertexSize(), writtenTrianglesTmp * sizeof(triangle_type));
+    }
+    else
+    {
+        writtenVerticesTmp = 0;
+        writtenTrianglesTmp = 0;
+        addedInternalVertices = 0;
+        tmpWriter.setCompress(getCompressTmp());
+        tmpWriter.start();
+    }
 
     return boost::bind(&OOCMesher::add, this, _1, _2);
 }
@@ -486,6 +952,7 @@ void OOCMesher::finalize(Timeplot::Worker &tworker)
     flushBuffer(tworker);
     if (tmpWriter.running())
         tmpWriter.stop();
+    resolveClumpKeys();
 }
 
 void OOCMesher::getStatistics(
@@ -533,7 +1000,7 @@ void OOCMesher::getStatistics(
         registry.getStatistic<Statistics::Variable>("components.triangles.kept").add(keptTriangles);
         registry.getStatistic<Statistics::Variable>("components.total").add(totalComponents);
         registry.getStatistic<Statistics::Variable>("components.kept").add(keptComponents);
-        registry.getStatistic<Statistics::Variable>("externalvertices").add(clumpIdMap.size());
+        registry.getStatistic<Statistics::Variable>("externalvertices").add(externalVertices);
     }
 }
 
@@ -580,7 +1047,7 @@ std::size_t OOCMesher::getAsyncMem(std::tr1::uint64_t thresholdVertices) const
             if (clumps[cid].vertices >= thresholdVertices)
             {
                 const std::size_t vertices = cc.numInternalVertices + cc.numExternalVertices;
-                asyncMem = std::max(asyncMem, vertices * FastPly::Writer::vertexSize);
+                asyncMem = std::max(asyncMem, vertices * tmpVertexSize());
                 asyncMem = std::max(asyncMem, cc.numTriangles * FastPly::Writer::triangleSize);
             }
         }
@@ -602,23 +1069,110 @@ void OOCMesher::rewriteTriangles(
     for (std::size_t i = 0; i < numTriangles; i++)
     {
         triangle_type t = inTriangles[i];
-        // Convert indices to account for compaction
-        for (int k = 0; k < 3; k++)
+        remapTriangle(t, externalBoundary, externalRemap, offset);
+        outTriangles[i * FastPly::Writer::triangleSize] = 3;
+        std::memcpy(outTriangles + i * FastPly::Writer::triangleSize + 1, &t, sizeof(t));
+    }
+}
+
+void OOCMesher::remapTriangle(
+    triangle_type &triangle,
+    std::tr1::uint32_t externalBoundary,
+    const std::tr1::uint32_t *externalRemap,
+    std::tr1::uint32_t offset)
+{
+    // Convert indices to account for compaction
+    for (int k = 0; k < 3; k++)
+    {
+        if (triangle[k] > externalBoundary)
         {
-            if (t[k] > externalBoundary)
-            {
-                t[k] = externalRemap[~t[k]];
+            triangle[k] = externalRemap[~triangle[k]];
 #if DEBUG
-                const std::tr1::uint32_t badIndex = std::numeric_limits<std::tr1::uint32_t>::max();
-                assert(t[k] != badIndex);
+            const std::tr1::uint32_t badIndex = std::numeric_limits<std::tr1::uint32_t>::max();
+            assert(triangle[k] != badIndex);
 #endif
+        }
+        else
+            triangle[k] += offset;
+    }
+}
+
+OOCMesher::ClumpOptimizer::ClumpOptimizer()
+    : indices("mem.OOCMesher::ClumpOptimizer::indices"),
+    order("mem.OOCMesher::ClumpOptimizer::order"),
+    remap("mem.OOCMesher::ClumpOptimizer::remap"),
+    sortedTriangles("mem.OOCMesher::ClumpOptimizer::sortedTriangles"),
+    sortedVertices("mem.OOCMesher::ClumpOptimizer::sortedVertices")
+{
+}
+
+void OOCMesher::ClumpOptimizer::operator()(
+    std::size_t numInternalVertices,
+    std::size_t numTriangles,
+    std::tr1::uint32_t externalBoundary,
+    std::size_t vertexSize,
+    char *vertices,
+    triangle_type *triangles)
+{
+    const std::tr1::uint32_t badIndex = std::numeric_limits<std::tr1::uint32_t>::max();
+
+    if (numTriangles == 0)
+        return;
+    Statistics::Timer timer("finalize.optimize.time");
+
+    /* Give the external vertices that are referenced small indices after
+     * the internal ones, so that the optimizer sees a dense range.
+     */
+    indices.reserve(3 * numTriangles, false);
+    externalIds.clear();
+    std::tr1::uint32_t numVertices = numInternalVertices;
+    for (std::size_t i = 0; i < numTriangles; i++)
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            std::tr1::uint32_t v = triangles[i][k];
+            if (v > externalBoundary)
+            {
+                std::pair<std::tr1::unordered_map<std::tr1::uint32_t, std::tr1::uint32_t>::iterator, bool> added
+                    = externalIds.insert(std::make_pair(v, numVertices));
+                if (added.second)
+                    numVertices++;
+                v = added.first->second;
             }
-            else
-                t[k] += offset;
+            indices[3 * i + k] = v;
         }
-        outTriangles[i * FastPly::Writer::triangleSize] = 3;
-        std::memcpy(outTriangles + i * FastPly::Writer::triangleSize + 1, &t, sizeof(t));
+
+    order.reserve(numTriangles, false);
+    optimizer(numVertices, numTriangles, indices.data(), order.data());
+
+    /* Number the internal vertices in order of first use. Any that are
+     * not used at all go at the end.
+     */
+    remap.reserve(numInternalVertices, false);
+    std::fill(remap.data(), remap.data() + numInternalVertices, badIndex);
+    sortedTriangles.reserve(numTriangles, false);
+    std::tr1::uint32_t nextVertex = 0;
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        triangle_type &t = sortedTriangles[i];
+        t = triangles[order[i]];
+        for (unsigned int k = 0; k < 3; k++)
+            if (t[k] <= externalBoundary)
+            {
+                if (remap[t[k]] == badIndex)
+                    remap[t[k]] = nextVertex++;
+                t[k] = remap[t[k]];
+            }
     }
+    for (std::size_t i = 0; i < numInternalVertices; i++)
+        if (remap[i] == badIndex)
+            remap[i] = nextVertex++;
+    assert(nextVertex == numInternalVertices);
+    std::copy(sortedTriangles.data(), sortedTriangles.data() + numTriangles, triangles);
+
+    sortedVertices.reserve(numInternalVertices * vertexSize, false);
+    for (std::size_t i = 0; i < numInternalVertices; i++)
+        std::memcpy(sortedVertices.data() + remap[i] * vertexSize, vertices + i * vertexSize, vertexSize);
+    std::memcpy(vertices, sortedVertices.data(), numInternalVertices * vertexSize);
 }
 
 void OOCMesher::writeChunkPrepare(
@@ -668,6 +1222,7 @@ void OOCMesher::writeChunkVertices(
     Timeplot::Worker &tworker,
     BinaryReader &verticesTmpRead,
     AsyncWriter &asyncWriter,
+    FastPly::Writer &writer,
     const Chunk &chunk,
     std::tr1::uint64_t thresholdVertices,
     const std::tr1::uint32_t *startVertex,
@@ -676,6 +1231,8 @@ void OOCMesher::writeChunkVertices(
 {
     Statistics::Timer timer("finalize.vertices.time");
     Statistics::Variable &readVerticesStat = Statistics::getStatistic<Statistics::Variable>("write.readVertices.time");
+    // The temporary file holds vertices in the same form as the output
+    const std::size_t vertexSize = writer.getVertexSize();
 
     for (std::size_t j = firstClump; j < lastClump; j++)
     {
@@ -684,22 +1241,42 @@ void OOCMesher::writeChunkVertices(
         if (clumps[cid].vertices >= thresholdVertices)
         {
             std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            if (j + 1 < lastClump)
+            {
+                // Start fetching the next clump while this one is processed
+                const Chunk::Clump &nc = chunk.clumps[j + 1];
+                if (clumps[UnionFind::findRoot(clumps, nc.globalId)].vertices >= thresholdVertices)
+                    verticesTmpRead.willNeed(
+                        nc.firstVertex * vertexSize,
+                        (nc.numInternalVertices + nc.numExternalVertices) * vertexSize);
+            }
             /* This test catches a corner case where a clump
              * contains only triangles built from previously emitted
              * external vertices.
              */
-            if (numVertices > 0)
+            if (numVertices > 0 && writer.canMap())
+            {
+                // Read straight into the output file
+                boost::scoped_ptr<BinaryWriter::Mapping> mapping(
+                    writer.mapVertices(startVertex[j], numVertices));
+                Statistics::Timer timer(readVerticesStat);
+                verticesTmpRead.read(
+                    mapping->get(),
+                    numVertices * vertexSize,
+                    cc.firstVertex * vertexSize);
+            }
+            else if (numVertices > 0)
             {
                 boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
-                    tworker, numVertices * sizeof(vertex_type));
+                    tworker, numVertices * vertexSize);
                 {
                     Statistics::Timer timer(readVerticesStat);
                     verticesTmpRead.read(
                         item->get(),
-                        numVertices * sizeof(vertex_type),
-                        cc.firstVertex * sizeof(vertex_type));
+                        numVertices * vertexSize,
+                        cc.firstVertex * vertexSize);
                 }
-                getWriter().writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
+                writer.writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
             }
             // Yes, numTriangles. That's easier to make add up to the total
             // than vertices (which share), and still a good indicator
@@ -714,6 +1291,7 @@ void OOCMesher::writeChunkTriangles(
     Timeplot::Worker &tworker,
     BinaryReader &trianglesTmpRead,
     AsyncWriter &asyncWriter,
+    FastPly::Writer &writer,
     const Chunk &chunk,
     std::tr1::uint64_t thresholdVertices,
     std::size_t chunkExternal,
@@ -735,10 +1313,32 @@ void OOCMesher::writeChunkTriangles(
         clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
         if (clumps[cid].vertices >= thresholdVertices)
         {
+            if (j + 1 < lastClump)
+            {
+                const Chunk::Clump &nc = chunk.clumps[j + 1];
+                if (clumps[UnionFind::findRoot(clumps, nc.globalId)].vertices >= thresholdVertices)
+                    trianglesTmpRead.willNeed(
+                        nc.firstTriangle * sizeof(triangle_type),
+                        nc.numTriangles * sizeof(triangle_type));
+            }
+
             triangles.reserve(cc.numTriangles, false);
-            boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
-                tworker, cc.numTriangles * FastPly::Writer::triangleSize);
-            std::tr1::uint8_t *raw = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+            /* If possible, the triangles are rewritten straight into the
+             * output file, otherwise they are staged for the async writer.
+             */
+            boost::scoped_ptr<BinaryWriter::Mapping> mapping;
+            boost::shared_ptr<AsyncWriterItem> item;
+            std::tr1::uint8_t *raw;
+            if (cc.numTriangles > 0 && writer.canMap())
+            {
+                mapping.reset(writer.mapTriangles(startTriangle[j], cc.numTriangles));
+                raw = reinterpret_cast<std::tr1::uint8_t *>(mapping->get());
+            }
+            else
+            {
+                item = asyncWriter.get(tworker, cc.numTriangles * FastPly::Writer::triangleSize);
+                raw = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+            }
             {
                 Statistics::Timer timer(readTrianglesStat);
                 trianglesTmpRead.read(
@@ -753,41 +1353,177 @@ void OOCMesher::writeChunkTriangles(
                 startVertex[j],
                 triangles.data(), raw);
 
-            getWriter().writeTrianglesRaw(tworker, startTriangle[j], cc.numTriangles, item, asyncWriter);
+            if (item)
+                writer.writeTrianglesRaw(tworker, startTriangle[j], cc.numTriangles, item, asyncWriter);
             if (progress != NULL)
                 *progress += cc.numTriangles;
         }
     }
 }
 
-std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+void OOCMesher::writeChunkCompact(
+    BinaryReader &verticesTmpRead,
+    BinaryReader &trianglesTmpRead,
+    CompactWriter &writer,
+    const Chunk &chunk,
+    std::tr1::uint64_t thresholdVertices,
+    std::size_t chunkExternal,
+    const std::tr1::uint32_t *startVertex,
+    const std::tr1::uint32_t *externalRemap,
+    Statistics::Container::PODBuffer<vertex_type> &vertices,
+    Statistics::Container::PODBuffer<triangle_type> &triangles,
+    ClumpOptimizer *optimizer,
+    ProgressMeter *progress)
 {
-    std::size_t outputFiles = 0;
-
-    Timeplot::Action writeAction("write", tworker, "finalize.time");
-    FastPly::Writer &writer = getWriter();
-
-    finalize(tworker);
-
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
-    verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
-    trianglesTmpRead->open(tmpWriter.getTrianglesPath());
-
-    std::tr1::uint64_t thresholdVertices;
-    clump_id keptComponents;
-    std::tr1::uint64_t keptVertices, keptTriangles;
-    getStatistics(thresholdVertices, keptComponents, keptVertices, keptTriangles);
+    // Compact output does not carry normals, so the temporary file holds bare positions
+    MLSGPU_ASSERT(!getWriter().hasNormals(), state_error);
 
-    std::size_t asyncMem = getAsyncMem(thresholdVertices);
+    Statistics::Timer timer("finalize.compact.time");
+    Statistics::Variable &readVerticesStat = Statistics::getStatistic<Statistics::Variable>("write.readVertices.time");
+    Statistics::Variable &readTrianglesStat = Statistics::getStatistic<Statistics::Variable>("write.readTriangles.time");
+    std::tr1::uint32_t externalBoundary = ~chunkExternal;
 
-    boost::scoped_ptr<ProgressDisplay> progress;
-    if (progressStream != NULL)
+    for (std::size_t j = 0; j < chunk.clumps.size(); j++)
     {
-        *progressStream << "\nWriting file(s)\n";
-        progress.reset(new ProgressDisplay(2 * keptTriangles, *progressStream));
-    }
-
+        const Chunk::Clump &cc = chunk.clumps[j];
+        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        if (clumps[cid].vertices >= thresholdVertices)
+        {
+            std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            if (numVertices > 0)
+            {
+                vertices.reserve(numVertices, false);
+                Statistics::Timer timer(readVerticesStat);
+                verticesTmpRead.read(
+                    vertices.data(),
+                    numVertices * sizeof(vertex_type),
+                    cc.firstVertex * sizeof(vertex_type));
+            }
+            if (cc.numTriangles > 0)
+            {
+                triangles.reserve(cc.numTriangles, false);
+                Statistics::Timer timer(readTrianglesStat);
+                trianglesTmpRead.read(
+                    triangles.data(),
+                    cc.numTriangles * sizeof(triangle_type),
+                    cc.firstTriangle * sizeof(triangle_type));
+            }
+            if (optimizer != NULL)
+            {
+                (*optimizer)(cc.numInternalVertices, cc.numTriangles, externalBoundary,
+                             sizeof(vertex_type), reinterpret_cast<char *>(vertices.data()),
+                             triangles.data());
+            }
+
+            if (numVertices > 0)
+                writer.writeVertices(startVertex[j], numVertices, &vertices[0][0]);
+            if (cc.numTriangles > 0)
+            {
+                for (std::size_t i = 0; i < cc.numTriangles; i++)
+                    remapTriangle(triangles[i], externalBoundary, externalRemap, startVertex[j]);
+                writer.writeTriangles(cc.numTriangles, &triangles[0][0]);
+            }
+
+            // Counted twice to match the progress of the PLY path
+            if (progress != NULL)
+                *progress += 2 * cc.numTriangles;
+        }
+    }
+}
+
+void OOCMesher::writeChunkOptimized(
+    BinaryReader &verticesTmpRead,
+    BinaryReader &trianglesTmpRead,
+    FastPly::Writer &writer,
+    const Chunk &chunk,
+    std::tr1::uint64_t thresholdVertices,
+    std::size_t chunkExternal,
+    const std::tr1::uint32_t *startVertex,
+    const FastPly::Writer::size_type *startTriangle,
+    const std::tr1::uint32_t *externalRemap,
+    ClumpOptimizer &optimizer,
+    Statistics::Container::PODBuffer<char> &vertices,
+    Statistics::Container::PODBuffer<triangle_type> &triangles,
+    ProgressMeter *progress)
+{
+    Statistics::Timer timer("finalize.optimized.time");
+    Statistics::Variable &readVerticesStat = Statistics::getStatistic<Statistics::Variable>("write.readVertices.time");
+    Statistics::Variable &readTrianglesStat = Statistics::getStatistic<Statistics::Variable>("write.readTriangles.time");
+    const std::size_t vertexSize = writer.getVertexSize();
+    std::tr1::uint32_t externalBoundary = ~chunkExternal;
+
+    for (std::size_t j = 0; j < chunk.clumps.size(); j++)
+    {
+        const Chunk::Clump &cc = chunk.clumps[j];
+        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        if (clumps[cid].vertices >= thresholdVertices)
+        {
+            std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            vertices.reserve(numVertices * vertexSize, false);
+            triangles.reserve(cc.numTriangles, false);
+            if (numVertices > 0)
+            {
+                Statistics::Timer timer(readVerticesStat);
+                verticesTmpRead.read(
+                    vertices.data(),
+                    numVertices * vertexSize,
+                    cc.firstVertex * vertexSize);
+            }
+            if (cc.numTriangles > 0)
+            {
+                Statistics::Timer timer(readTrianglesStat);
+                trianglesTmpRead.read(
+                    triangles.data(),
+                    cc.numTriangles * sizeof(triangle_type),
+                    cc.firstTriangle * sizeof(triangle_type));
+            }
+            optimizer(cc.numInternalVertices, cc.numTriangles, externalBoundary,
+                      vertexSize, vertices.data(), triangles.data());
+
+            if (numVertices > 0)
+                writer.writeVertices(startVertex[j], numVertices,
+                                     reinterpret_cast<const float *>(vertices.data()));
+            if (cc.numTriangles > 0)
+            {
+                for (std::size_t i = 0; i < cc.numTriangles; i++)
+                    remapTriangle(triangles[i], externalBoundary, externalRemap, startVertex[j]);
+                writer.writeTriangles(startTriangle[j], cc.numTriangles, &triangles[0][0]);
+            }
+
+            // Counted twice to match the progress of the unoptimized path
+            if (progress != NULL)
+                *progress += 2 * cc.numTriangles;
+        }
+    }
+}
+
+bool OOCMesher::WriteQueue::pop(ChunkWrite &task)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (error || next == tasks.size())
+        return false;
+    task = tasks[next++];
+    return true;
+}
+
+void OOCMesher::WriteQueue::fail(const boost::exception_ptr &e)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!error)
+        error = e;
+}
+
+void OOCMesher::writeChunks(
+    Timeplot::Worker &tworker,
+    FastPly::Writer &writer,
+    CompactWriter *compactWriter,
+    BinaryReader &verticesTmpRead,
+    BinaryReader &trianglesTmpRead,
+    AsyncWriter &asyncWriter,
+    std::tr1::uint64_t thresholdVertices,
+    WriteQueue &queue,
+    ProgressMeter *progress)
+{
     /* Maps from an linear enumeration of all external vertices of a chunk to
      * the final index in the file. It is badIndex for dropped vertices,
      * although that is not actually used and could be skipped. This is declared
@@ -799,55 +1535,198 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
     // Offset to first triangle of each clump in output file
     Statistics::Container::PODBuffer<FastPly::Writer::size_type> startTriangle("mem.OOCMesher::startTriangle");
     Statistics::Container::PODBuffer<triangle_type> triangles("mem.OOCMesher::triangles");
-
-    AsyncWriter asyncWriter(1, asyncMem * 2); // * 2 to allow overlapping
-    asyncWriter.start();
-
-    for (std::size_t i = 0; i < chunks.size(); i++)
+    Statistics::Container::PODBuffer<vertex_type> vertices("mem.OOCMesher::vertices");
+    Statistics::Container::PODBuffer<char> vertexData("mem.OOCMesher::vertexData");
+    boost::scoped_ptr<ClumpOptimizer> optimizer;
+    if (getOptimizeOrder())
+        optimizer.reset(new ClumpOptimizer);
+
+    ChunkWrite task;
+    while (queue.pop(task))
     {
-        const Chunk &chunk = chunks[i];
-        std::tr1::uint64_t chunkVertices, chunkTriangles, chunkExternal;
-        // Note: chunkExternal includes discarded clumps, the others exclude them
-        getChunkStatistics(thresholdVertices, chunk, chunkVertices, chunkTriangles, chunkExternal);
-
-        if (chunkTriangles > 0)
+        const Chunk &chunk = chunks[task.chunkIdx];
+        const std::string filename = getOutputName(chunk.chunkId);
+        try
         {
-            const std::string filename = getOutputName(chunk.chunkId);
-            try
+            writeChunkPrepare(
+                chunk, thresholdVertices, task.numExternal,
+                startVertex, startTriangle, externalRemap);
+
+            if (compactWriter != NULL)
+            {
+                compactWriter->setNumVertices(task.numVertices);
+                compactWriter->setNumTriangles(task.numTriangles);
+                compactWriter->setGrid(getChunkGrid(chunk.chunkId));
+                compactWriter->open(filename);
+
+                writeChunkCompact(
+                    verticesTmpRead, trianglesTmpRead, *compactWriter, chunk,
+                    thresholdVertices, task.numExternal,
+                    startVertex.data(), externalRemap.data(),
+                    vertices, triangles, optimizer.get(), progress);
+
+                compactWriter->close();
+            }
+            else
             {
-                writer.setNumVertices(chunkVertices);
-                writer.setNumTriangles(chunkTriangles);
+                writer.setNumVertices(task.numVertices);
+                writer.setNumTriangles(task.numTriangles);
                 writer.open(filename);
-                outputFiles++;
 
-                writeChunkPrepare(
-                    chunk, thresholdVertices, chunkExternal,
-                    startVertex, startTriangle, externalRemap);
-
-                writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, startVertex.data(), progress.get(),
-                    0, chunk.clumps.size());
-
-                writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, chunkExternal,
-                    startVertex.data(), startTriangle.data(), externalRemap.data(),
-                    triangles, progress.get(),
-                    0, chunk.clumps.size());
+                if (optimizer)
+                {
+                    writeChunkOptimized(
+                        verticesTmpRead, trianglesTmpRead, writer, chunk,
+                        thresholdVertices, task.numExternal,
+                        startVertex.data(), startTriangle.data(), externalRemap.data(),
+                        *optimizer, vertexData, triangles, progress);
+                }
+                else
+                {
+                    writeChunkVertices(
+                        tworker, verticesTmpRead, asyncWriter, writer, chunk,
+                        thresholdVertices, startVertex.data(), progress,
+                        0, chunk.clumps.size());
+
+                    writeChunkTriangles(
+                        tworker, trianglesTmpRead, asyncWriter, writer, chunk,
+                        thresholdVertices, task.numExternal,
+                        startVertex.data(), startTriangle.data(), externalRemap.data(),
+                        triangles, progress,
+                        0, chunk.clumps.size());
+                }
 
                 writer.close();
             }
-            catch (std::ios::failure &e)
+        }
+        catch (std::ios::failure &e)
+        {
+            /* The file name is attached here if the thrower did not do so.
+             * Any errno was recorded by the thrower: it cannot be trusted
+             * this far from the failing call.
+             */
+            boost::exception *be = dynamic_cast<boost::exception *>(&e);
+            if (be == NULL)
+                queue.fail(boost::copy_exception(
+                        boost::enable_error_info(e) << boost::errinfo_file_name(filename)));
+            else
             {
-                throw boost::enable_error_info(e)
-                    << boost::errinfo_file_name(filename)
-                    << boost::errinfo_errno(errno);
+                if (boost::get_error_info<boost::errinfo_file_name>(*be) == NULL)
+                    *be << boost::errinfo_file_name(filename);
+                queue.fail(boost::current_exception());
             }
+            return;
+        }
+        catch (...)
+        {
+            queue.fail(boost::current_exception());
+            return;
+        }
+    }
+}
+
+void OOCMesher::writeChunksThread(
+    unsigned int idx,
+    BinaryReader *verticesTmpRead,
+    BinaryReader *trianglesTmpRead,
+    AsyncWriter *asyncWriter,
+    std::tr1::uint64_t thresholdVertices,
+    WriteQueue *queue,
+    ProgressMeter *progress)
+{
+    Timeplot::Worker tworker("finalize", idx);
+    // Copies of the writers, so that several files can be open at once
+    FastPly::Writer writer(getWriter());
+    boost::scoped_ptr<CompactWriter> compactWriter;
+    if (getCompactWriter() != NULL)
+        compactWriter.reset(new CompactWriter(*getCompactWriter()));
+    writeChunks(tworker, writer, compactWriter.get(), *verticesTmpRead, *trianglesTmpRead, *asyncWriter,
+                thresholdVertices, *queue, progress);
+}
+
+std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+{
+    Timeplot::Action writeAction("write", tworker, "finalize.time");
+
+    finalize(tworker);
+
+    std::tr1::uint64_t thresholdVertices;
+    clump_id keptComponents;
+    std::tr1::uint64_t keptVertices, keptTriangles;
+    getStatistics(thresholdVertices, keptComponents, keptVertices, keptTriangles);
+
+    WriteQueue queue;
+    for (std::size_t i = 0; i < chunks.size(); i++)
+    {
+        ChunkWrite task;
+        task.chunkIdx = i;
+        // Note: numExternal includes discarded clumps, the others exclude them
+        getChunkStatistics(thresholdVertices, chunks[i], task.numVertices, task.numTriangles, task.numExternal);
+        if (task.numTriangles > 0)
+            queue.tasks.push_back(task);
+    }
+
+    const unsigned int numThreads = std::max(1U, std::min(
+        getWriterThreads(), (unsigned int) std::max(std::size_t(1), queue.tasks.size())));
+    if (numThreads > 1)
+    {
+        /* Fully compress the union-find trees, so that the threads can
+         * query it without modifying it.
+         */
+        for (clump_id i = 0; i < clump_id(clumps.size()); i++)
+            UnionFind::findRoot(clumps, i);
+    }
+
+    boost::ptr_vector<BinaryReader> verticesTmpRead, trianglesTmpRead;
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        verticesTmpRead.push_back(tmpWriter.openVertices());
+        trianglesTmpRead.push_back(tmpWriter.openTriangles());
+    }
+
+    /* When the output can be filled in place or is written synchronously
+     * (compact or optimized output), the async writer is only needed as a
+     * fallback, so it does not need much memory.
+     */
+    std::size_t asyncMem = getWriter().canMap() || getCompactWriter() != NULL || getOptimizeOrder()
+        ? 4096 : getAsyncMem(thresholdVertices);
+
+    boost::scoped_ptr<ProgressDisplay> progress;
+    if (progressStream != NULL)
+    {
+        *progressStream << "\nWriting file(s)\n";
+        progress.reset(new ProgressDisplay(2 * keptTriangles, *progressStream));
+    }
+
+    // * 2 to allow overlapping
+    AsyncWriter asyncWriter(numThreads, asyncMem * 2 * numThreads);
+    asyncWriter.start();
+
+    if (numThreads == 1)
+    {
+        writeChunks(tworker, getWriter(), getCompactWriter(), verticesTmpRead[0], trianglesTmpRead[0],
+                    asyncWriter, thresholdVertices, queue, progress.get());
+    }
+    else
+    {
+        boost::thread_group threads;
+        for (unsigned int i = 0; i < numThreads; i++)
+        {
+            threads.create_thread(boost::bind(
+                    &OOCMesher::writeChunksThread, this, i,
+                    &verticesTmpRead[i], &trianglesTmpRead[i], &asyncWriter,
+                    thresholdVertices, &queue, progress.get()));
         }
+        threads.join_all();
     }
     asyncWriter.stop();
+
+    if (queue.error)
+        boost::rethrow_exception(queue.error);
+
+    const std::size_t outputFiles = queue.tasks.size();
     Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+    keepPartial = false; // any partial checkpoint is now obsolete
     return outputFiles;
 }
 
@@ -858,10 +1737,12 @@ void OOCMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::p
 
     try
     {
-        boost::filesystem::ofstream dump(path);
+        boost::filesystem::ofstream dump(path, std::ios::binary);
         if (!dump)
             throw std::ios::failure("Could not open file");
-        boost::archive::text_oarchive archive(dump);
+        boost::archive::binary_oarchive archive(dump);
+        const bool partial = false;
+        archive << partial;
         archive << *this;
         dump.close();
     }
@@ -881,10 +1762,14 @@ std::size_t OOCMesher::resume(
     retainFiles = true; // to allow resume to be re-run
     try
     {
-        boost::filesystem::ifstream dump(path);
+        boost::filesystem::ifstream dump(path, std::ios::binary);
         if (!dump)
             throw std::ios::failure("Could not open file");
-        boost::archive::text_iarchive archive(dump);
+        boost::archive::binary_iarchive archive(dump);
+        bool partial;
+        archive >> partial;
+        if (partial)
+            throw std::runtime_error(path.string() + " was written part-way through a run");
         archive >> *this;
         dump.close();
     }
@@ -897,6 +1782,810 @@ std::size_t OOCMesher::resume(
     return write(tworker, progressStream);
 }
 
+void OOCMesher::checkpointPartial(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    std::tr1::uint64_t completedBins)
+{
+    Timeplot::Action checkpointAction("checkpoint", tworker, "checkpoint.partial.time");
+
+    /* Get everything received so far into the temporary files. Stopping the
+     * writer closes the files, which ensures that it has all reached the OS.
+     */
+    flushBuffer(tworker);
+    tmpWriter.stop();
+    if (!keysPath.empty())
+    {
+        keysFile.flush();
+        if (!keysFile)
+        {
+            throw boost::enable_error_info(std::ios::failure("Could not write temporary file"))
+                << boost::errinfo_errno(errno)
+                << boost::errinfo_file_name(keysPath.string());
+        }
+    }
+    keepPartial = true;
+
+    /* Write to a separate file and rename it over the old one, so that a
+     * failure part-way through does not lose the previous checkpoint.
+     */
+    const boost::filesystem::path tmpPath(path.string() + ".tmp");
+    try
+    {
+        boost::filesystem::ofstream dump(tmpPath, std::ios::binary);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        {
+            boost::archive::binary_oarchive archive(dump);
+            const bool partial = true;
+            archive << partial;
+            archive << completedBins;
+            serializePartial(archive);
+        }
+        dump.close();
+        if (!dump)
+            throw std::ios::failure("Could not write file");
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(tmpPath.string());
+    }
+    boost::filesystem::rename(tmpPath, path);
+
+    tmpWriter.restart(writtenVerticesTmp * tmpVertexSize(), writtenTrianglesTmp * sizeof(triangle_type));
+}
+
+std::tr1::uint64_t OOCMesher::resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    std::tr1::uint64_t completedBins;
+    try
+    {
+        boost::filesystem::ifstream dump(path, std::ios::binary);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        boost::archive::binary_iarchive archive(dump);
+        bool partial;
+        archive >> partial;
+        if (!partial)
+            throw std::runtime_error(path.string() + " was not written part-way through a run");
+        archive >> completedBins;
+        serializePartial(archive);
+        dump.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+
+    if (!keysPath.empty())
+    {
+        std::tr1::uint64_t keys = 0;
+        BOOST_FOREACH(std::tr1::uint64_t run, keyRuns)
+            keys += run;
+        reopenTmpFile(keysPath, keys * sizeof(key_record_type), keysFile);
+    }
+    // The checkpoint may be needed again if this run fails
+    keepPartial = true;
+    resumedPartial = true;
+    return completedBins;
+}
+
+bool isPartialCheckpoint(const boost::filesystem::path &path)
+{
+    try
+    {
+        boost::filesystem::ifstream dump(path, std::ios::binary);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        boost::archive::binary_iarchive archive(dump);
+        bool partial;
+        archive >> partial;
+        return partial;
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+}
+
+RecomputeMesher::PendingBlock::PendingBlock(const ChunkId &chunkId, const HostKeyMesh &in)
+    : chunkId(chunkId), storage("mem.RecomputeMesher::pendingBlocks")
+{
+    storage.reserve((in.getHostBytes() + sizeof(cl_ulong) - 1) / sizeof(cl_ulong), false);
+    mesh = HostKeyMesh(storage.data(), in);
+    std::copy(in.vertices, in.vertices + in.numVertices(), mesh.vertices);
+    std::copy(in.triangles, in.triangles + in.numTriangles(), mesh.triangles);
+    std::copy(in.vertexKeys, in.vertexKeys + in.numExternalVertices(), mesh.vertexKeys);
+}
+
+RecomputeMesher::RecomputeMesher(FastPly::Writer &writer, const Namer &namer)
+    : OOCMesher(writer, namer),
+    chunkOutputs("mem.RecomputeMesher::chunkOutputs"),
+    pendingBlocks("mem.RecomputeMesher::pendingBlocks"),
+    thresholdVertices(0), maxBlockBytes(1),
+    curChunk(0), curTriangles(0), nextVertex(0), nextTriangle(0), outputFiles(0)
+{
+}
+
+RecomputeMesher::~RecomputeMesher()
+{
+    if (asyncWriter && asyncWriter->running())
+        asyncWriter->stop();
+}
+
+void RecomputeMesher::countLocalClumps(
+    Chunk &chunk,
+    const Scratch &scratch,
+    clump_id clumpIdFirst,
+    const HostKeyMesh &mesh)
+{
+    const std::size_t numInternalVertices = mesh.numInternalVertices();
+    const clump_id numClumps = scratch.clumps.size();
+
+    for (clump_id cid = 0; cid < numClumps; cid++)
+    {
+        std::size_t clumpInternalVertices = 0;
+        std::size_t clumpExternalVertices = 0;
+        for (std::tr1::int32_t vid = scratch.firstVertex[cid]; vid != -1; vid = scratch.nextVertex[vid])
+        {
+            if (std::size_t(vid) >= numInternalVertices)
+            {
+                // The value is not used, only the presence of the key
+                if (chunk.vertexIdMap.insert(mesh.vertexKeys[vid - numInternalVertices], 0).second)
+                    clumpExternalVertices++;
+            }
+            else
+                clumpInternalVertices++;
+        }
+        chunk.clumps.push_back(Chunk::Clump(
+                0, clumpInternalVertices, clumpExternalVertices,
+                0, scratch.clumps[cid].triangles,
+                cid + clumpIdFirst));
+    }
+}
+
+void RecomputeMesher::count(MesherWork &work, Timeplot::Worker &tworker)
+{
+    (void) tworker;
+    boost::shared_ptr<Scratch> scratch = acquireScratch();
+
+    HostKeyMesh &mesh = work.mesh;
+
+    if (work.hasEvents)
+        work.trianglesEvent.wait();
+    computeLocalComponents(mesh.numVertices(), mesh.numTriangles(), mesh.triangles, scratch->nodes);
+    computeLocalClumps(mesh.numTriangles(), scratch->nodes, mesh.triangles, scratch->clumpId, scratch->clumps);
+    linkLocalClumps(*scratch, mesh);
+
+    if (work.hasEvents)
+    {
+        work.vertexKeysEvent.wait();
+        // The vertices are not needed, but the buffer may not be recycled while they are in flight
+        work.verticesEvent.wait();
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (work.chunkId.gen >= chunks.size())
+            chunks.resize(work.chunkId.gen + 1);
+        Chunk &chunk = chunks[work.chunkId.gen];
+        chunk.chunkId = work.chunkId;
+
+        clump_id clumpIdFirst = updateGlobalClumps(scratch->clumps);
+        updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys,
+                          scratch->clumpId, clumpIdFirst);
+        countLocalClumps(chunk, *scratch, clumpIdFirst, mesh);
+
+        maxBlockBytes = std::max(maxBlockBytes, std::size_t(mesh.numVertices() * FastPly::Writer::vertexSize));
+        maxBlockBytes = std::max(maxBlockBytes, std::size_t(mesh.numTriangles() * FastPly::Writer::triangleSize));
+    }
+
+    releaseScratch(scratch);
+}
+
+void RecomputeMesher::finishCounting()
+{
+    resolveClumpKeys();
+
+    clump_id keptComponents;
+    std::tr1::uint64_t keptVertices, keptTriangles;
+    getStatistics(thresholdVertices, keptComponents, keptVertices, keptTriangles);
+
+    chunkOutputs.clear();
+    chunkOutputs.resize(chunks.size());
+    for (std::size_t i = 0; i < chunks.size(); i++)
+    {
+        Chunk &chunk = chunks[i];
+        ChunkOutput &out = chunkOutputs[i];
+        std::tr1::uint64_t chunkExternal;
+        getChunkStatistics(thresholdVertices, chunk, out.keptVertices, out.keptTriangles, chunkExternal);
+        BOOST_FOREACH(const Chunk::Clump &cc, chunk.clumps)
+        {
+            out.totalTriangles += cc.numTriangles;
+        }
+
+        // The second pass rebuilds the map, this time holding output indices
+        chunk.clumps.clear();
+        chunk.vertexIdMap.clear();
+        chunk.numExternalVertices = 0;
+    }
+}
+
+bool RecomputeMesher::keepClump(const Scratch &scratch, clump_id cid, const HostKeyMesh &mesh) const
+{
+    const std::size_t numInternalVertices = mesh.numInternalVertices();
+    for (std::tr1::int32_t vid = scratch.firstVertex[cid]; vid != -1; vid = scratch.nextVertex[vid])
+    {
+        if (std::size_t(vid) >= numInternalVertices)
+        {
+            const clump_id *gid = clumpIdMap.find(mesh.vertexKeys[vid - numInternalVertices]);
+            if (gid == NULL)
+            {
+                Log::log[Log::error] << "A vertex was generated in the second pass but not the first.\n";
+                std::exit(1);
+            }
+            return clumps[UnionFind::findRoot(clumps, *gid)].vertices >= thresholdVertices;
+        }
+    }
+    // A clump with no external vertices is a whole component
+    return scratch.clumps[cid].vertices >= thresholdVertices;
+}
+
+void RecomputeMesher::openChunk()
+{
+    while (curChunk < chunks.size() && chunkOutputs[curChunk].totalTriangles == 0)
+        curChunk++;
+    curTriangles = 0;
+    nextVertex = 0;
+    nextTriangle = 0;
+    if (curChunk == chunks.size())
+        return;
+
+    const ChunkOutput &out = chunkOutputs[curChunk];
+    if (out.keptTriangles > 0)
+    {
+        FastPly::Writer &writer = getWriter();
+        const std::string filename = getOutputName(chunks[curChunk].chunkId);
+        try
+        {
+            writer.setNumVertices(out.keptVertices);
+            writer.setNumTriangles(out.keptTriangles);
+            writer.open(filename);
+            outputFiles++;
+        }
+        catch (std::ios::failure &e)
+        {
+            // This is usually called from a worker thread, which cannot throw
+            Log::log[Log::error] << "Failed to open " << filename << ": "
+                << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+            std::exit(1);
+        }
+    }
+}
+
+void RecomputeMesher::writeBlock(Scratch &scratch, const HostKeyMesh &mesh, Timeplot::Worker &tworker)
+{
+    FastPly::Writer &writer = getWriter();
+    Chunk &chunk = chunks[curChunk];
+    const std::size_t numInternalVertices = mesh.numInternalVertices();
+    const clump_id numClumps = scratch.clumps.size();
+    const FastPly::Writer::size_type firstVertex = nextVertex;
+    const FastPly::Writer::size_type firstTriangle = nextTriangle;
+
+    std::vector<bool> keep(numClumps);
+    scratch.vertexLabel.reserve(mesh.numVertices(), false);
+
+    /* Assign output indices. Vertices that are new to the output file are
+     * given consecutive indices starting from firstVertex, while external
+     * vertices already written by an earlier block keep their index.
+     */
+    for (clump_id cid = 0; cid < numClumps; cid++)
+    {
+        keep[cid] = keepClump(scratch, cid, mesh);
+        if (!keep[cid])
+            continue;
+        for (std::tr1::int32_t vid = scratch.firstVertex[cid]; vid != -1; vid = scratch.nextVertex[vid])
+        {
+            if (std::size_t(vid) >= numInternalVertices)
+            {
+                std::pair<std::tr1::uint32_t *, bool> added = chunk.vertexIdMap.insert(
+                    mesh.vertexKeys[vid - numInternalVertices], (std::tr1::uint32_t) nextVertex);
+                if (added.second)
+                    nextVertex++;
+                scratch.vertexLabel[vid] = *added.first;
+            }
+            else
+                scratch.vertexLabel[vid] = nextVertex++;
+        }
+        nextTriangle += scratch.clumps[cid].triangles;
+    }
+
+    if (nextVertex > firstVertex)
+    {
+        const std::size_t numVertices = nextVertex - firstVertex;
+        boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(
+            tworker, numVertices * FastPly::Writer::vertexSize);
+        vertex_type *out = reinterpret_cast<vertex_type *>(item->get());
+        for (clump_id cid = 0; cid < numClumps; cid++)
+        {
+            if (!keep[cid])
+                continue;
+            for (std::tr1::int32_t vid = scratch.firstVertex[cid]; vid != -1; vid = scratch.nextVertex[vid])
+                if (scratch.vertexLabel[vid] >= firstVertex)
+                    out[scratch.vertexLabel[vid] - firstVertex] = mesh.vertices[vid];
+        }
+        writer.writeVertices(tworker, firstVertex, numVertices, item, *asyncWriter);
+    }
+
+    if (nextTriangle > firstTriangle)
+    {
+        const std::size_t numTriangles = nextTriangle - firstTriangle;
+        boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(
+            tworker, numTriangles * FastPly::Writer::triangleSize);
+        std::tr1::uint8_t *out = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+        for (clump_id cid = 0; cid < numClumps; cid++)
+        {
+            if (!keep[cid])
+                continue;
+            for (std::tr1::int32_t tid = scratch.firstTriangle[cid]; tid != -1; tid = scratch.nextTriangle[tid])
+            {
+                triangle_type t;
+                for (int j = 0; j < 3; j++)
+                    t[j] = scratch.vertexLabel[mesh.triangles[tid][j]];
+                *out = 3;
+                std::memcpy(out + 1, &t, sizeof(t));
+                out += FastPly::Writer::triangleSize;
+            }
+        }
+        writer.writeTrianglesRaw(tworker, firstTriangle, numTriangles, item, *asyncWriter);
+    }
+}
+
+void RecomputeMesher::emitBlock(Scratch &scratch, const HostKeyMesh &mesh, Timeplot::Worker &tworker)
+{
+    writeBlock(scratch, mesh, tworker);
+    curTriangles += mesh.numTriangles();
+
+    while (curChunk < chunks.size() && curTriangles == chunkOutputs[curChunk].totalTriangles)
+    {
+        FastPly::Writer &writer = getWriter();
+        if (writer.isOpen())
+            writer.close();
+        chunks[curChunk].vertexIdMap.clear();
+        curChunk++;
+        openChunk();
+
+        // Catch up on blocks that arrived early for the new chunk
+        std::size_t i = 0;
+        while (i < pendingBlocks.size() && curChunk < chunks.size())
+        {
+            if (pendingBlocks[i]->chunkId.gen == curChunk)
+            {
+                boost::shared_ptr<PendingBlock> block = pendingBlocks[i];
+                pendingBlocks[i] = pendingBlocks.back();
+                pendingBlocks.pop_back();
+
+                const HostKeyMesh &pmesh = block->mesh;
+                computeLocalComponents(pmesh.numVertices(), pmesh.numTriangles(), pmesh.triangles, scratch.nodes);
+                computeLocalClumps(pmesh.numTriangles(), scratch.nodes, pmesh.triangles, scratch.clumpId, scratch.clumps);
+                linkLocalClumps(scratch, pmesh);
+                writeBlock(scratch, pmesh, tworker);
+                curTriangles += pmesh.numTriangles();
+            }
+            else
+                i++;
+        }
+    }
+}
+
+void RecomputeMesher::emit(MesherWork &work, Timeplot::Worker &tworker)
+{
+    HostKeyMesh &mesh = work.mesh;
+    if (work.hasEvents)
+    {
+        work.trianglesEvent.wait();
+        work.vertexKeysEvent.wait();
+        work.verticesEvent.wait();
+    }
+    if (mesh.numTriangles() == 0)
+        return; // nothing to write, and does not count towards completing the chunk
+
+    boost::shared_ptr<Scratch> scratch = acquireScratch();
+    computeLocalComponents(mesh.numVertices(), mesh.numTriangles(), mesh.triangles, scratch->nodes);
+    computeLocalClumps(mesh.numTriangles(), scratch->nodes, mesh.triangles, scratch->clumpId, scratch->clumps);
+    linkLocalClumps(*scratch, mesh);
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (work.chunkId.gen == curChunk)
+            emitBlock(*scratch, mesh, tworker);
+        else if (work.chunkId.gen > curChunk && work.chunkId.gen < chunks.size())
+        {
+            Statistics::getStatistic<Statistics::Counter>("mesher.pending").add(1);
+            pendingBlocks.push_back(boost::make_shared<PendingBlock>(work.chunkId, mesh));
+        }
+        else
+        {
+            Log::log[Log::error] << "A block was generated in the second pass but not the first.\n";
+            std::exit(1);
+        }
+    }
+
+    releaseScratch(scratch);
+}
+
+MesherBase::InputFunctor RecomputeMesher::functor(unsigned int pass)
+{
+    assert(pass < 2);
+    if (pass == 0)
+    {
+        // The map of shared vertices must survive until the second pass
+        setKeysCapacity(0);
+        return boost::bind(&RecomputeMesher::count, this, _1, _2);
+    }
+    else
+    {
+        finishCounting();
+        asyncWriter.reset(new AsyncWriter(1, maxBlockBytes * 2)); // * 2 to allow overlapping
+        asyncWriter->start();
+        curChunk = 0;
+        outputFiles = 0;
+        openChunk();
+        return boost::bind(&RecomputeMesher::emit, this, _1, _2);
+    }
+}
+
+std::size_t RecomputeMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+{
+    (void) progressStream; // the output was written during the second pass
+    Timeplot::Action writeAction("write", tworker, "finalize.time");
+
+    if (curChunk != chunks.size() || !pendingBlocks.empty())
+        throw std::runtime_error("Some blocks were generated in the first pass but not the second");
+    asyncWriter->stop();
+    asyncWriter.reset();
+
+    Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+    return outputFiles;
+}
+
+void RecomputeMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    (void) path;
+    throw std::logic_error("RecomputeMesher does not support checkpointing");
+}
+
+std::size_t RecomputeMesher::resume(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    std::ostream *progressStream)
+{
+    (void) tworker;
+    (void) path;
+    (void) progressStream;
+    throw std::logic_error("RecomputeMesher does not support checkpointing");
+}
+
+void RecomputeMesher::checkpointPartial(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    std::tr1::uint64_t completedBins)
+{
+    (void) tworker;
+    (void) path;
+    (void) completedBins;
+    throw std::logic_error("RecomputeMesher does not support checkpointing");
+}
+
+std::tr1::uint64_t RecomputeMesher::resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    (void) path;
+    throw std::logic_error("RecomputeMesher does not support checkpointing");
+}
+
+StreamMesher::Chunk::Chunk(const ChunkId &chunkId)
+    : chunkId(chunkId), numVertices(0), numTriangles(0),
+    triangleRanges("mem.StreamMesher::triangleRanges"),
+    vertexIdMap("mem.mesher.vertexIdMap")
+{
+}
+
+StreamMesher::StreamMesher(FastPly::Writer &writer, const Namer &namer)
+    : MesherBase(writer, namer),
+    chunks("mem.StreamMesher::chunks"),
+    writtenTrianglesTmp(0), maxItemBytes(0)
+{
+}
+
+StreamMesher::~StreamMesher()
+{
+    if (asyncWriter && asyncWriter->running())
+        asyncWriter->stop();
+
+    if (!trianglesPath.empty())
+    {
+        if (trianglesFile)
+            trianglesFile->close();
+        boost::system::error_code ec;
+        remove(trianglesPath, ec);
+        if (ec)
+            Log::log[Log::warn] << "Could not delete " << trianglesPath.string() << ": " << ec.message() << std::endl;
+    }
+}
+
+StreamMesher::Chunk &StreamMesher::getChunk(const ChunkId &chunkId)
+{
+    if (chunkId.gen >= chunks.size())
+        chunks.resize(chunkId.gen + 1);
+    boost::shared_ptr<Chunk> &chunk = chunks[chunkId.gen];
+    if (!chunk)
+    {
+        chunk = boost::make_shared<Chunk>(chunkId);
+        // A copy of the writer, so that several files can be open at once
+        chunk->writer = boost::make_shared<FastPly::Writer>(getWriter());
+        const std::string filename = getOutputName(chunkId);
+        try
+        {
+            chunk->writer->openUnsized(filename);
+        }
+        catch (std::ios::failure &e)
+        {
+            // This is called from a worker thread, which cannot throw
+            Log::log[Log::error] << "Failed to open " << filename << ": "
+                << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+            std::exit(1);
+        }
+    }
+    return *chunk;
+}
+
+void StreamMesher::add(MesherWork &work, Timeplot::Worker &tworker)
+{
+    HostKeyMesh &mesh = work.mesh;
+    if (work.hasEvents)
+    {
+        work.trianglesEvent.wait();
+        work.vertexKeysEvent.wait();
+        work.verticesEvent.wait();
+    }
+    if (mesh.numTriangles() == 0)
+        return;
+
+    const std::size_t numVertices = mesh.numVertices();
+    const std::size_t numInternalVertices = mesh.numInternalVertices();
+    const std::size_t numExternalVertices = mesh.numExternalVertices();
+    const std::size_t numTriangles = mesh.numTriangles();
+
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vertexLabel("mem.StreamMesher::vertexLabel");
+    vertexLabel.reserve(numVertices, false);
+
+    Chunk *chunk;
+    std::tr1::uint64_t firstVertex, nextVertex, firstTriangle;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        chunk = &getChunk(work.chunkId);
+
+        firstVertex = chunk->numVertices;
+        if (firstVertex + numVertices > std::tr1::uint64_t(std::numeric_limits<std::tr1::uint32_t>::max()) + 1)
+        {
+            Log::log[Log::error] << "Too many vertices in " << getOutputName(work.chunkId) << std::endl;
+            std::exit(1);
+        }
+
+        /* Vertices that are new to the output file are given consecutive
+         * indices starting from firstVertex (internal vertices first), while
+         * external vertices already written by an earlier block keep their
+         * index. New indices thus increase with the position in the block.
+         */
+        nextVertex = firstVertex;
+        for (std::size_t i = 0; i < numInternalVertices; i++)
+            vertexLabel[i] = nextVertex++;
+        for (std::size_t i = 0; i < numExternalVertices; i++)
+        {
+            std::pair<std::tr1::uint32_t *, bool> added = chunk->vertexIdMap.insert(
+                mesh.vertexKeys[i], (std::tr1::uint32_t) nextVertex);
+            if (added.second)
+                nextVertex++;
+            vertexLabel[numInternalVertices + i] = *added.first;
+        }
+        chunk->numVertices = nextVertex;
+
+        firstTriangle = writtenTrianglesTmp;
+        writtenTrianglesTmp += numTriangles;
+        chunk->numTriangles += numTriangles;
+        if (!chunk->triangleRanges.empty() && chunk->triangleRanges.back().second == firstTriangle)
+            chunk->triangleRanges.back().second = writtenTrianglesTmp;
+        else
+            chunk->triangleRanges.push_back(std::make_pair(firstTriangle, writtenTrianglesTmp));
+    }
+
+    /* The writes to disjoint parts of the files can proceed without the lock.
+     * They are split into pieces so that large blocks do not need a
+     * correspondingly large buffer.
+     */
+    const std::size_t pieceVertices = maxItemBytes / FastPly::Writer::vertexSize;
+    std::size_t vid = 0;
+    for (std::tr1::uint64_t first = firstVertex; first < nextVertex; first += pieceVertices)
+    {
+        const std::size_t count = std::min(std::tr1::uint64_t(pieceVertices), nextVertex - first);
+        boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(
+            tworker, count * FastPly::Writer::vertexSize);
+        vertex_type *out = reinterpret_cast<vertex_type *>(item->get());
+        for (std::size_t i = 0; i < count; vid++)
+            if (vertexLabel[vid] >= firstVertex)
+                out[i++] = mesh.vertices[vid];
+        chunk->writer->writeVertices(tworker, first, count, item, *asyncWriter);
+    }
+
+    const std::size_t pieceTriangles = maxItemBytes / FastPly::Writer::triangleSize;
+    for (std::size_t first = 0; first < numTriangles; first += pieceTriangles)
+    {
+        const std::size_t count = std::min(pieceTriangles, numTriangles - first);
+        const std::size_t bytes = count * FastPly::Writer::triangleSize;
+        boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(tworker, bytes);
+        std::tr1::uint8_t *out = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+        for (std::size_t i = first; i < first + count; i++)
+        {
+            triangle_type t;
+            for (int j = 0; j < 3; j++)
+                t[j] = vertexLabel[mesh.triangles[i][j]];
+            *out = 3;
+            std::memcpy(out + 1, &t, sizeof(t));
+            out += FastPly::Writer::triangleSize;
+        }
+        asyncWriter->push(tworker, item, trianglesFile, bytes,
+                          (firstTriangle + first) * FastPly::Writer::triangleSize);
+    }
+}
+
+MesherBase::InputFunctor StreamMesher::functor(unsigned int pass)
+{
+    assert(pass == 0);
+    (void) pass;
+
+    boost::filesystem::ofstream out;
+    createTmpFile(trianglesPath, out);
+    out.close();
+    trianglesFile.reset(createWriter(SYSCALL_WRITER));
+    trianglesFile->open(trianglesPath);
+
+    /* There is no reorder buffer, so the same memory is used to buffer the
+     * writes instead. Individual writes are kept to a fraction of it so that
+     * several mesher threads can have writes in flight.
+     */
+    const std::size_t bufferBytes = std::max(getReorderCapacity(), std::size_t(1024 * 1024));
+    maxItemBytes = bufferBytes / 4;
+    asyncWriter.reset(new AsyncWriter(1, bufferBytes));
+    asyncWriter->start();
+    return boost::bind(&StreamMesher::add, this, _1, _2);
+}
+
+std::size_t StreamMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+{
+    std::size_t outputFiles = 0;
+    Timeplot::Action writeAction("write", tworker, "finalize.time");
+
+    if (asyncWriter)
+    {
+        asyncWriter->stop();
+        asyncWriter.reset();
+    }
+    if (!trianglesFile)
+        return 0;
+    trianglesFile->close();
+    trianglesFile.reset();
+
+    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
+    trianglesTmpRead->open(trianglesPath);
+
+    boost::scoped_ptr<ProgressDisplay> progress;
+    if (progressStream != NULL)
+    {
+        *progressStream << "\nWriting file(s)\n";
+        progress.reset(new ProgressDisplay(writtenTrianglesTmp, *progressStream));
+    }
+
+    const std::size_t bufferTriangles = 1024 * 1024;
+    Statistics::Container::PODBuffer<std::tr1::uint8_t> buffer("mem.StreamMesher::buffer");
+    buffer.reserve(bufferTriangles * FastPly::Writer::triangleSize, false);
+
+    BOOST_FOREACH(const boost::shared_ptr<Chunk> &chunk, chunks)
+    {
+        if (!chunk)
+            continue;
+        FastPly::Writer &writer = *chunk->writer;
+        const std::string filename = getOutputName(chunk->chunkId);
+        try
+        {
+            writer.setFinalCounts(chunk->numVertices, chunk->numTriangles);
+            FastPly::Writer::size_type pos = 0;
+            typedef std::pair<std::tr1::uint64_t, std::tr1::uint64_t> range_type;
+            BOOST_FOREACH(const range_type &range, chunk->triangleRanges)
+            {
+                for (std::tr1::uint64_t first = range.first; first < range.second; first += bufferTriangles)
+                {
+                    const std::size_t count = std::min(std::tr1::uint64_t(bufferTriangles), range.second - first);
+                    trianglesTmpRead->read(buffer.data(), count * FastPly::Writer::triangleSize,
+                                           first * FastPly::Writer::triangleSize);
+                    writer.writeTrianglesRaw(pos, count, buffer.data());
+                    pos += count;
+                    if (progress)
+                        *progress += count;
+                }
+            }
+            writer.close();
+            outputFiles++;
+        }
+        catch (std::ios::failure &e)
+        {
+            throw boost::enable_error_info(e)
+                << boost::errinfo_file_name(filename)
+                << boost::errinfo_errno(errno);
+        }
+    }
+
+    Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+    return outputFiles;
+}
+
+void StreamMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    (void) path;
+    throw std::logic_error("StreamMesher does not support checkpointing");
+}
+
+std::size_t StreamMesher::resume(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    std::ostream *progressStream)
+{
+    (void) tworker;
+    (void) path;
+    (void) progressStream;
+    throw std::logic_error("StreamMesher does not support checkpointing");
+}
+
+void StreamMesher::checkpointPartial(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    std::tr1::uint64_t completedBins)
+{
+    (void) tworker;
+    (void) path;
+    (void) completedBins;
+    throw std::logic_error("StreamMesher does not support checkpointing");
+}
+
+std::tr1::uint64_t StreamMesher::resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    (void) path;
+    throw std::logic_error("StreamMesher does not support checkpointing");
+}
+
+MesherBase *createMesher(MesherType type, FastPly::Writer &writer, const MesherBase::Namer &namer)
+{
+    switch (type)
+    {
+    case OOC_MESHER:       return new OOCMesher(writer, namer);
+    case RECOMPUTE_MESHER: return new RecomputeMesher(writer, namer);
+    case STREAM_MESHER:    return new StreamMesher(writer, namer);
+    default:
+        MLSGPU_ASSERT(false, std::invalid_argument);
+        return NULL;
+    }
+}
+
 namespace
 {
 
@@ -928,6 +2617,7 @@ public:
         CLH::enqueueMarkerWithWaitList(queue, &wait, event);
 
         work.chunkId = chunkId;
+        work.level = 0;
         work.hasEvents = true;
         work.verticesEvent = wait[0];
         work.vertexKeysEvent = wait[1];
@@ -24,7 +24,7 @@
  * Data structures for storing the output of @ref Marching.
  *
  * The classes in this file are @ref MesherBase, an abstract base class, and
- * one concrete instantiation of it.
+ * concrete instantiations of it.
  */
 
 #ifndef MESHER_H
@@ -48,10 +48,11 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/optional.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/filesystem/fstream.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/split_free.hpp>
@@ -60,7 +61,13 @@
 #include "tr1_unordered_set.h"
 #include "marching.h"
 #include "fast_ply.h"
+#include "compact_writer.h"
+#include "vertex_cache.h"
+#include "decimate.h"
 #include "union_find.h"
+#include "key_map.h"
+#include "compressed_io.h"
+#include "binary_io.h"
 #include "work_queue.h"
 #include "worker_group.h"
 #include "statistics.h"
@@ -68,6 +75,7 @@
 #include "timeplot.h"
 #include "circular_buffer.h"
 #include "chunk_id.h"
+#include "grid.h"
 #include "progress.h"
 
 class TestTmpWriterWorkerGroup;
@@ -111,7 +119,9 @@ inline void serialize(Archive &ar, boost::filesystem::path &path, const unsigned
  */
 enum MesherType
 {
-    OOC_MESHER
+    OOC_MESHER,
+    RECOMPUTE_MESHER,
+    STREAM_MESHER
 };
 
 /**
@@ -132,6 +142,7 @@ public:
 struct MesherWork
 {
     ChunkId chunkId;               ///< Chunk containing this mesh
+    unsigned int level;            ///< Level of detail (index into @c --fit-levels, 0 for the finest)
     HostKeyMesh mesh;              ///< Mesh data (may be empty)
     bool hasEvents;                ///< If false, the event fields have undefined values
     cl::Event verticesEvent;       ///< Signaled when vertices may be read
@@ -164,18 +175,21 @@ public:
  * The generated name is
  * <i>base</i><code>_</code><i>XXXX</i><code>_</code><i>YYYY</i><code>_</code><i>ZZZZ</i><code>.ply</code>,
  * where @a base is the base name given to the constructor and @a XXXX, @a YYYY
- * and @a ZZZZ are the coordinates.
+ * and @a ZZZZ are the coordinates. A different extension may be given to the
+ * constructor.
  */
 class ChunkNamer
 {
 private:
     std::string baseName;
+    std::string extension;
 
 public:
     typedef std::string result_type;
     std::string operator()(const ChunkId &chunkId) const;
 
-    ChunkNamer(const std::string &baseName) : baseName(baseName) {}
+    ChunkNamer(const std::string &baseName, const std::string &extension = ".ply")
+        : baseName(baseName), extension(extension) {}
 };
 
 /**
@@ -196,8 +210,8 @@ public:
  *    order).
  * -# Call @ref write.
  *
- * @warning The functor is @em not required to be thread-safe. The caller must
- * serialize calls if necessary (@ref MesherGroup only uses one thread).
+ * @warning The functor must be thread-safe, since @ref MesherGroup may call
+ * it from several threads at once.
  */
 class MesherBase
 {
@@ -227,7 +241,9 @@ public:
      * @param namer          Callback function to assign names to output files.
      */
     MesherBase(FastPly::Writer &writer, const Namer &namer)
-        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024), writer(writer), namer(namer) {}
+        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024), keysCapacity(0),
+        compressTmp(false), writerThreads(1), optimizeOrder(false), decimateError(0.0),
+        writer(writer), compactWriter(NULL), namer(namer) {}
 
     /// Virtual destructor to allow destruction via base class pointer
     virtual ~MesherBase() {}
@@ -250,12 +266,81 @@ public:
      */
     void setReorderCapacity(std::size_t bytes) { reorderCapacity = bytes; }
 
+    /**
+     * Sets the memory budget (in bytes) for tracking vertices that are shared
+     * between blocks, if supported. Beyond this, the mesher may spill them to
+     * temporary files. Zero (the default) means there is no limit.
+     */
+    void setKeysCapacity(std::size_t bytes) { keysCapacity = bytes; }
+
+    /**
+     * Sets whether temporary files holding geometry should be compressed, if
+     * there are any. The default is not to compress them.
+     */
+    void setCompressTmp(bool compress) { compressTmp = compress; }
+
+    /**
+     * Sets the number of output files that may be written concurrently, if
+     * supported. The default is to write one file at a time.
+     *
+     * @pre @a threads is at least 1.
+     */
+    void setWriterThreads(unsigned int threads) { writerThreads = threads; }
+
+    /**
+     * Sets a writer to use for output files instead of the PLY writer, if
+     * supported. It must persist until the mesher is destroyed, and is
+     * subject to the same requirements as the writer passed to the
+     * constructor. The default (@c NULL) is to write PLY files.
+     */
+    void setCompactWriter(CompactWriter *writer) { compactWriter = writer; }
+
+    /**
+     * Records the region of space covered by an output chunk, which is used
+     * to quantize compact output (see @ref setCompactWriter). It is intended
+     * to be connected to @ref BucketCollector::setChunkFunctor. It may be
+     * called from any thread, and again for the same chunk in later passes.
+     */
+    void setChunkGrid(const ChunkId &chunkId, const Grid &grid);
+
+    /**
+     * Sets whether the triangles and vertices of each output file should be
+     * reordered for efficient rendering (see @ref VertexCacheOptimizer), if
+     * supported. The default is to write them in the order they were
+     * generated.
+     */
+    void setOptimizeOrder(bool optimize) { optimizeOrder = optimize; }
+
+    /**
+     * Sets the error bound for simplifying each block of the mesh before it
+     * is stored (see @ref Decimator), if supported. The default of zero
+     * disables simplification.
+     *
+     * @param error  Error bound, in world units.
+     */
+    void setDecimateError(double error) { decimateError = error; }
+
     /// Retrieve the value set with @ref setPruneThreshold.
     double getPruneThreshold() const { return pruneThreshold; }
 
     /// Retrieve the value set with @ref setReorderCapacity.
     std::size_t getReorderCapacity() const { return reorderCapacity; }
 
+    /// Retrieve the value set with @ref setKeysCapacity.
+    std::size_t getKeysCapacity() const { return keysCapacity; }
+
+    /// Retrieve the value set with @ref setCompressTmp.
+    bool getCompressTmp() const { return compressTmp; }
+
+    /// Retrieve the value set with @ref setWriterThreads.
+    unsigned int getWriterThreads() const { return writerThreads; }
+
+    /// Retrieve the value set with @ref setOptimizeOrder.
+    bool getOptimizeOrder() const { return optimizeOrder; }
+
+    /// Retrieve the value set with @ref setDecimateError.
+    double getDecimateError() const { return decimateError; }
+
     /**
      * Retrieves a functor that will accept data in a specific pass.
      * Multi-pass classes may do finalization on a previous pass before
@@ -268,7 +353,14 @@ public:
      *
      * @pre @a pass is less than @ref numPasses().
      *
-     * @warning The returned functor is @em not required to be thread-safe.
+     * @warning The returned functor @em must be thread-safe, because
+     * @ref MesherGroup calls it from @c --mesher-threads threads at once.
+     * Outside of the subclass's @c mutex, it may only touch the work item it
+     * was given, scratch space private to the call, and settings that are
+     * fixed for the duration of the pass (such as @ref getDecimateError).
+     * Everything else, including the chunk and component state, the reorder
+     * buffer and the temporary file offsets, must only be accessed with the
+     * @c mutex held.
      */
     virtual InputFunctor functor(unsigned int pass) = 0;
 
@@ -293,6 +385,28 @@ public:
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL) = 0;
 
+    /**
+     * Serialize enough state into @a path to continue a run that is
+     * interrupted part-way through the (first) pass. It may only be called
+     * while no calls to the functor are in progress, and the functor may
+     * continue to be used afterwards. The mesher does not know which parts
+     * of the input have been seen, so the caller passes a count of them in
+     * @a completedBins to be stored in the file.
+     *
+     * @see @ref resumePartial, @ref isPartialCheckpoint
+     */
+    virtual void checkpointPartial(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                   std::tr1::uint64_t completedBins) = 0;
+
+    /**
+     * Restore state written by @ref checkpointPartial, on a newly constructed
+     * mesher of the same class. The caller must then call @ref functor and
+     * feed it the input that had not been seen, before finishing as normal.
+     *
+     * @return The value passed as @a completedBins to @ref checkpointPartial.
+     */
+    virtual std::tr1::uint64_t resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path) = 0;
+
     /**
      * Performs any final file I/O.
      *
@@ -307,6 +421,14 @@ public:
 
 protected:
     FastPly::Writer &getWriter() const { return writer; }
+    CompactWriter *getCompactWriter() const { return compactWriter; }
+
+    /**
+     * Retrieves the region recorded with @ref setChunkGrid.
+     * @throw state_error if no region was recorded for @a chunkId.
+     */
+    Grid getChunkGrid(const ChunkId &chunkId) const;
+
     std::string getOutputName(const ChunkId &id) const { return namer(id); }
 
 private:
@@ -314,9 +436,24 @@ private:
     double pruneThreshold;
     /// Capacity set by @ref setReorderCapacity
     std::size_t reorderCapacity;
+    /// Capacity set by @ref setKeysCapacity
+    std::size_t keysCapacity;
+    /// Flag set by @ref setCompressTmp
+    bool compressTmp;
+    /// Thread count set by @ref setWriterThreads
+    unsigned int writerThreads;
+    /// Flag set by @ref setOptimizeOrder
+    bool optimizeOrder;
+    /// Error bound set by @ref setDecimateError
+    double decimateError;
 
     FastPly::Writer &writer;       ///< Writer for output files
+    CompactWriter *compactWriter;  ///< Writer set with @ref setCompactWriter
     const Namer namer;             ///< Output file namer
+
+    /// Regions recorded with @ref setChunkGrid, indexed by generation
+    std::map<ChunkId::gen_type, Grid> chunkGrids;
+    mutable boost::mutex chunkGridsMutex; ///< Protects @ref chunkGrids
 };
 
 /**
@@ -348,7 +485,10 @@ private:
  *
  * External vertices are entered into a hash table that maps their keys to
  * their (global) chunk ID, and a chunk-local hash table that maps it to the
- * triangle index used to encode it.
+ * triangle index used to encode it. If the former exceeds the budget given by
+ * @ref setKeysCapacity, it is written to a temporary file as a run sorted by
+ * key and emptied. The runs are merged in @ref finalize, which completes the
+ * union-find over the clumps. The chunk-local tables are not spilled.
  */
 class OOCMesher : public MesherBase
 {
@@ -360,6 +500,8 @@ public:
 
 protected:
     static const int reorderSlots;
+    /// Ratio between the largest and smallest size of @ref reorderBuffer before flushing
+    static const int reorderShrink;
 
     typedef std::tr1::int32_t clump_id;
 
@@ -430,7 +572,7 @@ protected:
             }
         };
 
-        typedef Statistics::Container::unordered_map<cl_ulong, std::tr1::uint32_t> vertex_id_map_type;
+        typedef KeyMap<std::tr1::uint32_t> vertex_id_map_type;
 
         /// ID for this chunk, used to generate the filename
         ChunkId chunkId;
@@ -459,6 +601,17 @@ protected:
             ar & numExternalVertices;
             // bufferedClumps and vertexIdMap are not needed
         }
+
+        /**
+         * Like @ref serialize, but also includes @ref vertexIdMap so that
+         * more blocks can be added. @ref bufferedClumps must be empty.
+         */
+        template<typename Archive>
+        void serializePartial(Archive &ar)
+        {
+            serialize(ar, 0);
+            ar & vertexIdMap;
+        }
     };
 
     /**
@@ -515,6 +668,12 @@ protected:
     {
         /// Backing store for vertices
         Statistics::Container::vector<vertex_type> vertices;
+        /**
+         * Normals corresponding to @ref vertices, if the output has normals,
+         * otherwise empty. They are interleaved with the vertices in the
+         * temporary file.
+         */
+        Statistics::Container::vector<vertex_type> normals;
         /// Backing store for triangles
         Statistics::Container::vector<triangle_type> triangles;
         /**
@@ -544,10 +703,17 @@ protected:
         TmpWriterWorkerGroup &owner;   ///< Owning worker group
         std::ostream &verticesFile;    ///< File for temporary vertices
         std::ostream &trianglesFile;   ///< File for temporary triangles
+        BlockCompressor &verticesCompressor;   ///< Compressor for @ref verticesFile
+        BlockCompressor &trianglesCompressor;  ///< Compressor for @ref trianglesFile
+        /// Staging area for interleaving vertices with normals
+        Statistics::Container::vector<vertex_type> interleaved;
     public:
-        TmpWriterWorker(TmpWriterWorkerGroup &owner, std::ostream &verticesFile, std::ostream &trianglesFile)
+        TmpWriterWorker(TmpWriterWorkerGroup &owner, std::ostream &verticesFile, std::ostream &trianglesFile,
+                        BlockCompressor &verticesCompressor, BlockCompressor &trianglesCompressor)
             : WorkerBase("tmpwriter", 0),
-            owner(owner), verticesFile(verticesFile), trianglesFile(trianglesFile) {}
+            owner(owner), verticesFile(verticesFile), trianglesFile(trianglesFile),
+            verticesCompressor(verticesCompressor), trianglesCompressor(trianglesCompressor),
+            interleaved("mem.OOCMesher::TmpWriterWorker::interleaved") {}
         void operator()(TmpWriterItem &item);
     };
 
@@ -558,6 +724,9 @@ protected:
      * files when the group is stopped.
      *
      * Errors while writing the temporary files immediately terminate the program.
+     *
+     * If compression is enabled, the files are written with @ref BlockCompressor,
+     * and the index needed to read them back is retained (and checkpointed).
      */
     class TmpWriterWorkerGroup : public WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>
     {
@@ -573,6 +742,17 @@ protected:
         /// Filename for @ref trianglesFile
         boost::filesystem::path trianglesPath;
 
+        /// Whether the files are compressed
+        bool compress;
+        /// Compressor for @ref verticesFile, if @ref compress is set
+        BlockCompressor verticesCompressor;
+        /// Compressor for @ref trianglesFile, if @ref compress is set
+        BlockCompressor trianglesCompressor;
+        /// Layout of @ref verticesPath, once complete, if @ref compress is set
+        BlockIndex verticesIndex;
+        /// Layout of @ref trianglesPath, once complete, if @ref compress is set
+        BlockIndex trianglesIndex;
+
         /// Allocator for items
         CircularBufferBase itemAllocator;
         /// Backing store of items
@@ -583,6 +763,9 @@ protected:
         {
             ar & verticesPath;
             ar & trianglesPath;
+            ar & compress;
+            ar & verticesIndex;
+            ar & trianglesIndex;
         }
     public:
         /**
@@ -597,6 +780,15 @@ protected:
          */
         void start();
 
+        /**
+         * Like @ref start, but reopens the temporary files from a previous
+         * @ref start (or a checkpoint) instead of creating new ones. They are
+         * first truncated to the given sizes in bytes.
+         *
+         * @pre The files are not compressed.
+         */
+        void restart(std::tr1::uint64_t verticesSize, std::tr1::uint64_t trianglesSize);
+
         /**
          * Close the temporary files. This should not be called directly (it is called
          * by @ref WorkerGroup).
@@ -607,6 +799,25 @@ protected:
 
         void freeItem(boost::shared_ptr<TmpWriterItem> item);
 
+        /**
+         * Set whether to compress the files. This must be called before
+         * @ref start to have any effect.
+         */
+        void setCompress(bool compress) { this->compress = compress; }
+
+        /// Whether the files are compressed
+        bool isCompressed() const { return compress; }
+
+        /**
+         * Create and open a reader for the vertices written to the temporary file.
+         * Reads are in terms of the uncompressed data. This may only be called
+         * after the group has been stopped.
+         */
+        BinaryReader *openVertices() const;
+
+        /// Like @ref openVertices, but for the triangles.
+        BinaryReader *openTriangles() const;
+
         /**
          * Get the path to the temporary file for vertices. If @ref start has
          * not been called this will return an empty path.
@@ -622,27 +833,65 @@ protected:
     // Needed to enable the curiously recursive template pattern
     friend class WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>;
 
-private:
     /**
-     * @name
-     * @{
-     * Temporary buffers.
-     * These are stored in the object so that memory can be recycled if
-     * possible, rather than thrashing the allocator.
-     */
-    Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > tmpNodes;
-    Statistics::Container::PODBuffer<clump_id> tmpClumpId;
-    Statistics::Container::PODBuffer<std::tr1::uint32_t> tmpVertexLabel;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpFirstVertex;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpNextVertex;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpFirstTriangle;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpNextTriangle;
-    /** @} */
+     * Temporary buffers for processing a single mesh in @ref add.
+     * These are recycled through @ref scratchPool rather than thrashing the
+     * allocator, and each call to @ref add uses its own, so that the
+     * block-local parts of the work can run on several threads at once.
+     */
+    struct Scratch
+    {
+        Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > nodes;
+        Statistics::Container::PODBuffer<clump_id> clumpId;  ///< Block-local clump ID per vertex
+        Statistics::Container::vector<Clump> clumps;         ///< Block-local clumps
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> vertexLabel;
+        Statistics::Container::PODBuffer<std::tr1::int32_t> firstVertex;
+        Statistics::Container::PODBuffer<std::tr1::int32_t> nextVertex;
+        Statistics::Container::PODBuffer<std::tr1::int32_t> firstTriangle;
+        Statistics::Container::PODBuffer<std::tr1::int32_t> nextTriangle;
+        Decimator decimator;                                 ///< Used if @ref setDecimateError is in effect
+
+        Scratch();
+    };
+
+    /// Scratch spaces not currently in use by any thread
+    Statistics::Container::vector<boost::shared_ptr<Scratch> > scratchPool;
+    /// Mutex protecting @ref scratchPool
+    boost::mutex scratchMutex;
+
+    /// Take a scratch space from @ref scratchPool, or create one if it is empty
+    boost::shared_ptr<Scratch> acquireScratch();
+
+    /// Return a scratch space obtained from @ref acquireScratch
+    void releaseScratch(const boost::shared_ptr<Scratch> &scratch);
+
+    /**
+     * Mutex held for the parts of @ref add that modify the global state
+     * (clumps, @ref clumpIdMap, the per-chunk data, the reorder buffer and
+     * the counters below). Outside it, @ref add touches only the mesh being
+     * added and its @ref Scratch, which is guarded by @ref scratchMutex
+     * while in @ref scratchPool.
+     */
+    boost::mutex mutex;
 
     /// Total number of vertices written to temporary file
     std::tr1::uint64_t writtenVerticesTmp;
     /// Total number of triangles written to temporary file
     std::tr1::uint64_t writtenTrianglesTmp;
+    /**
+     * Total number of internal vertices added. Together with the size of
+     * @ref clumpIdMap, this gives a lower bound on the final number of
+     * vertices, and hence on the pruning threshold.
+     */
+    std::tr1::uint64_t addedInternalVertices;
+
+    /**
+     * Size in bytes at which @ref reorderBuffer is flushed. This adapts
+     * between 1/@ref reorderShrink of a slot and a whole slot of the reorder
+     * capacity, growing while chunks are interleaved and shrinking
+     * otherwise.
+     */
+    std::size_t reorderLimit;
 
     /**
      * Reorder buffer. Initially only the vertices and triangles are placed
@@ -657,10 +906,40 @@ private:
 
     Statistics::Container::vector<Clump> clumps;  ///< All clumps seen so far
 
-    typedef Statistics::Container::unordered_map<cl_ulong, clump_id> clump_id_map_type;
+    typedef KeyMap<clump_id> clump_id_map_type;
     /// Maps external vertex keys to global clump IDs
     clump_id_map_type clumpIdMap;
 
+    /// An entry of @ref clumpIdMap, as stored in @ref keysPath
+    typedef std::pair<std::tr1::uint64_t, clump_id> key_record_type;
+
+    class KeyRunReader;
+
+    /**
+     * Temporary file holding entries spilled from @ref clumpIdMap, or empty
+     * if nothing has been spilled.
+     */
+    boost::filesystem::path keysPath;
+    /// Stream for writing @ref keysPath
+    boost::filesystem::ofstream keysFile;
+    /// Number of entries in each sorted run in @ref keysPath
+    Statistics::Container::vector<std::tr1::uint64_t> keyRuns;
+    /// Number of distinct external vertices (only valid after @ref finalize)
+    std::tr1::uint64_t externalVertices;
+
+    /**
+     * Set when state has been loaded by @ref resumePartial, so that @ref
+     * functor continues with the existing temporary files.
+     */
+    bool resumedPartial;
+
+    /**
+     * Set while a partial checkpoint refers to the temporary files and the
+     * output has not yet been written, so that they are not deleted if the
+     * run fails.
+     */
+    bool keepPartial;
+
     /**
      * Identifies components with a local set of triangles, and
      * returns a union-find tree for them.
@@ -678,20 +957,41 @@ private:
         Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes);
 
     /**
-     * Create global clumps from local union-find tree. The clumps are populated
+     * Create block-local clumps from local union-find tree. The clumps are populated
      * with the appropriate vertex and triangle counts, but are not merged together
-     * using shared external vertices.
+     * using shared external vertices. This function does not touch any shared
+     * state, and so may be called concurrently.
      *
      * @param numTriangles   Number of triangles in @a triangles.
      * @param nodes          Union-find tree over the block vertices (see @ref computeLocalComponents).
      * @param triangles      Triangles in the block.
-     * @param[out] clumpId   Clump IDs, one per vertex passed in.
+     * @param[out] clumpId   Block-local clump IDs, one per vertex passed in.
+     * @param[out] localClumps The clumps, indexed by the values in @a clumpId.
      */
-    void updateGlobalClumps(
+    static void computeLocalClumps(
         std::size_t numTriangles,
         const Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes,
         const triangle_type *triangles,
-        Statistics::Container::PODBuffer<clump_id> &clumpId);
+        Statistics::Container::PODBuffer<clump_id> &clumpId,
+        Statistics::Container::vector<Clump> &localClumps);
+
+    /**
+     * Build linked lists of the vertices and triangles in each block-local clump,
+     * for use by @ref updateLocalClumps. This function does not touch any shared
+     * state, and so may be called concurrently.
+     *
+     * @param scratch        Scratch space containing the clump IDs computed by
+     *                       @ref computeLocalClumps. The lists are written here.
+     * @param mesh           The mesh. Only the triangles are used.
+     */
+    static void linkLocalClumps(Scratch &scratch, const HostKeyMesh &mesh);
+
+    /**
+     * Append block-local clumps to the global clumps.
+     *
+     * @return The global clump ID corresponding to block-local clump 0.
+     */
+    clump_id updateGlobalClumps(const Statistics::Container::vector<Clump> &localClumps);
 
     /**
      * Update @ref clumpIdMap and merge global clumps that share external vertices.
@@ -699,7 +999,8 @@ private:
      * @param numVertices    Total number of vertices in @a clumpId
      * @param numExternalVertices Number of external vertices in @a keys
      * @param keys           Vertex keys in the mesh.
-     * @param clumpId        Vertex clump IDs computed by @ref updateGlobalClumps.
+     * @param clumpId        Block-local vertex clump IDs computed by @ref computeLocalClumps.
+     * @param clumpIdFirst   Global clump ID of block-local clump 0.
      *
      * Note that the internal vertices in @a clumpId are ignored, but must still be present.
      */
@@ -707,32 +1008,75 @@ private:
         std::size_t numVertices,
         std::size_t numExternalVertices,
         const cl_ulong *keys,
-        const Statistics::Container::PODBuffer<clump_id> &clumpId);
+        const Statistics::Container::PODBuffer<clump_id> &clumpId,
+        clump_id clumpIdFirst);
 
+    /**
+     * Write the contents of @ref clumpIdMap to @ref keysPath as a run sorted
+     * by key, and empty it. Since a key that is already in the map when it
+     * is seen again only causes clumps to be merged, this merging can be
+     * deferred to @ref resolveClumpKeys.
+     */
+    void spillClumpKeyMap();
+
+    /**
+     * Complete the work deferred by @ref spillClumpKeyMap, by merging the
+     * runs and unifying the clumps of any key that appears in more than one.
+     * This also sets @ref externalVertices, and removes the temporary file.
+     */
+    void resolveClumpKeys();
+
+private:
     /**
      * Populate the per-chunk clump data and write the geometry to external
      * memory. This also does chunk-level welding to update @ref Chunk::vertexIdMap.
      *
      * @param chunk          The chunk to update.
-     * @param globalClumpId  The clump IDs generated by @ref updateGlobalClumps
-     * @param clumpIdFirst   Smallest value in @a globalClumpId
-     * @param clumpIdLast    One greater than largest value in @a globalClumpId
+     * @param scratch        Block-local data computed by @ref computeLocalClumps
+     *                       and @ref linkLocalClumps.
+     * @param clumpIdFirst   Global clump ID of block-local clump 0.
      * @param mesh           The original data. All fields (vertices, triangles and keys)
      *                       must have finished loading.
      * @param tworker        Timeplot worker for recording interactions with the writer worker group
      */
     void updateLocalClumps(
         Chunk &chunk,
-        const Statistics::Container::PODBuffer<clump_id> &globalClumpId,
+        Scratch &scratch,
         clump_id clumpIdFirst,
-        clump_id clumpIdLast,
         HostKeyMesh &mesh,
         Timeplot::Worker &tworker);
 
+    /**
+     * Determines whether a clump in @ref Chunk::bufferedClumps has no
+     * external vertices, meaning that it can never be merged with another
+     * and its size is final. This relies on the global clump counting all
+     * the vertices (internal and external) it has received: it will only
+     * be a root with exactly the internal vertices of the chunk-local
+     * clump if there were no external vertices.
+     */
+    bool isClosed(const Chunk::Clump &clump) const;
+
+    /// Number of bytes in the reorder buffer for a chunk
+    std::tr1::uint64_t bufferedBytes(const Chunk &chunk) const;
+
+    /**
+     * Bytes per vertex in the temporary vertices file. The records have the
+     * same form as in the output file, so that they can be copied directly.
+     */
+    std::size_t tmpVertexSize() const { return getWriter().getVertexSize(); }
+
     /**
      * Start async transfer any data in the reordering buffer to the temporary files.
+     * Buffered clumps that are closed (see @ref isClosed) and already smaller
+     * than the pruning threshold would be for the vertices seen so far are
+     * certain to be pruned, and so are discarded instead of being written.
+     *
+     * @param tworker        Timeplot worker for interactions with the writer
+     * @param all            If false, chunks with little buffered data may be
+     *                       moved to a new reorder buffer instead of being
+     *                       written, so that they produce longer runs later.
      */
-    void flushBuffer(Timeplot::Worker &tworker);
+    void flushBuffer(Timeplot::Worker &tworker, bool all = true);
 
     /// Implementation of the functor
     void add(MesherWork &work, Timeplot::Worker &worker);
@@ -748,6 +1092,29 @@ private:
         ar & clumps;
     }
 
+    /**
+     * Serialize the data for @ref checkpointPartial. In addition to what
+     * @ref serialize stores, this includes the state needed to keep adding
+     * blocks. The reorder buffer must have been flushed.
+     */
+    template<typename Archive>
+    void serializePartial(Archive &ar)
+    {
+        ar & tmpWriter;
+        std::size_t numChunks = chunks.size();
+        ar & numChunks;
+        chunks.resize(numChunks);
+        for (std::size_t i = 0; i < numChunks; i++)
+            chunks[i].serializePartial(ar);
+        ar & clumps;
+        ar & clumpIdMap;
+        ar & keysPath;
+        ar & keyRuns;
+        ar & writtenVerticesTmp;
+        ar & writtenTrianglesTmp;
+        ar & addedInternalVertices;
+    }
+
 protected:
     /// If set to true, will not delete the temporary files
     bool retainFiles;
@@ -836,6 +1203,62 @@ protected:
         const triangle_type *inTriangles,
         std::tr1::uint8_t *outTriangles);
 
+    /**
+     * Transform the indices of a single triangle in place. The parameters
+     * are as for @ref rewriteTriangles.
+     */
+    static void remapTriangle(
+        triangle_type &triangle,
+        std::tr1::uint32_t externalBoundary,
+        const std::tr1::uint32_t *externalRemap,
+        std::tr1::uint32_t offset);
+
+    /**
+     * Reorders the triangles of a single clump for vertex-cache efficiency,
+     * and renumbers its internal vertices in the order they are first used.
+     * External vertices may be shared with other clumps, so they keep
+     * their positions. Each writer thread has its own instance, which holds
+     * working memory that is reused between clumps.
+     */
+    class ClumpOptimizer : public boost::noncopyable
+    {
+    public:
+        ClumpOptimizer();
+
+        /**
+         * Reorder a clump in place.
+         *
+         * @param numInternalVertices Number of internal vertices in the clump
+         * @param numTriangles      Number of triangles in the clump
+         * @param externalBoundary  Threshold for separating internal/external vertices (see @ref rewriteTriangles)
+         * @param vertexSize        Size in bytes of each vertex record
+         * @param[in,out] vertices  The internal vertex records of the clump
+         * @param[in,out] triangles Triangles of the clump, in temporary file form
+         */
+        void operator()(
+            std::size_t numInternalVertices,
+            std::size_t numTriangles,
+            std::tr1::uint32_t externalBoundary,
+            std::size_t vertexSize,
+            char *vertices,
+            triangle_type *triangles);
+
+    private:
+        VertexCacheOptimizer optimizer;
+        /// Vertex indices with external vertices packed after the internal ones
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> indices;
+        /// Triangle order chosen by @ref optimizer
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> order;
+        /// New index for each internal vertex
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> remap;
+        /// Staging area for the reordered triangles
+        Statistics::Container::PODBuffer<triangle_type> sortedTriangles;
+        /// Staging area for the reordered vertices
+        Statistics::Container::PODBuffer<char> sortedVertices;
+        /// Maps encoded external indices to packed indices
+        std::tr1::unordered_map<std::tr1::uint32_t, std::tr1::uint32_t> externalIds;
+    };
+
     /**
      * Compute write positions and remapping table for one output chunk.
      *
@@ -860,6 +1283,7 @@ protected:
      * @param tworker           Worker to pass to @ref AsyncWriter::get
      * @param verticesTmpRead   Reader for the vertices temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
+     * @param writer            Writer for the output file, which must be open
      * @param chunk             Output chunk to write
      * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
      * @param startVertex       Position (in vertices) to start writing each clump (see @ref writeChunkPrepare)
@@ -875,6 +1299,7 @@ protected:
         Timeplot::Worker &tworker,
         BinaryReader &verticesTmpRead,
         AsyncWriter &asyncWriter,
+        FastPly::Writer &writer,
         const Chunk &chunk,
         std::tr1::uint64_t thresholdVertices,
         const std::tr1::uint32_t *startVertex,
@@ -887,6 +1312,7 @@ protected:
      * @param tworker           Worker to pass to @ref AsyncWriter::get
      * @param trianglesTmpRead  Reader for the triangles temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
+     * @param writer            Writer for the output file, which must be open
      * @param chunk             Output chunk to write
      * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
      * @param chunkExternal     Total number of external vertices for the chunk (see @ref getChunkStatistics)
@@ -906,6 +1332,7 @@ protected:
         Timeplot::Worker &tworker,
         BinaryReader &trianglesTmpRead,
         AsyncWriter &asyncWriter,
+        FastPly::Writer &writer,
         const Chunk &chunk,
         std::tr1::uint64_t thresholdVertices,
         std::size_t chunkExternal,
@@ -916,6 +1343,137 @@ protected:
         ProgressMeter *progress,
         std::size_t firstClump, std::size_t lastClump);
 
+    /**
+     * Transfer clumps from the temporary files to a compact output file.
+     * This combines the work of @ref writeChunkVertices and @ref
+     * writeChunkTriangles, with the parameters having the same meanings.
+     * The vertices are written synchronously, so no asynchronous writer is needed.
+     *
+     * @param[in,out] vertices  Temporary buffer the callee may use to hold data
+     * @param optimizer         If non-NULL, used to reorder each clump before it is written
+     *
+     * @pre @ref finalize has been called
+     */
+    void writeChunkCompact(
+        BinaryReader &verticesTmpRead,
+        BinaryReader &trianglesTmpRead,
+        CompactWriter &writer,
+        const Chunk &chunk,
+        std::tr1::uint64_t thresholdVertices,
+        std::size_t chunkExternal,
+        const std::tr1::uint32_t *startVertex,
+        const std::tr1::uint32_t *externalRemap,
+        Statistics::Container::PODBuffer<vertex_type> &vertices,
+        Statistics::Container::PODBuffer<triangle_type> &triangles,
+        ClumpOptimizer *optimizer,
+        ProgressMeter *progress);
+
+    /**
+     * Transfer clumps from the temporary files to the output file, reordering
+     * each one with @a optimizer. This is used instead of @ref
+     * writeChunkVertices and @ref writeChunkTriangles when @ref
+     * setOptimizeOrder is in effect, and the parameters have the same
+     * meanings. Each clump is read entirely into memory and written
+     * synchronously.
+     *
+     * @param[in,out] vertices  Temporary buffer the callee may use to hold data
+     *
+     * @pre @ref finalize has been called
+     */
+    void writeChunkOptimized(
+        BinaryReader &verticesTmpRead,
+        BinaryReader &trianglesTmpRead,
+        FastPly::Writer &writer,
+        const Chunk &chunk,
+        std::tr1::uint64_t thresholdVertices,
+        std::size_t chunkExternal,
+        const std::tr1::uint32_t *startVertex,
+        const FastPly::Writer::size_type *startTriangle,
+        const std::tr1::uint32_t *externalRemap,
+        ClumpOptimizer &optimizer,
+        Statistics::Container::PODBuffer<char> &vertices,
+        Statistics::Container::PODBuffer<triangle_type> &triangles,
+        ProgressMeter *progress);
+
+    /// An output file to be produced by @ref write
+    struct ChunkWrite
+    {
+        std::size_t chunkIdx;              ///< Index into @ref chunks
+        std::tr1::uint64_t numVertices;    ///< Retained vertices
+        std::tr1::uint64_t numTriangles;   ///< Retained triangles
+        std::tr1::uint64_t numExternal;    ///< External vertices, including discarded ones
+    };
+
+    /**
+     * Output files shared between the threads of @ref write. Each thread
+     * takes the next file from the list until it is exhausted. The first
+     * exception thrown by any thread is recorded so that it can be rethrown
+     * by the calling thread.
+     */
+    struct WriteQueue : public boost::noncopyable
+    {
+        std::vector<ChunkWrite> tasks;
+        std::size_t next;                  ///< Next element of @a tasks to take
+        boost::exception_ptr error;        ///< First exception thrown by a thread, if any
+        boost::mutex mutex;                ///< Mutex protecting all the fields
+
+        WriteQueue() : next(0) {}
+
+        /**
+         * Takes the next task from the queue.
+         * @return @c false if there are no more tasks or a failure has occurred.
+         */
+        bool pop(ChunkWrite &task);
+
+        /**
+         * Records an exception, unless one has already been recorded. Once
+         * this has been called, @ref pop returns @c false.
+         */
+        void fail(const boost::exception_ptr &e);
+    };
+
+    /**
+     * Write output files taken from @a queue until it is empty. This is run
+     * by each of the threads used by @ref write. Each thread must have its
+     * own readers and writer.
+     *
+     * @param tworker           Timeplot worker for the current thread
+     * @param writer            Writer for output files (must not be open)
+     * @param compactWriter     If non-NULL, used instead of @a writer (must not be open)
+     * @param verticesTmpRead   Reader for the vertices temporary file
+     * @param trianglesTmpRead  Reader for the triangles temporary file
+     * @param asyncWriter       Asynchronous writer to schedule through
+     * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
+     * @param queue             Files to write
+     * @param progress          If non-NULL, updated with the number of triangles written
+     *
+     * @pre @ref finalize has been called and every clump has been passed to
+     * @ref UnionFind::findRoot since, so that it is safe to share.
+     */
+    void writeChunks(
+        Timeplot::Worker &tworker,
+        FastPly::Writer &writer,
+        CompactWriter *compactWriter,
+        BinaryReader &verticesTmpRead,
+        BinaryReader &trianglesTmpRead,
+        AsyncWriter &asyncWriter,
+        std::tr1::uint64_t thresholdVertices,
+        WriteQueue &queue,
+        ProgressMeter *progress);
+
+    /**
+     * Thread entry point for @ref write, which wraps @ref writeChunks with a
+     * private timeplot worker and copies of the writers.
+     */
+    void writeChunksThread(
+        unsigned int idx,
+        BinaryReader *verticesTmpRead,
+        BinaryReader *trianglesTmpRead,
+        AsyncWriter *asyncWriter,
+        std::tr1::uint64_t thresholdVertices,
+        WriteQueue *queue,
+        ProgressMeter *progress);
+
 public:
     /**
      * @copydoc MesherBase::MesherBase
@@ -930,8 +1488,288 @@ public:
     virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL);
+    virtual void checkpointPartial(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                   std::tr1::uint64_t completedBins);
+    virtual std::tr1::uint64_t resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+};
+
+/**
+ * Mesher that trades GPU time for disk space, by generating the geometry
+ * twice instead of storing it in temporary files. The first pass identifies
+ * components in the same way as @ref OOCMesher, but only counts the vertices
+ * and triangles in each clump. Once the component sizes are known, the second
+ * pass writes the vertices and triangles of the retained components straight
+ * to the output files.
+ *
+ * Output files are written one at a time, in chunk order. The blocks of a
+ * chunk may arrive in any order, and a chunk is known to be complete once all
+ * the triangles counted for it in the first pass have been seen. A block that
+ * arrives for a later chunk before then is copied and held in memory until
+ * that chunk is reached.
+ *
+ * The map of shared vertices from the first pass is needed again for the
+ * second, so it is never spilled and @ref setKeysCapacity has no effect.
+ * Checkpointing is not supported, since the output files are already written
+ * when the last pass ends.
+ */
+class RecomputeMesher : public OOCMesher
+{
+private:
+    /// Per-chunk totals from the first pass
+    struct ChunkOutput
+    {
+        std::tr1::uint64_t totalTriangles;   ///< Triangles before pruning
+        std::tr1::uint64_t keptVertices;     ///< Vertices in the output file
+        std::tr1::uint64_t keptTriangles;    ///< Triangles in the output file
+
+        ChunkOutput() : totalTriangles(0), keptVertices(0), keptTriangles(0) {}
+    };
+
+    /// Copy of a block that arrived before its chunk was reached
+    struct PendingBlock
+    {
+        ChunkId chunkId;
+        /// Backing store for @ref mesh
+        Statistics::Container::PODBuffer<cl_ulong> storage;
+        HostKeyMesh mesh;
+
+        PendingBlock(const ChunkId &chunkId, const HostKeyMesh &mesh);
+    };
+
+    /// Output sizes for each element of @ref chunks (only valid in the second pass)
+    Statistics::Container::vector<ChunkOutput> chunkOutputs;
+    /// Blocks held back until their chunk is reached
+    Statistics::Container::vector<boost::shared_ptr<PendingBlock> > pendingBlocks;
+    /// Components with fewer vertices than this are discarded (see @ref getStatistics)
+    std::tr1::uint64_t thresholdVertices;
+    /// Largest number of bytes output for the vertices or triangles of a block
+    std::size_t maxBlockBytes;
+    /// Writer for the output files, which exists only during the second pass
+    boost::scoped_ptr<AsyncWriter> asyncWriter;
+    /// Index into @ref chunks of the chunk being written
+    std::size_t curChunk;
+    /// Triangles (before pruning) seen so far for @ref curChunk
+    std::tr1::uint64_t curTriangles;
+    /// Next vertex index to assign in the current output file
+    FastPly::Writer::size_type nextVertex;
+    /// Next triangle index to assign in the current output file
+    FastPly::Writer::size_type nextTriangle;
+    /// Number of output files opened so far
+    std::size_t outputFiles;
+
+    /**
+     * Update the per-chunk clump data with counts of the vertices and
+     * triangles, without storing any geometry. External vertices that are
+     * shared with a previous clump of the same chunk are counted only once.
+     *
+     * @param chunk          The chunk to update.
+     * @param scratch        Block-local data computed by @ref computeLocalClumps
+     *                       and @ref linkLocalClumps.
+     * @param clumpIdFirst   Global clump ID of block-local clump 0.
+     * @param mesh           The original data. The triangles and keys must
+     *                       have finished loading.
+     */
+    void countLocalClumps(
+        Chunk &chunk,
+        const Scratch &scratch,
+        clump_id clumpIdFirst,
+        const HostKeyMesh &mesh);
+
+    /// Implementation of the functor for the first pass
+    void count(MesherWork &work, Timeplot::Worker &tworker);
+
+    /**
+     * Complete the first pass: determine the pruning threshold and the size of
+     * each output file, and release the data that is no longer needed.
+     */
+    void finishCounting();
+
+    /**
+     * Determine whether a block-local clump belongs to a component that is
+     * retained. Clumps with an external vertex are looked up through
+     * @ref clumpIdMap, while those without one form a complete component.
+     */
+    bool keepClump(const Scratch &scratch, clump_id cid, const HostKeyMesh &mesh) const;
+
+    /**
+     * Skip over chunks without triangles, then open the output file for the
+     * chunk at @ref curChunk, if it has any triangles that are kept.
+     */
+    void openChunk();
+
+    /**
+     * Write the retained geometry of a block of @ref curChunk.
+     *
+     * @param scratch        Block-local data computed by @ref computeLocalClumps
+     *                       and @ref linkLocalClumps.
+     * @param mesh           The block. All fields must have finished loading.
+     * @param tworker        Timeplot worker for recording interactions with the writer
+     */
+    void writeBlock(Scratch &scratch, const HostKeyMesh &mesh, Timeplot::Worker &tworker);
+
+    /**
+     * Write a block of @ref curChunk with @ref writeBlock, and move on to
+     * later chunks (including any blocks held in @ref pendingBlocks) if this
+     * completes it.
+     *
+     * @param scratch        Block-local data for @a mesh. It is used as
+     *                       scratch space for pending blocks afterwards.
+     * @param mesh           The block. All fields must have finished loading.
+     * @param tworker        Timeplot worker for recording interactions with the writer
+     */
+    void emitBlock(Scratch &scratch, const HostKeyMesh &mesh, Timeplot::Worker &tworker);
+
+    /// Implementation of the functor for the second pass
+    void emit(MesherWork &work, Timeplot::Worker &tworker);
+
+public:
+    /**
+     * @copydoc MesherBase::MesherBase
+     */
+    RecomputeMesher(FastPly::Writer &writer, const Namer &namer);
+
+    ~RecomputeMesher();
+
+    virtual unsigned int numPasses() const { return 2; }
+    virtual InputFunctor functor(unsigned int pass);
+    virtual std::size_t write(Timeplot::Worker &tworker, std::ostream *progressStream = NULL);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                               std::ostream *progressStream = NULL);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual void checkpointPartial(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                   std::tr1::uint64_t completedBins);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual std::tr1::uint64_t resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+};
+
+/**
+ * Mesher that writes the output as the blocks arrive, without making a
+ * temporary copy of the vertices. It does not identify components, so
+ * pruning is not supported and the threshold set with @ref
+ * setPruneThreshold is ignored.
+ *
+ * Each output file is opened with @ref FastPly::Writer::openUnsized when the
+ * first block of its chunk arrives, and vertices are written to it directly,
+ * with external vertices welded through a per-chunk map of keys. PLY places
+ * all the vertices before any of the triangles, so the triangles (already
+ * encoded with their final indices) go to a temporary file, and @ref write
+ * just sets the final counts of each file and appends its triangles.
+ *
+ * Since blocks from neighbouring chunks may be interleaved, each output file
+ * is written through its own copy of the writer and stays open until @ref
+ * write. It is thus not well suited to producing a very large number of
+ * output files. Checkpointing is not supported.
+ */
+class StreamMesher : public MesherBase
+{
+public:
+    typedef boost::array<float, 3> vertex_type;
+    typedef boost::array<cl_uint, 3> triangle_type;
+
+private:
+    /// Per-chunk state
+    struct Chunk
+    {
+        /// ID for this chunk, used to generate the filename
+        ChunkId chunkId;
+        /// Writer for the output file, which is open from the first block
+        boost::shared_ptr<FastPly::Writer> writer;
+        /// Vertices assigned so far in the output file
+        std::tr1::uint64_t numVertices;
+        /// Triangles assigned so far in the output file
+        std::tr1::uint64_t numTriangles;
+        /**
+         * Ranges of the temporary triangle file belonging to this chunk, in
+         * the order they appear in the output. Each range is of [first, last)
+         * form, in units of triangles.
+         */
+        Statistics::Container::vector<std::pair<std::tr1::uint64_t, std::tr1::uint64_t> > triangleRanges;
+        /// Maps an external vertex key to its index in the output file
+        KeyMap<std::tr1::uint32_t> vertexIdMap;
+
+        explicit Chunk(const ChunkId &chunkId);
+    };
+
+    /// Chunks seen so far, indexed by generation (NULL if none seen)
+    Statistics::Container::vector<boost::shared_ptr<Chunk> > chunks;
+    /**
+     * Mutex protecting @ref chunks and @ref writtenTrianglesTmp. Outside it,
+     * @ref add only writes the block's data, through the thread-safe
+     * @ref asyncWriter, to the ranges of the files that were reserved for it
+     * while the mutex was held.
+     */
+    boost::mutex mutex;
+
+    /// Filename of the temporary file holding the triangles
+    boost::filesystem::path trianglesPath;
+    /// Handle to @ref trianglesPath, which is open while blocks are received
+    boost::shared_ptr<BinaryWriter> trianglesFile;
+    /// Total number of triangles assigned space in @ref trianglesFile
+    std::tr1::uint64_t writtenTrianglesTmp;
+    /// Writer for vertices and temporary triangles, which exists only during the pass
+    boost::scoped_ptr<AsyncWriter> asyncWriter;
+    /// Largest number of bytes to write in one request to @ref asyncWriter
+    std::size_t maxItemBytes;
+
+    /**
+     * Get the state for a chunk, creating it and opening its output file
+     * if necessary. The caller must hold @ref mutex.
+     */
+    Chunk &getChunk(const ChunkId &chunkId);
+
+    /// Implementation of the functor
+    void add(MesherWork &work, Timeplot::Worker &tworker);
+
+public:
+    /**
+     * @copydoc MesherBase::MesherBase
+     */
+    StreamMesher(FastPly::Writer &writer, const Namer &namer);
+
+    ~StreamMesher();
+
+    virtual unsigned int numPasses() const { return 1; }
+    virtual InputFunctor functor(unsigned int pass);
+    virtual std::size_t write(Timeplot::Worker &tworker, std::ostream *progressStream = NULL);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                               std::ostream *progressStream = NULL);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual void checkpointPartial(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                   std::tr1::uint64_t completedBins);
+
+    /// Not supported: throws @c std::logic_error.
+    virtual std::tr1::uint64_t resumePartial(Timeplot::Worker &tworker, const boost::filesystem::path &path);
 };
 
+/**
+ * Create a mesher of the given type.
+ *
+ * @param type       The type of mesher to create.
+ * @param writer, namer  Arguments for @ref MesherBase::MesherBase.
+ */
+MesherBase *createMesher(MesherType type, FastPly::Writer &writer, const MesherBase::Namer &namer);
+
+/**
+ * Determine whether a checkpoint file was written by @ref
+ * MesherBase::checkpointPartial rather than @ref MesherBase::checkpoint.
+ *
+ * @throw std::ios::failure if the file could not be opened.
+ */
+bool isPartialCheckpoint(const boost::filesystem::path &path);
+
 /**
  * Creates an adapter between @ref MesherBase::InputFunctor and @ref Marching::OutputFunctor
  * that reads the mesh from the device to the host synchronously.
@@ -66,7 +66,7 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
     if (rank == root)
     {
         std::ostringstream dump;
-        boost::archive::text_oarchive archive(dump);
+        boost::archive::binary_oarchive archive(dump);
         archive << *this;
         std::string serial = dump.str();
         Serialize::broadcast(serial, comm, root);
@@ -77,14 +77,12 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
         Serialize::broadcast(serial, comm, root);
 
         std::istringstream dump(serial);
-        boost::archive::text_iarchive archive(dump);
+        boost::archive::binary_iarchive archive(dump);
         archive >> *this;
     }
 
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
-    verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
-    trianglesTmpRead->open(tmpWriter.getTrianglesPath());
+    boost::scoped_ptr<BinaryReader> verticesTmpRead(tmpWriter.openVertices());
+    boost::scoped_ptr<BinaryReader> trianglesTmpRead(tmpWriter.openTriangles());
 
     std::tr1::uint64_t thresholdVertices;
     clump_id keptComponents;
@@ -185,12 +183,12 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
                 }
 
                 writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
+                    tworker, *verticesTmpRead, asyncWriter, writer, chunk,
                     thresholdVertices, startVertex.data(), progress.get(),
                     first, last);
 
                 writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
+                    tworker, *trianglesTmpRead, asyncWriter, writer, chunk,
                     thresholdVertices, chunkExternal,
                     startVertex.data(), startTriangle.data(), externalRemap.data(),
                     triangles, progress.get(),
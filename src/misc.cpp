@@ -90,6 +90,27 @@ void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &o
     }
 }
 
+void reopenTmpFile(const boost::filesystem::path &path, std::tr1::uint64_t size,
+                   boost::filesystem::ofstream &out)
+{
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(path, size, ec);
+    if (ec)
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not truncate temporary file"))
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(ec.value());
+    }
+    out.open(path, std::ios::binary | std::ios::app);
+    if (!out)
+    {
+        int e = errno;
+        throw boost::enable_error_info(std::ios::failure("Could not open temporary file"))
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(e);
+    }
+}
+
 void setTmpFileDir(const boost::filesystem::path &path)
 {
     tmpFileDir = path;
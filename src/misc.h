@@ -206,6 +206,20 @@ static inline std::tr1::uint32_t floatToBits(float x)
  */
 void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &out);
 
+/**
+ * Reopen a file previously created by @ref createTmpFile to append to it,
+ * after first truncating it to @a size bytes. This is used to continue from
+ * a checkpoint, discarding anything written after it.
+ *
+ * @param path           The path to the temporary file.
+ * @param size           The length to which the file is truncated.
+ * @param[out] out       The open temporary file.
+ * @throw std::ios::failure if the file could not be truncated or opened (with
+ * boost error info on the filename and errno)
+ */
+void reopenTmpFile(const boost::filesystem::path &path, std::tr1::uint64_t size,
+                   boost::filesystem::ofstream &out);
+
 /**
  * Set the directory to use for temporary files created by @ref createTmpFile.
  */
@@ -35,12 +35,15 @@
 #include <CL/cl.hpp>
 #include <stdexcept>
 #include <algorithm>
+#include <string>
 #include <boost/math/constants/constants.hpp>
+#include <boost/lexical_cast.hpp>
 #include "errors.h"
 #include "mls.h"
 #include "clh.h"
 #include "misc.h"
 #include "statistics.h"
+#include "statistics_cl.h"
 
 std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
 {
@@ -51,23 +54,37 @@ std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
 }
 
 const Grid::size_type MlsFunctor::wgs[3] = {8, 8, 8};
+const unsigned int MlsFunctor::maxBucketDefault = 256;
 const int MlsFunctor::subsamplingMin = 3; // must be at least log2 of highest wgs
 
-MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape)
-    : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time"))
+MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape,
+                       Grid::size_type edge, unsigned int maxBucket)
+    : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time")),
+    normalsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.computeNormals.time")),
+    subsamplingKernelTime(NULL)
 {
     // These would ideally be static assertions, but C++ doesn't allow that
     MLSGPU_ASSERT((1U << subsamplingMin) >= *std::max_element(wgs, wgs + 3), std::length_error);
 
+    MLSGPU_ASSERT(edge > 0 && (edge & (edge - 1)) == 0, std::invalid_argument);
+    MLSGPU_ASSERT(maxBucket >= 1 && maxBucket <= edge * edge * edge, std::invalid_argument);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(wgs[i] % edge == 0, std::invalid_argument);
+        groupSize[i] = edge;
+    }
+
     std::map<std::string, std::string> defines;
-    defines["WGS_X"] = boost::lexical_cast<std::string>(wgs[0]);
-    defines["WGS_Y"] = boost::lexical_cast<std::string>(wgs[1]);
-    defines["WGS_Z"] = boost::lexical_cast<std::string>(wgs[2]);
+    defines["WGS_X"] = boost::lexical_cast<std::string>(groupSize[0]);
+    defines["WGS_Y"] = boost::lexical_cast<std::string>(groupSize[1]);
+    defines["WGS_Z"] = boost::lexical_cast<std::string>(groupSize[2]);
+    defines["MAX_BUCKET"] = boost::lexical_cast<std::string>(maxBucket);
     defines["FIT_SPHERE"] = shape == MLS_SHAPE_SPHERE ? "1" : "0";
     defines["FIT_PLANE"] = shape == MLS_SHAPE_PLANE ? "1" : "0";
 
     cl::Program program = CLH::build(context, "kernels/mls.cl", defines);
     kernel = cl::Kernel(program, "processCorners");
+    normalsKernel = cl::Kernel(program, "computeNormals");
 
     setBoundaryLimit(1.0f);
 }
@@ -76,6 +93,7 @@ void MlsFunctor::set(const Grid::difference_type offset[3],
                      const cl::Buffer &splats,
                      const cl::Buffer &commands,
                      const cl::Buffer &start,
+                     std::size_t startOffset,
                      unsigned int subsamplingShift)
 {
     cl_int3 offset3 = {{ offset[0], offset[1], offset[2] }};
@@ -83,19 +101,30 @@ void MlsFunctor::set(const Grid::difference_type offset[3],
     kernel.setArg(1, splats);
     kernel.setArg(2, commands);
     kernel.setArg(3, start);
-    kernel.setArg(4, 3 * subsamplingShift);
-    kernel.setArg(5, offset3);
+    kernel.setArg(4, cl_uint(startOffset));
+    kernel.setArg(5, 3 * subsamplingShift);
+    kernel.setArg(6, offset3);
+    normalsKernel.setArg(2, splats);
+    normalsKernel.setArg(3, commands);
+    normalsKernel.setArg(4, start);
+    normalsKernel.setArg(5, cl_uint(startOffset));
+    normalsKernel.setArg(6, 3 * subsamplingShift);
+    normalsKernel.setArg(7, offset3);
+    subsamplingKernelTime = &Statistics::getStatistic<Statistics::Variable>(
+        "kernel.mls.processCorners.subsampling" + boost::lexical_cast<std::string>(subsamplingShift) + ".time");
 }
 
 void MlsFunctor::set(const Grid::difference_type offset[3],
-                     const SplatTreeCL &tree, unsigned int subsamplingShift)
+                     const SplatTreeCL &tree, unsigned int subsamplingShift,
+                     std::size_t segment)
 {
-    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift);
+    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(),
+        tree.getStartOffset(segment), subsamplingShift);
 }
 
 const Grid::size_type *MlsFunctor::alignment() const
 {
-    return wgs;
+    return groupSize;
 }
 
 void MlsFunctor::enqueue(
@@ -105,33 +134,60 @@ void MlsFunctor::enqueue(
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
-    Grid::size_type width = roundUp(swathe.width, wgs[0]);
-    Grid::size_type height = roundUp(swathe.height, wgs[1]);
+    Grid::size_type width = roundUp(swathe.width, groupSize[0]);
+    Grid::size_type height = roundUp(swathe.height, groupSize[1]);
 
     MLSGPU_ASSERT(swathe.zStride >= height, std::invalid_argument);
     MLSGPU_ASSERT(swathe.zFirst <= swathe.zLast, std::invalid_argument);
-    MLSGPU_ASSERT(swathe.zFirst % wgs[2] == 0, std::invalid_argument);
+    MLSGPU_ASSERT(swathe.zFirst % groupSize[2] == 0, std::invalid_argument);
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_WIDTH>() >= width, std::length_error);
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_HEIGHT>() >= swathe.zStride * (swathe.zLast + 1) + swathe.zBias, std::length_error);
 
     kernel.setArg(0, distance);
-    kernel.setArg(6, cl_uint(swathe.zStride));
-    kernel.setArg(7, cl_int(swathe.zBias));
+    kernel.setArg(7, cl_uint(swathe.zStride));
+    kernel.setArg(8, cl_int(swathe.zBias));
 
-    const std::size_t wgs3 = wgs[0] * wgs[1] * wgs[2];
+    const std::size_t wgs3 = groupSize[0] * groupSize[1] * groupSize[2];
     const std::size_t blocks[3] =
     {
-        width / wgs[0],
-        height / wgs[1],
-        divUp(swathe.zLast - swathe.zFirst + 1, wgs[2])
+        width / groupSize[0],
+        height / groupSize[1],
+        divUp(swathe.zLast - swathe.zFirst + 1, groupSize[2])
     };
 
+    cl::Event myEvent;
+    if (event == NULL)
+        event = &myEvent;
     CLH::enqueueNDRangeKernel(queue,
                               kernel,
                               cl::NDRange(0, 0, swathe.zFirst),
                               cl::NDRange(wgs3 * blocks[0], blocks[1], blocks[2]),
                               cl::NDRange(wgs3, 1, 1),
                               events, event, &kernelTime);
+    if (subsamplingKernelTime != NULL)
+        Statistics::timeEvent(*event, *subsamplingKernelTime);
+}
+
+void MlsFunctor::enqueueNormals(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &vertices,
+    const cl::Buffer &normals,
+    std::size_t numVertices,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    // See ScaleBiasFilter for why the enqueue happens even if there is no work
+    if (numVertices > 0)
+    {
+        normalsKernel.setArg(0, normals);
+        normalsKernel.setArg(1, vertices);
+    }
+    CLH::enqueueNDRangeKernelSplit(queue,
+                                   normalsKernel,
+                                   cl::NullRange,
+                                   cl::NDRange(numVertices),
+                                   cl::NullRange,
+                                   events, event, &normalsKernelTime);
 }
 
 void MlsFunctor::setBoundaryLimit(float limit)
@@ -140,5 +196,25 @@ void MlsFunctor::setBoundaryLimit(float limit)
     // uniform distribution of samples and a straight boundary
     const float boundaryScale = (sqrt(6.0f) * 512) / (693 * boost::math::constants::pi<float>());
     const float gamma = boundaryScale * limit;
-    kernel.setArg(8, 1.0f - gamma * gamma);
+    kernel.setArg(9, 1.0f - gamma * gamma);
+}
+
+MlsNormalFilter::MlsNormalFilter(const cl::Context &context, MlsFunctor &input, std::size_t maxVertices)
+    : input(input),
+    normals(context, CL_MEM_READ_WRITE, std::max(maxVertices, std::size_t(1)) * (3 * sizeof(cl_float))),
+    maxVertices(maxVertices)
+{
+}
+
+void MlsNormalFilter::operator()(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &inMesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event,
+    DeviceKeyMesh &outMesh) const
+{
+    MLSGPU_ASSERT(inMesh.numVertices() <= maxVertices, std::length_error);
+    input.enqueueNormals(queue, inMesh.vertices, normals, inMesh.numVertices(), events, event);
+    outMesh = inMesh;
+    outMesh.normals = normals;
 }
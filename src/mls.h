@@ -35,9 +35,11 @@
 #include <cstddef>
 #include <map>
 #include <string>
+#include <vector>
 #include "grid.h"
 #include "splat_tree_cl.h"
 #include "marching.h"
+#include "mesh.h"
 #include "clh.h"
 #include "statistics.h"
 
@@ -86,11 +88,34 @@ private:
      */
     cl::Kernel kernel;
 
+    /**
+     * Kernel generated from @ref computeNormals. It shares the splat and
+     * octree arguments with @ref kernel.
+     */
+    cl::Kernel normalsKernel;
+
+    /**
+     * Work group size used by this instance. It divides into @ref wgs.
+     */
+    Grid::size_type groupSize[3];
+
     /**
      * Measures device time spent in @ref kernel.
      */
     Statistics::Variable &kernelTime;
 
+    /**
+     * Measures device time spent in @ref normalsKernel.
+     */
+    Statistics::Variable &normalsKernelTime;
+
+    /**
+     * Measures device time spent in @ref kernel for the subsampling shift
+     * most recently passed to @ref set. This allows the choice of shift to
+     * be evaluated.
+     */
+    Statistics::Variable *subsamplingKernelTime;
+
     /**
      * Specify the parameters. This is a private variant that
      * does not require the buffers to be stored in a @ref SplatTreeCL, and
@@ -100,13 +125,21 @@ private:
              const cl::Buffer &splats,
              const cl::Buffer &commands,
              const cl::Buffer &start,
+             std::size_t startOffset,
              unsigned int subsamplingShift);
 public:
     /**
-     * Work group size for @ref kernel.
+     * Default (and largest supported) work group size for @ref kernel. Sizes
+     * rounded up to a multiple of this are suitable for any instance.
      */
     static const Grid::size_type wgs[3];
 
+    /**
+     * Default number of splat IDs loaded cooperatively by the work group in
+     * each step of @ref processCorners.
+     */
+    static const unsigned int maxBucketDefault;
+
     /**
      * Minimum subsampling for corresponding octree.
      */
@@ -116,8 +149,16 @@ public:
      * Constructor. It compiles the kernel, so it can throw a compilation error.
      * @param context   The context in which the function operates.
      * @param shape     The shape to fit to the data.
+     * @param edge      Edge length of the (cubic) work group.
+     * @param maxBucket Number of splat IDs loaded per step of the kernel.
+     *
+     * @pre
+     * - @a edge is a power of 2 that divides into @ref wgs.
+     * - 1 &lt;= @a maxBucket &lt;= @a edge<sup>3</sup>.
      */
-    MlsFunctor(const cl::Context &context, MlsShape shape);
+    MlsFunctor(const cl::Context &context, MlsShape shape,
+               Grid::size_type edge = wgs[0],
+               unsigned int maxBucket = maxBucketDefault);
 
     /**
      * Specify the parameters. This must be called before using this object as a functor.
@@ -129,18 +170,20 @@ public:
      * @param offset           Offset between world coordinates and region-relative coordinates.
      * @param tree             Octree containing input splats.
      * @param subsamplingShift Subsampling shift passed when building @a tree.
+     * @param segment          Index of the octree to use, if @a tree was built as a batch.
      *
      * @pre
      * - @a tree was constructed with the same @a offset and @a subsamplingShift.
      */
     void set(const Grid::difference_type offset[3],
-             const SplatTreeCL &tree, unsigned int subsamplingShift);
+             const SplatTreeCL &tree, unsigned int subsamplingShift,
+             std::size_t segment = 0);
 
     virtual const Grid::size_type *alignment() const;
 
     /**
      * @pre The tree passed to @ref set was constructed with dimensions at least
-     * equal to @a size rounded up to multiples of @ref wgs.
+     * equal to @a size rounded up to multiples of @ref alignment.
      */
     virtual void enqueue(
         const cl::CommandQueue &queue,
@@ -161,6 +204,29 @@ public:
                     const std::vector<cl::Event> *events,
                     cl::Event *event) const;
 
+    /**
+     * Compute the surface normal at each of a set of vertices, using the
+     * octree most recently passed to @ref set. The normals are unit length,
+     * except where there is insufficient data for a fit, in which case they
+     * are zero.
+     *
+     * @param queue       Command queue to use.
+     * @param vertices    Vertices in global grid coordinates, as tightly packed @c cl_float triplets.
+     * @param normals     Output normals, as tightly packed @c cl_float triplets.
+     * @param numVertices Number of vertices to process.
+     * @param events      Events to wait for before starting (may be @c NULL).
+     * @param[out] event  Event signaled on completion (may be @c NULL).
+     *
+     * @pre The vertices lie within the region covered by the octree.
+     */
+    void enqueueNormals(
+        const cl::CommandQueue &queue,
+        const cl::Buffer &vertices,
+        const cl::Buffer &normals,
+        std::size_t numVertices,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+
     /**
      * Sets the tuning factor for boundary clipping.
      * A value of 1 is theoretically "correct" and is the default, but in
@@ -169,4 +235,41 @@ public:
     void setBoundaryLimit(float limit);
 };
 
+/**
+ * Mesh filter that attaches normals to the vertices, computed by @ref
+ * MlsFunctor::enqueueNormals. It must be applied while the octree used to
+ * generate the mesh is still current, and before the vertices are
+ * transformed out of grid coordinates. Since the grid spacing is uniform,
+ * the normals need no further transformation.
+ *
+ * Like @ref ScaleBiasFilter, this class is not reentrant. The normals are
+ * written to an internal buffer, so the output mesh must be consumed before
+ * the filter is used again.
+ */
+class MlsNormalFilter
+{
+private:
+    MlsFunctor &input;    ///< Functor holding the current octree
+    cl::Buffer normals;   ///< Storage for the output normals
+    std::size_t maxVertices; ///< Capacity of @ref normals, in vertices
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param context     Context in which to allocate the normals.
+     * @param input       Functor used to compute the normals.
+     * @param maxVertices Maximum number of vertices in a mesh passed to the filter.
+     */
+    MlsNormalFilter(const cl::Context &context, MlsFunctor &input, std::size_t maxVertices);
+
+    /// Filter operation (see @ref MeshFilter).
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &inMesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event,
+        DeviceKeyMesh &outMesh) const;
+};
+
 #endif /* !MLS_H */
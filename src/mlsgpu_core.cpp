@@ -50,6 +50,7 @@
 #include <sstream>
 #include <cstdlib>
 #include <cassert>
+#include <cmath>
 #include <limits>
 #include "mlsgpu_core.h"
 #include "options.h"
@@ -63,10 +64,13 @@
 #include "provenance.h"
 #include "marching.h"
 #include "splat_tree_cl.h"
+#include "device_arena.h"
 #include "workers.h"
 #include "bucket.h"
 #include "splat_set.h"
 #include "decache.h"
+#include "tuning.h"
+#include "incremental.h"
 
 namespace po = boost::program_options;
 
@@ -89,7 +93,8 @@ static void addFitOptions(po::options_description &opts)
         (Option::fitPrune,        po::value<double>()->default_value(0.02), "Minimum fraction of vertices per component")
         (Option::fitBoundaryLimit, po::value<double>()->default_value(1.0), "Tuning factor for boundary detection")
         (Option::fitShape,        po::value<Choice<MlsShapeWrapper> >()->default_value(MLS_SHAPE_SPHERE),
-                                                                            "Model shape (sphere | plane)");
+                                                                            "Model shape (sphere | plane)")
+        (Option::fitAdaptive,     po::value<int>()->default_value(0),       "Coarsen the grid up to 2^N times where splats are large");
 }
 
 static void addStatisticsOptions(po::options_description &opts)
@@ -103,23 +108,36 @@ static void addStatisticsOptions(po::options_description &opts)
     opts.add(statistics);
 }
 
-static void addAdvancedOptions(po::options_description &opts)
+static void addAdvancedOptions(po::options_description &opts, bool isMPI)
 {
     po::options_description advanced("Advanced options");
     advanced.add_options()
         (Option::levels,       po::value<int>()->default_value(6), "Levels in octree")
         (Option::subsampling,  po::value<int>()->default_value(3), "Subsampling of octree")
+        (Option::fixedOctree,  "Use the same octree levels and subsampling for every bucket")
         (Option::maxSplit,     po::value<int>()->default_value(1024 * 1024 * 1024), "Maximum fan-out in partitioning")
         (Option::leafCells,    po::value<int>()->default_value(63), "Leaf size for initial histogram")
         (Option::deviceThreads, po::value<int>()->default_value(1), "Number of threads per device for submitting OpenCL work")
+        (Option::mesherThreads, po::value<int>()->default_value(2), "Number of threads for processing the output mesh")
+        (Option::writerThreads, po::value<int>()->default_value(2), "Number of output files to write concurrently")
         (Option::reader,       po::value<Choice<ReaderTypeWrapper> >()->default_value(SYSCALL_READER), "File reader class (syscall | stream | mmap)")
-        (Option::writer,       po::value<Choice<WriterTypeWrapper> >()->default_value(SYSCALL_WRITER), "File writer class (syscall | stream)")
+        (Option::writer,       po::value<Choice<WriterTypeWrapper> >()->default_value(SYSCALL_WRITER), "File writer class (syscall | stream | mmap)")
 #ifdef _OPENMP
         (Option::ompThreads,   po::value<int>(), "Number of threads for OpenMP")
+#endif
+#if HAVE_LZ4
+        (Option::compressTmp,  "Compress temporary files holding the output mesh")
 #endif
         (Option::decache,      "Try to evict input files from OS cache for benchmarking")
         (Option::checkpoint,   po::value<std::string>(), "Checkpoint state prior to writing output")
-        (Option::resume,       po::value<std::string>(), "Restart from checkpoint");
+        (Option::resume,       po::value<std::string>(), "Restart from checkpoint")
+        (Option::tune,         "Benchmark kernel parameters for the devices and save the results")
+        (Option::tuningFile,   po::value<std::string>(), "File holding saved kernel parameters");
+    if (!isMPI)
+        advanced.add_options()
+            (Option::mesher,   po::value<Choice<MesherTypeWrapper> >()->default_value(OOC_MESHER), "Mesher class (ooc | recompute | stream)")
+            (Option::partialCheckpoint, po::value<std::string>(), "Periodically checkpoint state while processing, for use with --resume")
+            (Option::checkpointInterval, po::value<int>()->default_value(600), "Seconds between partial checkpoints");
     opts.add(advanced);
 }
 
@@ -131,7 +149,9 @@ static void addMemoryOptions(po::options_description &opts, bool isMPI)
         (Option::memHostSplats,   po::value<Capacity>()->default_value(512 * 1024 * 1024), "Memory for splats on the CPU")
         (Option::memBucketSplats, po::value<Capacity>()->default_value(64 * 1024 * 1024),  "Memory for splats in a single bucket")
         (Option::memMesh,         po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for raw mesh data on the CPU")
-        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU");
+        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU")
+        (Option::memOctree,       po::value<Capacity>()->default_value(0),  "Optional octree scratch memory shared by each device's threads (0 to disable)")
+        (Option::memMesherKeys,   po::value<Capacity>()->default_value(0),  "Memory for vertices shared between blocks (0 for unlimited)");
     if (isMPI)
         memory.add_options()
             (Option::memGather,   po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for buffering raw mesh data on the slaves");
@@ -154,12 +174,22 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
     addCommonOptions(desc);
     addFitOptions(desc);
     addStatisticsOptions(desc);
-    addAdvancedOptions(desc);
+    addAdvancedOptions(desc, isMPI);
     addMemoryOptions(desc, isMPI);
     desc.add_options()
         ("output-file,o",   po::value<std::string>()->required(), "output file")
         (Option::split,     "split output across multiple files")
         (Option::splitSize, po::value<Capacity>()->default_value(100 * 1024 * 1024), "approximate size of output chunks");
+    if (!isMPI)
+        desc.add_options()
+            (Option::normals, "write vertex normals computed from the fit")
+            (Option::compact, "write quantized compact meshes instead of PLY")
+            (Option::optimizeOrder, "reorder triangles and vertices for vertex-cache efficiency")
+            (Option::decimate, po::value<double>()->default_value(0.0), "simplify the mesh within this error, in grid cells")
+            (Option::fitLevels, po::value<std::vector<double> >()->composing(), "also reconstruct at this coarser grid spacing, a power-of-two multiple of --fit-grid (may be repeated)")
+            (Option::region, po::value<std::string>(), "only reconstruct within xmin,ymin,zmin,xmax,ymax,zmax")
+            (Option::incremental, po::value<std::string>(), "only recompute chunks whose inputs changed since the run recorded in this file")
+            (Option::preview, po::value<int>(), "quick preview on a grid this many times coarser, from a subset of the input");
 
     po::options_description clopts("OpenCL options");
     CLH::addOptions(clopts);
@@ -280,6 +310,13 @@ static std::string makeOptions(const po::variables_map &vm)
                 opts << " --" << i->first << '=' << j;
             }
         }
+        else if (value.type() == typeid(std::vector<double>))
+        {
+            BOOST_FOREACH(double j, param.as<std::vector<double> >())
+            {
+                opts << " --" << i->first << '=' << j;
+            }
+        }
         else
         {
             opts << " --" << i->first << '=';
@@ -395,6 +432,69 @@ static std::size_t getMaxBucketSplats(const po::variables_map &vm)
     return mem / sizeof(Splat);
 }
 
+/**
+ * Device memory to share between the device threads for octree construction.
+ * If not specified by the user, this is zero, and each thread holds its own
+ * storage for a maximum-size bucket. A shared arena is not used in that case,
+ * because it is handed out in ring order: a thread that is slow to free its
+ * allocation would hold up the others, no matter how large the arena is.
+ */
+static std::size_t getOctreeMemory(const po::variables_map &vm)
+{
+    return vm[Option::memOctree].as<Capacity>();
+}
+
+/**
+ * Parse the value of @c --region.
+ *
+ * @return @c false if the option was not given.
+ * @throw invalid_option if the value is malformed.
+ */
+static bool getRegion(const po::variables_map &vm, double lower[3], double upper[3])
+{
+    if (!vm.count(Option::region))
+        return false;
+
+    std::istringstream in(vm[Option::region].as<std::string>());
+    double values[6];
+    for (unsigned int i = 0; i < 6; i++)
+    {
+        char sep;
+        if ((i > 0 && !(in >> sep && sep == ',')) || !(in >> values[i]) || !std::isfinite(values[i]))
+            throw invalid_option(std::string("Value of --") + Option::region
+                                 + " must be six comma-separated numbers");
+    }
+    if (!(in >> std::ws).eof())
+        throw invalid_option(std::string("Value of --") + Option::region
+                             + " must be six comma-separated numbers");
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        lower[i] = values[i];
+        upper[i] = values[i + 3];
+        if (!(lower[i] < upper[i]))
+            throw invalid_option(std::string("Value of --") + Option::region
+                                 + " must have each minimum less than the corresponding maximum");
+    }
+    return true;
+}
+
+/**
+ * Compute the range of cells (on a grid with reference at the origin) that
+ * covers the region. The lower bound is rounded down to a multiple of
+ * @a align. The results are returned as floating-point values, since they
+ * have not yet been clamped to any grid.
+ */
+static void getRegionCells(
+    const double lower[3], const double upper[3], double spacing, unsigned int align,
+    double cellLower[3], double cellUpper[3])
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        cellLower[i] = std::floor(std::floor(lower[i] / spacing) / align) * align;
+        cellUpper[i] = std::ceil(upper[i] / spacing);
+    }
+}
+
 void validateOptions(const po::variables_map &vm, bool isMPI)
 {
     const int levels = vm[Option::levels].as<int>();
@@ -404,9 +504,12 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
     const std::size_t maxHostSplats = getMaxHostSplats(vm);
     const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
     const int deviceThreads = vm[Option::deviceThreads].as<int>();
+    const int mesherThreads = vm[Option::mesherThreads].as<int>();
     const double pruneThreshold = vm[Option::fitPrune].as<double>();
+    const int fitAdaptive = vm[Option::fitAdaptive].as<int>();
 
     const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
+    const std::size_t memOctree = vm[Option::memOctree].as<Capacity>();
 
     int maxLevels = std::min(
             std::size_t(Marching::MAX_DIMENSION_LOG2 + 1),
@@ -443,11 +546,143 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
 
     if (deviceThreads < 1)
         throw invalid_option(std::string("Value of --") + Option::deviceThreads + " must be at least 1");
+    if (mesherThreads < 1)
+        throw invalid_option(std::string("Value of --") + Option::mesherThreads + " must be at least 1");
+    if (vm[Option::writerThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::writerThreads + " must be at least 1");
     if (!(pruneThreshold >= 0.0 && pruneThreshold <= 1.0))
         throw invalid_option(std::string("Value of --") + Option::fitPrune + " must be in [0, 1]");
+    if (fitAdaptive < 0)
+        throw invalid_option(std::string("Value of --") + Option::fitAdaptive + " must be non-negative");
+    if (fitAdaptive >= Marching::MAX_DIMENSION_LOG2
+        || (1U << fitAdaptive) > std::min(std::size_t(vm[Option::leafCells].as<int>()), treeVerts - 1))
+        throw invalid_option(std::string("Value of --") + Option::fitAdaptive
+                             + " is too large for the microblock size (see --" + Option::leafCells + ")");
 
     if (memMesh < getMeshHostMemory(vm))
         throw invalid_option(std::string("Value of --") + Option::memMesh + " is too small");
+    if (memOctree != 0
+        && memOctree < SplatTreeCL::arenaBytes(levels, maxBucketSplats, DeviceArena::MAX_ALIGNMENT))
+        throw invalid_option(std::string("Value of --") + Option::memOctree + " is too small");
+    if (!isMPI)
+    {
+        if (vm.count(Option::preview))
+        {
+            const int factor = vm[Option::preview].as<int>();
+            if (factor < 2 || factor > 256)
+                throw invalid_option(std::string("Value of --") + Option::preview + " must be in the range 2 to 256");
+            // The preview always streams its output, which rules out these
+            const char * const conflicts[] =
+            {
+                Option::mesher, Option::split, Option::checkpoint, Option::resume,
+                Option::partialCheckpoint, Option::normals, Option::compact,
+                Option::optimizeOrder, Option::fitLevels, Option::incremental
+            };
+            BOOST_FOREACH(const char *name, conflicts)
+            {
+                if (vm.count(name) && !vm[name].defaulted())
+                    throw invalid_option(std::string("--") + Option::preview
+                                         + " cannot be combined with --" + name);
+            }
+            if (vm[Option::decimate].as<double>() != 0.0)
+                throw invalid_option(std::string("--") + Option::preview
+                                     + " cannot be combined with --" + Option::decimate);
+        }
+
+        const MesherType mesherType = getMesherType(vm);
+        if (mesherType != OOC_MESHER && (vm.count(Option::checkpoint) || vm.count(Option::resume)))
+            throw invalid_option(std::string("--") + Option::checkpoint + " and --" + Option::resume
+                                 + " are only supported with --" + Option::mesher + "=ooc");
+        if (mesherType == STREAM_MESHER && pruneThreshold != 0.0 && !vm.count(Option::preview))
+            throw invalid_option(std::string("--") + Option::mesher + "=stream requires --"
+                                 + Option::fitPrune + "=0");
+        if (vm.count(Option::partialCheckpoint))
+        {
+            if (mesherType != OOC_MESHER)
+                throw invalid_option(std::string("--") + Option::partialCheckpoint
+                                     + " is only supported with --" + Option::mesher + "=ooc");
+            if (vm.count(Option::compressTmp))
+                throw invalid_option(std::string("--") + Option::partialCheckpoint
+                                     + " cannot be combined with --" + Option::compressTmp);
+        }
+        if (vm.count(Option::normals))
+        {
+            if (mesherType != OOC_MESHER)
+                throw invalid_option(std::string("--") + Option::normals
+                                     + " is only supported with --" + Option::mesher + "=ooc");
+            if (vm.count(Option::checkpoint) || vm.count(Option::resume) || vm.count(Option::partialCheckpoint))
+                throw invalid_option(std::string("--") + Option::normals
+                                     + " cannot be combined with checkpointing");
+        }
+        if (vm.count(Option::compact))
+        {
+            if (mesherType != OOC_MESHER)
+                throw invalid_option(std::string("--") + Option::compact
+                                     + " is only supported with --" + Option::mesher + "=ooc");
+            if (vm.count(Option::checkpoint) || vm.count(Option::resume) || vm.count(Option::partialCheckpoint))
+                throw invalid_option(std::string("--") + Option::compact
+                                     + " cannot be combined with checkpointing");
+            if (vm.count(Option::normals))
+                throw invalid_option(std::string("--") + Option::compact
+                                     + " cannot be combined with --" + Option::normals);
+            /* Each chunk is quantized to 65535 steps, which is only finer
+             * than the grid if the chunks are small (at most a few thousand
+             * cells with any --split-size).
+             */
+            if (!vm.count(Option::split))
+                throw invalid_option(std::string("--") + Option::compact
+                                     + " requires --" + Option::split);
+        }
+        if (vm.count(Option::optimizeOrder) && mesherType != OOC_MESHER)
+            throw invalid_option(std::string("--") + Option::optimizeOrder
+                                 + " is only supported with --" + Option::mesher + "=ooc");
+        if (vm[Option::decimate].as<double>() < 0.0)
+            throw invalid_option(std::string("Value of --") + Option::decimate + " must be non-negative");
+        if (vm[Option::decimate].as<double>() > 0.0 && mesherType != OOC_MESHER)
+            throw invalid_option(std::string("--") + Option::decimate
+                                 + " is only supported with --" + Option::mesher + "=ooc");
+        if (vm.count(Option::fitLevels))
+        {
+            if (vm.count(Option::checkpoint) || vm.count(Option::resume) || vm.count(Option::partialCheckpoint))
+                throw invalid_option(std::string("--") + Option::fitLevels
+                                     + " cannot be combined with checkpointing");
+            const double spacing = vm[Option::fitGrid].as<double>();
+            const double maxFactor = std::min(std::size_t(vm[Option::leafCells].as<int>()), treeVerts - 1);
+            BOOST_FOREACH(double levelSpacing, vm[Option::fitLevels].as<std::vector<double> >())
+            {
+                /* Each bucket is scaled down by the factor in the copy stage,
+                 * which only lines up between buckets if the buckets are
+                 * aligned to it (see getMicroCells).
+                 */
+                const double ratio = levelSpacing / spacing;
+                const double factor = std::floor(ratio + 0.5);
+                if (!(factor >= 2.0 && factor <= 65536.0 && std::abs(ratio - factor) <= 1e-3 * factor)
+                    || (Grid::size_type(factor) & (Grid::size_type(factor) - 1)) != 0)
+                    throw invalid_option(std::string("Values of --") + Option::fitLevels
+                                         + " must be power-of-two multiples (of at least 2) of --" + Option::fitGrid);
+                if (factor > maxFactor)
+                    throw invalid_option(std::string("Values of --") + Option::fitLevels
+                                         + " are too large for the microblock size (see --" + Option::leafCells + ")");
+            }
+        }
+        double regionLower[3], regionUpper[3];
+        getRegion(vm, regionLower, regionUpper);
+        if (vm.count(Option::incremental))
+        {
+            if (!vm.count(Option::split))
+                throw invalid_option(std::string("--") + Option::incremental
+                                     + " requires --" + Option::split);
+            if (vm.count(Option::checkpoint) || vm.count(Option::resume) || vm.count(Option::partialCheckpoint))
+                throw invalid_option(std::string("--") + Option::incremental
+                                     + " cannot be combined with checkpointing");
+            if (vm.count(Option::fitLevels) || vm.count(Option::region))
+                throw invalid_option(std::string("--") + Option::incremental
+                                     + " cannot be combined with --" + Option::fitLevels
+                                     + " or --" + Option::region);
+        }
+        if (vm[Option::checkpointInterval].as<int>() < 1)
+            throw invalid_option(std::string("Value of --") + Option::checkpointInterval + " must be at least 1");
+    }
     if (isMPI)
     {
         const std::size_t memGather = vm[Option::memGather].as<Capacity>();
@@ -479,7 +714,8 @@ CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
     CLH::ResourceUsage totalUsage = DeviceWorkerGroup::resourceUsage(
         deviceThreads, deviceSpare, cl::Device(),
         maxBucketSplats, maxCells,
-        getMeshMemory(vm), levels);
+        getMeshMemory(vm), getOctreeMemory(vm), levels,
+        vm.count(Option::normals));
     return totalUsage;
 }
 
@@ -517,7 +753,11 @@ void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsa
     }
 }
 
-void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float smooth, float maxRadius)
+/**
+ * Expand the input file names, replacing each directory by the PLY files it
+ * contains.
+ */
+static std::vector<boost::filesystem::path> getInputPaths(const po::variables_map &vm)
 {
     const std::vector<std::string> &names = vm[Option::inputFile].as<std::vector<std::string> >();
     std::vector<boost::filesystem::path> paths;
@@ -537,7 +777,12 @@ void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float
         else
             paths.push_back(name);
     }
+    return paths;
+}
 
+void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float smooth, float maxRadius)
+{
+    const std::vector<boost::filesystem::path> paths = getInputPaths(vm);
     const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
     if (paths.size() > SplatSet::FileSet::maxFiles)
     {
@@ -584,23 +829,63 @@ void reportException(std::exception &e)
         std::cerr << e.what() << std::endl;
 }
 
+/**
+ * Largest ratio of a --fit-levels spacing to --fit-grid, or 1 if there is
+ * only one level. Buckets are aligned to it so that every level can be
+ * computed from the same buckets.
+ */
+static unsigned int getLevelAlign(const po::variables_map &vm)
+{
+    const std::vector<Grid::size_type> factors = getLevelFactors(vm);
+    return *std::max_element(factors.begin(), factors.end());
+}
+
+/**
+ * Cells per microblock, which is also the bucket size used for the blobs.
+ * With --fit-adaptive or --fit-levels it is rounded down to a multiple of the
+ * largest coarsening factor, so that the coarse grids of adjacent buckets
+ * line up.
+ */
+static unsigned int getMicroCells(const po::variables_map &vm)
+{
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const unsigned int leafCells = vm[Option::leafCells].as<int>();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+    const unsigned int coarse = std::max(1U << vm[Option::fitAdaptive].as<int>(), getLevelAlign(vm));
+    return std::min(leafCells, blockCells) / coarse * coarse;
+}
+
+/// Ratio of the preview grid spacing to --fit-grid, or 1 if not previewing
+static unsigned int getPreviewFactor(const po::variables_map &vm)
+{
+    return vm.count(Option::preview) ? vm[Option::preview].as<int>() : 1;
+}
+
+/// Grid spacing to use, which is coarser than --fit-grid for --preview
+static double getSpacing(const po::variables_map &vm)
+{
+    return vm[Option::fitGrid].as<double>() * getPreviewFactor(vm);
+}
+
 void doComputeBlobs(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
     SplatSet::FileSet &splats,
     boost::function<void(float, unsigned int)> computeBlobs)
 {
-    const float spacing = vm[Option::fitGrid].as<double>();
-    const float smooth = vm[Option::fitSmooth].as<double>();
+    const float spacing = getSpacing(vm);
+    /* A preview keeps about one splat in factor^2 (see SlaveWorkers), which
+     * makes the samples on a surface about factor times further apart. The
+     * radii are enlarged to match, so that the splats still overlap as much.
+     */
+    const float factor = getPreviewFactor(vm);
+    const float smooth = vm[Option::fitSmooth].as<double>() * factor;
     const float maxRadius = vm.count(Option::maxRadius)
-        ? vm[Option::maxRadius].as<double>() : std::numeric_limits<float>::infinity();
+        ? vm[Option::maxRadius].as<double>() * factor : std::numeric_limits<float>::infinity();
 
-    const int subsampling = vm[Option::subsampling].as<int>();
-    const int levels = vm[Option::levels].as<int>();
-    const unsigned int leafCells = vm[Option::leafCells].as<int>();
-    const unsigned int block = 1U << (levels + subsampling - 1);
-    const unsigned int blockCells = block - 1;
-    const unsigned int microCells = std::min(leafCells, blockCells);
+    const unsigned int microCells = getMicroCells(vm);
 
     prepareInputs(splats, vm, smooth, maxRadius);
     try
@@ -614,20 +899,53 @@ void doComputeBlobs(
     }
 }
 
-unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
+bool getRegionBox(const po::variables_map &vm, float lower[3], float upper[3])
 {
+    double regionLower[3], regionUpper[3];
+    if (!getRegion(vm, regionLower, regionUpper))
+        return false;
+
+    const double spacing = getSpacing(vm);
+    const unsigned int microCells = getMicroCells(vm);
+    // postprocessGrid may extend the upper bound to a multiple of this
+    const unsigned int align = getLevelAlign(vm);
+    double cellLower[3], cellUpper[3];
+    getRegionCells(regionLower, regionUpper, spacing, microCells, cellLower, cellUpper);
     for (unsigned int i = 0; i < 3; i++)
     {
-        double size = grid.numCells(i) * grid.getSpacing();
-        Statistics::getStatistic<Statistics::Variable>(std::string("bbox") + "XYZ"[i]).add(size);
-        if (grid.numVertices(i) > Marching::MAX_GLOBAL_DIMENSION)
-        {
-            std::ostringstream msg;
-            msg << "The bounding box is too big (" << grid.numVertices(i) << " grid units).\n"
-                << "Perhaps you have used the wrong units for --fit-grid?";
-            throw std::runtime_error(msg.str());
-        }
+        lower[i] = cellLower[i] * spacing;
+        upper[i] = (cellUpper[i] + align - 1) * spacing;
     }
+    return true;
+}
+
+void clipGrid(const po::variables_map &vm, Grid &grid)
+{
+    double regionLower[3], regionUpper[3];
+    if (!getRegion(vm, regionLower, regionUpper))
+        return;
+
+    double cellLower[3], cellUpper[3];
+    getRegionCells(regionLower, regionUpper, grid.getSpacing(), getMicroCells(vm),
+                   cellLower, cellUpper);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const Grid::extent_type e = grid.getExtent(i);
+        // Clamp before converting, to avoid overflow
+        const Grid::difference_type lo = Grid::difference_type(
+            std::max(cellLower[i], double(e.first)));
+        const Grid::difference_type hi = Grid::difference_type(
+            std::min(cellUpper[i], double(e.second)));
+        if (lo >= hi)
+            throw std::runtime_error(std::string("The region given by --") + Option::region
+                                     + " does not contain any input");
+        grid.setExtent(i, lo, hi);
+    }
+}
+
+unsigned int postprocessGrid(const po::variables_map &vm, Grid &grid)
+{
+    clipGrid(vm, grid);
 
     const bool split = vm.count(Option::split);
     const unsigned int splitSize = vm[Option::splitSize].as<Capacity>();
@@ -650,6 +968,38 @@ unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
         chunkCells = (unsigned int) ceil(sqrt(splitSize / 760.0));
         if (chunkCells == 0) chunkCells = 1;
     }
+
+    if (vm.count(Option::incremental))
+    {
+        const int subsampling = vm[Option::subsampling].as<int>();
+        const int levels = vm[Option::levels].as<int>();
+        const unsigned int blockCells = (1U << (levels + subsampling - 1)) - 1;
+        chunkCells = Incremental::alignGrid(grid, chunkCells, getMicroCells(vm), blockCells,
+                                            vm[Option::maxSplit].as<int>());
+    }
+
+    /* Every level of detail is computed from the same buckets, so the grid
+     * must be a whole number of cells at the coarsest level.
+     */
+    const Grid::difference_type align = getLevelAlign(vm);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const Grid::extent_type e = grid.getExtent(i);
+        grid.setExtent(i, e.first, e.first + roundUp(e.second - e.first, align));
+    }
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        double size = grid.numCells(i) * grid.getSpacing();
+        Statistics::getStatistic<Statistics::Variable>(std::string("bbox") + "XYZ"[i]).add(size);
+        if (grid.numVertices(i) > Marching::MAX_GLOBAL_DIMENSION)
+        {
+            std::ostringstream msg;
+            msg << "The bounding box is too big (" << grid.numVertices(i) << " grid units).\n"
+                << "Perhaps you have used the wrong units for --fit-grid?";
+            throw std::runtime_error(msg.str());
+        }
+    }
     return chunkCells;
 }
 
@@ -659,7 +1009,7 @@ void doBucket(
     const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
     const Grid &grid,
     Grid::size_type chunkCells,
-    BucketCollector &collector)
+    const Bucket::ProcessorType<SplatSet::FastBlobSet<SplatSet::FileSet> >::type &process)
 {
     Timeplot::Action bucketTimer("compute", tworker, "bucket.compute");
 
@@ -667,14 +1017,13 @@ void doBucket(
     const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
     const int subsampling = vm[Option::subsampling].as<int>();
     const int levels = vm[Option::levels].as<int>();
-    const unsigned int leafCells = vm[Option::leafCells].as<int>();
 
     const unsigned int block = 1U << (levels + subsampling - 1);
     const unsigned int blockCells = block - 1;
-    const unsigned int microCells = std::min(leafCells, blockCells);
+    const unsigned int microCells = getMicroCells(vm);
 
     Bucket::bucket(splats, grid, maxBucketSplats, blockCells, chunkCells, microCells, maxSplit,
-                   boost::ref(collector));
+                   process, Bucket::Recursion(), getLevelAlign(vm));
 }
 
 void setWriterComments(const po::variables_map &vm, FastPly::Writer &writer)
@@ -688,17 +1037,276 @@ MesherBase::Namer getNamer(const po::variables_map &vm, const std::string &out)
 {
     const bool split = vm.count(Option::split);
     if (split)
-        return ChunkNamer(out);
+        return ChunkNamer(out, vm.count(Option::compact) ? ".mlsq" : ".ply");
     else
         return TrivialNamer(out);
 }
 
-void setMesherOptions(const po::variables_map &vm, MesherBase &mesher)
+std::string getIncrementalOptions(const po::variables_map &vm)
 {
-    const double pruneThreshold = vm[Option::fitPrune].as<double>();
+    const char * const names[] =
+    {
+        Option::fitSmooth, Option::maxRadius, Option::fitGrid, Option::fitPrune,
+        Option::fitBoundaryLimit, Option::fitShape, Option::fitAdaptive, Option::splitSize,
+        Option::normals, Option::compact, Option::optimizeOrder, Option::decimate
+    };
+    po::variables_map relevant;
+    BOOST_FOREACH(const char *name, names)
+    {
+        po::variables_map::const_iterator pos = vm.find(name);
+        if (pos != vm.end())
+            relevant.insert(*pos);
+    }
+    return makeOptions(relevant);
+}
+
+Incremental::Tracker *createTracker(
+    const po::variables_map &vm,
+    const Grid &grid, Grid::size_type chunkCells,
+    const MesherBase::Namer &namer)
+{
+    Incremental::Manifest previous, current;
+    previous.load(vm[Option::incremental].as<std::string>());
+
+    current.options = getIncrementalOptions(vm);
+    current.chunkCells = chunkCells;
+    for (unsigned int i = 0; i < 3; i++)
+        current.origin[i] = grid.getExtent(i).first / Grid::difference_type(chunkCells);
+    BOOST_FOREACH(const boost::filesystem::path &path, getInputPaths(vm))
+    {
+        current.files.push_back(Incremental::FileInfo(path));
+    }
+
+    Incremental::Tracker *tracker = new Incremental::Tracker(previous, current, namer);
+    if (!previous.chunks.empty() && !tracker->isCompatible())
+        Log::log[Log::info] << "Options have changed since the previous run, so all chunks will be recomputed\n";
+    return tracker;
+}
+
+MesherType getMesherType(const po::variables_map &vm)
+{
+    const MesherType mesherType = vm[Option::mesher].as<Choice<MesherTypeWrapper> >();
+    if (vm.count(Option::preview))
+        return STREAM_MESHER;
+    /* Without pruning, there is no need to hold the whole mesh back until the
+     * end, so unless a mesher was requested, stream the output. This is not
+     * done for split output since every output file is kept open.
+     */
+    if (vm[Option::mesher].defaulted()
+        && vm[Option::fitPrune].as<double>() == 0.0
+        && !vm.count(Option::split)
+        && !vm.count(Option::checkpoint)
+        && !vm.count(Option::resume)
+        && !vm.count(Option::partialCheckpoint)
+        && !vm.count(Option::normals)
+        && !vm.count(Option::compact)
+        && !vm.count(Option::optimizeOrder)
+        && vm[Option::decimate].as<double>() == 0.0)
+        return STREAM_MESHER;
+    return mesherType;
+}
+
+std::vector<Grid::size_type> getLevelFactors(const po::variables_map &vm)
+{
+    std::vector<Grid::size_type> factors(1, 1);
+    if (vm.count(Option::fitLevels))
+    {
+        const double spacing = vm[Option::fitGrid].as<double>();
+        BOOST_FOREACH(double levelSpacing, vm[Option::fitLevels].as<std::vector<double> >())
+            factors.push_back(Grid::size_type(std::floor(levelSpacing / spacing + 0.5)));
+    }
+    return factors;
+}
+
+void setMesherOptions(const po::variables_map &vm, MesherBase &mesher, Grid::size_type factor)
+{
+    /* Previews are streamed, so cannot be pruned. With an adaptive grid,
+     * buckets of different resolutions do not share vertices, so a component
+     * may be cut into pieces that are small enough to be pruned.
+     */
+    const bool noPrune = vm.count(Option::preview) || vm[Option::fitAdaptive].as<int>() > 0;
+    const double pruneThreshold = noPrune ? 0.0 : vm[Option::fitPrune].as<double>();
     const std::size_t memReorder = vm[Option::memReorder].as<Capacity>();
+    const std::size_t memMesherKeys = vm[Option::memMesherKeys].as<Capacity>();
     mesher.setPruneThreshold(pruneThreshold);
     mesher.setReorderCapacity(memReorder);
+    mesher.setKeysCapacity(memMesherKeys);
+    mesher.setCompressTmp(vm.count(Option::compressTmp));
+    mesher.setWriterThreads(vm[Option::writerThreads].as<int>());
+    mesher.setOptimizeOrder(vm.count(Option::optimizeOrder));
+    if (vm.count(Option::decimate))
+        mesher.setDecimateError(vm[Option::decimate].as<double>() * vm[Option::fitGrid].as<double>() * factor);
+}
+
+static boost::filesystem::path getTuningPath(const po::variables_map &vm)
+{
+    if (vm.count(Option::tuningFile))
+        return vm[Option::tuningFile].as<std::string>();
+    else
+        return Tuning::defaultCachePath();
+}
+
+/**
+ * Determine the kernel parameters for a device. The command-line options are
+ * used unless there are saved results for the device. Saved values for @c
+ * --levels and @c --subsampling are only used if these options were not given
+ * explicitly.
+ */
+static Tuning::Parameters getTuning(const po::variables_map &vm, const cl::Device &device)
+{
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
+
+    Tuning::Parameters params(levels, subsampling);
+    const boost::filesystem::path path = getTuningPath(vm);
+    if (path.empty())
+        return params;
+
+    Tuning::Cache cache(path);
+    cache.load();
+    Tuning::Parameters tuned(levels, subsampling);
+    if (!cache.lookup(Tuning::makeKey(device, shape, levels, subsampling), tuned))
+        return params;
+
+    const Grid::size_type edge = tuned.mlsEdge;
+    if (edge == 0 || (edge & (edge - 1)) != 0 || MlsFunctor::wgs[0] % edge != 0
+        || tuned.mlsMaxBucket < 1 || tuned.mlsMaxBucket > edge * edge * edge)
+    {
+        Log::log[Log::warn] << "Warning: ignoring invalid tuning results in " << path.string() << '\n';
+        return params;
+    }
+    params.mlsEdge = tuned.mlsEdge;
+    params.mlsMaxBucket = tuned.mlsMaxBucket;
+
+    /* Only accept a split that does not use more octree levels than requested, so
+     * that the memory estimate remains valid.
+     */
+    if (vm[Option::levels].defaulted() && vm[Option::subsampling].defaulted()
+        && tuned.levels >= 1 && tuned.levels <= levels
+        && tuned.levels + tuned.subsampling == levels + subsampling)
+    {
+        params.levels = tuned.levels;
+        params.subsampling = tuned.subsampling;
+    }
+    Log::log[Log::debug] << "Using tuned parameters for " << device.getInfo<CL_DEVICE_NAME>() << '\n';
+    return params;
+}
+
+namespace
+{
+
+/**
+ * Bucket processor that loads a few buckets, spread through the data set, for
+ * use as tuning samples.
+ */
+class TuningSampler
+{
+public:
+    typedef void result_type;
+    typedef SplatSet::FastBlobSet<SplatSet::FileSet> Splats;
+
+    TuningSampler(const Grid &fullGrid, std::tr1::uint64_t totalSplats,
+                  std::size_t maxSamples, std::vector<Tuning::Sample> &samples)
+        : fullGrid(fullGrid), stride(std::max(totalSplats / maxSamples, std::tr1::uint64_t(1))),
+        seen(0), next(0), maxSamples(maxSamples), samples(samples)
+    {
+    }
+
+    void operator()(
+        const SplatSet::Traits<Splats>::subset_type &subset,
+        const Grid &grid,
+        const Bucket::Recursion &recursionState)
+    {
+        (void) recursionState;
+        const std::tr1::uint64_t numSplats = subset.numSplats();
+        const bool take = seen >= next && samples.size() < maxSamples && numSplats > 0;
+        seen += numSplats;
+        if (!take)
+            return;
+        next += stride;
+
+        samples.push_back(Tuning::Sample());
+        Tuning::Sample &sample = samples.back();
+        sample.splats.resize(numSplats);
+        boost::scoped_ptr<SplatSet::SplatStream> splatStream(subset.makeSplatStream());
+        sample.splats.resize(splatStream->read(&sample.splats[0], NULL, numSplats));
+
+        /* Transform into the same coordinate system used by BucketLoader */
+        const float invSpacing = 1.0f / fullGrid.getSpacing();
+        BOOST_FOREACH(Splat &splat, sample.splats)
+        {
+            fullGrid.worldToVertex(splat.position, splat.position);
+            splat.radius *= invSpacing;
+        }
+        const float ref[3] = {0.0f, 0.0f, 0.0f};
+        sample.grid = Grid(ref, 1.0f, 0, 1, 0, 1, 0, 1);
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            Grid::difference_type base = fullGrid.getExtent(i).first;
+            sample.grid.setExtent(i, grid.getExtent(i).first - base, grid.getExtent(i).second - base);
+        }
+    }
+
+private:
+    const Grid &fullGrid;
+    const std::tr1::uint64_t stride;    ///< Splats to skip between samples
+    std::tr1::uint64_t seen;            ///< Splats in buckets seen so far
+    std::tr1::uint64_t next;            ///< Value of @ref seen at which to take the next sample
+    const std::size_t maxSamples;
+    std::vector<Tuning::Sample> &samples;
+};
+
+} // anonymous namespace
+
+void doTune(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+    const Grid &grid)
+{
+    Timeplot::Action timer("tune", tworker, "tune.time");
+
+    const std::size_t numSamples = 4;
+    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
+    const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
+
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+    const unsigned int microCells = getMicroCells(vm);
+
+    const boost::filesystem::path path = getTuningPath(vm);
+    if (path.empty())
+    {
+        Log::log[Log::warn] << "Warning: no location to save tuning results; use --" << Option::tuningFile << '\n';
+        return;
+    }
+
+    Log::log[Log::info] << "Tuning...\n";
+    std::vector<Tuning::Sample> samples;
+    TuningSampler sampler(grid, splats.numSplats(), numSamples, samples);
+    Bucket::bucket(splats, grid, maxBucketSplats, blockCells, 0, microCells, maxSplit,
+                   boost::ref(sampler));
+
+    Tuning::Cache cache(path);
+    cache.load();
+    const std::vector<Tuning::Parameters> candidates = Tuning::makeCandidates(levels, subsampling);
+    for (std::size_t i = 0; i < devices.size(); i++)
+    {
+        const cl::Device &device = devices[i].second;
+        Tuning::Parameters best = Tuning::tune(
+            devices[i].first, device, shape, samples,
+            maxBucketSplats, getMeshMemory(vm), candidates);
+        Log::log[Log::info] << "Tuned " << device.getInfo<CL_DEVICE_NAME>() << ": "
+            << "levels=" << best.levels << " subsampling=" << best.subsampling
+            << " edge=" << best.mlsEdge << " max-bucket=" << best.mlsMaxBucket << '\n';
+        cache.store(Tuning::makeKey(device, shape, levels, subsampling), best);
+    }
+    cache.save();
 }
 
 SlaveWorkers::SlaveWorkers(
@@ -712,6 +1320,7 @@ SlaveWorkers::SlaveWorkers(
     const int levels = vm[Option::levels].as<int>();
     const unsigned int numDeviceThreads = vm[Option::deviceThreads].as<int>();
     const float boundaryLimit = vm[Option::fitBoundaryLimit].as<double>();
+    const float smooth = vm[Option::fitSmooth].as<double>();
     const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
     const std::size_t deviceSpare = getDeviceWorkerGroupSpare(vm);
 
@@ -725,18 +1334,37 @@ SlaveWorkers::SlaveWorkers(
     std::vector<DeviceWorkerGroup *> deviceWorkerGroupPtrs;
     for (std::size_t i = 0; i < devices.size(); i++)
     {
+        const Tuning::Parameters tuning = getTuning(vm, devices[i].second);
         DeviceWorkerGroup *dwg = new DeviceWorkerGroup(
             numDeviceThreads, deviceSpare,
             outputGenerator,
             devices[i].first, devices[i].second,
             maxBucketSplats, blockCells,
-            getMeshMemory(vm),
-            levels, subsampling,
-            boundaryLimit, shape);
+            getMeshMemory(vm), getOctreeMemory(vm),
+            tuning.levels, tuning.subsampling,
+            boundaryLimit, shape,
+            tuning.mlsEdge, tuning.mlsMaxBucket,
+            vm.count(Option::normals));
+        dwg->setAdaptiveOctree(!vm.count(Option::fixedOctree));
         deviceWorkerGroups.push_back(dwg);
         deviceWorkerGroupPtrs.push_back(dwg);
     }
     copyGroup.reset(new CopyGroup(deviceWorkerGroupPtrs, maxHostSplats));
+    /* Splat radii are the sample spacing scaled by the smoothing factor, so
+     * this coarsens the grid until cells are about as big as the samples.
+     */
+    copyGroup->setAdaptiveGrid(vm[Option::fitAdaptive].as<int>(), smooth);
+    std::vector<unsigned int> levelShifts;
+    BOOST_FOREACH(Grid::size_type factor, getLevelFactors(vm))
+    {
+        unsigned int shift = 0;
+        while ((Grid::size_type(1) << shift) < factor)
+            shift++;
+        levelShifts.push_back(shift);
+    }
+    copyGroup->setLevels(levelShifts);
+    const unsigned int previewFactor = getPreviewFactor(vm);
+    copyGroup->setThinning(previewFactor * previewFactor);
     loader.reset(new BucketLoader(maxLoadSplats, *copyGroup, tworker));
 }
 
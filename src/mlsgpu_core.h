@@ -46,6 +46,7 @@
 #include "grid.h"
 #include "progress.h"
 #include "timeplot.h"
+#include "incremental.h"
 #include <CL/cl.hpp>
 
 namespace CLH
@@ -67,11 +68,20 @@ namespace Option
     const char * const fitPrune = "fit-prune";
     const char * const fitBoundaryLimit = "fit-boundary-limit";
     const char * const fitShape = "fit-shape";
+    const char * const fitAdaptive = "fit-adaptive";
 
     const char * const inputFile = "input-file";
     const char * const outputFile = "output-file";
     const char * const split = "split";
     const char * const splitSize = "split-size";
+    const char * const normals = "normals";
+    const char * const compact = "compact";
+    const char * const optimizeOrder = "optimize-order";
+    const char * const decimate = "decimate";
+    const char * const fitLevels = "fit-levels";
+    const char * const region = "region";
+    const char * const incremental = "incremental";
+    const char * const preview = "preview";
 
     const char * const statistics = "statistics";
     const char * const statisticsFile = "statistics-file";
@@ -81,14 +91,23 @@ namespace Option
     const char * const maxSplit = "max-split";
     const char * const levels = "levels";
     const char * const subsampling = "subsampling";
+    const char * const fixedOctree = "fixed-octree";
     const char * const leafCells = "leaf-cells";
     const char * const deviceThreads = "device-threads";
+    const char * const mesherThreads = "mesher-threads";
+    const char * const writerThreads = "writer-threads";
+    const char * const mesher = "mesher";
     const char * const reader = "reader";
     const char * const writer = "writer";
     const char * const ompThreads = "omp-threads";
     const char * const decache = "decache";
     const char * const checkpoint = "checkpoint";
     const char * const resume = "resume";
+    const char * const partialCheckpoint = "partial-checkpoint";
+    const char * const checkpointInterval = "checkpoint-interval";
+    const char * const tune = "tune";
+    const char * const tuningFile = "tuning-file";
+    const char * const compressTmp = "compress-tmp";
 
     const char * const memLoadSplats = "mem-load-splats";
     const char * const memHostSplats = "mem-host-splats";
@@ -96,6 +115,8 @@ namespace Option
     const char * const memMesh = "mem-mesh";
     const char * const memReorder = "mem-reorder";
     const char * const memGather = "mem-gather";
+    const char * const memOctree = "mem-octree";
+    const char * const memMesherKeys = "mem-mesher-keys";
 };
 
 /**
@@ -180,15 +201,45 @@ void doComputeBlobs(
     boost::function<void(float, unsigned int)> computeBlobs);
 
 /**
- * Validate the grid size and compute the chunk size.
+ * Determine the world-space box from which splats are needed to process the
+ * region given by @c --region. It covers the grid cells that @ref clipGrid
+ * will keep, plus those that @ref postprocessGrid may add for @c
+ * --fit-levels, so it is slightly larger than the region itself.
+ *
+ * @param vm               Command-line options
+ * @param[out] lower       Lower corner of the box
+ * @param[out] upper       Upper corner of the box
+ * @return @c false if @c --region was not given, in which case @a lower and
+ * @a upper are not modified.
+ */
+bool getRegionBox(const boost::program_options::variables_map &vm, float lower[3], float upper[3]);
+
+/**
+ * Restrict a grid to the region given by @c --region, if any. The grid
+ * vertices are not moved, so the output lines up with that of a run over
+ * the whole grid. The lower extent is rounded down to a multiple of the
+ * bucket size used by @ref doComputeBlobs, so that the blob data can still
+ * be used.
+ *
+ * @param vm               Command-line options
+ * @param grid             Grid to clip, which must have its reference at the origin
+ * @throw std::runtime_error if the region does not intersect the grid
+ */
+void clipGrid(const boost::program_options::variables_map &vm, Grid &grid);
+
+/**
+ * Clip the grid to the region of interest (see @ref clipGrid), validate the
+ * grid size and compute the chunk size. For @c --incremental, the grid is
+ * also extended to chunk boundaries (see @ref Incremental::alignGrid). For
+ * @c --fit-levels, it is extended to a multiple of the coarsest spacing.
  * @param vm               Command-line options
  * @param grid             Bounding box grid
  * @return Chunk size for output, in cells
- * @throw std::runtime_error if the grid is too large
+ * @throw std::runtime_error if the grid is too large or outside the region
  */
 unsigned int postprocessGrid(
     const boost::program_options::variables_map &vm,
-    const Grid &grid);
+    Grid &grid);
 
 /**
  * An all-in-one helper to call @ref Bucket::bucket with appropriate parameters.
@@ -198,7 +249,7 @@ unsigned int postprocessGrid(
  * @param splats           Splats to bucket
  * @param grid             Bounding box grid from @ref doComputeBlobs
  * @param chunkCells       Chunk side length from @ref postprocessGrid
- * @param collector        Bucket processor passed to @ref Bucket::bucket
+ * @param process          Bucket processor passed to @ref Bucket::bucket
  */
 void doBucket(
     Timeplot::Worker &tworker,
@@ -206,23 +257,87 @@ void doBucket(
     const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
     const Grid &grid,
     Grid::size_type chunkCells,
-    BucketCollector &collector);
+    const Bucket::ProcessorType<SplatSet::FastBlobSet<SplatSet::FileSet> >::type &process);
+
+/**
+ * Benchmark candidate kernel parameters on each device using a sample of the
+ * buckets, and store the fastest in the tuning file for use by @ref SlaveWorkers.
+ *
+ * @param tworker          Worker to which the tuning time is allocated
+ * @param vm               Command-line options
+ * @param devices          Devices to tune
+ * @param splats           Splats to sample buckets from
+ * @param grid             Bounding box grid from @ref doComputeBlobs
+ *
+ * @throw std::ios::failure if the tuning file could not be written.
+ */
+void doTune(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+    const Grid &grid);
 
 /**
  * Set comments on the writer showing provenance of the file.
  */
 void setWriterComments(const boost::program_options::variables_map &vm, FastPly::Writer &writer);
 
+/**
+ * Determine the mesher class to use. This is normally given by the @c --mesher
+ * option, but if it is not given and there is no pruning, a @ref StreamMesher
+ * is chosen where possible.
+ */
+MesherType getMesherType(const boost::program_options::variables_map &vm);
+
+/**
+ * Determine the levels of detail to produce. Each level is given as the
+ * ratio of its grid spacing to that of @c --fit-grid, which is a power of
+ * two. The first element is always 1, and it is followed by one element per
+ * spacing given to @c --fit-levels.
+ *
+ * @pre The options have been checked by @ref validateOptions.
+ */
+std::vector<Grid::size_type> getLevelFactors(const boost::program_options::variables_map &vm);
+
 /**
  * Set mesher options based on command-line options.
+ *
+ * @param vm       Command-line options
+ * @param mesher   Mesher to configure
+ * @param factor   Ratio of the mesher's grid spacing to that of @c --fit-grid
  */
-void setMesherOptions(const boost::program_options::variables_map &vm, MesherBase &mesher);
+void setMesherOptions(const boost::program_options::variables_map &vm, MesherBase &mesher,
+                      Grid::size_type factor = 1);
 
 /**
  * Generate a file name from command-line options.
  */
 MesherBase::Namer getNamer(const boost::program_options::variables_map &vm, const std::string &out);
 
+/**
+ * Generate a string holding the command-line options that affect the
+ * content of the output chunks. An incremental run can only reuse the
+ * output of a previous run if these match.
+ */
+std::string getIncrementalOptions(const boost::program_options::variables_map &vm);
+
+/**
+ * Create the tracker for @c --incremental, loading the manifest from the
+ * previous run if there is one.
+ *
+ * @param vm               Command-line options
+ * @param grid             Grid from @ref postprocessGrid
+ * @param chunkCells       Chunk size from @ref postprocessGrid
+ * @param namer            Output file namer from @ref getNamer
+ *
+ * @throw boost::filesystem::filesystem_error if an input file could not be examined.
+ */
+Incremental::Tracker *createTracker(
+    const boost::program_options::variables_map &vm,
+    const Grid &grid, Grid::size_type chunkCells,
+    const MesherBase::Namer &namer);
+
 /**
  * Collects together the workers that run on the slave side in MPI, without
  * using any MPI-specific code.
@@ -306,6 +306,8 @@ void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source)
     work.vertexKeysEvent = cl::Event();
 
     recv(work.chunkId, comm, source);
+    // The MPI version only produces one level of detail
+    work.level = 0;
     std::size_t sizes[3];
     MPI_Recv(&sizes, 3, mpi_type_traits<std::size_t>::type(),
              source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
@@ -796,6 +796,19 @@ public:
                       std::ostream *progressStream = NULL,
                       bool warnNonFinite = true);
 
+    /**
+     * Restrict the set to splats whose bounding boxes intersect an
+     * axis-aligned box in world space. The other splats are discarded by
+     * @ref computeBlobs, so they do not contribute to the bounding grid or
+     * to @ref numSplats, and are not returned by blob streams on the fast
+     * path. They are still returned by splat streams and by blob streams
+     * that do not use the fast path.
+     *
+     * This must be called before @ref computeBlobs. By default the region is
+     * unbounded.
+     */
+    void setRegion(const float lower[3], const float upper[3]);
+
     /**
      * Return the bounding grid generated by @ref computeBlobs. The grid will
      * have an origin at the world origin and the @a spacing passed to @ref
@@ -850,6 +863,11 @@ protected:
 
     splat_id nSplats;  ///< Exact splat count computed during blob generation
 
+    /// Lower corner of the region set by @ref setRegion
+    boost::array<float, 3> regionLower;
+    /// Upper corner of the region set by @ref setRegion
+    boost::array<float, 3> regionUpper;
+
     /// Erase a temporary file, if it is owned
     static void eraseBlobFile(const BlobFile &bf);
 
@@ -868,7 +886,10 @@ protected:
      * @param toBuckets          Functor for converting splats to their blob ranges
      * @param[out] bbox          Bounding box for the processed splats.
      * @param[out] bf            Blob file produced.
-     * @param[out] nSplats       Number of finite splats encountered in the range.
+     * @param[out] nSplats       Number of finite splats encountered in the range
+     *                           that are inside the region (see @ref setRegion).
+     * @param[out] nCulled       Number of finite splats discarded because they are
+     *                           outside the region.
      * @param progress           Optional progress meter, incremented once per finite splat.
      *
      * @post
@@ -882,7 +903,7 @@ protected:
     void computeBlobsRange(
         splat_id first, splat_id last,
         const detail::SplatToBuckets &toBuckets,
-        detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
+        detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats, splat_id &nCulled,
         ProgressMeter *progress);
 
 private:
@@ -48,6 +48,7 @@
 #endif
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <utility>
 #include <iostream>
 #include <boost/smart_ptr/shared_ptr.hpp>
@@ -439,6 +440,15 @@ template<typename Base>
 FastBlobSet<Base>::FastBlobSet()
 : Base(), internalBucketSize(0), nSplats(0)
 {
+    std::fill(regionLower.begin(), regionLower.end(), -std::numeric_limits<float>::infinity());
+    std::fill(regionUpper.begin(), regionUpper.end(), std::numeric_limits<float>::infinity());
+}
+
+template<typename Base>
+void FastBlobSet<Base>::setRegion(const float lower[3], const float upper[3])
+{
+    std::copy(lower, lower + 3, regionLower.begin());
+    std::copy(upper, upper + 3, regionUpper.begin());
 }
 
 template<typename Base>
@@ -638,15 +648,18 @@ template<typename Base>
 void FastBlobSet<Base>::computeBlobsRange(
     splat_id first, splat_id last,
     const detail::SplatToBuckets &toBuckets,
-    detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
+    detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats, splat_id &nCulled,
     ProgressMeter *progress)
 {
     Statistics::Registry &registry = Statistics::Registry::getInstance();
 
     std::pair<splat_id, splat_id> ranges(first, last);
+    const boost::array<float, 3> lower = regionLower;
+    const boost::array<float, 3> upper = regionUpper;
 
     bbox = detail::Bbox();
     nSplats = 0;
+    nCulled = 0;
     bf.nBlobs = 0;
     boost::filesystem::ofstream out;
     createTmpFile(bf.path, out);
@@ -666,7 +679,7 @@ void FastBlobSet<Base>::computeBlobsRange(
                 break;
 
 #ifdef _OPENMP
-#pragma omp parallel shared(out, buffer, bufferIds, bbox, bf, toBuckets, err) default(none)
+#pragma omp parallel shared(out, buffer, bufferIds, bbox, bf, toBuckets, err, lower, upper, nCulled) default(none)
 #endif
             {
                 const int nThreads = omp_get_num_threads();
@@ -686,6 +699,7 @@ void FastBlobSet<Base>::computeBlobsRange(
                     BlobInfo curBlob, prevBlob;
                     bool haveCurBlob = false;
                     std::tr1::uint64_t threadBlobs = 0;
+                    splat_id threadCulled = 0;
 
                     // Compute the blobs for a single subrange. The first blob will always
                     // be a non-differential encoding, so the encoding depends on the number
@@ -693,6 +707,17 @@ void FastBlobSet<Base>::computeBlobsRange(
                     for (std::size_t i = first; i < last; i++)
                     {
                         const Splat &splat = buffer[i];
+                        bool inside = true;
+                        for (unsigned int j = 0; j < 3; j++)
+                            inside = inside
+                                && splat.position[j] + splat.radius >= lower[j]
+                                && splat.position[j] - splat.radius <= upper[j];
+                        if (!inside)
+                        {
+                            threadCulled++;
+                            continue;
+                        }
+
                         BlobInfo blob;
                         toBuckets(splat, blob.lower, blob.upper);
                         blob.firstSplat = bufferIds[i];
@@ -729,6 +754,7 @@ void FastBlobSet<Base>::computeBlobsRange(
                         // Write the blobs for this subrange out to file
                         bbox += threadBbox;
                         bf.nBlobs += threadBlobs;
+                        nCulled += threadCulled;
                         out.write(reinterpret_cast<const char *>(&threadBlobData[0]), threadBlobData.size() * sizeof(threadBlobData[0]));
                         if (!out && err == 0)
                             err = errno;
@@ -743,6 +769,7 @@ void FastBlobSet<Base>::computeBlobsRange(
             if (progress != NULL)
                 *progress += nBuffer;
         }
+        nSplats -= nCulled;
         out.close();
         if (!out)
         {
@@ -833,14 +860,15 @@ void FastBlobSet<Base>::computeBlobs(
     detail::Bbox bbox;
 
     const detail::SplatToBuckets toBuckets(spacing, bucketSize);
+    splat_id nCulled;
     computeBlobsRange(
         detail::rangeAll.first, detail::rangeAll.second,
         toBuckets,
-        bbox, blobFiles.back(), nSplats,
+        bbox, blobFiles.back(), nSplats, nCulled,
         progress.get());
 
-    assert(nSplats <= Base::maxSplats());
-    splat_id nonFinite = Base::maxSplats() - nSplats;
+    assert(nSplats + nCulled <= Base::maxSplats());
+    splat_id nonFinite = Base::maxSplats() - nSplats - nCulled;
     if (nonFinite > 0)
     {
         if (progress != NULL)
@@ -849,6 +877,7 @@ void FastBlobSet<Base>::computeBlobs(
             Log::log[Log::warn] << "Input contains " << nonFinite << " splat(s) with non-finite values\n";
     }
     registry.getStatistic<Statistics::Variable>("blobset.nonfinite").add(nonFinite);
+    registry.getStatistic<Statistics::Variable>("blobset.culled").add(nCulled);
 
     boundingGrid = makeBoundingGrid(spacing, bucketSize, bbox);
 }
@@ -120,22 +120,24 @@ void FastBlobSetMPI<Base>::computeBlobs(
     {
         const detail::SplatToBuckets toBuckets(spacing, bucketSize);
         std::pair<splat_id, splat_id> range = Base::partition(rank, size);
+        splat_id nCulled;
         this->computeBlobsRange(
             range.first, range.second,
             toBuckets,
-            bbox, blobFile, this->nSplats,
+            bbox, blobFile, this->nSplats, nCulled,
             progress.get());
 
         MPI_Allreduce(MPI_IN_PLACE, &this->nSplats, 1, Serialize::mpi_type_traits<splat_id>::type(), MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &nCulled, 1, Serialize::mpi_type_traits<splat_id>::type(), MPI_SUM, comm);
         MPI_Allreduce(MPI_IN_PLACE, &bbox.bboxMin[0], 3, MPI_FLOAT, MPI_MIN, comm);
         MPI_Allreduce(MPI_IN_PLACE, &bbox.bboxMax[0], 3, MPI_FLOAT, MPI_MAX, comm);
 
-        assert(this->nSplats <= Base::maxSplats());
+        assert(this->nSplats + nCulled <= Base::maxSplats());
         if (progress)
             progress->sync();
         if (rank == root)
         {
-            splat_id nonFinite = Base::maxSplats() - this->nSplats;
+            splat_id nonFinite = Base::maxSplats() - this->nSplats - nCulled;
             if (progressThread)
             {
                 *progress += nonFinite;
@@ -37,6 +37,7 @@
 #include <cstddef>
 #include "tr1_cstdint.h"
 #include <limits>
+#include <algorithm>
 #include <vector>
 #include "tr1_cstdint.h"
 #include "splat_tree_cl.h"
@@ -46,6 +47,9 @@
 #include "errors.h"
 #include "statistics.h"
 #include "statistics_cl.h"
+#include "device_arena.h"
+#include "timeplot.h"
+#include "misc.h"
 
 void SplatTreeCL::validateDevice(const cl::Device &device)
 {
@@ -53,8 +57,29 @@ void SplatTreeCL::validateDevice(const cl::Device &device)
         throw CLH::invalid_device(device, "image support is required");
 }
 
+void SplatTreeCL::scratchSizes(std::size_t maxLevels, std::size_t numSplats, std::size_t sizes[4])
+{
+    const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
+    const std::size_t maxRanges = std::min(maxStart, std::tr1::uint64_t(8 * numSplats));
+    sizes[0] = (numSplats * 8 + maxRanges * 2) * sizeof(command_type);  // commands
+    sizes[1] = numSplats * 8 * sizeof(command_type);                     // commandMap
+    sizes[2] = numSplats * 8 * sizeof(code_type);                        // entryKeys
+    sizes[3] = numSplats * 8 * sizeof(command_type);                     // entryValues
+}
+
+std::size_t SplatTreeCL::arenaBytes(std::size_t maxLevels, std::size_t numSplats, std::size_t alignment)
+{
+    std::size_t sizes[4];
+    scratchSizes(maxLevels, std::max(numSplats, std::size_t(1)), sizes);
+    std::size_t total = 0;
+    for (int i = 0; i < 4; i++)
+        total += roundUp(sizes[i], alignment);
+    return total;
+}
+
 CLH::ResourceUsage SplatTreeCL::resourceUsage(
-    const cl::Device &device, const std::size_t maxLevels, const std::size_t maxSplats)
+    const cl::Device &device, const std::size_t maxLevels, const std::size_t maxSplats,
+    bool pooled)
 {
     /* Not currently used, although it should be to determine constant overheads in
      * the clogs primitives.
@@ -74,6 +99,8 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
     ans.addBuffer("start", maxStart * sizeof(command_type));
     // jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
     ans.addBuffer("jumpPos", maxStart * sizeof(command_type));
+    if (pooled)
+        return ans; // the remainder is accounted to the arena
     // commands = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
     ans.addBuffer("commands", (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
     // commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
@@ -89,7 +116,8 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
 }
 
 SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
-                         std::size_t maxLevels, std::size_t maxSplats)
+                         std::size_t maxLevels, std::size_t maxSplats,
+                         DeviceArena *arena, Timeplot::Worker *tworker)
     :
     writeEntriesKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeEntries.time")),
     countCommandsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.countCommands.time")),
@@ -97,12 +125,17 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     writeStartKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStart.time")),
     writeStartTopKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStartTop.time")),
     fillKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.fill.time")),
-    maxSplats(maxSplats), maxLevels(maxLevels), numSplats(0),
+    maxSplats(maxSplats), maxLevels(maxLevels), numSplats(0), startOffsets(1, 0),
     sort(context, device, clogs::TYPE_UINT, clogs::TYPE_INT),
-    scan(context, device, clogs::TYPE_UINT)
+    scan(context, device, clogs::TYPE_UINT),
+    arena(arena), tworker(tworker), haveArenaAllocation(false),
+    arenaGetStat(Statistics::getStatistic<Statistics::Variable>("octree.arena.get"))
 {
     MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
     MLSGPU_ASSERT(1 <= maxLevels && maxLevels <= MAX_LEVELS, std::length_error);
+    MLSGPU_ASSERT(arena == NULL || tworker != NULL, std::invalid_argument);
+    MLSGPU_ASSERT(arena == NULL || arena->size() >= arenaBytes(maxLevels, maxSplats, arena->getAlignment()),
+                  std::length_error);
 
     sort.setEventCallback(
         &Statistics::timeEventCallback,
@@ -117,16 +150,19 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     // If this section is modified, remember to update deviceMemory above
     start = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
     jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
-    commands = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
-    commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
-    entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
-    entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
-
     // Ensure that commands will be big enough to act as a temporary buffer
     BOOST_STATIC_ASSERT(sizeof(command_type) >= sizeof(code_type));
-    // These buffers are not live during the sort, so we save memory by using them as
-    // temporary buffers for the sort.
-    sort.setTemporaryBuffers(commands, commandMap);
+    if (arena == NULL)
+    {
+        commands = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
+        commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
+        entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
+        entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
+
+        // These buffers are not live during the sort, so we save memory by using them as
+        // temporary buffers for the sort.
+        sort.setTemporaryBuffers(commands, commandMap);
+    }
 
     std::map<std::string, std::string> defines;
     defines["MAX_LEVELS"] = boost::lexical_cast<std::string>(maxLevels);
@@ -140,6 +176,36 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     writeStartTopKernel = cl::Kernel(program, "writeStartTop");
 }
 
+SplatTreeCL::~SplatTreeCL()
+{
+    if (haveArenaAllocation)
+        arena->free(arenaAllocation);
+}
+
+void SplatTreeCL::allocateFromArena(std::size_t numSplats)
+{
+    if (haveArenaAllocation)
+    {
+        arena->free(arenaAllocation);
+        haveArenaAllocation = false;
+    }
+
+    const std::size_t alignment = arena->getAlignment();
+    std::size_t sizes[4];
+    scratchSizes(maxLevels, std::max(numSplats, std::size_t(1)), sizes);
+    arenaAllocation = arena->allocate(*tworker, arenaBytes(maxLevels, numSplats, alignment), &arenaGetStat);
+    haveArenaAllocation = true;
+
+    cl::Buffer *targets[4] = { &commands, &commandMap, &entryKeys, &entryValues };
+    std::size_t offset = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        *targets[i] = arena->subBuffer(arenaAllocation, offset, sizes[i]);
+        offset += roundUp(sizes[i], alignment);
+    }
+    sort.setTemporaryBuffers(commands, commandMap);
+}
+
 void SplatTreeCL::enqueueWriteEntries(
     const cl::CommandQueue &queue,
     const cl::Buffer &keys,
@@ -150,6 +216,8 @@ void SplatTreeCL::enqueueWriteEntries(
     const Grid::difference_type offset[3],
     std::size_t minShift,
     std::size_t maxShift,
+    code_type keyBase,
+    std::size_t entryOffset,
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
@@ -163,10 +231,11 @@ void SplatTreeCL::enqueueWriteEntries(
     writeEntriesKernel.setArg(5, (cl_uint) minShift);
     writeEntriesKernel.setArg(6, (cl_uint) maxShift);
     writeEntriesKernel.setArg(7, (cl_uint) firstSplat);
+    writeEntriesKernel.setArg(8, (cl_uint) keyBase);
 
     CLH::enqueueNDRangeKernel(queue,
                               writeEntriesKernel,
-                              cl::NullRange,
+                              cl::NDRange(entryOffset),
                               cl::NDRange(numSplats),
                               cl::NullRange,
                               events, event, &writeEntriesKernelTime);
@@ -266,34 +335,90 @@ void SplatTreeCL::enqueueWriteStart(
 }
 
 
+std::size_t SplatTreeCL::startSize(std::size_t levels)
+{
+    MLSGPU_ASSERT(levels <= MAX_LEVELS, std::length_error);
+    return (std::tr1::uint64_t(1) << (3 * levels)) / 7;
+}
+
 void SplatTreeCL::enqueueBuild(
     const cl::CommandQueue &queue,
     const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
     const Grid::size_type size[3], const Grid::difference_type offset[3],
     unsigned int subsamplingShift,
+    std::size_t levels,
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
-    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
-    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
-    Grid::size_type maxSize = Grid::size_type(1U) << (maxLevels + subsamplingShift - 1);
-    MLSGPU_ASSERT(size[0] <= maxSize && size[1] <= maxSize && size[2] <= maxSize,
-                  std::length_error);
-    unsigned int maxShift = maxLevels + subsamplingShift - 1;
-    unsigned int minShift = std::min(subsamplingShift, maxShift);
-    // TODO: this will always construct a full-size octree, even if size[] only
-    // specifies a much smaller space. At a minimum, it should be possible to make
-    // levelOffsets more compact.
-
-    this->numSplats = numSplats;
-    std::size_t pos = 0;
-    levelOffsets.resize(maxShift + 1);
-    for (std::size_t i = minShift; i <= maxShift; i++)
+    std::vector<Segment> segments(1);
+    Segment &segment = segments[0];
+    segment.firstSplat = firstSplat;
+    segment.numSplats = numSplats;
+    for (int i = 0; i < 3; i++)
     {
-        levelOffsets[i] = pos;
-        pos += 1U << (3 * (maxShift - i));
+        segment.size[i] = size[i];
+        segment.offset[i] = offset[i];
     }
-    std::size_t numStart = pos;
+    segment.subsamplingShift = subsamplingShift;
+    segment.levels = levels;
+    enqueueBuild(queue, splats, segments, events, event);
+}
+
+void SplatTreeCL::enqueueBuild(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats,
+    const std::vector<Segment> &segments,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(!segments.empty(), std::invalid_argument);
+
+    const std::size_t nSegments = segments.size();
+    std::vector<unsigned int> minShifts(nSegments), maxShifts(nSegments);
+    std::vector<std::vector<std::size_t> > offsets(nSegments);
+    std::size_t numStart = 0;
+    std::size_t totalSplats = 0;
+    std::size_t nextSplat = segments[0].firstSplat;
+    startOffsets.resize(nSegments);
+    for (std::size_t j = 0; j < nSegments; j++)
+    {
+        const Segment &seg = segments[j];
+        MLSGPU_ASSERT(seg.firstSplat >= nextSplat, std::invalid_argument);
+        MLSGPU_ASSERT(seg.numSplats <= maxSplats - totalSplats, std::length_error);
+        MLSGPU_ASSERT(seg.firstSplat < CL_UINT_MAX - seg.numSplats, std::length_error);
+        MLSGPU_ASSERT(1 <= seg.levels && seg.levels <= maxLevels, std::length_error);
+        Grid::size_type maxSize = Grid::size_type(1U) << (seg.levels + seg.subsamplingShift - 1);
+        MLSGPU_ASSERT(seg.size[0] <= maxSize && seg.size[1] <= maxSize && seg.size[2] <= maxSize,
+                      std::length_error);
+        nextSplat = seg.firstSplat + seg.numSplats;
+        totalSplats += seg.numSplats;
+
+        maxShifts[j] = seg.levels + seg.subsamplingShift - 1;
+        minShifts[j] = std::min(seg.subsamplingShift, maxShifts[j]);
+        // TODO: this will always construct a full octree with the requested number of
+        // levels, even if size[] only specifies a much smaller space. At a minimum, it
+        // should be possible to make levelOffsets more compact.
+        startOffsets[j] = numStart;
+        offsets[j].resize(maxShifts[j] + 1);
+        std::size_t pos = 0;
+        for (std::size_t i = minShifts[j]; i <= maxShifts[j]; i++)
+        {
+            offsets[j][i] = pos;
+            pos += 1U << (3 * (maxShifts[j] - i));
+        }
+        numStart += pos;
+    }
+    MLSGPU_ASSERT(numStart <= startSize(maxLevels), std::length_error);
+
+    this->numSplats = totalSplats;
+    levelOffsets = offsets[0];
+    if (arena != NULL)
+        allocateFromArena(totalSplats);
+
+    // Keys (other than the UINT_MAX padding) are less than numStart
+    unsigned int keyBits = 1;
+    while ((std::size_t(1) << keyBits) <= numStart)
+        keyBits++;
 
     std::vector<cl::Event> wait(1);
 
@@ -302,10 +427,18 @@ void SplatTreeCL::enqueueBuild(
     this->splats = splats;
 
     // TODO: revisit this dependency tracking
-    const std::size_t numEntries = numSplats * 8;
-    enqueueWriteEntries(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats, offset, minShift, maxShift, events, &writeEntriesEvent);
-    wait[0] = writeEntriesEvent;
-    sort.enqueue(queue, entryKeys, entryValues, numEntries, 3 * (maxShift - minShift) + 1, &wait, &sortEvent);
+    const std::size_t numEntries = totalSplats * 8;
+    std::size_t entryOffset = 0;
+    for (std::size_t j = 0; j < nSegments; j++)
+    {
+        enqueueWriteEntries(queue, entryKeys, entryValues, this->splats,
+                            segments[j].firstSplat, segments[j].numSplats, segments[j].offset,
+                            minShifts[j], maxShifts[j], startOffsets[j], entryOffset,
+                            j == 0 ? events : &wait, &writeEntriesEvent);
+        wait[0] = writeEntriesEvent;
+        entryOffset += segments[j].numSplats;
+    }
+    sort.enqueue(queue, entryKeys, entryValues, numEntries, keyBits, &wait, &sortEvent);
     wait[0] = sortEvent;
     enqueueCountCommands(queue, commandMap, entryKeys, numEntries, &wait, &countEvent);
     wait[0] = countEvent;
@@ -317,17 +450,22 @@ void SplatTreeCL::enqueueBuild(
     enqueueWriteSplatIds(queue, commands, start, jumpPos, commandMap, entryKeys, entryValues, numEntries, &wait, &writeSplatIdsEvent);
     wait[0] = writeSplatIdsEvent;
 
-    for (int i = maxShift; i >= int(minShift); i--)
+    for (std::size_t j = 0; j < nSegments; j++)
     {
-        std::size_t levelSize = std::size_t(1) << (3 * (maxShift - i));
-        bool havePrev = (i != int(maxShift));
-        enqueueWriteStart(queue, start, commands, jumpPos,
-                          levelOffsets[i],
-                          havePrev,
-                          havePrev ? levelOffsets[i + 1] : 0,
-                          levelSize,
-                          &wait, &levelEvent);
-        wait[0] = levelEvent;
+        const unsigned int maxShift = maxShifts[j];
+        const unsigned int minShift = minShifts[j];
+        for (int i = maxShift; i >= int(minShift); i--)
+        {
+            std::size_t levelSize = std::size_t(1) << (3 * (maxShift - i));
+            bool havePrev = (i != int(maxShift));
+            enqueueWriteStart(queue, start, commands, jumpPos,
+                              startOffsets[j] + offsets[j][i],
+                              havePrev,
+                              havePrev ? startOffsets[j] + offsets[j][i + 1] : 0,
+                              levelSize,
+                              &wait, &levelEvent);
+            wait[0] = levelEvent;
+        }
     }
 
     if (event != NULL)
@@ -337,4 +475,13 @@ void SplatTreeCL::enqueueBuild(
 void SplatTreeCL::clearSplats()
 {
     splats = cl::Buffer();
+    if (haveArenaAllocation)
+    {
+        commands = cl::Buffer();
+        commandMap = cl::Buffer();
+        entryKeys = cl::Buffer();
+        entryValues = cl::Buffer();
+        arena->free(arenaAllocation);
+        haveArenaAllocation = false;
+    }
 }
@@ -32,7 +32,9 @@
 #endif
 
 #include <CL/cl.hpp>
+#include <cstddef>
 #include <utility>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <clogs/clogs.h>
@@ -40,6 +42,8 @@
 #include "clh.h"
 #include "grid.h"
 #include "statistics.h"
+#include "device_arena.h"
+#include "timeplot.h"
 
 /**
  * Concrete implementation of @ref SplatTree that stores the data
@@ -143,11 +147,36 @@ private:
     std::size_t maxLevels;   ///< Maximum levels for which memory has been allocated
 
     std::size_t numSplats;   ///< Number of splats in the octree
-    std::vector<std::size_t> levelOffsets; ///< Start of each level in compacted arrays
+    std::vector<std::size_t> levelOffsets; ///< Start of each level in compacted arrays (first segment)
+    std::vector<std::size_t> startOffsets; ///< Start of each segment in the start array
 
     clogs::Radixsort sort;   ///< Sorter for sorting the entries
     clogs::Scan scan;        ///< Scanner for computing @ref commandMap
 
+    /**
+     * @name
+     * @{
+     * Pooled storage. If @ref arena is non-@c NULL, the buffers whose size
+     * depends on the number of splats are sub-allocated from it for each
+     * build, and returned by @ref clearSplats.
+     */
+    DeviceArena *arena;
+    Timeplot::Worker *tworker;     ///< Worker to which waiting for @ref arena is accounted
+    DeviceArena::Allocation arenaAllocation;
+    bool haveArenaAllocation;      ///< Whether @ref arenaAllocation is live
+    Statistics::Variable &arenaGetStat;
+    /** @} */
+
+    /**
+     * Compute the sizes in bytes of @ref commands, @ref commandMap,
+     * @ref entryKeys and @ref entryValues (in that order) needed for
+     * @a numSplats splats.
+     */
+    static void scratchSizes(std::size_t maxLevels, std::size_t numSplats, std::size_t sizes[4]);
+
+    /// Allocate the per-splat buffers from @ref arena for @a numSplats splats.
+    void allocateFromArena(std::size_t numSplats);
+
     /// Wrapper to call @ref writeEntries
     void enqueueWriteEntries(const cl::CommandQueue &queue,
                              const cl::Buffer &keys,
@@ -158,6 +187,8 @@ private:
                              const Grid::difference_type offset[3],
                              std::size_t minShift,
                              std::size_t maxShift,
+                             code_type keyBase,
+                             std::size_t entryOffset,
                              const std::vector<cl::Event> *events,
                              cl::Event *event);
 
@@ -207,6 +238,26 @@ private:
                      cl::Event *event);
 
 public:
+    /**
+     * A region of the splat buffer to be built into an independent octree
+     * by @ref enqueueBuild. The fields have the same meaning as the
+     * corresponding parameters of the single-octree form.
+     */
+    struct Segment
+    {
+        std::size_t firstSplat;
+        std::size_t numSplats;
+        Grid::size_type size[3];
+        Grid::difference_type offset[3];
+        unsigned int subsamplingShift;
+        std::size_t levels;
+    };
+
+    /**
+     * Number of entries in the start array used by an octree with @a levels levels.
+     */
+    static std::size_t startSize(std::size_t levels);
+
     /**
      * Checks whether the device can support this class at all. At the time of
      * writing, this just means that it needs image support.
@@ -224,7 +275,14 @@ public:
      * - 1 <= @a maxSplats <= @ref MAX_SPLATS.
      */
     static CLH::ResourceUsage resourceUsage(
-        const cl::Device &device, std::size_t maxLevels, std::size_t maxSplats);
+        const cl::Device &device, std::size_t maxLevels, std::size_t maxSplats,
+        bool pooled = false);
+
+    /**
+     * Bytes of a @ref DeviceArena needed to build an octree containing
+     * @a numSplats splats, when allocations are aligned to @a alignment.
+     */
+    static std::size_t arenaBytes(std::size_t maxLevels, std::size_t numSplats, std::size_t alignment);
 
     /**
      * Constructor. This allocates the maximum supported sizes for all the
@@ -234,13 +292,23 @@ public:
      * @param device    OpenCL device used to specialise kernels.
      * @param maxLevels Maximum number of octree levels (maximum dimension is 2^<sup>@a maxLevels - 1</sup>).
      * @param maxSplats Maximum number of splats supported.
+     * @param arena     If non-@c NULL, the storage that depends on the number of
+     *                  splats is allocated from this arena during each build
+     *                  instead of up front.
+     * @param tworker   Worker to which waiting for @a arena is accounted (must be
+     *                  non-@c NULL if @a arena is).
      *
      * @pre
      * - 1 <= @a maxLevels <= @ref MAX_LEVELS
      * - 1 <= @a maxSplats <= @ref MAX_SPLATS.
+     * - If given, @a arena is big enough for @ref arenaBytes with @a maxSplats.
      */
     SplatTreeCL(const cl::Context &context, const cl::Device &device,
-                std::size_t maxLevels, std::size_t maxSplats);
+                std::size_t maxLevels, std::size_t maxSplats,
+                DeviceArena *arena = NULL, Timeplot::Worker *tworker = NULL);
+
+    /// Destructor. It returns any storage held in the arena.
+    ~SplatTreeCL();
 
     /**
      * Asynchronously builds the octree, discarding any previous contents.
@@ -255,11 +323,13 @@ public:
      * @param size          The number of cells to cover with the octree.
      * @param offset        The offset of the octree within the overall grid.
      * @param subsamplingShift Number of fine levels to drop.
+     * @param levels        Number of levels to build (at most the @a maxLevels passed to the constructor).
      * @param events        Events to wait for (or @c NULL).
      * @param[out] event    Event that fires when the octree is ready to use (or @c NULL).
      *
      * @pre
-     * - @a size is no more than 2^(maxLevels - subSamplingShift - 1) elements in any direction.
+     * - 1 <= @a levels <= @a maxLevels.
+     * - @a size is no more than 2^(levels + subSamplingShift - 1) elements in any direction.
      * - @a numSplats is at most @a maxSplats.
      *
      * @note @a splats is not copied. It becomes the backing store of splats for the octree.
@@ -268,9 +338,45 @@ public:
                       const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
                       const Grid::size_type size[3], const Grid::difference_type offset[3],
                       unsigned int subsamplingShift,
+                      std::size_t levels,
+                      const std::vector<cl::Event> *events = NULL,
+                      cl::Event *event = NULL);
+
+    /**
+     * Asynchronously builds several independent octrees, discarding any
+     * previous contents. This is equivalent to building each segment
+     * separately, but the entries for all the segments are sorted and
+     * scanned together, which saves a large number of kernel launches
+     * when the segments are small. The segments share the command
+     * array, and each has its own region of the start array (see
+     * @ref getStartOffset).
+     *
+     * @param queue         The command queue for the building operations.
+     * @param splats        The splats to use in the octrees.
+     * @param segments      The octrees to build.
+     * @param events        Events to wait for (or @c NULL).
+     * @param[out] event    Event that fires when the octrees are ready to use (or @c NULL).
+     *
+     * @pre
+     * - @a segments is non-empty, and the segments are ordered and disjoint
+     *   within @a splats.
+     * - Each segment satisfies the preconditions of the single-octree form.
+     * - The total number of splats is at most @a maxSplats.
+     * - The sum of @ref startSize over the segments is at most
+     *   <code>startSize(maxLevels)</code>.
+     */
+    void enqueueBuild(const cl::CommandQueue &queue,
+                      const cl::Buffer &splats,
+                      const std::vector<Segment> &segments,
                       const std::vector<cl::Event> *events = NULL,
                       cl::Event *event = NULL);
 
+    /**
+     * Position of the start array for segment @a segment from the most
+     * recent build. This is zero for the single-octree form.
+     */
+    std::size_t getStartOffset(std::size_t segment) const { return startOffsets[segment]; }
+
     /**
      * @name Getters for the buffers and images needed to use the octree.
      * These can be called at any time, and remain valid across a call to
@@ -287,13 +393,18 @@ public:
      */
 
     /**
-     * Drop the reference to the splats buffer. After calling this,
-     * the tree must not be used until @ref enqueueBuild is called again.
+     * Drop the reference to the splats buffer, and return any storage
+     * allocated from the arena. After calling this, the tree must not be used
+     * until @ref enqueueBuild is called again, and any previously enqueued
+     * work using it must have completed.
      */
     void clearSplats();
 
-    /// Get the number of levels currently in the octree.
+    /// Get the number of levels currently in the octree (the first, for a batch).
     std::size_t getNumLevels() const { return levelOffsets.size(); }
+
+    /// Get the number of levels passed to the constructor.
+    std::size_t getMaxLevels() const { return maxLevels; }
 };
 
 #endif /* !SPLATTREE_CL_H */
@@ -0,0 +1,325 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Per-device selection of kernel parameters by benchmarking.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.hpp>
+#include <cstdlib>
+#include <cerrno>
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/exception/all.hpp>
+#include <boost/foreach.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "tuning.h"
+#include "mls.h"
+#include "marching.h"
+#include "splat_tree_cl.h"
+#include "workers.h"
+#include "clh.h"
+#include "errors.h"
+#include "logging.h"
+#include "misc.h"
+#include "timer.h"
+#include "statistics.h"
+
+namespace Tuning
+{
+
+Parameters::Parameters(int levels, int subsampling)
+    : levels(levels), subsampling(subsampling),
+    mlsEdge(MlsFunctor::wgs[0]), mlsMaxBucket(MlsFunctor::maxBucketDefault)
+{
+}
+
+/// Replace characters that would break the line-based cache format
+static std::string sanitize(const std::string &s)
+{
+    std::string ans = s;
+    for (std::size_t i = 0; i < ans.size(); i++)
+        if (ans[i] == '\t' || ans[i] == '\n' || ans[i] == '\r' || ans[i] == '\0')
+            ans[i] = ' ';
+    // Some drivers include trailing NULs or spaces in the strings
+    std::size_t end = ans.find_last_not_of(' ');
+    ans.erase(end == std::string::npos ? 0 : end + 1);
+    return ans;
+}
+
+std::string makeKey(const cl::Device &device, MlsShape shape, int levels, int subsampling)
+{
+    std::ostringstream key;
+    key << sanitize(device.getInfo<CL_DEVICE_NAME>()) << ';'
+        << sanitize(device.getInfo<CL_DEVICE_VENDOR>()) << ';'
+        << sanitize(device.getInfo<CL_DRIVER_VERSION>()) << ';'
+        << (shape == MLS_SHAPE_SPHERE ? "sphere" : "plane") << ';'
+        << levels + subsampling;
+    return key.str();
+}
+
+std::vector<Parameters> makeCandidates(int levels, int subsampling)
+{
+    std::vector<Parameters> ans;
+    for (int shift = 0; shift <= 2 && levels - shift >= 1; shift++)
+    {
+        for (Grid::size_type edge = MlsFunctor::wgs[0]; edge >= 4; edge /= 2)
+        {
+            for (unsigned int maxBucket = MlsFunctor::maxBucketDefault; maxBucket >= 64; maxBucket /= 2)
+            {
+                if (maxBucket > edge * edge * edge)
+                    continue;
+                Parameters p(levels - shift, subsampling + shift);
+                p.mlsEdge = edge;
+                p.mlsMaxBucket = maxBucket;
+                ans.push_back(p);
+            }
+        }
+    }
+    return ans;
+}
+
+boost::filesystem::path defaultCachePath()
+{
+#ifdef _WIN32
+    const char *base = std::getenv("APPDATA");
+    const char *dir = "mlsgpu";
+#else
+    const char *base = std::getenv("HOME");
+    const char *dir = ".mlsgpu";
+#endif
+    if (base == NULL || *base == '\0')
+        return boost::filesystem::path();
+    return boost::filesystem::path(base) / dir / "tuning.txt";
+}
+
+Cache::Cache(const boost::filesystem::path &path) : path(path)
+{
+}
+
+void Cache::load()
+{
+    entries.clear();
+    boost::filesystem::ifstream in(path);
+    if (!in)
+        return;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::string::size_type tab = line.rfind('\t');
+        if (tab == std::string::npos)
+        {
+            Log::log[Log::warn] << "Warning: ignoring malformed line in " << path.string() << '\n';
+            continue;
+        }
+        std::istringstream fields(line.substr(tab + 1));
+        Parameters params(0, 0);
+        if (!(fields >> params.levels >> params.subsampling >> params.mlsEdge >> params.mlsMaxBucket))
+        {
+            Log::log[Log::warn] << "Warning: ignoring malformed line in " << path.string() << '\n';
+            continue;
+        }
+        entries.insert(std::make_pair(line.substr(0, tab), params));
+    }
+}
+
+void Cache::save() const
+{
+    try
+    {
+        if (path.has_parent_path())
+            boost::filesystem::create_directories(path.parent_path());
+        boost::filesystem::ofstream out;
+        out.exceptions(std::ios::failbit | std::ios::badbit);
+        out.open(path);
+        out << "# mlsgpu tuning results: device;vendor;driver;shape;block<TAB>levels subsampling edge max-bucket\n";
+        for (std::map<std::string, Parameters>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+        {
+            const Parameters &p = i->second;
+            out << i->first << '\t'
+                << p.levels << ' ' << p.subsampling << ' '
+                << p.mlsEdge << ' ' << p.mlsMaxBucket << '\n';
+        }
+        out.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(errno);
+    }
+}
+
+bool Cache::lookup(const std::string &key, Parameters &params) const
+{
+    std::map<std::string, Parameters>::const_iterator pos = entries.find(key);
+    if (pos == entries.end())
+        return false;
+    params = pos->second;
+    return true;
+}
+
+void Cache::store(const std::string &key, const Parameters &params)
+{
+    std::map<std::string, Parameters>::iterator pos = entries.find(key);
+    if (pos == entries.end())
+        entries.insert(std::make_pair(key, params));
+    else
+        pos->second = params;
+}
+
+/// Mesh output function for benchmarking, which discards the mesh
+static void discardMesh(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &mesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    (void) mesh;
+    CLH::enqueueMarkerWithWaitList(queue, events, event);
+}
+
+/**
+ * Process one sample in the same way as @ref DeviceWorkerGroupBase::Worker.
+ */
+static void runSample(
+    const cl::CommandQueue &queue,
+    SplatTreeCL &tree, MlsFunctor &input, Marching &marching,
+    const cl::Buffer &splats, const Sample &sample, int subsampling)
+{
+    cl_uint3 keyOffset;
+    Grid::difference_type offset[3];
+    Grid::size_type size[3], expandedSize[3];
+    for (int i = 0; i < 3; i++)
+    {
+        keyOffset.s[i] = sample.grid.getExtent(i).first;
+        offset[i] = sample.grid.getExtent(i).first;
+        size[i] = sample.grid.numVertices(i);
+        expandedSize[i] = roundUp(size[i], MlsFunctor::wgs[i]);
+    }
+
+    cl::Event treeBuildEvent;
+    std::vector<cl::Event> wait(1);
+    tree.enqueueBuild(queue, splats, 0, sample.splats.size(),
+                      expandedSize, offset, subsampling, tree.getMaxLevels(),
+                      NULL, &treeBuildEvent);
+    wait[0] = treeBuildEvent;
+    input.set(offset, tree, subsampling);
+    marching.generate(queue, input, &discardMesh, size, keyOffset, &wait);
+    tree.clearSplats();
+    queue.finish();
+}
+
+Parameters tune(
+    const cl::Context &context, const cl::Device &device,
+    MlsShape shape,
+    const std::vector<Sample> &samples,
+    std::size_t maxSplats, std::size_t meshMemory,
+    const std::vector<Parameters> &candidates)
+{
+    MLSGPU_ASSERT(!candidates.empty(), std::invalid_argument);
+    const int blockShift = candidates[0].levels + candidates[0].subsampling - 1;
+    const Grid::size_type block = Grid::size_type(1) << blockShift;
+    BOOST_FOREACH(const Parameters &c, candidates)
+    {
+        MLSGPU_ASSERT(c.levels + c.subsampling - 1 == blockShift, std::invalid_argument);
+    }
+    BOOST_FOREACH(const Sample &sample, samples)
+    {
+        MLSGPU_ASSERT(sample.splats.size() <= maxSplats, std::length_error);
+    }
+
+    const cl::CommandQueue queue(context, device);
+    const Grid::size_type maxSwathe = DeviceWorkerGroupBase::computeMaxSwathe(
+        DeviceWorkerGroupBase::MAX_IMAGE_HEIGHT, block, MlsFunctor::wgs[1], MlsFunctor::wgs[2]);
+    Marching marching(context, device, block, block, block, maxSwathe, meshMemory, MlsFunctor::wgs);
+
+    /* All samples are uploaded up front, so that the transfers are not
+     * included in the timings.
+     */
+    std::vector<cl::Buffer> buffers;
+    BOOST_FOREACH(const Sample &sample, samples)
+    {
+        const std::size_t bytes = std::max(sample.splats.size(), std::size_t(1)) * sizeof(Splat);
+        buffers.push_back(cl::Buffer(context, CL_MEM_READ_ONLY, bytes));
+        if (!sample.splats.empty())
+            queue.enqueueWriteBuffer(buffers.back(), CL_TRUE, 0,
+                                     sample.splats.size() * sizeof(Splat), &sample.splats[0]);
+    }
+
+    Statistics::Variable &candidateStat = Statistics::getStatistic<Statistics::Variable>("tune.candidate.time");
+    boost::scoped_ptr<SplatTreeCL> tree;
+    std::size_t best = 0;
+    double bestTime = std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < candidates.size(); i++)
+    {
+        const Parameters &c = candidates[i];
+        if (!tree || tree->getMaxLevels() != std::size_t(c.levels))
+        {
+            tree.reset(); // release the memory before allocating the replacement
+            tree.reset(new SplatTreeCL(context, device, c.levels, maxSplats));
+        }
+        MlsFunctor input(context, shape, c.mlsEdge, c.mlsMaxBucket);
+
+        // Warm up, to exclude one-time costs such as lazy compilation
+        if (!samples.empty())
+            runSample(queue, *tree, input, marching, buffers[0], samples[0], c.subsampling);
+
+        Timer timer;
+        for (std::size_t j = 0; j < samples.size(); j++)
+            runSample(queue, *tree, input, marching, buffers[j], samples[j], c.subsampling);
+        const double elapsed = timer.getElapsed();
+        candidateStat.add(elapsed);
+
+        Log::log[Log::debug] << "Tuning: levels=" << c.levels
+            << " subsampling=" << c.subsampling
+            << " edge=" << c.mlsEdge
+            << " max-bucket=" << c.mlsMaxBucket
+            << ": " << elapsed << "s\n";
+        if (elapsed < bestTime)
+        {
+            bestTime = elapsed;
+            best = i;
+        }
+    }
+    return candidates[best];
+}
+
+} // namespace Tuning
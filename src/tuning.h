@@ -0,0 +1,171 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Per-device selection of kernel parameters by benchmarking.
+ */
+
+#ifndef MLSGPU_TUNING_H
+#define MLSGPU_TUNING_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "grid.h"
+#include "splat.h"
+#include "mls.h"
+
+class TestTuning;
+
+/**
+ * Automatic tuning of the parameters that affect kernel performance but not
+ * the output: the work group shape used by @ref MlsFunctor, the number of
+ * splat IDs it loads per step, and the split of the bucket size between
+ * octree levels and subsampling.
+ *
+ * The split between levels and subsampling is only varied while keeping their
+ * sum fixed. This keeps the bucket size, and hence the output, identical, and
+ * ensures that the device memory estimate computed from the command-line
+ * options remains an upper bound.
+ */
+namespace Tuning
+{
+
+/**
+ * A set of tunable parameters.
+ */
+struct Parameters
+{
+    int levels;                  ///< Octree levels
+    int subsampling;             ///< Octree subsampling shift
+    Grid::size_type mlsEdge;     ///< Edge length of the MLS work group
+    unsigned int mlsMaxBucket;   ///< Splat IDs loaded per step of the MLS kernel
+
+    /// Constructor that uses the default MLS parameters.
+    Parameters(int levels, int subsampling);
+};
+
+/**
+ * Generate a key that identifies the device and driver, together with the
+ * settings that affect the outcome of tuning.
+ */
+std::string makeKey(const cl::Device &device, MlsShape shape, int levels, int subsampling);
+
+/**
+ * Generate the candidate parameters for a given user-specified octree shape.
+ * The first candidate is always the default (untuned) configuration.
+ */
+std::vector<Parameters> makeCandidates(int levels, int subsampling);
+
+/**
+ * Location used to store tuning results if the user does not specify one. It
+ * is empty if no suitable location could be determined.
+ */
+boost::filesystem::path defaultCachePath();
+
+/**
+ * Persistent record of the best parameters for each key produced by @ref makeKey.
+ * The file is a plain text file with one entry per line.
+ */
+class Cache
+{
+    friend class ::TestTuning;
+public:
+    /**
+     * Constructor. It does not touch the file.
+     */
+    explicit Cache(const boost::filesystem::path &path);
+
+    /**
+     * Load the entries from the file, replacing any in memory. A missing file
+     * is treated as empty, and malformed lines are skipped with a warning.
+     */
+    void load();
+
+    /**
+     * Write all entries to the file, creating the parent directory if necessary.
+     *
+     * @throw std::ios::failure if the file could not be written (with boost error
+     * info on the filename and errno).
+     */
+    void save() const;
+
+    /**
+     * Retrieve the entry for @a key.
+     *
+     * @param key          Key produced by @ref makeKey.
+     * @param[out] params  The stored parameters, if found.
+     * @return Whether an entry was found.
+     */
+    bool lookup(const std::string &key, Parameters &params) const;
+
+    /// Add or replace the entry for @a key.
+    void store(const std::string &key, const Parameters &params);
+
+private:
+    boost::filesystem::path path;
+    std::map<std::string, Parameters> entries;
+};
+
+/**
+ * A bucket of splats used for benchmarking. The splats and grid use the
+ * same coordinate system as the items passed to @ref DeviceWorkerGroup
+ * (i.e., grid vertex coordinates, with radii in grid units).
+ */
+struct Sample
+{
+    std::vector<Splat> splats;
+    Grid grid;
+};
+
+/**
+ * Time each candidate on the samples and return the fastest.
+ *
+ * @param context, device  Device to tune for.
+ * @param shape            Shape that will be fit.
+ * @param samples          Representative buckets.
+ * @param maxSplats        Upper bound on the size of a sample.
+ * @param meshMemory       Device memory to allocate for mesh data.
+ * @param candidates       Parameters to try (see @ref makeCandidates).
+ *
+ * @pre
+ * - @a candidates is non-empty and all the entries have the same sum of
+ *   levels and subsampling.
+ * - Each sample fits into a bucket of the size given by the candidates.
+ */
+Parameters tune(
+    const cl::Context &context, const cl::Device &device,
+    MlsShape shape,
+    const std::vector<Sample> &samples,
+    std::size_t maxSplats, std::size_t meshMemory,
+    const std::vector<Parameters> &candidates);
+
+} // namespace Tuning
+
+#endif /* !MLSGPU_TUNING_H */
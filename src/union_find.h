@@ -161,7 +161,10 @@ protected:
  * @param id           Index of the query node.
  * @return Index of the unique root node that is in the same component as @a id.
  * @note Although this function is semantically read-only, it performs path
- * compression and so does modify the internals of @a nodes.
+ * compression and so does modify the internals of @a nodes. Nodes whose
+ * parent is already the root are not written, so once every node has been
+ * passed to this function (with no merges since), it may safely be called
+ * from several threads at once.
  */
 template<typename NodeVector>
 typename NodeVector::iterator::value_type::size_type
@@ -174,7 +177,8 @@ findRoot(const NodeVector &nodes, typename NodeVector::iterator::value_type::siz
     while (id != root)
     {
         next = nodes[id].parent();
-        nodes[id].setParent(root);
+        if (next != root)
+            nodes[id].setParent(root);
         id = next;
     }
     return root;
@@ -0,0 +1,233 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref VertexCacheOptimizer.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include "tr1_cstdint.h"
+#include "vertex_cache.h"
+#include "allocator.h"
+#include "errors.h"
+
+const unsigned int VertexCacheOptimizer::cacheSize;
+
+namespace
+{
+
+/// Exponent applied to the cache position score
+const float cacheDecayPower = 1.5f;
+/// Score for the vertices of the most recently emitted triangle
+const float lastTriangleScore = 0.75f;
+/// Scale of the bonus for vertices with few remaining triangles
+const float valenceBoostScale = 2.0f;
+/// Exponent applied to the number of remaining triangles
+const float valenceBoostPower = -0.5f;
+
+} // anonymous namespace
+
+VertexCacheOptimizer::VertexCacheOptimizer()
+    : vScore("mem.VertexCacheOptimizer::vScore"),
+    vCachePos("mem.VertexCacheOptimizer::vCachePos"),
+    vActive("mem.VertexCacheOptimizer::vActive"),
+    vStart("mem.VertexCacheOptimizer::vStart"),
+    vTriangles("mem.VertexCacheOptimizer::vTriangles"),
+    tScore("mem.VertexCacheOptimizer::tScore")
+{
+    for (unsigned int i = 0; i < cacheSize; i++)
+    {
+        if (i < 3)
+            cachePosScore[i] = lastTriangleScore;
+        else
+            cachePosScore[i] = std::pow(1.0f - float(i - 3) / (cacheSize - 3), cacheDecayPower);
+    }
+    for (unsigned int i = 0; i < sizeof(valenceScore) / sizeof(valenceScore[0]); i++)
+        valenceScore[i] = i == 0 ? 0.0f : valenceBoostScale * std::pow(float(i), valenceBoostPower);
+}
+
+float VertexCacheOptimizer::vertexScore(int cachePos, std::tr1::uint32_t active) const
+{
+    if (active == 0)
+        return -1.0f; // no triangles left, so it does not matter
+    float score = cachePos >= 0 ? cachePosScore[cachePos] : 0.0f;
+    if (active < sizeof(valenceScore) / sizeof(valenceScore[0]))
+        score += valenceScore[active];
+    else
+        score += valenceBoostScale * std::pow(float(active), valenceBoostPower);
+    return score;
+}
+
+void VertexCacheOptimizer::operator()(
+    std::size_t numVertices, std::size_t numTriangles,
+    const std::tr1::uint32_t *indices, std::tr1::uint32_t *order)
+{
+    if (numTriangles == 0)
+        return;
+
+    vScore.reserve(numVertices, false);
+    vCachePos.reserve(numVertices, false);
+    vActive.reserve(numVertices, false);
+    vStart.reserve(numVertices + 1, false);
+    vTriangles.reserve(3 * numTriangles, false);
+    tScore.reserve(numTriangles, false);
+
+    // Build the vertex-to-triangle adjacency lists
+    std::fill(vActive.data(), vActive.data() + numVertices, 0);
+    for (std::size_t i = 0; i < 3 * numTriangles; i++)
+    {
+        MLSGPU_ASSERT(indices[i] < numVertices, std::out_of_range);
+        vActive[indices[i]]++;
+    }
+    vStart[0] = 0;
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        vStart[i + 1] = vStart[i] + vActive[i];
+        vActive[i] = 0;
+    }
+    for (std::size_t i = 0; i < 3 * numTriangles; i++)
+    {
+        const std::tr1::uint32_t v = indices[i];
+        vTriangles[vStart[v] + vActive[v]++] = i / 3;
+    }
+
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        vCachePos[i] = -1;
+        vScore[i] = vertexScore(-1, vActive[i]);
+    }
+
+    std::size_t best = 0;
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        const std::tr1::uint32_t *t = indices + 3 * i;
+        tScore[i] = vScore[t[0]] + vScore[t[1]] + vScore[t[2]];
+        if (tScore[i] > tScore[best])
+            best = i;
+    }
+
+    /* The cache is modelled as an LRU list. It is allowed to temporarily
+     * grow by 3 entries while a triangle is added, so that the vertices
+     * that fall out can have their scores updated.
+     */
+    std::tr1::uint32_t cache[cacheSize + 3], newCache[cacheSize + 3];
+    unsigned int cacheUsed = 0;
+    std::size_t scan = 0; // all triangles before this have been emitted
+
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        if (best == numTriangles)
+        {
+            /* None of the triangles touching the cache are left. Pick the
+             * next unemitted triangle rather than searching for the best,
+             * which keeps the whole algorithm linear.
+             */
+            while (tScore[scan] < 0.0f)
+                scan++;
+            best = scan;
+        }
+
+        order[i] = best;
+        tScore[best] = -1.0f;
+        const std::tr1::uint32_t *t = indices + 3 * best;
+
+        // Remove the triangle from the active lists of its vertices
+        unsigned int newUsed = 0;
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            const std::tr1::uint32_t v = t[j];
+            std::tr1::uint32_t *list = vTriangles.data() + vStart[v];
+            std::tr1::uint32_t *pos = std::find(list, list + vActive[v], std::tr1::uint32_t(best));
+            assert(pos != list + vActive[v]);
+            std::swap(*pos, list[--vActive[v]]);
+            newCache[newUsed++] = v;
+        }
+        // Update the cache, moving the triangle's vertices to the front
+        for (unsigned int j = 0; j < cacheUsed; j++)
+        {
+            const std::tr1::uint32_t v = cache[j];
+            if (v != t[0] && v != t[1] && v != t[2])
+                newCache[newUsed++] = v;
+        }
+
+        // Rescore the affected vertices, and evict those that fell out
+        for (unsigned int j = 0; j < newUsed; j++)
+        {
+            const std::tr1::uint32_t v = newCache[j];
+            vCachePos[v] = j < cacheSize ? int(j) : -1;
+            vScore[v] = vertexScore(vCachePos[v], vActive[v]);
+        }
+
+        // Rescore the triangles that touch them and find the new best
+        best = numTriangles;
+        float bestScore = -1.0f;
+        for (unsigned int j = 0; j < newUsed; j++)
+        {
+            const std::tr1::uint32_t v = newCache[j];
+            const std::tr1::uint32_t *list = vTriangles.data() + vStart[v];
+            for (std::tr1::uint32_t k = 0; k < vActive[v]; k++)
+            {
+                const std::tr1::uint32_t tid = list[k];
+                const std::tr1::uint32_t *u = indices + 3 * tid;
+                float score = vScore[u[0]] + vScore[u[1]] + vScore[u[2]];
+                tScore[tid] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = tid;
+                }
+            }
+        }
+
+        cacheUsed = std::min(newUsed, cacheSize);
+        std::copy(newCache, newCache + cacheUsed, cache);
+    }
+}
+
+double VertexCacheOptimizer::missRatio(
+    std::size_t numVertices, std::size_t numTriangles,
+    const std::tr1::uint32_t *indices, unsigned int fifoSize)
+{
+    if (numTriangles == 0)
+        return 0.0;
+
+    // Time at which each vertex was loaded into the cache (0 for never)
+    std::vector<std::size_t> loaded(numVertices, 0);
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < 3 * numTriangles; i++)
+    {
+        const std::tr1::uint32_t v = indices[i];
+        MLSGPU_ASSERT(v < numVertices, std::out_of_range);
+        if (loaded[v] == 0 || misses - loaded[v] >= fifoSize)
+            loaded[v] = ++misses;
+    }
+    return double(misses) / numTriangles;
+}
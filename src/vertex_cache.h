@@ -0,0 +1,109 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Reordering of triangles for efficient use of a GPU's post-transform
+ * vertex cache.
+ */
+
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "allocator.h"
+
+/**
+ * Computes a triangle order that makes good use of a vertex cache, using
+ * Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". The algorithm is
+ * greedy: at each step it emits the triangle with the highest score, where
+ * the score favours vertices that are recently used (and hence likely to
+ * be in the cache) and vertices with few remaining triangles (so that they
+ * are not left stranded).
+ *
+ * An instance holds working memory that is reused between calls, so it is
+ * worth keeping one around when processing many meshes. It is not
+ * thread-safe.
+ */
+class VertexCacheOptimizer : public boost::noncopyable
+{
+public:
+    /// Size of the modelled LRU cache
+    static const unsigned int cacheSize = 32;
+
+    /**
+     * Compute a triangle order.
+     *
+     * @param numVertices    Number of vertices referenced by @a indices
+     * @param numTriangles   Number of triangles
+     * @param indices        3 * @a numTriangles vertex indices, each less than @a numVertices
+     * @param[out] order     Receives @a numTriangles triangle indices, in the order they should be emitted
+     */
+    void operator()(
+        std::size_t numVertices, std::size_t numTriangles,
+        const std::tr1::uint32_t *indices, std::tr1::uint32_t *order);
+
+    /**
+     * Measure the average cache miss ratio (misses per triangle) for a
+     * FIFO cache, which is how most GPUs behave. This is useful for
+     * evaluating the quality of an ordering.
+     *
+     * @param numVertices    Number of vertices referenced by @a indices
+     * @param numTriangles   Number of triangles
+     * @param indices        3 * @a numTriangles vertex indices, each less than @a numVertices
+     * @param fifoSize       Number of entries in the simulated cache
+     */
+    static double missRatio(
+        std::size_t numVertices, std::size_t numTriangles,
+        const std::tr1::uint32_t *indices, unsigned int fifoSize);
+
+    VertexCacheOptimizer();
+
+private:
+    /// Score a vertex given its position in the cache (-1 if absent) and number of remaining triangles
+    float vertexScore(int cachePos, std::tr1::uint32_t active) const;
+
+    /// Score contribution for each cache position
+    float cachePosScore[cacheSize];
+    /// Score contribution for small numbers of remaining triangles
+    float valenceScore[16];
+
+    /// Current score of each vertex
+    Statistics::Container::PODBuffer<float> vScore;
+    /// Position of each vertex in the cache, or -1
+    Statistics::Container::PODBuffer<int> vCachePos;
+    /// Number of triangles not yet emitted that use each vertex
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vActive;
+    /// Start of each vertex's triangle list in @ref vTriangles (plus an end sentinel)
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vStart;
+    /// Triangle lists; the first @ref vActive entries for each vertex are those not yet emitted
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vTriangles;
+    /// Current score of each triangle, or negative once emitted
+    Statistics::Container::PODBuffer<float> tScore;
+};
+
+#endif /* !VERTEX_CACHE_H */
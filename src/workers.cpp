@@ -34,6 +34,8 @@
 
 #include <cstddef>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <CL/cl.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
@@ -47,6 +49,7 @@
 #include "work_queue.h"
 #include "splat_tree_cl.h"
 #include "splat.h"
+#include "tr1_cstdint.h"
 #include "splat_set.h"
 #include "bucket.h"
 #include "mesh.h"
@@ -57,8 +60,8 @@
 #include "thread_name.h"
 #include "misc.h"
 
-MesherGroupBase::Worker::Worker(MesherGroup &owner)
-    : WorkerBase("mesher", 0), owner(owner) {}
+MesherGroupBase::Worker::Worker(MesherGroup &owner, int idx)
+    : WorkerBase("mesher", idx), owner(owner) {}
 
 void MesherGroupBase::Worker::operator()(WorkItem &item)
 {
@@ -67,12 +70,13 @@ void MesherGroupBase::Worker::operator()(WorkItem &item)
     owner.meshBuffer.free(item.alloc);
 }
 
-MesherGroup::MesherGroup(std::size_t memMesh)
+MesherGroup::MesherGroup(std::size_t memMesh, std::size_t numWorkers)
     : WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>(
-        "mesher", 1),
+        "mesher", numWorkers),
     meshBuffer("mem.MesherGroup.mesh", memMesh)
 {
-    addWorker(new Worker(*this));
+    for (std::size_t i = 0; i < numWorkers; i++)
+        addWorker(new Worker(*this, i));
 }
 
 boost::shared_ptr<MesherGroup::WorkItem> MesherGroup::get(Timeplot::Worker &tworker, std::size_t size)
@@ -89,15 +93,21 @@ DeviceWorkerGroup::DeviceWorkerGroup(
     OutputGenerator outputGenerator,
     const cl::Context &context, const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
-    std::size_t meshMemory,
+    std::size_t meshMemory, std::size_t octreeMemory,
     int levels, int subsampling, float boundaryLimit,
-    MlsShape shape)
+    MlsShape shape,
+    Grid::size_type mlsEdge, unsigned int mlsMaxBucket,
+    bool normals)
 :
     Base("device", numWorkers),
     progress(NULL), outputGenerator(outputGenerator),
     context(context), device(device),
     maxBucketSplats(maxBucketSplats), maxCells(maxCells), meshMemory(meshMemory),
-    subsampling(subsampling),
+    octreeArena(octreeMemory > 0 ? new DeviceArena("mem.DeviceWorkerGroup.octreeArena", context, device, octreeMemory) : NULL),
+    levels(levels), subsampling(subsampling), adaptiveOctree(true), normals(normals),
+    levelsStat(Statistics::getStatistic<Statistics::Variable>("device.octree.levels")),
+    subsamplingStat(Statistics::getStatistic<Statistics::Variable>("device.octree.subsampling")),
+    batchStat(Statistics::getStatistic<Statistics::Variable>("device.octree.batch")),
     copyQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE),
     itemPool(),
     popMutex(NULL),
@@ -105,7 +115,8 @@ DeviceWorkerGroup::DeviceWorkerGroup(
 {
     for (std::size_t i = 0; i < numWorkers; i++)
     {
-        addWorker(new Worker(*this, context, device, levels, boundaryLimit, shape, i));
+        addWorker(new Worker(*this, context, device, levels, boundaryLimit,
+                             shape, mlsEdge, mlsMaxBucket, i));
     }
     const std::size_t items = numWorkers + spare;
     const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
@@ -118,7 +129,7 @@ DeviceWorkerGroup::DeviceWorkerGroup(
 
     CLH::ResourceUsage usage = resourceUsage(
         numWorkers, spare, device,
-        maxBucketSplats, maxCells, meshMemory, levels);
+        maxBucketSplats, maxCells, meshMemory, octreeMemory, levels, normals);
     usage.addStatistics(Statistics::Registry::getInstance(), "mem.device.");
 }
 
@@ -181,12 +192,45 @@ Grid::size_type DeviceWorkerGroupBase::computeMaxSwathe(
     return chunks * zAlign;
 }
 
+void DeviceWorkerGroupBase::chooseOctreeShape(
+    std::size_t numSplats, const Grid::size_type size[3], float meanRadius,
+    int maxLevels, int &levels, int &subsampling)
+{
+    MLSGPU_ASSERT(maxLevels >= 1, std::invalid_argument);
+    Grid::size_type maxSize = std::max(std::max(size[0], size[1]), size[2]);
+    int top = 0; // smallest value with 2^top >= maxSize
+    while ((Grid::size_type(1) << top) < maxSize)
+        top++;
+
+    /* Range that fits into the allocated levels while having at least one
+     * level. A bucket may be bigger than the allocated levels can cover at
+     * the minimum subsampling (when the configured subsampling is higher),
+     * in which case the lower bound is raised.
+     */
+    const int lo = std::max(MlsFunctor::subsamplingMin, top - maxLevels + 1);
+    const int hi = std::max(lo, top);
+
+    int shift = lo;
+    while (shift < hi && float(Grid::size_type(2) << shift) <= 2.0f * meanRadius)
+        shift++;
+    while (shift < hi)
+    {
+        Grid::size_type cells = maxSize >> shift;
+        if (cells * cells <= numSplats)
+            break;
+        shift++;
+    }
+
+    subsampling = shift;
+    levels = std::max(1, top - shift + 1);
+}
+
 CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
     std::size_t numWorkers, std::size_t spare,
     const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
-    std::size_t meshMemory,
-    int levels)
+    std::size_t meshMemory, std::size_t octreeMemory,
+    int levels, bool normals)
 {
     Grid::size_type block = maxCells + 1;
     Grid::size_type maxSwathe = computeMaxSwathe(
@@ -196,92 +240,150 @@ CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
     workerUsage += Marching::resourceUsage(
         device, block, block, block,
         maxSwathe, meshMemory, MlsFunctor::wgs);
-    workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats);
+    workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats, octreeMemory > 0);
+    if (normals)
+        workerUsage.addBuffer("normals", Marching::maxOutputVertices(meshMemory) * (3 * sizeof(cl_float)));
 
     const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
     CLH::ResourceUsage itemUsage;
     itemUsage.addBuffer("splats", maxItemSplats * sizeof(Splat));
-    return workerUsage * numWorkers + itemUsage * (numWorkers + spare);
+
+    CLH::ResourceUsage groupUsage;
+    if (octreeMemory > 0)
+        groupUsage.addBuffer("octreeArena", octreeMemory);
+    return workerUsage * numWorkers + itemUsage * (numWorkers + spare) + groupUsage;
 }
 
 DeviceWorkerGroupBase::Worker::Worker(
     DeviceWorkerGroup &owner,
     const cl::Context &context, const cl::Device &device,
     int levels, float boundaryLimit,
-    MlsShape shape, int idx)
+    MlsShape shape, Grid::size_type mlsEdge, unsigned int mlsMaxBucket, int idx)
 :
     WorkerBase("device", idx),
     owner(owner),
     queue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
-    tree(context, device, levels, owner.maxBucketSplats),
-    input(context, shape),
+    tree(context, device, levels, owner.maxBucketSplats,
+         owner.octreeArena.get(), &getTimeplotWorker()),
+    input(context, shape, mlsEdge, mlsMaxBucket),
+    /* The alignment is taken from the largest work group size rather than from
+     * the input, so that the allocation matches @ref resourceUsage regardless
+     * of the tuning.
+     */
     marching(context, device, owner.maxCells + 1, owner.maxCells + 1, owner.maxCells + 1,
-             computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, input.alignment()[1], input.alignment()[2]),
-             owner.meshMemory, input.alignment()),
+             computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, MlsFunctor::wgs[1], MlsFunctor::wgs[2]),
+             owner.meshMemory, MlsFunctor::wgs),
     scaleBias(context)
 {
     input.setBoundaryLimit(boundaryLimit);
+    if (owner.normals)
+    {
+        // Must precede the scale-bias, as it requires grid coordinates
+        normalFilter.reset(new MlsNormalFilter(
+                context, input, Marching::maxOutputVertices(owner.meshMemory)));
+        filterChain.addFilter(boost::ref(*normalFilter));
+    }
     filterChain.addFilter(boost::ref(scaleBias));
 }
 
-void DeviceWorkerGroupBase::Worker::start()
-{
-    scaleBias.setScaleBias(owner.fullGrid);
-}
-
 void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    BOOST_FOREACH(const SubItem &sub, work.subItems)
-    {
-        cl_uint3 keyOffset;
-        for (int i = 0; i < 3; i++)
-            keyOffset.s[i] = sub.grid.getExtent(i).first;
-        // same thing, just as a different type for a different API
-        Grid::difference_type offset[3] =
-        {
-            (Grid::difference_type) keyOffset.s[0],
-            (Grid::difference_type) keyOffset.s[1],
-            (Grid::difference_type) keyOffset.s[2]
-        };
 
-        Grid::size_type size[3];
+    const std::size_t numSubItems = work.subItems.size();
+    std::vector<SplatTreeCL::Segment> segments(numSubItems);
+    for (std::size_t j = 0; j < numSubItems; j++)
+    {
+        const SubItem &sub = work.subItems[j];
+        SplatTreeCL::Segment &seg = segments[j];
+        seg.firstSplat = sub.firstSplat;
+        seg.numSplats = sub.numSplats;
         for (int i = 0; i < 3; i++)
         {
+            seg.offset[i] = sub.grid.getExtent(i).first;
             /* Note: numVertices not numCells, because Marching does per-vertex queries.
              * So we need information about the cell that is just beyond the last vertex,
              * just to avoid special-casing it.
+             *
+             * We also need to round up the octree size to a multiple of the granularity
+             * used for MLS.
              */
-            size[i] = sub.grid.numVertices(i);
+            seg.size[i] = roundUp(sub.grid.numVertices(i), MlsFunctor::wgs[i]);
         }
 
-        /* We need to round up the octree size to a multiple of the granularity used for MLS. */
-        Grid::size_type expandedSize[3];
-        for (int i = 0; i < 3; i++)
-            expandedSize[i] = roundUp(size[i], MlsFunctor::wgs[i]);
+        int levels = owner.levels;
+        int subsampling = owner.subsampling;
+        if (owner.adaptiveOctree)
+            chooseOctreeShape(sub.numSplats, seg.size, sub.meanRadius, owner.levels,
+                              levels, subsampling);
+        owner.levelsStat.add(levels);
+        owner.subsamplingStat.add(subsampling);
+        seg.levels = levels;
+        seg.subsamplingShift = subsampling;
+    }
 
-        filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
+    /* Consecutive buckets are built into the octree together, for as long as
+     * their start arrays fit into the space allocated for a single full-size
+     * octree. This amortises the launch overheads of the sort and scan over
+     * many small buckets. The splats always fit, because the work item is no
+     * bigger than the space allocated for the octree.
+     */
+    const std::size_t maxStart = SplatTreeCL::startSize(tree.getMaxLevels());
+    std::size_t first = 0;
+    while (first < numSubItems)
+    {
+        std::size_t last = first;
+        std::size_t batchStart = 0;
+        while (last < numSubItems
+               && batchStart + SplatTreeCL::startSize(segments[last].levels) <= maxStart)
+        {
+            batchStart += SplatTreeCL::startSize(segments[last].levels);
+            last++;
+        }
+        owner.batchStat.add(last - first);
 
         cl::Event treeBuildEvent;
         std::vector<cl::Event> wait(1);
 
         wait[0] = work.copyEvent;
-        tree.enqueueBuild(queue, work.splats, sub.firstSplat, sub.numSplats,
-                          expandedSize, offset, owner.subsampling, &wait, &treeBuildEvent);
+        std::vector<SplatTreeCL::Segment> batch(segments.begin() + first, segments.begin() + last);
+        tree.enqueueBuild(queue, work.splats, batch, &wait, &treeBuildEvent);
         wait[0] = treeBuildEvent;
 
-        input.set(offset, tree, owner.subsampling);
-        marching.generate(queue, input, filterChain, size, keyOffset, &wait);
+        for (std::size_t j = first; j < last; j++)
+        {
+            const SubItem &sub = work.subItems[j];
+            const SplatTreeCL::Segment &seg = segments[j];
+            cl_uint3 keyOffset;
+            Grid::size_type size[3];
+            for (int i = 0; i < 3; i++)
+            {
+                keyOffset.s[i] = seg.offset[i];
+                size[i] = sub.grid.numVertices(i);
+            }
 
-        tree.clearSplats();
+            // The grid may have been coarsened by the copy group
+            float origin[3];
+            owner.fullGrid.getVertex(0, 0, 0, origin);
+            scaleBias.setScaleBias(owner.fullGrid.getSpacing() * (1U << sub.coarsening),
+                                   origin[0], origin[1], origin[2]);
 
-        if (owner.progress != NULL)
-            *owner.progress += sub.progressSplats;
+            filterChain.setOutput(owner.outputGenerator(sub.chunkId, sub.level, getTimeplotWorker()));
+            input.set(seg.offset, tree, seg.subsamplingShift, j - first);
+            // Keys are placed on the full grid so that they are consistent between buckets
+            marching.generate(queue, input, filterChain, size, keyOffset, &wait, sub.coarsening);
 
-        {
-            boost::lock_guard<boost::mutex> unallocatedLock(owner.unallocatedMutex);
-            owner.unallocated_ += sub.numSplats;
+            if (owner.progress != NULL)
+                *owner.progress += sub.progressSplats;
+
+            {
+                boost::lock_guard<boost::mutex> unallocatedLock(owner.unallocatedMutex);
+                owner.unallocated_ += sub.numSplats;
+            }
         }
+
+        tree.clearSplats();
+        first = last;
     }
 }
 
@@ -293,16 +395,61 @@ CopyGroup::CopyGroup(
         "copy", 1),
     outGroups(outGroups),
     maxDeviceItemSplats(outGroups[0]->getMaxItemSplats()),
+    maxCoarsening(0), cellRadius(0.0f), thinning(1), levelShifts(1, 0),
     splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat)),
     writeStat(Statistics::getStatistic<Statistics::Variable>("copy.write")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("copy.splats")),
-    sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size"))
+    sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size")),
+    coarseningStat(Statistics::getStatistic<Statistics::Variable>("copy.coarsening"))
 {
     addWorker(new Worker(*this, outGroups[0]->getContext(), outGroups[0]->getDevice()));
     BOOST_FOREACH(DeviceWorkerGroup *g, outGroups)
         g->setPopCondition(&popMutex, &popCondition);
 }
 
+unsigned int CopyGroupBase::chooseCoarsening(float meanRadius, float cellRadius, unsigned int maxCoarsening)
+{
+    unsigned int coarsening = 0;
+    while (coarsening < maxCoarsening
+           && float(2U << coarsening) * cellRadius <= meanRadius)
+        coarsening++;
+    return coarsening;
+}
+
+unsigned int CopyGroupBase::alignCoarsening(const Grid &grid, unsigned int coarsening)
+{
+    for (int j = 0; j < 3; j++)
+    {
+        Grid::extent_type e = grid.getExtent(j);
+        while (coarsening > 0
+               && ((e.first | e.second) & ((Grid::difference_type(1) << coarsening) - 1)) != 0)
+            coarsening--;
+    }
+    return coarsening;
+}
+
+bool CopyGroupBase::keepSplat(const Splat &splat, unsigned int ratio)
+{
+    if (ratio <= 1)
+        return true;
+    /* FNV-1a hash of the bits of the position, followed by the MurmurHash3
+     * finalizer since the low bits of FNV-1a are poorly mixed.
+     */
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(splat.position);
+    std::tr1::uint32_t hash = 2166136261U;
+    for (std::size_t i = 0; i < sizeof(splat.position); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash % ratio == 0;
+}
+
 CopyGroupBase::Worker::Worker(
     CopyGroup &owner, const cl::Context &context, const cl::Device &device)
     : WorkerBase("copy", 0), owner(owner),
@@ -379,40 +526,96 @@ void CopyGroupBase::Worker::operator()(WorkItem &work)
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
     timer.setValue(work.numSplats * sizeof(Splat));
 
-    if (bufferedSplats + work.numSplats > owner.maxDeviceItemSplats)
-        flush();
-
     const Splat *in = work.getSplats();
-    Splat *out = pinned.get() + bufferedSplats;
     std::size_t progressSplats = 0;
-    for (std::size_t i = 0; i < work.numSplats; i++)
+    /* The bin is loaded once, and a copy is passed to the device for each
+     * level of detail.
+     */
+    for (std::size_t level = 0; level < owner.levelShifts.size(); level++)
     {
-        /* Each splat is accounted in the progress meter with the
-         * bin it is inside (half-open intervals). Note that this
-         * test is a short-cut that makes assumptions about the
-         * grid written by BucketLoader.
+        if (bufferedSplats + work.numSplats > owner.maxDeviceItemSplats)
+            flush();
+
+        Splat *out = pinned.get() + bufferedSplats;
+        std::size_t numSplats = 0;
+        double sumRadius = 0.0;
+        for (std::size_t i = 0; i < work.numSplats; i++)
+        {
+            if (level == 0)
+            {
+                /* Each splat is accounted in the progress meter with the
+                 * bin it is inside (half-open intervals). Note that this
+                 * test is a short-cut that makes assumptions about the
+                 * grid written by BucketLoader.
+                 */
+                bool inside = true;
+                for (int j = 0; j < 3; j++)
+                {
+                    Grid::extent_type e = work.grid.getExtent(j);
+                    float p = in[i].position[j];
+                    inside = inside && p >= e.first && p < e.second;
+                }
+                progressSplats += inside;
+            }
+            if (keepSplat(in[i], owner.thinning))
+            {
+                sumRadius += in[i].radius;
+                out[numSplats++] = in[i];
+            }
+        }
+        float meanRadius = numSplats > 0 ? sumRadius / numSplats : 0.0f;
+
+        /* The level sets the minimum coarsening. The bins are aligned to it
+         * (see Bucket::bucket), so alignCoarsening never goes below it.
          */
-        bool inside = true;
-        for (int j = 0; j < 3; j++)
+        const unsigned int shift = owner.levelShifts[level];
+        Grid grid = work.grid;
+        const unsigned int coarsening = alignCoarsening(
+            work.grid,
+            shift + chooseCoarsening(meanRadius / float(1U << shift), owner.cellRadius, owner.maxCoarsening));
+        MLSGPU_ASSERT(coarsening >= shift, std::invalid_argument);
+        if (coarsening > 0)
+        {
+            /* Scale everything down about the origin of the full grid. The
+             * bounds of the bin are multiples of the factor, so the coarse grids
+             * of adjacent bins meet without overlapping.
+             */
+            const Grid::difference_type factor = Grid::difference_type(1) << coarsening;
+            const float scale = 1.0f / factor;
+            for (std::size_t i = 0; i < numSplats; i++)
+            {
+                for (int j = 0; j < 3; j++)
+                    out[i].position[j] *= scale;
+                out[i].radius *= scale;
+            }
+            for (int j = 0; j < 3; j++)
+            {
+                Grid::extent_type e = work.grid.getExtent(j);
+                grid.setExtent(j, e.first / factor, e.second / factor);
+            }
+            meanRadius *= scale;
+        }
+
+        DeviceWorkerGroup::SubItem subItem;
+        subItem.chunkId = work.chunkId;
+        subItem.grid = grid;
+        subItem.numSplats = numSplats;
+        subItem.firstSplat = bufferedSplats;
+        // Progress is only counted for the finest level
+        subItem.progressSplats = level == 0 ? progressSplats : 0;
+        subItem.meanRadius = meanRadius;
+        subItem.coarsening = coarsening;
+        subItem.level = level;
+        bufferedItems.push_back(subItem);
+        bufferedSplats += numSplats;
+
+        if (level == 0)
         {
-            Grid::extent_type e = work.grid.getExtent(j);
-            float p = in[i].position[j];
-            inside = inside && p >= e.first && p < e.second;
+            owner.splatsStat.add(numSplats);
+            owner.sizeStat.add(work.grid.numCells());
         }
-        progressSplats += inside;
-        out[i] = in[i];
+        owner.coarseningStat.add(coarsening);
     }
-    DeviceWorkerGroup::SubItem subItem;
-    subItem.chunkId = work.chunkId;
-    subItem.grid = work.grid;
-    subItem.numSplats = work.numSplats;
-    subItem.firstSplat = bufferedSplats;
-    subItem.progressSplats = progressSplats;
-    bufferedItems.push_back(subItem);
-    bufferedSplats += work.numSplats;
-
-    owner.splatsStat.add(work.numSplats);
-    owner.sizeStat.add(work.grid.numCells());
 
     owner.splatBuffer.free(work.splats);
 }
@@ -51,6 +51,7 @@
 #include <cstdlib>
 #include <CL/cl.hpp>
 #include "splat_tree_cl.h"
+#include "device_arena.h"
 #include "marching.h"
 #include "mls.h"
 #include "mesh.h"
@@ -88,15 +89,16 @@ public:
     public:
         typedef void result_type;
 
-        explicit Worker(MesherGroup &owner);
+        Worker(MesherGroup &owner, int idx);
         void operator()(WorkItem &work);
     };
 };
 
 /**
- * Object for handling asynchronous meshing. It always uses one consumer thread, since
- * the operation is fundamentally not thread-safe. However, there may be multiple
- * producers.
+ * Object for handling asynchronous meshing. There may be multiple producers
+ * and multiple consumer threads. The consumers run the block-local parts of
+ * the mesher in parallel, while the mesher serializes updates to its global
+ * state internally.
  */
 class MesherGroup : protected MesherGroupBase,
     public WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>
@@ -112,9 +114,10 @@ public:
     /**
      * Constructor.
      *
-     * @param memMesh Memory (in bytes) to allocate for holding queued mesh data.
+     * @param memMesh    Memory (in bytes) to allocate for holding queued mesh data.
+     * @param numWorkers Number of consumer threads.
      */
-    explicit MesherGroup(const std::size_t memMesh);
+    explicit MesherGroup(const std::size_t memMesh, std::size_t numWorkers = 1);
 private:
     MesherBase::InputFunctor input;
     CircularBuffer meshBuffer;
@@ -135,7 +138,7 @@ class DeviceWorkerGroup;
 
 class DeviceWorkerGroupBase
 {
-protected:
+public:
     /**
      * Maximum size we will use for the distance field image. This is set to minimum
      * maximum for @c CL_DEVICE_IMAGE2D_MAX_HEIGHT.
@@ -154,7 +157,6 @@ protected:
     static Grid::size_type computeMaxSwathe(
         Grid::size_type yMax, Grid::size_type y, Grid::size_type yAlign, Grid::size_type zAlign);
 
-public:
     /// Data about a single bucket.
     struct SubItem
     {
@@ -163,8 +165,38 @@ public:
         std::size_t firstSplat;        ///< Index of first splat in device buffer
         std::size_t numSplats;         ///< Number of splats in the bucket
         std::size_t progressSplats;    ///< Splats to count towards the progress meter
+        float meanRadius;              ///< Mean splat radius, in grid units
+        /// Log base 2 of the factor by which the grid was coarsened (see @ref CopyGroup::setAdaptiveGrid)
+        unsigned int coarsening;
+        /// Level of detail (see @ref CopyGroup::setLevels)
+        unsigned int level;
     };
 
+    /**
+     * Choose the octree shape for a single bucket. The finest level is made
+     * roughly as coarse as the typical splat diameter, since splats are
+     * inserted at a level where they overlap at most 2&times;2&times;2 cells
+     * and finer levels would thus mainly be empty. It is made coarser still if
+     * a surface through the bucket would cross many more finest-level cells
+     * than there are splats. The number of levels is then the smallest that
+     * will cover the bucket.
+     *
+     * @param numSplats        Number of splats in the bucket.
+     * @param size             Dimensions of the octree, as passed to @ref SplatTreeCL::enqueueBuild.
+     * @param meanRadius       Mean radius of the splats, in grid units.
+     * @param maxLevels        Levels allocated for the octree.
+     * @param[out] levels      Number of levels to build.
+     * @param[out] subsampling Subsampling shift to use.
+     *
+     * @pre @a maxLevels &gt;= 1.
+     *
+     * If @a size exceeds 2<sup>@a maxLevels + @ref MlsFunctor::subsamplingMin - 1</sup>,
+     * the subsampling is raised until @a maxLevels levels cover the bucket.
+     */
+    static void chooseOctreeShape(
+        std::size_t numSplats, const Grid::size_type size[3], float meanRadius,
+        int maxLevels, int &levels, int &subsampling);
+
     /// Data about multiple buckets that share a single CL buffer.
     struct WorkItem
     {
@@ -189,6 +221,8 @@ public:
         SplatTreeCL tree;
         MlsFunctor input;
         Marching marching;
+        /// Filter to compute normals (@c NULL if they are not wanted)
+        boost::scoped_ptr<MlsNormalFilter> normalFilter;
         ScaleBiasFilter scaleBias;
         MeshFilterChain filterChain;
 
@@ -199,9 +233,9 @@ public:
             DeviceWorkerGroup &owner,
             const cl::Context &context, const cl::Device &device,
             int levels, float boundaryLimit,
-            MlsShape shape, int idx);
+            MlsShape shape, Grid::size_type mlsEdge, unsigned int mlsMaxBucket,
+            int idx);
 
-        void start();
         void operator()(WorkItem &work);
     };
 };
@@ -217,12 +251,13 @@ class DeviceWorkerGroup :
 {
 public:
     /**
-     * Functor that generates an output function given the current chunk ID and
-     * worker. This is used to abstract the downstream worker group class.
+     * Functor that generates an output function given the current chunk ID,
+     * level of detail and worker. This is used to abstract the downstream
+     * worker group class.
      *
      * @see @ref DeviceWorkerGroup::DeviceWorkerGroup
      */
-    typedef boost::function<Marching::OutputFunctor(const ChunkId &, Timeplot::Worker &)> OutputGenerator;
+    typedef boost::function<Marching::OutputFunctor(const ChunkId &, unsigned int, Timeplot::Worker &)> OutputGenerator;
 
 private:
     typedef WorkerGroup<DeviceWorkerGroupBase::WorkItem, DeviceWorkerGroupBase::Worker, DeviceWorkerGroup> Base;
@@ -236,7 +271,15 @@ private:
     const std::size_t maxBucketSplats;  ///< Maximum splats in a single bucket
     const Grid::size_type maxCells;
     const std::size_t meshMemory;
+    boost::scoped_ptr<DeviceArena> octreeArena; ///< Shared octree storage (may be @c NULL)
+    const int levels;
     const int subsampling;
+    bool adaptiveOctree;          ///< Whether to choose the octree shape per bucket
+    const bool normals;           ///< Whether to compute vertex normals
+
+    Statistics::Variable &levelsStat;       ///< Octree levels used per bucket
+    Statistics::Variable &subsamplingStat;  ///< Octree subsampling used per bucket
+    Statistics::Variable &batchStat;        ///< Buckets per octree build
 
     cl::CommandQueue copyQueue;   ///< Queue for transferring data to the device
 
@@ -266,34 +309,44 @@ public:
      * @param numWorkers         Number of worker threads to use (each with a separate OpenCL queue and state)
      * @param spare              Number of extra slots (beyond @a numWorkers) for items.
      * @param outputGenerator    Output handler generator. The generator is passed a chunk
-     *                           ID and @ref Timeplot::Worker, and returns a @ref Marching::OutputFunctor which
-     *                           which will receive the output blocks for the corresponding chunk.
+     *                           ID, level of detail and @ref Timeplot::Worker, and returns a
+     *                           @ref Marching::OutputFunctor which will receive the output
+     *                           blocks for the corresponding chunk and level.
      * @param context            OpenCL context to run on.
      * @param device             OpenCL device to run on.
      * @param maxBucketSplats    Space to allocate for holding splats for one bucket.
      * @param maxCells           Space to allocate for the octree.
      * @param meshMemory         Maximum device bytes to use for mesh-related data.
+     * @param octreeMemory       Device bytes to share between the workers for octree
+     *                           storage that depends on the number of splats. If zero,
+     *                           each worker allocates for the worst case instead.
      * @param levels             Levels to allocate for the octree.
      * @param subsampling        Octree subsampling level.
      * @param boundaryLimit      Tuning factor for boundary pruning.
      * @param shape              The shape to fit to the data
+     * @param mlsEdge            Work group edge length for @ref MlsFunctor.
+     * @param mlsMaxBucket       Splat ID batch size for @ref MlsFunctor.
+     * @param normals            Whether to compute vertex normals (see @ref MlsNormalFilter).
      */
     DeviceWorkerGroup(
         std::size_t numWorkers, std::size_t spare,
         OutputGenerator outputGenerator,
         const cl::Context &context, const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
-        std::size_t meshMemory,
+        std::size_t meshMemory, std::size_t octreeMemory,
         int levels, int subsampling, float boundaryLimit,
-        MlsShape shape);
+        MlsShape shape,
+        Grid::size_type mlsEdge = MlsFunctor::wgs[0],
+        unsigned int mlsMaxBucket = MlsFunctor::maxBucketDefault,
+        bool normals = false);
 
     /// Returns total resources that would be used by all workers and workitems
     static CLH::ResourceUsage resourceUsage(
         std::size_t numWorkers, std::size_t spare,
         const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
-        std::size_t meshMemory,
-        int levels);
+        std::size_t meshMemory, std::size_t octreeMemory,
+        int levels, bool normals = false);
 
     /**
      * @copydoc WorkerGroup::start
@@ -302,6 +355,13 @@ public:
      */
     void start(const Grid &fullGrid);
 
+    /**
+     * Set whether the octree levels and subsampling are chosen per bucket
+     * using @ref chooseOctreeShape (the default), or are always the values
+     * passed to the constructor.
+     */
+    void setAdaptiveOctree(bool adaptive) { adaptiveOctree = adaptive; }
+
     /**
      * Sets a progress display that will be updated by the number of cells
      * processed.
@@ -354,6 +414,42 @@ class CopyGroup;
 class CopyGroupBase
 {
 public:
+    /**
+     * Choose how much to coarsen the grid for a bucket. The grid is
+     * coarsened by the largest power of two that is at most
+     * 2<sup>@a maxCoarsening</sup> and that keeps a coarse cell no bigger
+     * than @a meanRadius / @a cellRadius.
+     *
+     * @param meanRadius     Mean radius of the splats in the bucket, in grid units.
+     * @param cellRadius     Ratio of splat radius to cell size below which not to coarsen.
+     * @param maxCoarsening  Log base 2 of the maximum coarsening factor.
+     * @return Log base 2 of the coarsening factor.
+     */
+    static unsigned int chooseCoarsening(float meanRadius, float cellRadius, unsigned int maxCoarsening);
+
+    /**
+     * Reduce a coarsening so that the coarse grid covers exactly the same
+     * region as @a grid. The result is the largest value not exceeding
+     * @a coarsening for which 2<sup>result</sup> divides both bounds of
+     * every extent of @a grid. This keeps the coarse grids of adjacent bins
+     * from overlapping.
+     *
+     * @param grid           The bin grid, relative to the full grid.
+     * @param coarsening     Log base 2 of the requested coarsening factor.
+     * @return Log base 2 of the permitted coarsening factor.
+     */
+    static unsigned int alignCoarsening(const Grid &grid, unsigned int coarsening);
+
+    /**
+     * Decide whether to keep a splat when thinning the input (see @ref
+     * CopyGroup::setThinning). The decision is a hash of the position, so
+     * the same splat is treated the same way in every bin it falls into.
+     *
+     * @param splat          The splat, in grid coordinates.
+     * @param ratio          Keep about one splat in this many (1 to keep all).
+     */
+    static bool keepSplat(const Splat &splat, unsigned int ratio);
+
     /// A single bin of splats
     struct WorkItem
     {
@@ -422,9 +518,54 @@ public:
     /// Statistic for timing @c clEnqueueWriteBuffer
     Statistics::Variable &getWriteStat() const { return writeStat; }
 
+    /**
+     * Allow the grid to be coarsened for buckets whose splats are large
+     * compared to the grid spacing (see @ref chooseCoarsening). The splats
+     * and grid of such a bucket are scaled down before being passed to the
+     * device. The default is not to coarsen.
+     *
+     * @param maxCoarsening  Log base 2 of the maximum coarsening factor.
+     * @param cellRadius     Ratio of splat radius to cell size below which not to coarsen.
+     *
+     * Bins whose bounds are not multiples of the chosen factor are coarsened
+     * less (see @ref alignCoarsening).
+     */
+    void setAdaptiveGrid(unsigned int maxCoarsening, float cellRadius)
+    {
+        this->maxCoarsening = maxCoarsening;
+        this->cellRadius = cellRadius;
+    }
+
+    /**
+     * Discard all but about one in @a ratio splats before they are passed to
+     * the device (see @ref keepSplat). Discarded splats still count towards
+     * the progress meter. The default is to keep all splats.
+     */
+    void setThinning(unsigned int ratio) { thinning = ratio; }
+
+    /**
+     * Produce several levels of detail from each bin. Each bin is passed to
+     * the device once per level, as a separate bucket tagged with the level
+     * index (see @ref DeviceWorkerGroup::SubItem::level) and coarsened by at
+     * least 2<sup><code>shifts[level]</code></sup>. Only level 0 counts
+     * towards the progress meter. The default is a single level with a shift
+     * of zero.
+     *
+     * @pre The bins are aligned to the largest factor (see @ref Bucket::bucket).
+     */
+    void setLevels(const std::vector<unsigned int> &shifts)
+    {
+        MLSGPU_ASSERT(!shifts.empty(), std::invalid_argument);
+        levelShifts = shifts;
+    }
+
 private:
     const std::vector<DeviceWorkerGroup *> outGroups;
     const std::size_t maxDeviceItemSplats;     ///< Maximum splats to send to the device in one go
+    unsigned int maxCoarsening;                ///< See @ref setAdaptiveGrid
+    float cellRadius;                          ///< See @ref setAdaptiveGrid
+    unsigned int thinning;                     ///< See @ref setThinning
+    std::vector<unsigned int> levelShifts;     ///< See @ref setLevels
     CircularBuffer splatBuffer;                ///< Buffer holding incoming splats
 
     boost::mutex popMutex;                     ///< Mutex held while checking for device to target
@@ -433,6 +574,7 @@ private:
     Statistics::Variable &writeStat;           ///< See @ref getWriteStat
     Statistics::Variable &splatsStat;          ///< Number of splats per bin
     Statistics::Variable &sizeStat;            ///< Size of bins
+    Statistics::Variable &coarseningStat;      ///< Coarsening chosen for bins
 
     friend class CopyGroupBase::Worker;
 };
@@ -456,11 +598,12 @@ private:
     private:
         OutGroup &outGroup;
         ChunkId chunkId;
+        unsigned int level;
         Timeplot::Worker &tworker;
     public:
         typedef void result_type;
-        Functor(OutGroup &outGroup, const ChunkId &chunkId, Timeplot::Worker &tworker)
-            : outGroup(outGroup), chunkId(chunkId), tworker(tworker)
+        Functor(OutGroup &outGroup, const ChunkId &chunkId, unsigned int level, Timeplot::Worker &tworker)
+            : outGroup(outGroup), chunkId(chunkId), level(level), tworker(tworker)
         {
         }
 
@@ -479,9 +622,9 @@ public:
     {
     }
 
-    result_type operator()(const ChunkId &chunkId, Timeplot::Worker &tworker) const
+    result_type operator()(const ChunkId &chunkId, unsigned int level, Timeplot::Worker &tworker) const
     {
-        return Functor(outGroup, chunkId, tworker);
+        return Functor(outGroup, chunkId, level, tworker);
     }
 };
 
@@ -492,15 +635,17 @@ void OutputGeneratorBuilder<OutGroup>::Functor::operator()(
             const std::vector<cl::Event> *events,
             cl::Event *event) const
 {
-    std::size_t bytes = mesh.getHostBytes();
+    const bool normals = mesh.normals() != NULL;
+    std::size_t bytes = mesh.getHostBytes(normals);
 
     boost::shared_ptr<typename OutGroup::WorkItem> item = outGroup.get(tworker, bytes);
-    item->work.mesh = HostKeyMesh(item->alloc.get(), mesh);
+    item->work.mesh = HostKeyMesh(item->alloc.get(), mesh, normals);
     std::vector<cl::Event> wait(3);
     enqueueReadMesh(queue, mesh, item->work.mesh, events, &wait[0], &wait[1], &wait[2]);
     CLH::enqueueMarkerWithWaitList(queue, &wait, event);
 
     item->work.chunkId = chunkId;
+    item->work.level = level;
     item->work.hasEvents = true;
     item->work.verticesEvent = wait[0];
     item->work.vertexKeysEvent = wait[1];
@@ -33,6 +33,7 @@
 #include <boost/scoped_ptr.hpp>
 #include <fstream>
 #include <sstream>
+#include <cstring>
 #include <cctype>
 #include <locale>
 #include <iomanip>
@@ -168,6 +169,24 @@ BINARY_READER_CLASS(TestStreamReader, STREAM_READER);
 BINARY_WRITER_CLASS(TestSyscallWriter, SYSCALL_WRITER);
 BINARY_WRITER_CLASS(TestStreamWriter, STREAM_WRITER);
 
+/**
+ * Tests for the writer returned for @ref MMAP_WRITER, including
+ * @ref BinaryWriter::map.
+ */
+class TestMmapWriter : public TestBinaryWriter
+{
+    CPPUNIT_TEST_SUB_SUITE(TestMmapWriter, TestBinaryWriter);
+    CPPUNIT_TEST(testMap);
+    CPPUNIT_TEST(testMapMany);
+    CPPUNIT_TEST_SUITE_END();
+protected:
+    virtual BinaryIO *factory() { return createWriter(MMAP_WRITER); }
+private:
+    void testMap();              ///< Write through a mapping at an unaligned offset
+    void testMapMany();          ///< Write through several live mappings, across the window size
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMmapWriter, TestSet::perBuild());
+
 void TestBinaryIO::setUp()
 {
     boost::filesystem::ofstream f;
@@ -368,3 +387,57 @@ void TestBinaryWriter::testResize()
 
     MLSGPU_ASSERT_EQUAL(seekPos, file_size(testPath));
 }
+
+void TestMmapWriter::testMap()
+{
+    const std::string msg = "goodbye world";
+    const std::size_t offset = 10000; // deliberately not a multiple of the page size
+    const std::string expected = std::string(offset, '\0') + msg + std::string(20, '\0');
+
+    boost::scoped_ptr<BinaryWriter> b(factoryWriter());
+    b->open(testPath);
+    b->resize(expected.size());
+    {
+        boost::scoped_ptr<BinaryWriter::Mapping> mapping(b->map(offset, msg.size()));
+        CPPUNIT_ASSERT(mapping);
+        std::memcpy(mapping->get(), msg.data(), msg.size());
+    }
+    b->close();
+
+    ASSERT_CONTENT(expected, testPath);
+}
+
+void TestMmapWriter::testMapMany()
+{
+    // Larger than the window that the writer maps at once
+    const std::size_t size = 64 * 1024 * 1024 + 8192;
+    const std::size_t offsets[4] = { 100, 5000, size - 4100, 200 };
+    const std::string msgs[4] = { "first", "second", "last", "third" };
+
+    boost::scoped_ptr<BinaryWriter> b(factoryWriter());
+    b->open(testPath);
+    b->resize(size);
+    boost::scoped_ptr<BinaryWriter::Mapping> mappings[4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        mappings[i].reset(b->map(offsets[i], msgs[i].size()));
+        CPPUNIT_ASSERT(mappings[i]);
+    }
+    b->close();
+    // The mappings remain valid after the file is closed
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        std::memcpy(mappings[i]->get(), msgs[i].data(), msgs[i].size());
+        mappings[i].reset();
+    }
+
+    MLSGPU_ASSERT_EQUAL(size, file_size(testPath));
+    boost::filesystem::ifstream in(testPath, std::ios::binary);
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        std::string actual(msgs[i].size(), '\0');
+        in.seekg(offsets[i]);
+        in.read(&actual[0], actual.size());
+        CPPUNIT_ASSERT_EQUAL(msgs[i], actual);
+    }
+}
@@ -267,6 +267,7 @@ class TestBucket : public CppUnit::TestFixture
     CPPUNIT_TEST(testFlat);
     CPPUNIT_TEST(testEmpty);
     CPPUNIT_TEST(testChunkCells);
+    CPPUNIT_TEST(testMicroAlign);
     CPPUNIT_TEST_SUITE_ADD_CUSTOM_TESTS(addRandom);
     CPPUNIT_TEST_SUITE_END();
 
@@ -274,6 +275,8 @@ private:
     struct Block
     {
         Grid grid;
+        Grid chunkGrid;
+        boost::array<Grid::size_type, 3> chunk;
         SplatSet::splat_id numSplats;
         std::size_t numRanges;
         std::vector<SplatSet::splat_id> splatIds;
@@ -306,6 +309,7 @@ public:
     void testFlat();              ///< Top level already meets the requirements
     void testEmpty();             ///< Edge case with zero splats inside the grid
     void testChunkCells();        ///< Test non-zero @a chunkCells
+    void testMicroAlign();        ///< Test @a microAlign greater than 1
     void testRandom(unsigned long seed); ///< Randomly-generated test case
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBucket, TestSet::perBuild());
@@ -327,7 +331,7 @@ void TestBucket::bucketFunc(
     std::vector<Block> &blocks,
     const typename SplatSet::Traits<T>::subset_type &splats,
     const Grid &grid,
-    const Recursion &)
+    const Recursion &recursionState)
 {
     (void) splats;
     blocks.push_back(Block());
@@ -335,6 +339,8 @@ void TestBucket::bucketFunc(
     block.numSplats = splats.numSplats();
     block.numRanges = splats.numRanges();
     block.grid = grid;
+    block.chunkGrid = recursionState.chunkGrid;
+    block.chunk = recursionState.chunk;
     boost::scoped_ptr<SplatSet::SplatStream> splatStream(splats.makeSplatStream());
     Splat splat;
     SplatSet::splat_id id;
@@ -379,11 +385,18 @@ void TestBucket::validate(
             std::pair<int, int> extent = block.grid.getExtent(i);
             CPPUNIT_ASSERT(fullExtent.first <= extent.first);
             CPPUNIT_ASSERT(fullExtent.second >= extent.second);
+            // The block must lie inside its chunk
+            std::pair<int, int> chunkExtent = block.chunkGrid.getExtent(i);
+            CPPUNIT_ASSERT(chunkExtent.first <= extent.first);
+            CPPUNIT_ASSERT(chunkExtent.second >= extent.second);
             // Check that chunking is respected
             if (chunkCells != 0)
             {
                 CPPUNIT_ASSERT(divDown(extent.first - fullExtent.first, chunkCells)
                                == divDown(extent.second - fullExtent.first - 1, chunkCells));
+                // The chunk grid is not clipped to the full grid
+                CPPUNIT_ASSERT_EQUAL(int(fullExtent.first + block.chunk[i] * chunkCells), chunkExtent.first);
+                CPPUNIT_ASSERT_EQUAL(int(chunkCells), chunkExtent.second - chunkExtent.first);
             }
         }
 
@@ -565,6 +578,45 @@ void TestBucket::testChunkCells()
     validate(splats, grid, blocks, maxSplats, INT_MAX, chunkCellsRounded);
 }
 
+void TestBucket::testMicroAlign()
+{
+    setupSimple();
+
+    // The X range is not a multiple of the alignment, so the last blocks are clipped
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 19, 0, 20, -4, 4);
+    std::vector<Block> blocks;
+    const int maxSplats = 8;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    const int microAlign = 4;
+    bucket(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3),
+           Recursion(), microAlign);
+    validate(splats, grid, blocks, maxSplats, maxCells, 0);
+
+    BOOST_FOREACH(const Block &block, blocks)
+    {
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const std::pair<int, int> fullExtent = grid.getExtent(i);
+            const std::pair<int, int> extent = block.grid.getExtent(i);
+            CPPUNIT_ASSERT_EQUAL(0, (extent.first - fullExtent.first) % microAlign);
+            if (extent.second != fullExtent.second)
+                CPPUNIT_ASSERT_EQUAL(0, (extent.second - fullExtent.first) % microAlign);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(4, int(blocks.size()));
+
+    // With maxSplats = 5 the dense region would need to be split below the alignment
+    blocks.clear();
+    CPPUNIT_ASSERT_THROW(
+        bucket(splats, grid, 5, maxCells, 0, maxCells, maxSplit,
+               boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3),
+               Recursion(), microAlign),
+        DensityError);
+}
+
 static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
 {
     using std::tr1::mt19937;
@@ -0,0 +1,271 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref compact_writer.cpp.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
+#include <boost/ref.hpp>
+#include "../src/tr1_cstdint.h"
+#include "../src/tr1_unordered_map.h"
+#include "../src/compact_writer.h"
+#include "../src/grid.h"
+#include "memory_writer.h"
+#include "testutil.h"
+
+namespace
+{
+
+class MemoryWriterFactory
+{
+private:
+    std::tr1::unordered_map<std::string, std::string> &outputs;
+public:
+    typedef boost::shared_ptr<BinaryWriter> result_type;
+
+    explicit MemoryWriterFactory(std::tr1::unordered_map<std::string, std::string> &outputs)
+        : outputs(outputs) {}
+
+    result_type operator()()
+    {
+        return boost::make_shared<MemoryWriter>(boost::ref(outputs));
+    }
+};
+
+} // anonymous namespace
+
+/**
+ * Tests for @ref CompactWriter.
+ */
+class TestCompactWriter : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCompactWriter);
+    CPPUNIT_TEST(testEncodeIndices);
+    CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testSharedLattice);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    void testEncodeIndices();   ///< Test the delta and varint coding of indices
+    void testSimple();          ///< Test normal operation
+    void testSharedLattice();   ///< Test that adjacent grids quantize to the same lattice
+
+private:
+    /// Decode @a count indices from @a data, returning the number of bytes consumed
+    static std::size_t decodeIndices(
+        const std::string &data, std::size_t pos,
+        std::size_t count, std::vector<std::tr1::uint32_t> &out);
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCompactWriter, TestSet::perBuild());
+
+std::size_t TestCompactWriter::decodeIndices(
+    const std::string &data, std::size_t pos,
+    std::size_t count, std::vector<std::tr1::uint32_t> &out)
+{
+    const std::size_t start = pos;
+    std::tr1::int64_t prev = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::tr1::uint64_t code = 0;
+        int shift = 0;
+        std::tr1::uint8_t byte;
+        do
+        {
+            CPPUNIT_ASSERT(pos < data.size());
+            byte = data[pos++];
+            code |= std::tr1::uint64_t(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        std::tr1::int64_t delta = (code & 1) ? ~std::tr1::int64_t(code >> 1) : std::tr1::int64_t(code >> 1);
+        prev += delta;
+        out.push_back(std::tr1::uint32_t(prev));
+    }
+    return pos - start;
+}
+
+void TestCompactWriter::testEncodeIndices()
+{
+    const std::tr1::uint32_t indices[6] = { 0, 1, 0, 64, 4294967295U, 0 };
+    const std::tr1::uint8_t expected[] =
+    {
+        0x00,                              // 0
+        0x02,                              // +1
+        0x01,                              // -1
+        0x80, 0x01,                        // +64
+        0xfe, 0xfe, 0xff, 0xff, 0x1f,      // +4294967231
+        0xfd, 0xff, 0xff, 0xff, 0x1f       // -4294967295
+    };
+    std::tr1::uint8_t out[6 * 5];
+    std::tr1::uint32_t prev = 0;
+    std::size_t bytes = CompactWriter::encodeIndices(6, indices, prev, out);
+    MLSGPU_ASSERT_EQUAL(sizeof(expected), bytes);
+    CPPUNIT_ASSERT(0 == std::memcmp(expected, out, sizeof(expected)));
+    MLSGPU_ASSERT_EQUAL(0U, prev);
+
+    // Continuing from a previous index
+    prev = 10;
+    bytes = CompactWriter::encodeIndices(1, indices + 1, prev, out);
+    MLSGPU_ASSERT_EQUAL(1, bytes);
+    MLSGPU_ASSERT_EQUAL(0x11, out[0]);
+    MLSGPU_ASSERT_EQUAL(1U, prev);
+}
+
+void TestCompactWriter::testSimple()
+{
+    const float lower[3] = { 1.0f, -2.0f, 0.0f };
+    const Grid grid(lower, 1.0f, 0, 65535, 0, 2 * 65535, 0, 4 * 65535);
+    const float vertices[4 * 3] =
+    {
+        1.0f, -2.0f, 0.0f,
+        2.0f, 3.0f, 5.0f,
+        -10.0f, 1e9f, 0.0f,
+        101.4f, -1.2f, 0.0f
+    };
+    const std::tr1::uint16_t expectedVertices[4 * 3] =
+    {
+        0, 0, 0,
+        1, 3, 1,
+        0, 65535, 0,
+        100, 0, 0
+    };
+    const std::tr1::uint32_t triangles[3 * 3] =
+    {
+        0, 1, 2,
+        2, 1, 3,
+        3, 0, 1
+    };
+
+    std::tr1::unordered_map<std::string, std::string> outputs;
+    CompactWriter w((MemoryWriterFactory(outputs)));
+    w.setNumVertices(4);
+    w.setNumTriangles(3);
+    w.setGrid(grid);
+    w.open("file");
+    // Write out of order, and the triangles in pieces
+    w.writeVertices(2, 2, vertices + 2 * 3);
+    w.writeTriangles(1, triangles);
+    w.writeVertices(0, 2, vertices);
+    w.writeTriangles(2, triangles + 3);
+    w.close();
+    CPPUNIT_ASSERT(!w.isOpen());
+
+    const std::string &out = outputs["file"];
+    CPPUNIT_ASSERT(out.size() >= CompactWriter::headerSize);
+    CPPUNIT_ASSERT_EQUAL(std::string("MLSQ"), out.substr(0, 4));
+    std::tr1::uint32_t version;
+    std::tr1::uint64_t counts[3];
+    float origin[3], step[3];
+    const char *ptr = out.data() + 4;
+    std::memcpy(&version, ptr, sizeof(version)); ptr += sizeof(version);
+    std::memcpy(counts, ptr, sizeof(counts)); ptr += sizeof(counts);
+    std::memcpy(origin, ptr, sizeof(origin)); ptr += sizeof(origin);
+    std::memcpy(step, ptr, sizeof(step)); ptr += sizeof(step);
+    MLSGPU_ASSERT_EQUAL(1U, version);
+    MLSGPU_ASSERT_EQUAL(4U, counts[0]);
+    MLSGPU_ASSERT_EQUAL(3U, counts[1]);
+    for (unsigned int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT_EQUAL(lower[i], origin[i]);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, step[0], 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, step[1], 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(4.0, step[2], 1e-6);
+
+    const std::size_t triangleStart = CompactWriter::headerSize + 4 * CompactWriter::vertexSize;
+    MLSGPU_ASSERT_EQUAL(triangleStart + counts[2], out.size());
+    std::tr1::uint16_t outVertices[4 * 3];
+    std::memcpy(outVertices, out.data() + CompactWriter::headerSize, sizeof(outVertices));
+    for (unsigned int i = 0; i < 4 * 3; i++)
+        MLSGPU_ASSERT_EQUAL(expectedVertices[i], outVertices[i]);
+
+    std::vector<std::tr1::uint32_t> outIndices;
+    std::size_t bytes = decodeIndices(out, triangleStart, 9, outIndices);
+    MLSGPU_ASSERT_EQUAL(counts[2], bytes);
+    for (unsigned int i = 0; i < 9; i++)
+        MLSGPU_ASSERT_EQUAL(triangles[i], outIndices[i]);
+}
+
+void TestCompactWriter::testSharedLattice()
+{
+    const float ref[3] = { 0.25f, 1000.0f, -3.0f };
+    const Grid grids[2] =
+    {
+        Grid(ref, 0.01f, 0, 100, 0, 100, 0, 100),
+        Grid(ref, 0.01f, 100, 200, 0, 100, 0, 100)
+    };
+    // On the shared face, and one step either side of it
+    float vertex[3];
+    grids[1].getVertex(0, 50, 50, vertex);
+    const float step = 0.01f * 100 / 65535;
+    const float vertices[3 * 3] =
+    {
+        vertex[0], vertex[1], vertex[2],
+        vertex[0] - step, vertex[1], vertex[2],
+        vertex[0] + step, vertex[1], vertex[2]
+    };
+
+    std::tr1::unordered_map<std::string, std::string> outputs;
+    CompactWriter w((MemoryWriterFactory(outputs)));
+    float origin[2][3], steps[2][3];
+    std::tr1::uint16_t q[2][3 * 3];
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        const std::string name = i == 0 ? "a" : "b";
+        w.setNumVertices(3);
+        w.setNumTriangles(0);
+        w.setGrid(grids[i]);
+        w.open(name);
+        w.writeVertices(0, 3, vertices);
+        w.close();
+
+        const std::string &out = outputs[name];
+        const std::size_t pos = 4 + sizeof(std::tr1::uint32_t) + 3 * sizeof(std::tr1::uint64_t);
+        std::memcpy(origin[i], out.data() + pos, sizeof(origin[i]));
+        std::memcpy(steps[i], out.data() + pos + sizeof(origin[i]), sizeof(steps[i]));
+        std::memcpy(q[i], out.data() + CompactWriter::headerSize, sizeof(q[i]));
+    }
+
+    for (unsigned int j = 0; j < 3; j++)
+        CPPUNIT_ASSERT_EQUAL(steps[0][j], steps[1][j]);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(step, steps[0][0], 1e-9);
+    // The origin of the second grid lies on the lattice of the first
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(origin[1][0], origin[0][0] + 65535 * steps[0][0], 1e-5);
+
+    MLSGPU_ASSERT_EQUAL(65535, q[0][0]);
+    MLSGPU_ASSERT_EQUAL(0, q[1][0]);
+    MLSGPU_ASSERT_EQUAL(65534, q[0][3]);
+    MLSGPU_ASSERT_EQUAL(0, q[1][3]);  // clamped
+    MLSGPU_ASSERT_EQUAL(65535, q[0][6]); // clamped
+    MLSGPU_ASSERT_EQUAL(1, q[1][6]);
+    // The other coordinates are identical in both files
+    for (unsigned int j = 1; j < 3; j++)
+        MLSGPU_ASSERT_EQUAL(q[0][j], q[1][j]);
+}
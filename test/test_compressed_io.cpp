@@ -0,0 +1,200 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Tests for @ref compressed_io.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/tr1/random.hpp>
+#include "testutil.h"
+#include "../src/compressed_io.h"
+#include "../src/binary_io.h"
+#include "../src/misc.h"
+#include "../src/tr1_cstdint.h"
+
+class TestCompressedIO : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCompressedIO);
+    CPPUNIT_TEST(testCompressible);
+    CPPUNIT_TEST(testIncompressible);
+    CPPUNIT_TEST(testDelta3);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testRestart);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    virtual void setUp();    ///< Obtain filename for temporary file
+    virtual void tearDown(); ///< Remove the temporary file
+
+private:
+    boost::filesystem::path filename;
+
+    /**
+     * Write @a data to the file in pieces of varying size, then check that
+     * random ranges read back correctly.
+     */
+    void roundTrip(const std::vector<std::tr1::uint32_t> &data, BlockFilter filter, std::size_t blockSize);
+
+    void testCompressible();    ///< Data that compresses well
+    void testIncompressible();  ///< Random data, which is stored
+    void testDelta3();          ///< Triangle-like data with @ref BLOCK_FILTER_DELTA3
+    void testEmpty();           ///< File with no data
+    void testRestart();         ///< Reuse of a compressor for a second file
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCompressedIO, TestSet::perBuild());
+
+void TestCompressedIO::setUp()
+{
+    boost::filesystem::ofstream dummy;
+    createTmpFile(filename, dummy);
+}
+
+void TestCompressedIO::tearDown()
+{
+    boost::filesystem::remove(filename);
+}
+
+void TestCompressedIO::roundTrip(
+    const std::vector<std::tr1::uint32_t> &data, BlockFilter filter, std::size_t blockSize)
+{
+    typedef std::tr1::mt19937 engine_type;
+    engine_type engine;
+    const std::size_t bytes = data.size() * sizeof(std::tr1::uint32_t);
+    const char *raw = reinterpret_cast<const char *>(data.empty() ? NULL : &data[0]);
+
+    BlockCompressor compressor(filter, blockSize);
+    {
+        boost::filesystem::ofstream out(filename, std::ios::out | std::ios::binary);
+        compressor.start(out);
+        std::size_t pos = 0;
+        while (pos < bytes)
+        {
+            std::size_t n = std::min(bytes - pos, std::size_t(engine() % (3 * blockSize)));
+            compressor.write(raw + pos, n);
+            pos += n;
+        }
+        compressor.finish();
+        out.close();
+        CPPUNIT_ASSERT(out);
+    }
+
+    const BlockIndex &index = compressor.getIndex();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(bytes), index.size);
+    CPPUNIT_ASSERT_EQUAL((bytes + blockSize - 1) / blockSize, index.numBlocks());
+    CPPUNIT_ASSERT_EQUAL(index.offsets.back(), std::tr1::uint64_t(boost::filesystem::file_size(filename)));
+
+    BlockDecompressor reader(index);
+    reader.open(filename);
+    CPPUNIT_ASSERT_EQUAL(BinaryReader::offset_type(bytes), reader.size());
+
+    std::vector<char> buffer(bytes + 1);
+    // Read the whole thing at once
+    CPPUNIT_ASSERT_EQUAL(bytes, reader.read(&buffer[0], bytes + 1, 0));
+    CPPUNIT_ASSERT(std::equal(raw, raw + bytes, buffer.begin()));
+    // Read random ranges, including some that extend past the end
+    for (int i = 0; i < 100 && bytes > 0; i++)
+    {
+        std::size_t first = engine() % bytes;
+        std::size_t count = engine() % (2 * blockSize) + 1;
+        std::size_t expected = std::min(count, bytes - first);
+        buffer.resize(count);
+        CPPUNIT_ASSERT_EQUAL(expected, reader.read(&buffer[0], count, first));
+        CPPUNIT_ASSERT(std::equal(raw + first, raw + first + expected, buffer.begin()));
+    }
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reader.read(&buffer[0], 1, bytes));
+    reader.close();
+}
+
+void TestCompressedIO::testCompressible()
+{
+    std::vector<std::tr1::uint32_t> data(10000);
+    for (std::size_t i = 0; i < data.size(); i++)
+        data[i] = i / 100;
+    roundTrip(data, BLOCK_FILTER_NONE, 1024);
+}
+
+void TestCompressedIO::testIncompressible()
+{
+    std::tr1::mt19937 engine(1);
+    std::vector<std::tr1::uint32_t> data(10000);
+    for (std::size_t i = 0; i < data.size(); i++)
+        data[i] = engine();
+    roundTrip(data, BLOCK_FILTER_NONE, 1024);
+}
+
+void TestCompressedIO::testDelta3()
+{
+    std::vector<std::tr1::uint32_t> data;
+    for (std::tr1::uint32_t i = 0; i < 5000; i++)
+    {
+        data.push_back(i);
+        data.push_back(i + 1);
+        data.push_back(~(i / 2)); // as for an external vertex
+    }
+    // Block size is deliberately not a multiple of a triangle
+    roundTrip(data, BLOCK_FILTER_DELTA3, 1000);
+}
+
+void TestCompressedIO::testEmpty()
+{
+    roundTrip(std::vector<std::tr1::uint32_t>(), BLOCK_FILTER_NONE, 1024);
+}
+
+void TestCompressedIO::testRestart()
+{
+    BlockCompressor compressor(BLOCK_FILTER_NONE, 64);
+    boost::filesystem::ofstream out(filename, std::ios::out | std::ios::binary);
+    compressor.start(out);
+    compressor.write("hello world", 11);
+    compressor.finish();
+    out.close();
+
+    out.open(filename, std::ios::out | std::ios::binary);
+    compressor.start(out);
+    compressor.write("abc", 3);
+    compressor.finish();
+    out.close();
+
+    const BlockIndex &index = compressor.getIndex();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(3), index.size);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), index.numBlocks());
+
+    BlockDecompressor reader(index);
+    reader.open(filename);
+    char buffer[3];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), reader.read(buffer, 3, 0));
+    CPPUNIT_ASSERT(std::equal(buffer, buffer + 3, "abc"));
+}
@@ -0,0 +1,224 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref decimate.cpp.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <boost/array.hpp>
+#include "../src/tr1_cstdint.h"
+#include "../src/decimate.h"
+#include "../src/mesh.h"
+#include "testutil.h"
+
+/**
+ * Tests for @ref Decimator.
+ */
+class TestDecimate : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestDecimate);
+    CPPUNIT_TEST(testFlat);
+    CPPUNIT_TEST(testRidge);
+    CPPUNIT_TEST(testZero);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef boost::array<cl_float, 3> vertex_type;
+    typedef boost::array<cl_uint, 3> triangle_type;
+
+    std::vector<vertex_type> vertices;
+    std::vector<vertex_type> normals;
+    std::vector<triangle_type> triangles;
+    std::vector<cl_ulong> vertexKeys;
+    HostKeyMesh mesh;
+
+    /**
+     * Build a @a size by @a size grid in the XY plane, with height given by
+     * @a ridge times the distance from the line x = @a size / 2. The
+     * vertices on the border are external, and each normal is the vertex
+     * position plus a fixed offset so that it can be checked.
+     */
+    void makeGrid(unsigned int size, float ridge);
+
+    /**
+     * Check the common postconditions: the external vertices and their
+     * keys are unchanged, normals have moved with their vertices, every
+     * vertex is used, and the triangles still cover the grid without
+     * folding over.
+     */
+    void validate(unsigned int size, const std::vector<vertex_type> &oldExternal);
+
+public:
+    void testFlat();          ///< Test that a flat grid is simplified down to its boundary
+    void testRidge();         ///< Test that a sharp feature is preserved
+    void testZero();          ///< Test that a zero error bound does nothing
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestDecimate, TestSet::perBuild());
+
+void TestDecimate::makeGrid(unsigned int size, float ridge)
+{
+    std::vector<vertex_type> internal, external;
+    std::vector<std::tr1::int32_t> index((size + 1) * (size + 1));
+    vertexKeys.clear();
+    for (unsigned int y = 0; y <= size; y++)
+        for (unsigned int x = 0; x <= size; x++)
+        {
+            vertex_type v = {{ float(x), float(y), ridge * std::abs(float(x) - size * 0.5f) }};
+            if (x == 0 || y == 0 || x == size || y == size)
+            {
+                index[y * (size + 1) + x] = -1 - std::tr1::int32_t(external.size());
+                external.push_back(v);
+                vertexKeys.push_back(y * (size + 1) + x);
+            }
+            else
+            {
+                index[y * (size + 1) + x] = internal.size();
+                internal.push_back(v);
+            }
+        }
+    vertices = internal;
+    vertices.insert(vertices.end(), external.begin(), external.end());
+    normals.clear();
+    for (std::size_t i = 0; i < vertices.size(); i++)
+    {
+        vertex_type n = vertices[i];
+        n[2] += 100.0f;
+        normals.push_back(n);
+    }
+    for (std::size_t i = 0; i < index.size(); i++)
+        if (index[i] < 0)
+            index[i] = internal.size() + (-1 - index[i]);
+
+    triangles.clear();
+    for (unsigned int y = 0; y < size; y++)
+        for (unsigned int x = 0; x < size; x++)
+        {
+            const cl_uint a = index[y * (size + 1) + x];
+            const cl_uint b = index[y * (size + 1) + x + 1];
+            const cl_uint c = index[(y + 1) * (size + 1) + x];
+            const cl_uint d = index[(y + 1) * (size + 1) + x + 1];
+            triangle_type t1 = {{ a, b, d }};
+            triangle_type t2 = {{ a, d, c }};
+            triangles.push_back(t1);
+            triangles.push_back(t2);
+        }
+
+    mesh.assign(vertices.size(), triangles.size(), internal.size());
+    mesh.vertices = &vertices[0];
+    mesh.triangles = &triangles[0];
+    mesh.vertexKeys = &vertexKeys[0];
+    mesh.normals = &normals[0];
+}
+
+void TestDecimate::validate(unsigned int size, const std::vector<vertex_type> &oldExternal)
+{
+    const std::size_t numInternal = mesh.numInternalVertices();
+    MLSGPU_ASSERT_EQUAL(oldExternal.size(), mesh.numExternalVertices());
+    for (std::size_t i = 0; i < oldExternal.size(); i++)
+        CPPUNIT_ASSERT(oldExternal[i] == vertices[numInternal + i]);
+    for (std::size_t i = 0; i < mesh.numVertices(); i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(vertices[i][0], normals[i][0]);
+        CPPUNIT_ASSERT_EQUAL(vertices[i][2] + 100.0f, normals[i][2]);
+    }
+
+    std::vector<bool> used(mesh.numVertices(), false);
+    double area = 0.0;
+    for (std::size_t i = 0; i < mesh.numTriangles(); i++)
+    {
+        const triangle_type &t = triangles[i];
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            CPPUNIT_ASSERT(t[k] < mesh.numVertices());
+            used[t[k]] = true;
+        }
+        const vertex_type &a = vertices[t[0]], &b = vertices[t[1]], &c = vertices[t[2]];
+        const double z = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+        CPPUNIT_ASSERT(z > 0.0);
+        area += 0.5 * z;
+    }
+    for (std::size_t i = 0; i < used.size(); i++)
+        CPPUNIT_ASSERT(used[i]);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(double(size) * size, area, 1e-6);
+}
+
+void TestDecimate::testFlat()
+{
+    const unsigned int size = 30;
+    makeGrid(size, 0.0f);
+    const std::vector<vertex_type> external(vertices.begin() + mesh.numInternalVertices(), vertices.end());
+
+    Decimator decimator;
+    decimator(mesh, 0.001);
+    validate(size, external);
+    /* The border vertices cannot be removed, but almost all the others
+     * should go, leaving about one triangle per border vertex.
+     */
+    CPPUNIT_ASSERT(mesh.numTriangles() < 5 * size);
+    CPPUNIT_ASSERT(mesh.numInternalVertices() < size);
+}
+
+void TestDecimate::testRidge()
+{
+    const unsigned int size = 30;
+    makeGrid(size, 1.0f);
+    const std::vector<vertex_type> external(vertices.begin() + mesh.numInternalVertices(), vertices.end());
+
+    Decimator decimator;
+    decimator(mesh, 0.001);
+    validate(size, external);
+    CPPUNIT_ASSERT(mesh.numTriangles() < 2 * size * size / 4);
+
+    // No triangle may straddle the ridge
+    for (std::size_t i = 0; i < mesh.numTriangles(); i++)
+    {
+        bool left = false, right = false;
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            const float x = vertices[triangles[i][k]][0];
+            left = left || x < size * 0.5f;
+            right = right || x > size * 0.5f;
+        }
+        CPPUNIT_ASSERT(!(left && right));
+    }
+}
+
+void TestDecimate::testZero()
+{
+    makeGrid(10, 0.0f);
+    const MeshSizes oldSizes = mesh;
+    const std::vector<triangle_type> oldTriangles = triangles;
+
+    Decimator decimator;
+    decimator(mesh, 0.0);
+    CPPUNIT_ASSERT(oldSizes == mesh);
+    CPPUNIT_ASSERT(oldTriangles == triangles);
+}
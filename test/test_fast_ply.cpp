@@ -560,6 +560,8 @@ class TestFastPlyWriter : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestFastPlyWriter);
     TEST_EXCEPTION_FILENAME(testBadFilename, std::ios_base::failure, "/not_a_valid_filename/");
     CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testUnsized);
+    CPPUNIT_TEST(testNormals);
 #if DEBUG
     CPPUNIT_TEST(testState);
     CPPUNIT_TEST(testOverrun);
@@ -568,6 +570,8 @@ class TestFastPlyWriter : public CppUnit::TestFixture
 public:
     void testBadFilename();   ///< Try to write to an invalid filename, check for error
     void testSimple();        ///< Test normal operation
+    void testUnsized();       ///< Test writing vertices before the counts are known
+    void testNormals();       ///< Test writing vertices with normals
     void testState();         ///< Test assertions that the file is/is not open
     void testOverrun();       ///< Test writing beyond the end of the file
 };
@@ -645,6 +649,86 @@ void TestFastPlyWriter::testSimple()
     CPPUNIT_ASSERT(0 == memcmp(data + headerSize + 75, indices + 6, 12));
 }
 
+void TestFastPlyWriter::testUnsized()
+{
+    const float vertices[3 * 3] =
+    {
+        1.0f, 2.0f, 4.0f,
+        -1.0f, -2.0f, -4.0f,
+        5.5f, 6.25f, 7.75f
+    };
+    const std::tr1::uint32_t indices[3] = { 0, 2, 1 };
+
+    MemoryWriterPly w;
+    w.addComment("my comment");
+    w.openUnsized("file");
+    w.writeVertices(1, 2, vertices + 1 * 3);
+    w.writeVertices(0, 1, vertices);
+    w.setFinalCounts(3, 1);
+    w.writeTriangles(0, 1, indices);
+    w.close();
+
+    std::vector<boost::array<float, 3> > outVertices;
+    std::vector<boost::array<std::tr1::uint32_t, 3> > outTriangles;
+    MemoryWriterPly::parse(w.getOutput("file"), outVertices, outTriangles);
+    MLSGPU_ASSERT_EQUAL(3, outVertices.size());
+    MLSGPU_ASSERT_EQUAL(1, outTriangles.size());
+    CPPUNIT_ASSERT(0 == memcmp(&outVertices[0][0], vertices, sizeof(vertices)));
+    CPPUNIT_ASSERT(0 == memcmp(&outTriangles[0][0], indices, sizeof(indices)));
+
+    const std::string &content = w.getOutput("file");
+    const std::string::size_type headerSize = content.find("end_header\n") + 11;
+    MLSGPU_ASSERT_EQUAL(0, headerSize % 4);
+    MLSGPU_ASSERT_EQUAL(headerSize + 3 * 12 + 13, content.size());
+}
+
+void TestFastPlyWriter::testNormals()
+{
+    const float vertices[2 * 6] =
+    {
+        1.0f, 2.0f, 4.0f, 0.0f, 0.0f, 1.0f,
+        -1.0f, -2.0f, -4.0f, 0.6f, -0.8f, 0.0f
+    };
+    const std::tr1::uint32_t indices[3] = { 0, 1, 0 };
+    const std::string expectedHeader =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 2\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "element face 1\n"
+        "property list uint8 uint32 vertex_indices\n"
+        "comment padding:X\n"
+        "end_header\n";
+    const std::size_t headerSize = expectedHeader.size();
+
+    MemoryWriterPly w;
+    CPPUNIT_ASSERT(!w.hasNormals());
+    MLSGPU_ASSERT_EQUAL(12, w.getVertexSize());
+    w.setNormals(true);
+    CPPUNIT_ASSERT(w.hasNormals());
+    MLSGPU_ASSERT_EQUAL(24, w.getVertexSize());
+    w.setNumVertices(2);
+    w.setNumTriangles(1);
+
+    w.open("file");
+    w.writeVertices(1, 1, vertices + 6);
+    w.writeVertices(0, 1, vertices);
+    w.writeTriangles(0, 1, indices);
+    w.close();
+
+    const std::string &content = w.getOutput("file");
+    MLSGPU_ASSERT_EQUAL(headerSize + 48 + 13, content.size());
+    MLSGPU_ASSERT_EQUAL(expectedHeader, content.substr(0, headerSize));
+    CPPUNIT_ASSERT(0 == memcmp(content.data() + headerSize, vertices, sizeof(vertices)));
+    MLSGPU_ASSERT_EQUAL(3, content[headerSize + 48]);
+    CPPUNIT_ASSERT(0 == memcmp(content.data() + headerSize + 49, indices, 12));
+}
+
 void TestFastPlyWriter::testState()
 {
     MemoryWriterPly w;
@@ -0,0 +1,463 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref incremental.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <sstream>
+#include <cstdarg>
+#include <vector>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "testutil.h"
+#include "../src/incremental.h"
+#include "../src/grid.h"
+#include "../src/chunk_id.h"
+#include "../src/misc.h"
+#include "../src/splat_set.h"
+#include "../src/bucket.h"
+#include "../src/bucket_collector.h"
+#include "../src/statistics.h"
+
+using namespace Incremental;
+
+class TestIncremental : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestIncremental);
+    CPPUNIT_TEST(testAlignGrid);
+    CPPUNIT_TEST(testAlignGridRounding);
+    CPPUNIT_TEST(testAlignGridTooBig);
+    CPPUNIT_TEST(testManifestRoundTrip);
+    CPPUNIT_TEST(testManifestMalformed);
+    CPPUNIT_TEST(testTracker);
+    CPPUNIT_TEST(testTrackerIncompatible);
+    CPPUNIT_TEST(testPrepareOutputs);
+    CPPUNIT_TEST(testFilter);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    virtual void setUp();    ///< Obtain filename for temporary file
+    virtual void tearDown(); ///< Remove the temporary files
+
+private:
+    boost::filesystem::path filename;
+
+    /// Namer that puts the output files next to @ref filename
+    static std::string namer(const std::string &base, const ChunkId &chunkId);
+
+    /// Create a file holding @a content
+    static void writeFile(const std::string &name, const std::string &content);
+
+    /// Read back a file written by @ref writeFile
+    static std::string readFile(const std::string &name);
+
+    /// Make a file record without touching the file system
+    static FileInfo makeFile(const std::string &path, std::tr1::uint64_t size, std::tr1::int64_t mtime);
+
+    /// Make a chunk coordinate triple
+    static ChunkCoords makeCoords(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z);
+
+    /// Make a relative chunk coordinate triple, as passed to @ref Tracker::update
+    static boost::array<Grid::size_type, 3> makeChunk(Grid::size_type x, Grid::size_type y, Grid::size_type z);
+
+    /// Make a sorted list of file indices
+    static std::vector<std::size_t> makeFiles(std::size_t n, ...);
+
+    /// Manifest for a previous run used by several tests
+    static Manifest makePrevious();
+
+    /// Pass a bucket to @a filter that contains splats from files @a first to @a last
+    static void addBucket(Filter &filter, Grid::size_type chunkX, std::size_t first, std::size_t last);
+
+    /// Collector callback that records the chunks of the bins
+    static void collect(std::vector<Grid::size_type> &chunks, const Statistics::Container::vector<BucketCollector::Bin> &bins);
+
+    void testAlignGrid();            ///< Basic test of @ref alignGrid
+    void testAlignGridRounding();    ///< Chunk size rounding that must be repeated
+    void testAlignGridTooBig();      ///< Exception when the fan-out is exceeded
+    void testManifestRoundTrip();    ///< Write and read back a @ref Manifest
+    void testManifestMalformed();    ///< Reading invalid data gives an empty manifest
+    void testTracker();              ///< Decisions made by @ref Tracker::update
+    void testTrackerIncompatible();  ///< Changed options force everything to be recomputed
+    void testPrepareOutputs();       ///< Deletion and renaming by @ref Tracker::prepareOutputs
+    void testFilter();               ///< Test @ref Filter
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestIncremental, TestSet::perBuild());
+
+void TestIncremental::setUp()
+{
+    boost::filesystem::ofstream dummy;
+    createTmpFile(filename, dummy);
+}
+
+void TestIncremental::tearDown()
+{
+    for (int x = 0; x < 4; x++)
+    {
+        ChunkId id;
+        id.coords[0] = x;
+        const std::string name = namer(filename.string(), id);
+        boost::filesystem::remove(name);
+        boost::filesystem::remove(name + ".tmp");
+    }
+    boost::filesystem::remove(filename);
+}
+
+std::string TestIncremental::namer(const std::string &base, const ChunkId &chunkId)
+{
+    std::ostringstream name;
+    name << base << '_' << chunkId.coords[0] << '_' << chunkId.coords[1] << '_' << chunkId.coords[2];
+    return name.str();
+}
+
+void TestIncremental::writeFile(const std::string &name, const std::string &content)
+{
+    boost::filesystem::ofstream out(name);
+    out << content;
+}
+
+std::string TestIncremental::readFile(const std::string &name)
+{
+    boost::filesystem::ifstream in(name);
+    std::string content;
+    in >> content;
+    return content;
+}
+
+FileInfo TestIncremental::makeFile(const std::string &path, std::tr1::uint64_t size, std::tr1::int64_t mtime)
+{
+    FileInfo info;
+    info.path = path;
+    info.size = size;
+    info.mtime = mtime;
+    return info;
+}
+
+ChunkCoords TestIncremental::makeCoords(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z)
+{
+    ChunkCoords ans;
+    ans[0] = x;
+    ans[1] = y;
+    ans[2] = z;
+    return ans;
+}
+
+boost::array<Grid::size_type, 3> TestIncremental::makeChunk(Grid::size_type x, Grid::size_type y, Grid::size_type z)
+{
+    boost::array<Grid::size_type, 3> ans;
+    ans[0] = x;
+    ans[1] = y;
+    ans[2] = z;
+    return ans;
+}
+
+std::vector<std::size_t> TestIncremental::makeFiles(std::size_t n, ...)
+{
+    std::vector<std::size_t> ans;
+    va_list ap;
+    va_start(ap, n);
+    for (std::size_t i = 0; i < n; i++)
+        ans.push_back(va_arg(ap, int));
+    va_end(ap);
+    return ans;
+}
+
+Manifest TestIncremental::makePrevious()
+{
+    Manifest m;
+    m.options = " --fit-grid=0.1";
+    m.chunkCells = 64;
+    m.origin = makeCoords(0, 0, 0);
+    m.files.push_back(makeFile("/data/a.ply", 100, 1000));
+    m.files.push_back(makeFile("/data/b.ply", 200, 2000));
+    m.files.push_back(makeFile("/data/c.ply", 300, 3000));
+    m.chunks[makeCoords(0, 0, 0)].files = makeFiles(1, 0);
+    m.chunks[makeCoords(1, 0, 0)].files = makeFiles(2, 0, 1);
+    m.chunks[makeCoords(2, 0, 0)].files = makeFiles(1, 1);
+    m.chunks[makeCoords(3, 0, 0)].files = makeFiles(1, 2);
+    m.chunks[makeCoords(0, 1, 0)].files = makeFiles(2, 0, 1);
+    return m;
+}
+
+void TestIncremental::testAlignGrid()
+{
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    Grid grid(ref, 0.5f, -5, 100, 7, 8, 0, 300);
+    Grid::size_type cells = alignGrid(grid, 100, 16, 511, 1000000);
+    CPPUNIT_ASSERT_EQUAL(Grid::size_type(112), cells);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(-112), grid.getExtent(0).first);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(112), grid.getExtent(0).second);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(0), grid.getExtent(1).first);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(112), grid.getExtent(1).second);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(0), grid.getExtent(2).first);
+    CPPUNIT_ASSERT_EQUAL(Grid::difference_type(336), grid.getExtent(2).second);
+    CPPUNIT_ASSERT_EQUAL(0.5f, grid.getSpacing());
+}
+
+void TestIncremental::testAlignGridRounding()
+{
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    Grid grid(ref, 1.0f, 0, 10, 0, 10, 0, 10);
+    /* Rounding up to the microblock size gives 512, which is more than the
+     * maximum bucket size, so it is rounded again to a multiple of 448.
+     */
+    Grid::size_type cells = alignGrid(grid, 500, 64, 511, 1000000);
+    CPPUNIT_ASSERT_EQUAL(Grid::size_type(896), cells);
+    for (unsigned int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT_EQUAL(Grid::size_type(896), grid.numCells(i));
+}
+
+void TestIncremental::testAlignGridTooBig()
+{
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    Grid grid(ref, 1.0f, 0, 1000, 0, 1000, 0, 1000);
+    CPPUNIT_ASSERT_THROW(alignGrid(grid, 100, 16, 511, 1000), std::runtime_error);
+}
+
+void TestIncremental::testManifestRoundTrip()
+{
+    Manifest m = makePrevious();
+    m.origin = makeCoords(-3, 4, -5);
+    m.files[1].path = "/data/name with spaces.ply";
+    m.chunks[makeCoords(1, 0, 0)].hasOutput = true;
+
+    std::stringstream s;
+    m.write(s);
+    Manifest r;
+    CPPUNIT_ASSERT(r.read(s));
+    CPPUNIT_ASSERT_EQUAL(m.options, r.options);
+    CPPUNIT_ASSERT_EQUAL(m.chunkCells, r.chunkCells);
+    CPPUNIT_ASSERT(m.origin == r.origin);
+    MLSGPU_ASSERT_EQUAL(m.files.size(), r.files.size());
+    for (std::size_t i = 0; i < m.files.size(); i++)
+        CPPUNIT_ASSERT(m.files[i] == r.files[i]);
+    MLSGPU_ASSERT_EQUAL(m.chunks.size(), r.chunks.size());
+    for (std::map<ChunkCoords, ChunkInfo>::const_iterator i = m.chunks.begin(); i != m.chunks.end(); ++i)
+    {
+        CPPUNIT_ASSERT(r.chunks.count(i->first));
+        const ChunkInfo &info = r.chunks[i->first];
+        CPPUNIT_ASSERT_EQUAL(i->second.hasOutput, info.hasOutput);
+        CPPUNIT_ASSERT(i->second.files == info.files);
+    }
+
+    // Also go via the file
+    m.save(filename);
+    r = Manifest();
+    r.load(filename);
+    CPPUNIT_ASSERT_EQUAL(m.options, r.options);
+    MLSGPU_ASSERT_EQUAL(m.chunks.size(), r.chunks.size());
+}
+
+void TestIncremental::testManifestMalformed()
+{
+    Manifest m = makePrevious();
+    std::ostringstream out;
+    m.write(out);
+    const std::string good = out.str();
+
+    // Truncated
+    std::istringstream truncated(good.substr(0, good.size() - 10));
+    CPPUNIT_ASSERT(!m.read(truncated));
+    CPPUNIT_ASSERT_EQUAL(Grid::size_type(0), m.chunkCells);
+    CPPUNIT_ASSERT(m.files.empty());
+    CPPUNIT_ASSERT(m.chunks.empty());
+
+    // Wrong header
+    std::istringstream header("mlsgpu-incremental 99\n" + good.substr(good.find('\n') + 1));
+    CPPUNIT_ASSERT(!m.read(header));
+
+    // File index out of range
+    std::string bad = good;
+    bad.replace(bad.rfind(" 0\n"), 3, " 7\n");
+    std::istringstream badIndex(bad);
+    CPPUNIT_ASSERT(!m.read(badIndex));
+    CPPUNIT_ASSERT(m.chunks.empty());
+
+    // Missing file is not an error
+    boost::filesystem::remove(filename);
+    m = makePrevious();
+    m.load(filename);
+    CPPUNIT_ASSERT(m.chunks.empty());
+}
+
+void TestIncremental::testTracker()
+{
+    const Manifest previous = makePrevious();
+    Manifest current = previous;
+    current.files.clear();
+    current.files.push_back(makeFile("/data/b.ply", 200, 2000));  // was 1
+    current.files.push_back(makeFile("/data/a.ply", 100, 1000));  // was 0
+    current.files.push_back(makeFile("/data/d.ply", 400, 4000));  // new
+    current.files.push_back(makeFile("/data/c.ply", 300, 3001));  // modified
+    Tracker tracker(previous, current, boost::bind(&TestIncremental::namer, filename.string(), _1));
+    CPPUNIT_ASSERT(tracker.isCompatible());
+
+    // Same file, with a different index
+    CPPUNIT_ASSERT(!tracker.update(makeChunk(0, 0, 0), makeFiles(1, 1)));
+    // Same files in a different order
+    CPPUNIT_ASSERT(!tracker.update(makeChunk(1, 0, 0), makeFiles(2, 0, 1)));
+    // New file added
+    CPPUNIT_ASSERT(tracker.update(makeChunk(2, 0, 0), makeFiles(2, 0, 2)));
+    // File modified
+    CPPUNIT_ASSERT(tracker.update(makeChunk(3, 0, 0), makeFiles(1, 3)));
+    // File removed (b.ply no longer touches the chunk)
+    CPPUNIT_ASSERT(tracker.update(makeChunk(0, 1, 0), makeFiles(1, 1)));
+    // New chunk
+    CPPUNIT_ASSERT(tracker.update(makeChunk(4, 0, 0), makeFiles(1, 1)));
+    // Repeating a query gives the same answer
+    CPPUNIT_ASSERT(!tracker.update(makeChunk(0, 0, 0), makeFiles(1, 1)));
+    CPPUNIT_ASSERT(tracker.update(makeChunk(2, 0, 0), makeFiles(2, 0, 2)));
+
+    MLSGPU_ASSERT_EQUAL(4U, tracker.numDirty());
+    const Manifest &m = tracker.getManifest();
+    MLSGPU_ASSERT_EQUAL(6U, m.chunks.size());
+    CPPUNIT_ASSERT(m.chunks.find(makeCoords(1, 0, 0))->second.files == makeFiles(2, 0, 1));
+    MLSGPU_ASSERT_EQUAL(4U, m.files.size());
+}
+
+void TestIncremental::testTrackerIncompatible()
+{
+    const Manifest previous = makePrevious();
+    Manifest current = previous;
+    current.options = " --fit-grid=0.2";
+    Tracker tracker(previous, current, boost::bind(&TestIncremental::namer, filename.string(), _1));
+    CPPUNIT_ASSERT(!tracker.isCompatible());
+    CPPUNIT_ASSERT(tracker.update(makeChunk(0, 0, 0), makeFiles(1, 0)));
+
+    current = previous;
+    current.chunkCells = 128;
+    Tracker tracker2(previous, current, boost::bind(&TestIncremental::namer, filename.string(), _1));
+    CPPUNIT_ASSERT(!tracker2.isCompatible());
+
+    Tracker tracker3(Manifest(), previous, boost::bind(&TestIncremental::namer, filename.string(), _1));
+    CPPUNIT_ASSERT(!tracker3.isCompatible());
+}
+
+void TestIncremental::testPrepareOutputs()
+{
+    const std::string base = filename.string();
+    Manifest previous;
+    previous.options = " --fit-grid=0.1";
+    previous.chunkCells = 64;
+    previous.origin = makeCoords(0, 0, 0);
+    previous.files.push_back(makeFile("/data/a.ply", 100, 1000));
+    for (int x = 0; x < 3; x++)
+    {
+        ChunkInfo &info = previous.chunks[makeCoords(x, 0, 0)];
+        info.files = makeFiles(1, 0);
+        info.hasOutput = true;
+
+        ChunkId id;
+        id.coords[0] = x;
+        writeFile(namer(base, id), std::string(1, '0' + x));
+    }
+
+    // The bounding box has grown by one chunk in x
+    Manifest current = previous;
+    current.origin = makeCoords(-1, 0, 0);
+    current.files.push_back(makeFile("/data/d.ply", 400, 4000));
+    Tracker tracker(previous, current, boost::bind(&TestIncremental::namer, base, _1));
+    CPPUNIT_ASSERT(!tracker.update(makeChunk(1, 0, 0), makeFiles(1, 0)));
+    CPPUNIT_ASSERT(tracker.update(makeChunk(2, 0, 0), makeFiles(2, 0, 1)));
+    // Chunk 2 is no longer touched by any splats
+
+    MLSGPU_ASSERT_EQUAL(1U, tracker.prepareOutputs());
+
+    ChunkId id;
+    id.coords[0] = 0;
+    CPPUNIT_ASSERT(!boost::filesystem::exists(namer(base, id)));
+    id.coords[0] = 1;
+    CPPUNIT_ASSERT_EQUAL(std::string("0"), readFile(namer(base, id)));
+    CPPUNIT_ASSERT(!boost::filesystem::exists(namer(base, id) + ".tmp"));
+    id.coords[0] = 2;
+    CPPUNIT_ASSERT(!boost::filesystem::exists(namer(base, id)));
+
+    // Simulate writing the recomputed chunk
+    writeFile(namer(base, id), "new");
+    tracker.recordOutputs();
+    const Manifest &m = tracker.getManifest();
+    MLSGPU_ASSERT_EQUAL(2U, m.chunks.size());
+    CPPUNIT_ASSERT(m.chunks.find(makeCoords(0, 0, 0))->second.hasOutput);
+    CPPUNIT_ASSERT(m.chunks.find(makeCoords(1, 0, 0))->second.hasOutput);
+}
+
+void TestIncremental::addBucket(Filter &filter, Grid::size_type chunkX, std::size_t first, std::size_t last)
+{
+    SplatSet::SubsetBase splats;
+    for (std::size_t f = first; f <= last; f++)
+    {
+        const SplatSet::splat_id base = SplatSet::splat_id(f) << SplatSet::FileSet::scanIdShift;
+        splats.addRange(base + 10, base + 20);
+    }
+    splats.flush();
+
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    Grid grid(ref, 1.0f, 0, 64, 0, 64, 0, 64);
+    Bucket::Recursion recursionState;
+    recursionState.chunk[0] = chunkX;
+    filter(splats, grid, recursionState);
+}
+
+void TestIncremental::collect(std::vector<Grid::size_type> &chunks, const Statistics::Container::vector<BucketCollector::Bin> &bins)
+{
+    for (std::size_t i = 0; i < bins.size(); i++)
+        chunks.push_back(bins[i].chunkId.coords[0]);
+}
+
+void TestIncremental::testFilter()
+{
+    Manifest previous = makePrevious();
+    Manifest current = previous;
+    Tracker tracker(previous, current, boost::bind(&TestIncremental::namer, filename.string(), _1));
+
+    std::vector<Grid::size_type> chunks;
+    BucketCollector collector(1000000, boost::bind(&TestIncremental::collect, boost::ref(chunks), _1));
+    Filter filter(tracker, collector);
+    addBucket(filter, 0, 0, 0);   // unchanged
+    addBucket(filter, 0, 0, 0);
+    addBucket(filter, 1, 0, 0);   // b.ply no longer included
+    addBucket(filter, 1, 0, 0);
+    addBucket(filter, 2, 1, 1);   // unchanged
+    addBucket(filter, 3, 1, 2);   // c.ply was there before, but b.ply is new
+    addBucket(filter, 3, 1, 1);
+    filter.flush();
+    collector.flush();
+
+    MLSGPU_ASSERT_EQUAL(4U, chunks.size());
+    MLSGPU_ASSERT_EQUAL(1U, chunks[0]);
+    MLSGPU_ASSERT_EQUAL(1U, chunks[1]);
+    MLSGPU_ASSERT_EQUAL(3U, chunks[2]);
+    MLSGPU_ASSERT_EQUAL(3U, chunks[3]);
+    MLSGPU_ASSERT_EQUAL(2U, tracker.numDirty());
+    CPPUNIT_ASSERT(tracker.getManifest().chunks.find(makeCoords(3, 0, 0))->second.files == makeFiles(2, 1, 2));
+}
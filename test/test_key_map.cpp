@@ -0,0 +1,288 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Tests for @ref KeyMap.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <sstream>
+#include <boost/tr1/random.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "../src/key_map.h"
+#include "../src/statistics.h"
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+
+/// Tests for @ref KeyMap
+class TestKeyMap : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestKeyMap);
+    CPPUNIT_TEST(testInsertFind);
+    CPPUNIT_TEST(testEmptyKey);
+    CPPUNIT_TEST(testErase);
+    CPPUNIT_TEST(testRandom);
+    CPPUNIT_TEST(testClear);
+    CPPUNIT_TEST(testReserve);
+    CPPUNIT_TEST(testStatistics);
+    CPPUNIT_TEST(testCopy);
+    CPPUNIT_TEST(testSerialize);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef KeyMap<std::tr1::int32_t> map_type;
+
+    /// Segment and slot at which a key would be placed in an empty table
+    static std::pair<std::size_t, std::size_t> home(const map_type &m, map_type::key_type key)
+    {
+        const map_type::key_type h = map_type::hash(key);
+        const std::size_t segment = h >> map_type::segmentShift;
+        return std::make_pair(segment, std::size_t(h) & m.segments[segment].mask);
+    }
+
+public:
+    void testInsertFind();     ///< Basic insertion and lookup
+    void testEmptyKey();       ///< Inserting the reserved key must fail
+    void testErase();          ///< Erasure within a single probe sequence
+    void testRandom();         ///< Compare against @c std::map under random operations
+    void testClear();          ///< Test @ref KeyMap::clear
+    void testReserve();        ///< Test @ref KeyMap::reserve
+    void testStatistics();     ///< Memory is accounted to the named statistic
+    void testCopy();           ///< Test @ref KeyMap::copy
+    void testSerialize();      ///< Round trip through a boost archive
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestKeyMap, TestSet::perBuild());
+
+void TestKeyMap::testInsertFind()
+{
+    map_type m("mem.TestKeyMap");
+    CPPUNIT_ASSERT(m.empty());
+    CPPUNIT_ASSERT(m.find(123) == NULL);
+
+    std::pair<std::tr1::int32_t *, bool> added = m.insert(123, 5);
+    CPPUNIT_ASSERT(added.second);
+    CPPUNIT_ASSERT_EQUAL(5, *added.first);
+    added = m.insert(0, 6);
+    CPPUNIT_ASSERT(added.second);
+    added = m.insert(123, 7);
+    CPPUNIT_ASSERT(!added.second);
+    CPPUNIT_ASSERT_EQUAL(5, *added.first);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), m.size());
+
+    // Modification through the returned pointer
+    *m.find(0) = 8;
+    CPPUNIT_ASSERT_EQUAL(8, *m.find(0));
+    CPPUNIT_ASSERT(m.find(1) == NULL);
+    CPPUNIT_ASSERT(m.find(map_type::emptyKey) == NULL);
+}
+
+void TestKeyMap::testEmptyKey()
+{
+    map_type m("mem.TestKeyMap");
+    CPPUNIT_ASSERT_THROW(m.insert(map_type::emptyKey, 1), std::invalid_argument);
+}
+
+void TestKeyMap::testErase()
+{
+    map_type m("mem.TestKeyMap");
+    m.reserve(1);  // allocates every segment, so that home() is meaningful
+    m.insert(1, 1);
+
+    // Find several keys that collide with each other
+    std::vector<map_type::key_type> keys;
+    const std::pair<std::size_t, std::size_t> target = home(m, 1000);
+    for (map_type::key_type k = 1000; keys.size() < 4; k++)
+        if (home(m, k) == target)
+            keys.push_back(k);
+    for (std::size_t i = 0; i < keys.size(); i++)
+        m.insert(keys[i], i);
+    const std::size_t capacity = m.capacity();
+
+    // Removing the head of the chain must leave the rest reachable
+    CPPUNIT_ASSERT(m.erase(keys[0]));
+    CPPUNIT_ASSERT(!m.erase(keys[0]));
+    CPPUNIT_ASSERT(m.find(keys[0]) == NULL);
+    for (std::size_t i = 1; i < keys.size(); i++)
+    {
+        CPPUNIT_ASSERT(m.find(keys[i]) != NULL);
+        CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(i), *m.find(keys[i]));
+    }
+    CPPUNIT_ASSERT_EQUAL(std::size_t(keys.size()), m.size());
+    CPPUNIT_ASSERT_EQUAL(capacity, m.capacity());
+    CPPUNIT_ASSERT_EQUAL(1, *m.find(1));
+}
+
+static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
+{
+    using std::tr1::mt19937;
+    using std::tr1::uniform_int;
+    using std::tr1::variate_generator;
+
+    /* According to TR1, there has to be a conversion from the output type
+     * of the engine to the input type of the distribution, so we can't
+     * just use uniform_int<int> (and MSVC will do the wrong thing in this
+     * case). We thus also have to manually bias to avoid negative numbers.
+     */
+    variate_generator<mt19937 &, uniform_int<mt19937::result_type> > gen(engine, uniform_int<mt19937::result_type>(0, max - min));
+    return int(gen()) + min;
+}
+
+void TestKeyMap::testRandom()
+{
+    std::tr1::mt19937 engine;
+    std::map<map_type::key_type, std::tr1::int32_t> expected;
+    map_type m("mem.TestKeyMap");
+
+    for (int i = 0; i < 20000; i++)
+    {
+        // Small key range so that there are plenty of duplicates and erasures
+        map_type::key_type key = simpleRandomInt(engine, 0, 999);
+        if (simpleRandomInt(engine, 0, 2) == 0)
+        {
+            bool erased = m.erase(key);
+            CPPUNIT_ASSERT_EQUAL(expected.erase(key) > 0, erased);
+        }
+        else
+        {
+            std::pair<std::tr1::int32_t *, bool> added = m.insert(key, i);
+            bool inserted = expected.insert(std::make_pair(key, i)).second;
+            CPPUNIT_ASSERT_EQUAL(inserted, added.second);
+            CPPUNIT_ASSERT_EQUAL(expected[key], *added.first);
+        }
+        CPPUNIT_ASSERT_EQUAL(expected.size(), m.size());
+    }
+
+    for (map_type::key_type key = 0; key < 1000; key++)
+    {
+        std::map<map_type::key_type, std::tr1::int32_t>::const_iterator pos = expected.find(key);
+        if (pos == expected.end())
+            CPPUNIT_ASSERT(m.find(key) == NULL);
+        else
+        {
+            CPPUNIT_ASSERT(m.find(key) != NULL);
+            CPPUNIT_ASSERT_EQUAL(pos->second, *m.find(key));
+        }
+    }
+}
+
+void TestKeyMap::testClear()
+{
+    map_type m("mem.TestKeyMap");
+    for (int i = 0; i < 100; i++)
+        m.insert(i * 12345, i);
+    m.clear();
+    CPPUNIT_ASSERT(m.empty());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), m.capacity());
+    CPPUNIT_ASSERT(m.find(12345) == NULL);
+    CPPUNIT_ASSERT(m.insert(12345, 3).second);
+}
+
+void TestKeyMap::testReserve()
+{
+    map_type m("mem.TestKeyMap");
+    m.reserve(1000);
+    const std::size_t capacity = m.capacity();
+    CPPUNIT_ASSERT(capacity >= 1000);
+    /* The reservation assumes an even spread over the segments, so leave
+     * some slack for the statistical variation.
+     */
+    for (int i = 0; i < 500; i++)
+        m.insert(i, i);
+    CPPUNIT_ASSERT_EQUAL(capacity, m.capacity());
+}
+
+void TestKeyMap::testStatistics()
+{
+    Statistics::Peak &peak = Statistics::getStatistic<Statistics::Peak>("mem.TestKeyMap.stats");
+    const Statistics::Peak::value_type old = peak.get();
+    {
+        map_type m("mem.TestKeyMap.stats");
+        for (int i = 0; i < 100; i++)
+            m.insert(i, i);
+        CPPUNIT_ASSERT(peak.get() >= old + Statistics::Peak::value_type(100 * sizeof(std::tr1::int32_t)));
+    }
+    CPPUNIT_ASSERT_EQUAL(old, peak.get());
+}
+
+void TestKeyMap::testCopy()
+{
+    map_type m("mem.TestKeyMap");
+    std::map<map_type::key_type, std::tr1::int32_t> expected;
+    for (int i = 0; i < 1000; i++)
+    {
+        m.insert(i * 7919, i);
+        expected[i * 7919] = i;
+    }
+    m.erase(7919);
+    expected.erase(7919);
+
+    typedef std::vector<std::pair<map_type::key_type, std::tr1::int32_t> > entries_type;
+    entries_type out;
+    m.copy(std::back_inserter(out));
+    std::sort(out.begin(), out.end());
+    CPPUNIT_ASSERT_EQUAL(expected.size(), out.size());
+    CPPUNIT_ASSERT(out == entries_type(expected.begin(), expected.end()));
+}
+
+void TestKeyMap::testSerialize()
+{
+    map_type m("mem.TestKeyMap");
+    for (int i = 0; i < 1000; i++)
+        m.insert(i * 7919, i);
+    m.erase(7919);
+
+    std::ostringstream os;
+    {
+        boost::archive::binary_oarchive oa(os);
+        oa << m;
+    }
+
+    map_type m2("mem.TestKeyMap");
+    m2.insert(1, 1); // should be discarded by the load
+    std::istringstream is(os.str());
+    {
+        boost::archive::binary_iarchive ia(is);
+        ia >> m2;
+    }
+
+    typedef std::vector<std::pair<map_type::key_type, std::tr1::int32_t> > entries_type;
+    entries_type expected, actual;
+    m.copy(std::back_inserter(expected));
+    m2.copy(std::back_inserter(actual));
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    CPPUNIT_ASSERT_EQUAL(m.size(), m2.size());
+    CPPUNIT_ASSERT(expected == actual);
+}
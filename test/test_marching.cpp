@@ -215,7 +215,7 @@ private:
      * @param kernel            The @ref compactVertices kernel.
      * @param outSize           Entries to allocate for output vertices.
      * @param remapSize         Entries to allocate in the index remap table.
-     * @param outVertices, outKeys, indexRemap, firstExternal, vertexUnique, inVertices, inKeys, minExternalKey See @ref compactVertices.
+     * @param outVertices, outKeys, indexRemap, firstExternal, vertexUnique, inVertices, inKeys, minExternalKey, keyShift See @ref compactVertices.
      */
     void callCompactVertices(
         cl::Kernel &kernel,
@@ -227,7 +227,8 @@ private:
         const vector<cl_uint> &vertexUnique,
         const vector<cl_float4> &inVertices,
         const vector<cl_ulong> &inKeys,
-        cl_ulong minExternalKey);
+        cl_ulong minExternalKey,
+        cl_uint keyShift = 0);
 
     /**
      * Generate a mesh using an input functor, validate that it is manifold,
@@ -360,7 +361,8 @@ void TestMarching::callCompactVertices(
     const vector<cl_uint> &vertexUnique,
     const vector<cl_float4> &inVertices,
     const vector<cl_ulong> &inKeys,
-    cl_ulong minExternalKey)
+    cl_ulong minExternalKey,
+    cl_uint keyShift)
 {
     const size_t inSize = inVertices.size();
     cl::Buffer dOutVertices   = createBuffer(CL_MEM_WRITE_ONLY, outSize * (3 * sizeof(cl_float)));
@@ -380,6 +382,7 @@ void TestMarching::callCompactVertices(
     kernel.setArg(6, dInKeys);
     kernel.setArg(7, minExternalKey);
     kernel.setArg(8, cl_ulong(0));
+    kernel.setArg(9, keyShift);
     CLH::enqueueNDRangeKernel(queue,
                               kernel,
                               cl::NullRange,
@@ -476,6 +479,18 @@ void TestMarching::testCompactVertices()
     CPPUNIT_ASSERT_EQUAL(cl_uint(2), indexRemap[3]);
     CPPUNIT_ASSERT_EQUAL(cl_uint(0), indexRemap[4]);
     CPPUNIT_ASSERT_EQUAL(cl_uint(3), firstExternal);
+
+    // All external again, with each key field scaled by 4
+    const cl_ulong fields = (cl_ulong(7) << 42) | (cl_ulong(5) << 21) | 3;
+    inKeys[0] = inKeys[1] = externalBit | fields;
+    callCompactVertices(marching.compactVerticesKernel, 3, 5,
+                        outVertices, outKeys, indexRemap, firstExternal,
+                        vertexUnique, inVertices, inKeys, 0, 2);
+
+    CPPUNIT_ASSERT_EQUAL((cl_ulong(28) << 42) | (cl_ulong(20) << 21) | 12, outKeys[0]);
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(800), outKeys[1]);
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(200), outKeys[2]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(0), firstExternal);
 }
 
 void TestMarching::testCopySlice()
@@ -80,6 +80,7 @@ class TestEnqueueReadMesh : public CLH::Test::TestFixture
     CPPUNIT_TEST(testSkipVertices);
     CPPUNIT_TEST(testSkipVertexKeys);
     CPPUNIT_TEST(testSkipTriangles);
+    CPPUNIT_TEST(testNormals);
     CPPUNIT_TEST_SUITE_END();
 private:
     /**
@@ -114,6 +115,7 @@ public:
     void testSkipVertices();    ///< Test skipping transfer of vertices.
     void testSkipVertexKeys();  ///< Test skipping transfer of keys.
     void testSkipTriangles();   ///< Test skipping transfer of triangles.
+    void testNormals();         ///< Test transfer of normals along with the vertices.
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestEnqueueReadMesh, TestSet::perBuild());
 
@@ -251,3 +253,36 @@ void TestEnqueueReadMesh::testSkipTriangles()
     vertexKeysEvent.wait();
     validateVertexKeys(hMesh, dMesh.numInternalVertices());
 }
+
+void TestEnqueueReadMesh::testNormals()
+{
+    std::vector<boost::array<cl_float, 3> > expectedNormals(dMesh.numVertices());
+    for (std::size_t i = 0; i < expectedNormals.size(); i++)
+    {
+        expectedNormals[i][0] = 0.5f * i;
+        expectedNormals[i][1] = -1.0f;
+        expectedNormals[i][2] = i + 3.0f;
+    }
+    dMesh.normals = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               dMesh.numVertices() * (3 * sizeof(cl_float)),
+                               &expectedNormals[0][0]);
+    hMeshBuffer.reset(new char[dMesh.getHostBytes(true)]);
+    hMesh = HostKeyMesh(hMeshBuffer.get(), dMesh, true);
+    CPPUNIT_ASSERT(hMesh.normals != NULL);
+
+    cl::Event verticesEvent, vertexKeysEvent, trianglesEvent;
+    enqueueReadMesh(queue, dMesh, hMesh, NULL, &verticesEvent, &vertexKeysEvent, &trianglesEvent);
+
+    verticesEvent.wait();
+    validateVertices(hMesh);
+    for (std::size_t i = 0; i < expectedNormals.size(); i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(expectedNormals[i][0], hMesh.normals[i][0]);
+        CPPUNIT_ASSERT_EQUAL(expectedNormals[i][1], hMesh.normals[i][1]);
+        CPPUNIT_ASSERT_EQUAL(expectedNormals[i][2], hMesh.normals[i][2]);
+    }
+    vertexKeysEvent.wait();
+    validateVertexKeys(hMesh, dMesh.numInternalVertices());
+    trianglesEvent.wait();
+    validateTriangles(hMesh);
+}
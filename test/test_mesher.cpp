@@ -54,10 +54,18 @@
 #include <boost/foreach.hpp>
 #include <boost/array.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/exception/all.hpp>
 #include <CL/cl.hpp>
 #include "testutil.h"
 #include "../src/fast_ply.h"
 #include "../src/mesher.h"
+#include "../src/bucket_collector.h"
+#include "../src/splat_set.h"
+#include "../src/grid.h"
+#include "../src/bucket.h"
 #include "test_clh.h"
 #include "memory_reader.h"
 #include "memory_writer.h"
@@ -133,6 +141,7 @@ class TestMesherBase : public CLH::Test::TestFixture
     CPPUNIT_TEST(testWeld);
     CPPUNIT_TEST(testPrune);
     CPPUNIT_TEST(testChunk);
+    CPPUNIT_TEST(testChunkCollector);
     // CPPUNIT_TEST(testRandom); // Moved to TestMesherBaseSlow
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 private:
@@ -245,7 +254,29 @@ public:
     void testWeld();            ///< Tests vertex welding
     void testPrune();           ///< Tests component pruning
     void testChunk();           ///< Test chunking into multiple files
+    void testChunkCollector();  ///< Test chunking with chunk IDs assigned by @ref BucketCollector in every pass
     void testRandom();          ///< Test with pseudo-random data
+    void testRandomThreaded();  ///< Test with pseudo-random data, calling the functor from several threads
+    void testRandomSpill();     ///< Test with pseudo-random data, with a tiny budget for shared vertices
+    void testRandomCompress();  ///< Test with pseudo-random data, compressing the temporary files
+    void testRandomNoPrune();   ///< Test with pseudo-random data, without pruning, from several threads
+    void testRandomWriters();   ///< Test with pseudo-random data, writing several output files at once
+    void testRandomCheckpoint(); ///< Test with pseudo-random data, restarting from a partial checkpoint
+
+private:
+    /**
+     * Implementation of the @c testRandom* tests.
+     *
+     * @param numThreads    Number of threads that concurrently call the functor.
+     * @param keysCapacity  Value to pass to @ref MesherBase::setKeysCapacity.
+     * @param compressTmp   Value to pass to @ref MesherBase::setCompressTmp.
+     * @param prune         Whether to set a pruning threshold.
+     * @param writerThreads Value to pass to @ref MesherBase::setWriterThreads.
+     * @param checkpoint    If true, a partial checkpoint is taken half-way through
+     *                      the first pass, and a new mesher resumes from it.
+     */
+    void random(unsigned int numThreads, std::size_t keysCapacity = 0, bool compressTmp = false,
+                bool prune = true, unsigned int writerThreads = 1, bool checkpoint = false);
 };
 
 const boost::array<cl_float, 3> TestMesherBase::internalVertices0[] =
@@ -992,6 +1023,63 @@ void TestMesherBase::testChunk()
                     expectedVertices3, indices3, writer.getOutput("chunk_0003_0009_0001.ply"));
 }
 
+/// Collector callback for @ref TestMesherBase::testChunkCollector
+static void collectChunkIds(std::vector<ChunkId> &chunkIds, const Statistics::Container::vector<BucketCollector::Bin> &bins)
+{
+    for (std::size_t i = 0; i < bins.size(); i++)
+        chunkIds.push_back(bins[i].chunkId);
+}
+
+void TestMesherBase::testChunkCollector()
+{
+    Timeplot::Worker tworker("test");
+
+    ChunkNamer namer("chunk");
+    MemoryWriterPly writer;
+    boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+    unsigned int passes = mesher->numPasses();
+
+    std::vector<ChunkId> chunkIds;
+    BucketCollector collector(1000000, boost::bind(&collectChunkIds, boost::ref(chunkIds), _1));
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    const Grid grid(ref, 1.0f, 0, 64, 0, 64, 0, 64);
+    for (unsigned int i = 0; i < passes; i++)
+    {
+        // Run the buckets through the same collector in every pass, as mlsgpu does
+        chunkIds.clear();
+        collector.reset();
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            SplatSet::SubsetBase splats;
+            splats.addRange(j * 10, j * 10 + 10);
+            splats.flush();
+            Bucket::Recursion recursionState;
+            recursionState.chunk[0] = j + 1;
+            collector(splats, grid, recursionState);
+        }
+        collector.flush();
+        MLSGPU_ASSERT_EQUAL(2U, chunkIds.size());
+        MLSGPU_ASSERT_EQUAL(1U, chunkIds[0].gen);
+        MLSGPU_ASSERT_EQUAL(2U, chunkIds[1].gen);
+
+        const MesherBase::InputFunctor functor = mesher->functor(i);
+        add(chunkIds[0], functor,
+            boost::size(internalVertices0), 0, boost::size(indices0),
+            internalVertices0, NULL, NULL, indices0);
+        add(chunkIds[1], functor,
+            0, boost::size(externalVertices1), boost::size(indices1),
+            NULL, externalVertices1, externalKeys1, indices1);
+    }
+    mesher->write(tworker);
+
+    checkIsomorphic(boost::size(internalVertices0),
+                    boost::size(indices0),
+                    internalVertices0, indices0, writer.getOutput("chunk_0001_0000_0000.ply"));
+    checkIsomorphic(boost::size(externalVertices1),
+                    boost::size(indices1),
+                    externalVertices1, indices1, writer.getOutput("chunk_0002_0000_0000.ply"));
+}
+
 static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
 {
     using std::tr1::mt19937;
@@ -1007,7 +1095,54 @@ static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
     return int(gen()) + min;
 }
 
+/// Thread function for @ref TestMesherBase::random
+static void addWorks(
+    const MesherBase::InputFunctor &functor,
+    const std::vector<MesherWork *> &works,
+    std::size_t first, std::size_t step)
+{
+    Timeplot::Worker tworker("test");
+    for (std::size_t i = first; i < works.size(); i += step)
+        functor(*works[i], tworker);
+}
+
 void TestMesherBase::testRandom()
+{
+    random(1);
+}
+
+void TestMesherBase::testRandomThreaded()
+{
+    random(3);
+}
+
+void TestMesherBase::testRandomSpill()
+{
+    random(1, 1);
+}
+
+void TestMesherBase::testRandomCompress()
+{
+    random(1, 0, true);
+}
+
+void TestMesherBase::testRandomNoPrune()
+{
+    random(3, 0, false, false);
+}
+
+void TestMesherBase::testRandomWriters()
+{
+    random(1, 0, false, true, 3);
+}
+
+void TestMesherBase::testRandomCheckpoint()
+{
+    random(1, 1, false, true, 1, true);
+}
+
+void TestMesherBase::random(unsigned int numThreads, std::size_t keysCapacity, bool compressTmp, bool prune,
+                            unsigned int writerThreads, bool checkpoint)
 {
     Timeplot::Worker tworker("test");
 
@@ -1076,7 +1211,7 @@ void TestMesherBase::testRandom()
             }
     }
 
-    const double pruneThreshold = 1.0 / numComponents;
+    const double pruneThreshold = prune ? 1.0 / numComponents : 0.0;
     const std::size_t pruneThresholdVertices = std::size_t(allVertices.size() * pruneThreshold);
     // Assign triangles to blocks and compute expected outputs
     for (unsigned int cid = 0; cid < numComponents; cid++)
@@ -1168,11 +1303,15 @@ void TestMesherBase::testRandom()
     MemoryWriterPly writer;
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
     mesher->setPruneThreshold(pruneThreshold);
+    mesher->setKeysCapacity(keysCapacity);
+    mesher->setCompressTmp(compressTmp);
+    mesher->setWriterThreads(writerThreads);
     unsigned int passes = mesher->numPasses();
 
     for (unsigned int pass = 0; pass < passes; pass++)
     {
-        const MesherBase::InputFunctor functor = mesher->functor(pass);
+        MesherBase::InputFunctor functor = mesher->functor(pass);
+        std::vector<MesherWork *> works;
         BOOST_FOREACH(Chunk &chunk, chunks)
         {
             BOOST_FOREACH(Block &block, chunk.blocks)
@@ -1181,10 +1320,44 @@ void TestMesherBase::testRandom()
                 CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.vertexKeysEvent);
                 CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.trianglesEvent);
                 block.work.hasEvents = true;
-                queue.flush();
-                functor(block.work, tworker);
+                works.push_back(&block.work);
             }
         }
+        queue.flush();
+
+        if (checkpoint && pass == 0)
+        {
+            /* Feed half the blocks, then continue with a new mesher loaded
+             * from a partial checkpoint, as if the process had died.
+             */
+            const std::size_t half = works.size() / 2;
+            const std::vector<MesherWork *> head(works.begin(), works.begin() + half);
+            addWorks(functor, head, 0, 1);
+
+            const boost::filesystem::path path =
+                boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+            mesher->checkpointPartial(tworker, path, half);
+            mesher.reset(mesherFactory(writer, namer));
+            mesher->setPruneThreshold(pruneThreshold);
+            mesher->setKeysCapacity(keysCapacity);
+            mesher->setWriterThreads(writerThreads);
+            CPPUNIT_ASSERT(isPartialCheckpoint(path));
+            CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(half), mesher->resumePartial(tworker, path));
+            boost::filesystem::remove(path);
+
+            functor = mesher->functor(pass);
+            works.erase(works.begin(), works.begin() + half);
+        }
+
+        if (numThreads == 1)
+            addWorks(functor, works, 0, 1);
+        else
+        {
+            boost::thread_group threads;
+            for (unsigned int i = 0; i < numThreads; i++)
+                threads.create_thread(boost::bind(&addWorks, boost::cref(functor), boost::cref(works), i, numThreads));
+            threads.join_all();
+        }
     }
     mesher->write(tworker);
 
@@ -1211,15 +1384,24 @@ class TestMesherBaseSlow : public TestMesherBase
 {
     CPPUNIT_TEST_SUITE(TestMesherBaseSlow);
     CPPUNIT_TEST(testRandom);
+    CPPUNIT_TEST(testRandomThreaded);
+    CPPUNIT_TEST(testRandomSpill);
+    CPPUNIT_TEST(testRandomCompress);
+    CPPUNIT_TEST(testRandomNoPrune);
+    CPPUNIT_TEST(testRandomWriters);
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 };
 
 class TestOOCMesher : public TestMesherBase
 {
     CPPUNIT_TEST_SUB_SUITE(TestOOCMesher, TestMesherBase);
+    CPPUNIT_TEST(testWriteFailure);
     CPPUNIT_TEST_SUITE_END();
 protected:
     virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+
+public:
+    void testWriteFailure();    ///< Test that an error in a writer thread reaches the caller
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestOOCMesher, TestSet::perBuild());
 
@@ -1374,6 +1556,7 @@ void TestTmpWriterWorkerGroup::tearDown()
 class TestOOCMesherSlow : public TestOOCMesher
 {
     CPPUNIT_TEST_SUB_SUITE(TestOOCMesherSlow, TestMesherBaseSlow);
+    CPPUNIT_TEST(testRandomCheckpoint);
     CPPUNIT_TEST_SUITE_END();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestOOCMesherSlow, TestSet::perCommit());
@@ -1382,3 +1565,122 @@ MesherBase *TestOOCMesher::mesherFactory(FastPly::Writer &writer, const MesherBa
 {
     return new OOCMesher(writer, namer);
 }
+
+void TestOOCMesher::testWriteFailure()
+{
+    Timeplot::Worker tworker("test");
+
+    // The output directory does not exist, so every output file fails to open
+    const boost::filesystem::path dir =
+        boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    ChunkNamer namer((dir / "chunk").string());
+    FastPly::Writer writer(SYSCALL_WRITER);
+    boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+    mesher->setWriterThreads(2);
+
+    ChunkId chunkId[2];
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        chunkId[i].gen = i;
+        chunkId[i].coords[0] = i;
+    }
+    const MesherBase::InputFunctor functor = mesher->functor(0);
+    add(chunkId[0], functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(chunkId[1], functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
+
+    try
+    {
+        mesher->write(tworker);
+        CPPUNIT_FAIL("Expected std::ios::failure");
+    }
+    catch (std::ios::failure &e)
+    {
+        const std::string *filename = boost::get_error_info<boost::errinfo_file_name>(e);
+        CPPUNIT_ASSERT(filename != NULL);
+        CPPUNIT_ASSERT(filename->compare(0, dir.string().size(), dir.string()) == 0);
+        CPPUNIT_ASSERT(boost::get_error_info<boost::errinfo_errno>(e) != NULL);
+    }
+}
+
+class TestRecomputeMesher : public TestMesherBase
+{
+    CPPUNIT_TEST_SUB_SUITE(TestRecomputeMesher, TestMesherBase);
+    CPPUNIT_TEST(testCheckpoint);
+    CPPUNIT_TEST_SUITE_END();
+protected:
+    virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+public:
+    void testCheckpoint();      ///< Checkpointing is rejected
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestRecomputeMesher, TestSet::perBuild());
+
+class TestRecomputeMesherSlow : public TestRecomputeMesher
+{
+    CPPUNIT_TEST_SUB_SUITE(TestRecomputeMesherSlow, TestMesherBaseSlow);
+    CPPUNIT_TEST_SUITE_END();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestRecomputeMesherSlow, TestSet::perCommit());
+
+MesherBase *TestRecomputeMesher::mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer)
+{
+    return new RecomputeMesher(writer, namer);
+}
+
+void TestRecomputeMesher::testCheckpoint()
+{
+    Timeplot::Worker tworker("test");
+    MemoryWriterPly writer;
+    RecomputeMesher mesher(writer, TrivialNamer(""));
+    CPPUNIT_ASSERT_THROW(mesher.checkpoint(tworker, "checkpoint"), std::logic_error);
+    CPPUNIT_ASSERT_THROW(mesher.resume(tworker, "checkpoint"), std::logic_error);
+}
+
+/**
+ * Tests for @ref StreamMesher. It does not support pruning, so only the
+ * tests from @ref TestMesherBase that do not prune are included.
+ */
+class TestStreamMesher : public TestMesherBase
+{
+    CPPUNIT_TEST_SUITE(TestStreamMesher);
+    CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testNoInternal);
+    CPPUNIT_TEST(testNoExternal);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testWeld);
+    CPPUNIT_TEST(testChunk);
+    CPPUNIT_TEST(testCheckpoint);
+    CPPUNIT_TEST_SUITE_END();
+protected:
+    virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+public:
+    void testCheckpoint();      ///< Checkpointing is rejected
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestStreamMesher, TestSet::perBuild());
+
+class TestStreamMesherSlow : public TestStreamMesher
+{
+    CPPUNIT_TEST_SUITE(TestStreamMesherSlow);
+    CPPUNIT_TEST(testRandomNoPrune);
+    CPPUNIT_TEST_SUITE_END();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestStreamMesherSlow, TestSet::perCommit());
+
+MesherBase *TestStreamMesher::mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer)
+{
+    return new StreamMesher(writer, namer);
+}
+
+void TestStreamMesher::testCheckpoint()
+{
+    Timeplot::Worker tworker("test");
+    MemoryWriterPly writer;
+    StreamMesher mesher(writer, TrivialNamer(""));
+    CPPUNIT_ASSERT_THROW(mesher.checkpoint(tworker, "checkpoint"), std::logic_error);
+    CPPUNIT_ASSERT_THROW(mesher.resume(tworker, "checkpoint"), std::logic_error);
+}
@@ -137,6 +137,7 @@ void TestMls::setUp()
     defines["WGS_X"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[0]);
     defines["WGS_Y"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[1]);
     defines["WGS_Z"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[2]);
+    defines["MAX_BUCKET"] = boost::lexical_cast<std::string>(MlsFunctor::maxBucketDefault);
     defines["FIT_SPHERE"] = "1";
     defines["FIT_PLANE"] = "0";
     mlsProgram = CLH::build(context, "kernels/mls.cl", defines);
@@ -482,7 +483,7 @@ void TestMls::testProcessCorners()
     cl::Image2D dCorners = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
                                        imageWidth, imageDepth * swathe.zStride + swathe.zBias);
 
-    generator.set(offset, dSplats, dCommands, dStart, subsampling);
+    generator.set(offset, dSplats, dCommands, dStart, 0, subsampling);
     generator.enqueue(queue, dCorners, swathe, NULL, NULL);
     queue.finish();
 
@@ -331,6 +331,32 @@ SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > *TestFastSequenceSe
     return set.release();
 }
 
+void TestFastSequenceSet::testRegion()
+{
+    const float lower[3] = {0.0f, -1.0f, -1.0f};
+    const float upper[3] = {10.0f, 10.0f, 1.0f};
+    Set set;
+    TestSequenceSet::populate(set, splatData, store);
+    set.setRegion(lower, upper);
+    set.computeBlobs(2.5f, 5, NULL, false);
+
+    /* The splats at (5, i, 0) with radius 1 touch the region for i <= 11, and
+     * the other 5 finite splats all touch it.
+     */
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(17), set.numSplats());
+    // The large splat at (6, 3, 0) extends the bounding box to y = 103
+    CPPUNIT_ASSERT_EQUAL(42, set.getBoundingGrid().getExtent(1).second);
+
+    boost::scoped_ptr<SplatSet::BlobStream> blobs(set.makeBlobStream(set.getBoundingGrid(), 5));
+    SplatSet::splat_id total = 0;
+    while (!blobs->empty())
+    {
+        total += (**blobs).lastSplat - (**blobs).firstSplat;
+        ++*blobs;
+    }
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(17), total);
+}
+
 SplatSet::Subset<SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > > *
 TestSubset::setFactory(const std::vector<std::vector<Splat> > &splatData,
                        float spacing, Grid::size_type bucketSize)
@@ -391,12 +391,15 @@ class TestFastSequenceSet : public TestFastBlobSet<SplatSet::SequenceSet<const S
 {
     typedef TestFastBlobSet<SplatSet::SequenceSet<const Splat *> > BaseFixture;
     CPPUNIT_TEST_SUB_SUITE(TestFastSequenceSet, BaseFixture);
+    CPPUNIT_TEST(testRegion);
     CPPUNIT_TEST_SUITE_END();
 private:
     std::vector<Splat> store; ///< Backing data for the returned sets
 protected:
     virtual Set *setFactory(const std::vector<std::vector<Splat> > &splatData,
                             float spacing, Grid::size_type bucketSize);
+public:
+    void testRegion();           ///< Test that splats outside the region are discarded
 };
 
 /// Tests for @ref SplatSet::merge
@@ -36,11 +36,14 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cstddef>
 #include <vector>
+#include <set>
 #include <cmath>
 #include "testutil.h"
 #include "test_clh.h"
 #include "test_splat_tree.h"
 #include "../src/splat_tree_cl.h"
+#include "../src/device_arena.h"
+#include "../src/timeplot.h"
 
 using namespace std;
 
@@ -51,6 +54,8 @@ class TestSplatTreeCL : public TestSplatTree, public CLH::Test::Mixin
     CPPUNIT_TEST(testLevelShift);
     CPPUNIT_TEST(testPointBoxDist2);
     CPPUNIT_TEST(testMakeCode);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testArena);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -69,9 +74,19 @@ private:
     float callPointBoxDist2(float px, float py, float pz, float lx, float ly, float lz, float hx, float hy, float hz);
     int callMakeCode(cl_int x, cl_int y, cl_int z);
 
+    /// Build a single octree or a batch, and read back the start and command arrays
+    void buildSegments(
+        SplatTreeCL &tree,
+        std::vector<SplatTree::command_type> &commands,
+        std::vector<SplatTree::command_type> &start,
+        const std::vector<Splat> &splats,
+        const std::vector<SplatTreeCL::Segment> &segments);
+
     void testLevelShift();     ///< Test @ref levelShift in @ref octree.cl.
     void testPointBoxDist2();  ///< Test @ref pointBoxDist2 in @ref octree.cl.
     void testMakeCode();       ///< Test @ref makeCode in @ref octree.cl.
+    void testBatch();          ///< Test building several octrees at once
+    void testArena();          ///< Test building with scratch memory from a @ref DeviceArena
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -109,7 +124,7 @@ void TestSplatTreeCL::build(
     std::vector<cl::Event> events(1);
     cl::Buffer splatBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                            splats.size() * sizeof(Splat), (void *) &splats[0]);
-    tree.enqueueBuild(queue, splatBuffer, 0, splats.size(), size, offset, subsamplingShift, NULL, &events[0]);
+    tree.enqueueBuild(queue, splatBuffer, 0, splats.size(), size, offset, subsamplingShift, maxLevels, NULL, &events[0]);
 
     std::size_t commandsSize = tree.getCommands().getInfo<CL_MEM_SIZE>();
     std::size_t startSize = tree.getStart().getInfo<CL_MEM_SIZE>();
@@ -202,3 +217,175 @@ void TestSplatTreeCL::testMakeCode()
     CPPUNIT_ASSERT_EQUAL(174, callMakeCode(2, 5, 3));
     CPPUNIT_ASSERT_EQUAL(511, callMakeCode(7, 7, 7));
 }
+
+void TestSplatTreeCL::buildSegments(
+    SplatTreeCL &tree,
+    std::vector<SplatTree::command_type> &commands,
+    std::vector<SplatTree::command_type> &start,
+    const std::vector<Splat> &splats,
+    const std::vector<SplatTreeCL::Segment> &segments)
+{
+    // A fresh copy is needed each time, because building modifies the splats
+    cl::Buffer splatBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           splats.size() * sizeof(Splat), (void *) &splats[0]);
+    tree.enqueueBuild(queue, splatBuffer, segments);
+
+    std::size_t commandsSize = tree.getCommands().getInfo<CL_MEM_SIZE>();
+    std::size_t startSize = tree.getStart().getInfo<CL_MEM_SIZE>();
+    commands.resize(commandsSize / sizeof(SplatTree::command_type));
+    start.resize(startSize / sizeof(SplatTree::command_type));
+    queue.enqueueReadBuffer(tree.getCommands(), CL_TRUE, 0, commandsSize, &commands[0]);
+    queue.enqueueReadBuffer(tree.getStart(), CL_TRUE, 0, startSize, &start[0]);
+}
+
+/// Collect the splat IDs reachable from a start array entry
+static std::set<SplatTree::command_type> walkSplats(
+    const std::vector<SplatTree::command_type> &commands,
+    SplatTree::command_type pos)
+{
+    typedef SplatTree::command_type command_type;
+    std::set<command_type> ans;
+    std::size_t steps = 0; // for detecting loops
+    while (pos != -1 && steps <= commands.size())
+    {
+        CPPUNIT_ASSERT(pos >= 0 && std::size_t(pos) < commands.size());
+        command_type end = commands[pos++];
+        CPPUNIT_ASSERT(end >= pos && std::size_t(end) < commands.size());
+        for (command_type i = pos; i < end; i++)
+        {
+            ans.insert(commands[i]);
+            steps++;
+        }
+        pos = commands[end];
+        steps++;
+    }
+    CPPUNIT_ASSERT_MESSAGE("Infinite loop in command list", steps <= commands.size());
+    return ans;
+}
+
+/// Generate an arbitrary set of splats for testing octree construction
+static std::vector<Splat> makeSplats(int n)
+{
+    std::vector<Splat> splats;
+    for (int i = 0; i < n; i++)
+    {
+        Splat s;
+        s.position[0] = (i * 7) % 19 - 1.5f;
+        s.position[1] = (i * 5) % 17 - 0.5f;
+        s.position[2] = (i * 3) % 13 + 0.25f;
+        s.radius = 0.5f + (i % 5);
+        s.normal[0] = 1.0f;
+        s.normal[1] = 0.0f;
+        s.normal[2] = 0.0f;
+        s.quality = 1.0f;
+        splats.push_back(s);
+    }
+    return splats;
+}
+
+void TestSplatTreeCL::testBatch()
+{
+    typedef SplatTree::command_type command_type;
+
+    std::vector<Splat> splats = makeSplats(300);
+    std::vector<SplatTreeCL::Segment> segments(2);
+    segments[0].firstSplat = 10;
+    segments[0].numSplats = 150;
+    segments[0].size[0] = 16;
+    segments[0].size[1] = 12;
+    segments[0].size[2] = 16;
+    segments[0].offset[0] = 0;
+    segments[0].offset[1] = 0;
+    segments[0].offset[2] = 0;
+    segments[0].subsamplingShift = 2;
+    segments[0].levels = 3;
+
+    segments[1].firstSplat = 170;
+    segments[1].numSplats = 130;
+    segments[1].size[0] = 8;
+    segments[1].size[1] = 8;
+    segments[1].size[2] = 6;
+    segments[1].offset[0] = 5;
+    segments[1].offset[1] = -3;
+    segments[1].offset[2] = 2;
+    segments[1].subsamplingShift = 1;
+    segments[1].levels = 3;
+
+    SplatTreeCL tree(context, device, 4, splats.size());
+    std::vector<command_type> batchCommands, batchStart;
+    buildSegments(tree, batchCommands, batchStart, splats, segments);
+    std::vector<std::size_t> startOffsets;
+    for (std::size_t j = 0; j < segments.size(); j++)
+        startOffsets.push_back(tree.getStartOffset(j));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), startOffsets[0]);
+    CPPUNIT_ASSERT_EQUAL(SplatTreeCL::startSize(3), startOffsets[1]);
+
+    for (std::size_t j = 0; j < segments.size(); j++)
+    {
+        std::vector<command_type> commands, start;
+        buildSegments(tree, commands, start, splats,
+                      std::vector<SplatTreeCL::Segment>(1, segments[j]));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(0), tree.getStartOffset(0));
+
+        const std::size_t finest = std::size_t(1) << (3 * (segments[j].levels - 1));
+        for (std::size_t code = 0; code < finest; code++)
+        {
+            std::set<command_type> expected = walkSplats(commands, start[code]);
+            std::set<command_type> actual = walkSplats(batchCommands, batchStart[startOffsets[j] + code]);
+            CPPUNIT_ASSERT(expected == actual);
+        }
+    }
+}
+
+void TestSplatTreeCL::testArena()
+{
+    typedef SplatTree::command_type command_type;
+
+    std::vector<Splat> splats = makeSplats(200);
+    SplatTreeCL::Segment segment;
+    segment.firstSplat = 0;
+    segment.numSplats = 50;
+    for (int i = 0; i < 3; i++)
+    {
+        segment.size[i] = 16;
+        segment.offset[i] = -1;
+    }
+    segment.subsamplingShift = 2;
+    segment.levels = 3;
+    const std::vector<SplatTreeCL::Segment> segments(1, segment);
+
+    Timeplot::Worker tworker("test");
+    const std::size_t treeBytes = SplatTreeCL::arenaBytes(3, splats.size(), DeviceArena::getAlignment(device));
+    DeviceArena arena("mem.TestSplatTreeCL.arena", context, device, 2 * treeBytes);
+    SplatTreeCL reference(context, device, 3, splats.size());
+    SplatTreeCL tree1(context, device, 3, splats.size(), &arena, &tworker);
+    SplatTreeCL tree2(context, device, 3, splats.size(), &arena, &tworker);
+
+    std::vector<command_type> expectedCommands, expectedStart;
+    buildSegments(reference, expectedCommands, expectedStart, splats, segments);
+
+    // Only the actual bucket size should be taken from the arena
+    std::vector<command_type> commands1, start1;
+    buildSegments(tree1, commands1, start1, splats, segments);
+    CPPUNIT_ASSERT(commands1.size() < expectedCommands.size());
+
+    // Both trees are live at once, and the second must not overlap the first
+    std::vector<command_type> commands2, start2;
+    buildSegments(tree2, commands2, start2, splats, segments);
+    queue.enqueueReadBuffer(tree1.getCommands(), CL_TRUE, 0,
+                            commands1.size() * sizeof(command_type), &commands1[0]);
+
+    for (std::size_t code = 0; code < SplatTreeCL::startSize(3); code++)
+    {
+        std::set<command_type> expected = walkSplats(expectedCommands, expectedStart[code]);
+        CPPUNIT_ASSERT(expected == walkSplats(commands1, start1[code]));
+        CPPUNIT_ASSERT(expected == walkSplats(commands2, start2[code]));
+    }
+
+    // Releasing the memory must allow a worst-case build to proceed
+    tree1.clearSplats();
+    tree2.clearSplats();
+    segment.numSplats = splats.size();
+    buildSegments(tree1, commands1, start1, splats, std::vector<SplatTreeCL::Segment>(1, segment));
+    tree1.clearSplats();
+}
@@ -0,0 +1,168 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref tuning.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "testutil.h"
+#include "../src/tuning.h"
+#include "../src/mls.h"
+#include "../src/misc.h"
+
+class TestTuning : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestTuning);
+    CPPUNIT_TEST(testCandidates);
+    CPPUNIT_TEST(testCandidatesFewLevels);
+    CPPUNIT_TEST(testCacheRoundTrip);
+    CPPUNIT_TEST(testCacheMissing);
+    CPPUNIT_TEST(testCacheMalformed);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    virtual void setUp();    ///< Obtain filename for temporary file
+    virtual void tearDown(); ///< Remove the temporary file
+
+private:
+    boost::filesystem::path filename;
+
+    void testCandidates();           ///< Check constraints on @ref Tuning::makeCandidates
+    void testCandidatesFewLevels();  ///< Candidates must not drop below one level
+    void testCacheRoundTrip();       ///< Save and reload a @ref Tuning::Cache
+    void testCacheMissing();         ///< Loading a non-existent file gives an empty cache
+    void testCacheMalformed();       ///< Malformed lines are skipped
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestTuning, TestSet::perBuild());
+
+void TestTuning::setUp()
+{
+    boost::filesystem::ofstream dummy;
+    createTmpFile(filename, dummy);
+}
+
+void TestTuning::tearDown()
+{
+    boost::filesystem::remove(filename);
+}
+
+void TestTuning::testCandidates()
+{
+    std::vector<Tuning::Parameters> candidates = Tuning::makeCandidates(6, 3);
+    CPPUNIT_ASSERT(!candidates.empty());
+
+    // The first candidate must be the untuned default
+    CPPUNIT_ASSERT_EQUAL(6, candidates[0].levels);
+    CPPUNIT_ASSERT_EQUAL(3, candidates[0].subsampling);
+    CPPUNIT_ASSERT_EQUAL(MlsFunctor::wgs[0], candidates[0].mlsEdge);
+    CPPUNIT_ASSERT_EQUAL(MlsFunctor::maxBucketDefault, candidates[0].mlsMaxBucket);
+
+    BOOST_FOREACH(const Tuning::Parameters &c, candidates)
+    {
+        CPPUNIT_ASSERT_EQUAL(9, c.levels + c.subsampling);
+        CPPUNIT_ASSERT(c.levels >= 1 && c.levels <= 6);
+        CPPUNIT_ASSERT(c.subsampling >= MlsFunctor::subsamplingMin);
+        CPPUNIT_ASSERT(c.mlsEdge > 0);
+        CPPUNIT_ASSERT_EQUAL(Grid::size_type(0), MlsFunctor::wgs[0] % c.mlsEdge);
+        CPPUNIT_ASSERT(c.mlsMaxBucket >= 1);
+        CPPUNIT_ASSERT(c.mlsMaxBucket <= c.mlsEdge * c.mlsEdge * c.mlsEdge);
+    }
+}
+
+void TestTuning::testCandidatesFewLevels()
+{
+    std::vector<Tuning::Parameters> candidates = Tuning::makeCandidates(1, 5);
+    CPPUNIT_ASSERT(!candidates.empty());
+    BOOST_FOREACH(const Tuning::Parameters &c, candidates)
+    {
+        CPPUNIT_ASSERT_EQUAL(1, c.levels);
+        CPPUNIT_ASSERT_EQUAL(5, c.subsampling);
+    }
+}
+
+void TestTuning::testCacheRoundTrip()
+{
+    Tuning::Parameters a(5, 4);
+    a.mlsEdge = 4;
+    a.mlsMaxBucket = 64;
+    Tuning::Parameters b(6, 3);
+
+    {
+        Tuning::Cache cache(filename);
+        cache.store("Device A;Vendor;1.0;sphere;9", b);
+        cache.store("Device A;Vendor;1.0;sphere;9", a); // replaces b
+        cache.store("Device B;Vendor;2.0;plane;9", b);
+        cache.save();
+    }
+
+    Tuning::Cache cache(filename);
+    cache.load();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), cache.entries.size());
+
+    Tuning::Parameters out(0, 0);
+    CPPUNIT_ASSERT(cache.lookup("Device A;Vendor;1.0;sphere;9", out));
+    CPPUNIT_ASSERT_EQUAL(5, out.levels);
+    CPPUNIT_ASSERT_EQUAL(4, out.subsampling);
+    CPPUNIT_ASSERT_EQUAL(Grid::size_type(4), out.mlsEdge);
+    CPPUNIT_ASSERT_EQUAL(64U, out.mlsMaxBucket);
+
+    CPPUNIT_ASSERT(cache.lookup("Device B;Vendor;2.0;plane;9", out));
+    CPPUNIT_ASSERT_EQUAL(6, out.levels);
+    CPPUNIT_ASSERT_EQUAL(3, out.subsampling);
+
+    CPPUNIT_ASSERT(!cache.lookup("Device C;Vendor;2.0;plane;9", out));
+}
+
+void TestTuning::testCacheMissing()
+{
+    boost::filesystem::remove(filename);
+    Tuning::Cache cache(filename);
+    cache.load();
+    CPPUNIT_ASSERT(cache.entries.empty());
+}
+
+void TestTuning::testCacheMalformed()
+{
+    {
+        boost::filesystem::ofstream out(filename);
+        out << "# comment\n";
+        out << "no tab on this line\n";
+        out << "Device A;Vendor;1.0;sphere;9\t5 4\n";
+        out << "Device B;Vendor;1.0;sphere;9\t5 4 4 64\n";
+    }
+    Tuning::Cache cache(filename);
+    cache.load();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), cache.entries.size());
+    Tuning::Parameters out(0, 0);
+    CPPUNIT_ASSERT(cache.lookup("Device B;Vendor;1.0;sphere;9", out));
+}
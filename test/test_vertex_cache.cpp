@@ -0,0 +1,133 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref vertex_cache.cpp.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "../src/tr1_cstdint.h"
+#include "../src/vertex_cache.h"
+#include "testutil.h"
+
+/**
+ * Tests for @ref VertexCacheOptimizer.
+ */
+class TestVertexCache : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestVertexCache);
+    CPPUNIT_TEST(testMissRatio);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testGrid);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    void testMissRatio();     ///< Test the FIFO cache simulation
+    void testEmpty();         ///< Test with no triangles
+    void testGrid();          ///< Test that a shuffled grid is improved
+
+private:
+    /// Build a triangulated grid of @a size by @a size squares
+    static void makeGrid(unsigned int size, std::vector<std::tr1::uint32_t> &indices);
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestVertexCache, TestSet::perBuild());
+
+void TestVertexCache::makeGrid(unsigned int size, std::vector<std::tr1::uint32_t> &indices)
+{
+    indices.clear();
+    for (unsigned int y = 0; y < size; y++)
+        for (unsigned int x = 0; x < size; x++)
+        {
+            const std::tr1::uint32_t a = y * (size + 1) + x;
+            const std::tr1::uint32_t b = a + 1;
+            const std::tr1::uint32_t c = a + size + 1;
+            const std::tr1::uint32_t d = c + 1;
+            indices.push_back(a); indices.push_back(b); indices.push_back(c);
+            indices.push_back(b); indices.push_back(d); indices.push_back(c);
+        }
+}
+
+void TestVertexCache::testMissRatio()
+{
+    const std::tr1::uint32_t indices[] =
+    {
+        0, 1, 2,   // 3 misses
+        2, 1, 3,   // 1 miss
+        4, 5, 6,   // 3 misses, evicting 0, 1 and 2
+        0, 5, 6    // 1 miss
+    };
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, VertexCacheOptimizer::missRatio(7, 4, indices, 4), 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.75, VertexCacheOptimizer::missRatio(7, 4, indices, 7), 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, VertexCacheOptimizer::missRatio(7, 0, indices, 4), 1e-12);
+}
+
+void TestVertexCache::testEmpty()
+{
+    VertexCacheOptimizer optimizer;
+    optimizer(0, 0, NULL, NULL);
+}
+
+void TestVertexCache::testGrid()
+{
+    const unsigned int size = 50;
+    const std::size_t numVertices = (size + 1) * (size + 1);
+    std::vector<std::tr1::uint32_t> grid;
+    makeGrid(size, grid);
+    const std::size_t numTriangles = grid.size() / 3;
+
+    // Shuffle the triangles so that there is no locality to start with
+    std::vector<std::tr1::uint32_t> shuffle(numTriangles);
+    for (std::size_t i = 0; i < numTriangles; i++)
+        shuffle[i] = i;
+    std::random_shuffle(shuffle.begin(), shuffle.end());
+    std::vector<std::tr1::uint32_t> indices;
+    for (std::size_t i = 0; i < numTriangles; i++)
+        indices.insert(indices.end(), grid.begin() + 3 * shuffle[i], grid.begin() + 3 * shuffle[i] + 3);
+
+    VertexCacheOptimizer optimizer;
+    std::vector<std::tr1::uint32_t> order(numTriangles);
+    optimizer(numVertices, numTriangles, &indices[0], &order[0]);
+
+    std::vector<std::tr1::uint32_t> sorted(order);
+    std::sort(sorted.begin(), sorted.end());
+    for (std::size_t i = 0; i < numTriangles; i++)
+        MLSGPU_ASSERT_EQUAL(i, sorted[i]);
+
+    std::vector<std::tr1::uint32_t> optimized;
+    for (std::size_t i = 0; i < numTriangles; i++)
+        optimized.insert(optimized.end(), indices.begin() + 3 * order[i], indices.begin() + 3 * order[i] + 3);
+
+    /* A regular grid has one vertex per two triangles, so 0.5 is the
+     * ideal, while scanline order achieves about 1.0 with a small cache.
+     */
+    const double before = VertexCacheOptimizer::missRatio(numVertices, numTriangles, &indices[0], 16);
+    const double after = VertexCacheOptimizer::missRatio(numVertices, numTriangles, &optimized[0], 16);
+    CPPUNIT_ASSERT(before > 2.0);
+    CPPUNIT_ASSERT(after < 0.8);
+}
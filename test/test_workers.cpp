@@ -0,0 +1,195 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref workers.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "testutil.h"
+#include "../src/workers.h"
+#include "../src/mls.h"
+
+class TestDeviceWorkerGroup : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestDeviceWorkerGroup);
+    CPPUNIT_TEST(testChooseOctreeShapeSmallSplats);
+    CPPUNIT_TEST(testChooseOctreeShapeLargeSplats);
+    CPPUNIT_TEST(testChooseOctreeShapeSparse);
+    CPPUNIT_TEST(testChooseOctreeShapeTiny);
+    CPPUNIT_TEST(testChooseOctreeShapeHighSubsampling);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Call @ref DeviceWorkerGroupBase::chooseOctreeShape and check the postconditions
+    void choose(std::size_t numSplats, Grid::size_type size, float meanRadius,
+                int maxLevels, int &levels, int &subsampling);
+
+    void testChooseOctreeShapeSmallSplats();  ///< Small, dense splats use the finest octree
+    void testChooseOctreeShapeLargeSplats();  ///< Large splats coarsen the finest level
+    void testChooseOctreeShapeSparse();       ///< Few splats coarsen the finest level
+    void testChooseOctreeShapeTiny();         ///< Bucket smaller than a work group
+    void testChooseOctreeShapeHighSubsampling(); ///< Full-size bucket with subsampling above the minimum
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestDeviceWorkerGroup, TestSet::perBuild());
+
+void TestDeviceWorkerGroup::choose(
+    std::size_t numSplats, Grid::size_type size, float meanRadius,
+    int maxLevels, int &levels, int &subsampling)
+{
+    const Grid::size_type sizes[3] = { size, size / 2, size };
+    DeviceWorkerGroupBase::chooseOctreeShape(numSplats, sizes, meanRadius, maxLevels,
+                                             levels, subsampling);
+    CPPUNIT_ASSERT(levels >= 1 && levels <= maxLevels);
+    CPPUNIT_ASSERT(subsampling >= MlsFunctor::subsamplingMin);
+    CPPUNIT_ASSERT(size <= Grid::size_type(1) << (levels + subsampling - 1));
+}
+
+void TestDeviceWorkerGroup::testChooseOctreeShapeSmallSplats()
+{
+    int levels, subsampling;
+    choose(1000000, 256, 1.5f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(3, subsampling);
+    CPPUNIT_ASSERT_EQUAL(6, levels);
+}
+
+void TestDeviceWorkerGroup::testChooseOctreeShapeLargeSplats()
+{
+    int levels, subsampling;
+    choose(1000000, 256, 20.0f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(5, subsampling);
+    CPPUNIT_ASSERT_EQUAL(4, levels);
+
+    // Cannot exceed the bucket size
+    choose(1000000, 256, 1000.0f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(8, subsampling);
+    CPPUNIT_ASSERT_EQUAL(1, levels);
+}
+
+void TestDeviceWorkerGroup::testChooseOctreeShapeSparse()
+{
+    int levels, subsampling;
+    // (256 >> 4)^2 = 256 cells, which is the first that is not more than the splats
+    choose(300, 256, 1.0f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(4, subsampling);
+    CPPUNIT_ASSERT_EQUAL(5, levels);
+
+    choose(0, 256, 0.0f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(8, subsampling);
+    CPPUNIT_ASSERT_EQUAL(1, levels);
+}
+
+void TestDeviceWorkerGroup::testChooseOctreeShapeTiny()
+{
+    int levels, subsampling;
+    choose(1000, 4, 1.0f, 6, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(MlsFunctor::subsamplingMin, subsampling);
+    CPPUNIT_ASSERT_EQUAL(1, levels);
+}
+
+void TestDeviceWorkerGroup::testChooseOctreeShapeHighSubsampling()
+{
+    int levels, subsampling;
+    // --levels=4 --subsampling=5 allows buckets of 2^8 vertices
+    choose(1000000, 256, 1.5f, 4, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(5, subsampling);
+    CPPUNIT_ASSERT_EQUAL(4, levels);
+
+    // --levels=5 --subsampling=4, with large splats
+    choose(1000000, 256, 20.0f, 5, levels, subsampling);
+    CPPUNIT_ASSERT_EQUAL(5, subsampling);
+    CPPUNIT_ASSERT_EQUAL(4, levels);
+}
+
+class TestCopyGroup : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCopyGroup);
+    CPPUNIT_TEST(testChooseCoarsening);
+    CPPUNIT_TEST(testAlignCoarsening);
+    CPPUNIT_TEST(testKeepSplat);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void testChooseCoarsening();     ///< Test @ref CopyGroupBase::chooseCoarsening
+    void testAlignCoarsening();      ///< Test @ref CopyGroupBase::alignCoarsening
+    void testKeepSplat();            ///< Test @ref CopyGroupBase::keepSplat
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCopyGroup, TestSet::perBuild());
+
+void TestCopyGroup::testChooseCoarsening()
+{
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::chooseCoarsening(4.0f, 4.0f, 3));
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::chooseCoarsening(7.9f, 4.0f, 3));
+    CPPUNIT_ASSERT_EQUAL(1U, CopyGroupBase::chooseCoarsening(8.0f, 4.0f, 3));
+    CPPUNIT_ASSERT_EQUAL(2U, CopyGroupBase::chooseCoarsening(31.9f, 4.0f, 3));
+    // Limited by the maximum
+    CPPUNIT_ASSERT_EQUAL(3U, CopyGroupBase::chooseCoarsening(1000.0f, 4.0f, 3));
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::chooseCoarsening(1000.0f, 4.0f, 0));
+    // Empty buckets
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::chooseCoarsening(0.0f, 4.0f, 3));
+}
+
+void TestCopyGroup::testAlignCoarsening()
+{
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    const Grid aligned(ref, 1.0f, 0, 16, 8, 24, 32, 40);
+    CPPUNIT_ASSERT_EQUAL(3U, CopyGroupBase::alignCoarsening(aligned, 3));
+    CPPUNIT_ASSERT_EQUAL(3U, CopyGroupBase::alignCoarsening(aligned, 5));
+    CPPUNIT_ASSERT_EQUAL(1U, CopyGroupBase::alignCoarsening(aligned, 1));
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::alignCoarsening(aligned, 0));
+
+    // Microblocks smaller than the requested factor
+    const Grid lower(ref, 1.0f, 0, 16, 4, 24, 32, 40);
+    CPPUNIT_ASSERT_EQUAL(2U, CopyGroupBase::alignCoarsening(lower, 3));
+    const Grid upper(ref, 1.0f, 0, 16, 8, 24, 32, 34);
+    CPPUNIT_ASSERT_EQUAL(1U, CopyGroupBase::alignCoarsening(upper, 3));
+    const Grid odd(ref, 1.0f, 0, 16, 8, 24, 33, 40);
+    CPPUNIT_ASSERT_EQUAL(0U, CopyGroupBase::alignCoarsening(odd, 3));
+}
+
+void TestCopyGroup::testKeepSplat()
+{
+    const unsigned int ratio = 4;
+    std::size_t kept = 0;
+    for (unsigned int x = 0; x < 100; x++)
+        for (unsigned int y = 0; y < 100; y++)
+        {
+            Splat splat;
+            splat.position[0] = x * 0.5f;
+            splat.position[1] = y * 0.25f;
+            splat.position[2] = 3.0f;
+            splat.radius = 1.0f;
+            CPPUNIT_ASSERT(CopyGroupBase::keepSplat(splat, 1));
+            const bool keep = CopyGroupBase::keepSplat(splat, ratio);
+            // Only the position matters
+            splat.radius = 2.0f;
+            CPPUNIT_ASSERT_EQUAL(keep, CopyGroupBase::keepSplat(splat, ratio));
+            kept += keep;
+        }
+    CPPUNIT_ASSERT(kept > 10000 / ratio * 9 / 10);
+    CPPUNIT_ASSERT(kept < 10000 / ratio * 11 / 10);
+}